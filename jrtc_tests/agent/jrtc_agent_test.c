@@ -85,8 +85,7 @@ main()
     jrtc_logger(JRTC_INFO, "Starting test for agent API...\n");
     assert(test_agent_api() == 0);
     jrtc_logger(JRTC_INFO, "Test completed.\n");
-    // TODO: when jrtc_router_stop() is implemented, uncomment the following line
-    // jrtc_router_stop();
+    assert(jrtc_router_stop() == 0);
     jrtc_logger(JRTC_INFO, "Router stopped successfully.\n");
     return 0;
 }
@@ -0,0 +1,153 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef JRTC_BENCH_H
+#define JRTC_BENCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Helpers shared by the benchmarks
+
+#define JRTC_BENCH_MAX_VALUES (16)
+
+// A swept parameter, given as a comma-separated list of values
+struct jrtc_bench_list
+{
+    int values[JRTC_BENCH_MAX_VALUES];
+    int num_values;
+};
+
+static inline uint64_t
+jrtc_bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Returns 0 if all the values are at least min
+static inline int
+jrtc_bench_parse_list(const char* s, struct jrtc_bench_list* list, int min)
+{
+    char buf[256];
+    char* save = NULL;
+    char* tok;
+
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    list->num_values = 0;
+
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if (list->num_values >= JRTC_BENCH_MAX_VALUES) {
+            return -1;
+        }
+        list->values[list->num_values] = atoi(tok);
+        if (list->values[list->num_values] < min) {
+            return -1;
+        }
+        list->num_values++;
+    }
+    return list->num_values > 0 ? 0 : -1;
+}
+
+static inline int
+jrtc_bench_list_max(const struct jrtc_bench_list* list)
+{
+    int max = list->values[0];
+
+    for (int i = 1; i < list->num_values; i++) {
+        if (list->values[i] > max) {
+            max = list->values[i];
+        }
+    }
+    return max;
+}
+
+// Log-linear histogram of the latencies: 16 buckets per power of 2, for a relative error below 1/16. It has no
+// pointers, so it can be kept in shared memory.
+
+#define JRTC_BENCH_HIST_SUB_BITS (4)
+#define JRTC_BENCH_HIST_SUB_BUCKETS (1 << JRTC_BENCH_HIST_SUB_BITS)
+#define JRTC_BENCH_HIST_NUM_BUCKETS ((64 - JRTC_BENCH_HIST_SUB_BITS + 1) * JRTC_BENCH_HIST_SUB_BUCKETS)
+
+struct jrtc_bench_hist
+{
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[JRTC_BENCH_HIST_NUM_BUCKETS];
+};
+
+static inline uint32_t
+jrtc_bench_hist_bucket(uint64_t v)
+{
+    uint32_t e;
+
+    if (v < JRTC_BENCH_HIST_SUB_BUCKETS) {
+        return v;
+    }
+    e = 63 - __builtin_clzll(v);
+    return (e - JRTC_BENCH_HIST_SUB_BITS + 1) * JRTC_BENCH_HIST_SUB_BUCKETS +
+           ((v >> (e - JRTC_BENCH_HIST_SUB_BITS)) & (JRTC_BENCH_HIST_SUB_BUCKETS - 1));
+}
+
+// The lowest value of a bucket
+static inline uint64_t
+jrtc_bench_hist_value(uint32_t bucket)
+{
+    uint32_t e;
+
+    if (bucket < JRTC_BENCH_HIST_SUB_BUCKETS) {
+        return bucket;
+    }
+    e = bucket / JRTC_BENCH_HIST_SUB_BUCKETS + JRTC_BENCH_HIST_SUB_BITS - 1;
+    return (uint64_t)(JRTC_BENCH_HIST_SUB_BUCKETS + bucket % JRTC_BENCH_HIST_SUB_BUCKETS)
+           << (e - JRTC_BENCH_HIST_SUB_BITS);
+}
+
+static inline void
+jrtc_bench_hist_add(struct jrtc_bench_hist* hist, uint64_t v)
+{
+    hist->buckets[jrtc_bench_hist_bucket(v)]++;
+    hist->count++;
+    if (v > hist->max) {
+        hist->max = v;
+    }
+}
+
+static inline void
+jrtc_bench_hist_merge(struct jrtc_bench_hist* dst, const struct jrtc_bench_hist* src)
+{
+    for (int i = 0; i < JRTC_BENCH_HIST_NUM_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+    dst->count += src->count;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+static inline uint64_t
+jrtc_bench_hist_percentile(const struct jrtc_bench_hist* hist, double p)
+{
+    uint64_t rank = (uint64_t)(p * hist->count + 0.5);
+    uint64_t seen = 0;
+
+    if (hist->count == 0) {
+        return 0;
+    }
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (uint32_t i = 0; i < JRTC_BENCH_HIST_NUM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            return jrtc_bench_hist_value(i) < hist->max ? jrtc_bench_hist_value(i) : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+#endif
@@ -0,0 +1,557 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+/**
+    This benchmark measures the latency from an agent to an app, on a single host. It forks an agent process that
+    sends timestamped messages with the agent library (agent_init(), agent_create_output_channel()), starts the
+    controller with start_jrtc() and loads jrtc_e2e_bench_app into it with load_app(). The messages go through the
+    IPC segment, the router and jrtc_router_receive() of the app, which records their latency. For every
+    combination of the rates and payload sizes, the agent sends for a fixed duration and the throughput, the losses
+    and the latency histogram of the run are written as a JSON document.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "jrtc.h"
+#include "jrtc_int.h"
+#include "jrtc_rest_server.h"
+#include "jrtc_router.h"
+#include "jrtc_router_stats.h"
+#include "jrtc_router_stream_id.h"
+
+#include "jrtc_agent.h"
+#include "jrtc_agent_defs.h"
+
+#include "jrtc_logging.h"
+
+#include "jrtc_config.h"
+#include "jrtc_config_int.h"
+
+#include "jrtc_e2e_bench.h"
+
+#define E2E_APP_LIB "libjrtc_e2e_bench_app.so"
+#define E2E_APP_NAME "e2e_bench_app"
+
+#define E2E_READY_TIMEOUT_MS (30 * 1000)
+// The controller loads its north io app right after the router is up
+#define E2E_CONTROLLER_SETTLE_MS (1000)
+#define E2E_DRAIN_CHECK_US (10 * 1000)
+#define E2E_DRAIN_IDLE_CHECKS (10)
+#define E2E_SPIN_NS (50 * 1000)
+
+struct e2e_opts
+{
+    struct jrtc_bench_list rate;
+    struct jrtc_bench_list payload_size;
+    int duration_ms;
+    int app_queue_size;
+    int channel_size;
+    int memory_size_mb;
+    bool spin;
+    const char* config_file;
+    const char* app_file;
+    const char* output_file;
+};
+
+struct e2e_result
+{
+    uint64_t num_sent;
+    uint64_t num_failed;
+    uint64_t num_received;
+    uint64_t num_reordered;
+    uint64_t send_ns;
+    uint64_t elapsed_ns;
+    struct jrtc_bench_hist hist;
+};
+
+static void
+_e2e_wait_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+    uint64_t now = jrtc_bench_now_ns();
+
+    if (deadline_ns > now + E2E_SPIN_NS) {
+        ts.tv_sec = (deadline_ns - E2E_SPIN_NS) / 1000000000ULL;
+        ts.tv_nsec = (deadline_ns - E2E_SPIN_NS) % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    while (jrtc_bench_now_ns() < deadline_ns) {
+    }
+}
+
+// Waits until a flag of the shared memory reaches a value. Returns 0 on success, -1 on timeout.
+static int
+_e2e_wait_flag(const uint32_t* flag, uint32_t val, int timeout_ms)
+{
+    for (int i = 0; i < timeout_ms; i++) {
+        if (__atomic_load_n(flag, __ATOMIC_ACQUIRE) == val) {
+            return 0;
+        }
+        usleep(1000);
+    }
+    return -1;
+}
+
+// Sends the messages of one run at the given rate, or as fast as possible with a rate of 0
+static void
+_e2e_agent_send(struct jrtc_e2e_bench_shm* shm, jbpf_io_channel_t* chan, uint32_t run)
+{
+    struct jrtc_e2e_bench_msg* msg;
+    uint64_t interval_ns, next_ns, end_ns, now;
+    uint64_t num_sent = 0, num_failed = 0;
+
+    interval_ns = shm->rate > 0 ? 1000000000ULL / shm->rate : 0;
+    now = jrtc_bench_now_ns();
+    shm->send_start_ns = now;
+    end_ns = now + shm->duration_ms * 1000000ULL;
+    next_ns = now;
+
+    while ((now = jrtc_bench_now_ns()) < end_ns) {
+        // The agent does not slow down if the router falls behind: a message that does not fit in the channel
+        // is lost, as it would be for a real agent
+        if (interval_ns > 0) {
+            if (next_ns > now) {
+                _e2e_wait_until(next_ns);
+            }
+            next_ns += interval_ns;
+        }
+
+        msg = jbpf_io_channel_reserve_buf(chan);
+        if (!msg) {
+            num_failed++;
+            if (interval_ns == 0) {
+                sched_yield();
+            }
+            continue;
+        }
+        msg->send_ns = jrtc_bench_now_ns();
+        msg->seq = num_sent++;
+        msg->run = run;
+        agent_channel_submit(chan);
+    }
+
+    shm->send_end_ns = jrtc_bench_now_ns();
+    shm->num_sent = num_sent;
+    shm->num_failed = num_failed;
+}
+
+static int
+_e2e_agent_run(struct jrtc_e2e_bench_shm* shm, const char* ipc_name, size_t memory_size)
+{
+    jrtc_agent_schema_definition schema = {0};
+    jbpf_io_channel_t* chan = NULL;
+    char stream_name[32];
+    uint32_t run, done_run = 0;
+
+    while (!__atomic_load_n(&shm->router_ready, __ATOMIC_ACQUIRE)) {
+        if (__atomic_load_n(&shm->stop, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        usleep(1000);
+    }
+
+    if (agent_init((char*)ipc_name, memory_size, 0, JRTC_E2E_BENCH_STREAM_PATH) != 0) {
+        jrtc_logger(JRTC_ERROR, "The agent could not connect to the router %s\n", ipc_name);
+        return -1;
+    }
+    __atomic_store_n(&shm->agent_ready, 1, __ATOMIC_RELEASE);
+
+    while (!__atomic_load_n(&shm->stop, __ATOMIC_ACQUIRE)) {
+        run = __atomic_load_n(&shm->run, __ATOMIC_ACQUIRE);
+        if (run == done_run) {
+            usleep(1000);
+            continue;
+        }
+
+        // The previous run has drained, each run has its own stream of the size of its messages
+        if (chan) {
+            agent_destroy_channel(chan);
+        }
+        snprintf(stream_name, sizeof(stream_name), JRTC_E2E_BENCH_STREAM_NAME_FMT, run);
+        schema.name = stream_name;
+        schema.elem_size = shm->payload_size;
+        chan = agent_create_output_channel(JRTC_ROUTER_DEST_NONE, shm->channel_size, &schema);
+        if (chan) {
+            _e2e_agent_send(shm, chan, run);
+        } else {
+            jrtc_logger(JRTC_ERROR, "The agent could not create the channel of run %u\n", run);
+            shm->num_sent = 0;
+            shm->num_failed = 0;
+            shm->send_start_ns = shm->send_end_ns = jrtc_bench_now_ns();
+        }
+
+        __atomic_store_n(&shm->agent_done_run, run, __ATOMIC_RELEASE);
+        done_run = run;
+    }
+
+    if (chan) {
+        agent_destroy_channel(chan);
+    }
+    agent_stop();
+    return 0;
+}
+
+static void*
+_e2e_controller_run(void* args)
+{
+    if (start_jrtc(args) < 0) {
+        jrtc_logger(JRTC_CRITICAL, "The controller failed to start\n");
+    }
+    return NULL;
+}
+
+static int
+_e2e_wait_router(const char* ipc_name)
+{
+    struct jrtc_router_stats_header* stats;
+
+    for (int i = 0; i < E2E_READY_TIMEOUT_MS / 10; i++) {
+        stats = jrtc_router_stats_map(ipc_name);
+        if (stats) {
+            jrtc_router_stats_unmap(stats);
+            usleep(E2E_CONTROLLER_SETTLE_MS * 1000);
+            return 0;
+        }
+        usleep(10 * 1000);
+    }
+    return -1;
+}
+
+static int
+_e2e_load_app(const struct e2e_opts* opts, const char* shm_name)
+{
+    load_app_request_t load_req = {0};
+    char app_file[PATH_MAX];
+    char exe[PATH_MAX] = {0};
+    FILE* f;
+    long size;
+    int app_id = -1;
+
+    // By default, the app is in the lib directory next to the bin directory of the benchmark
+    if (opts->app_file) {
+        snprintf(app_file, sizeof(app_file), "%s", opts->app_file);
+    } else {
+        if (readlink("/proc/self/exe", exe, sizeof(exe) - 1) < 0) {
+            return -1;
+        }
+        snprintf(app_file, sizeof(app_file), "%s/../lib/%s", dirname(exe), E2E_APP_LIB);
+    }
+
+    f = fopen(app_file, "rb");
+    if (!f) {
+        jrtc_logger(JRTC_ERROR, "Could not open the app %s\n", app_file);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    load_req.app = malloc(size > 0 ? size : 1);
+    if (size <= 0 || !load_req.app || fread(load_req.app, 1, size, f) != (size_t)size) {
+        jrtc_logger(JRTC_ERROR, "Could not read the app %s\n", app_file);
+        goto out;
+    }
+
+    load_req.app_size = size;
+    load_req.app_name = E2E_APP_NAME;
+    load_req.app_path = app_file;
+    load_req.ioq_size = opts->app_queue_size;
+    load_req.params[0].key = "shm";
+    load_req.params[0].val = (char*)shm_name;
+    load_req.params[1].key = "spin";
+    load_req.params[1].val = opts->spin ? "1" : "0";
+
+    app_id = load_app(load_req);
+
+out:
+    free(load_req.app);
+    fclose(f);
+    return app_id;
+}
+
+// Waits until the app has received everything the router will deliver
+static void
+_e2e_drain(struct jrtc_e2e_bench_shm* shm)
+{
+    uint64_t last = __atomic_load_n(&shm->num_received, __ATOMIC_ACQUIRE);
+    uint64_t total;
+    int idle = 0;
+
+    while (idle < E2E_DRAIN_IDLE_CHECKS) {
+        usleep(E2E_DRAIN_CHECK_US);
+        total = __atomic_load_n(&shm->num_received, __ATOMIC_ACQUIRE);
+        idle = total == last ? idle + 1 : 0;
+        last = total;
+    }
+}
+
+static int
+_e2e_run(struct jrtc_e2e_bench_shm* shm, uint32_t run, struct e2e_result* result)
+{
+    uint64_t end_ns;
+
+    memset(result, 0, sizeof(*result));
+
+    __atomic_store_n(&shm->run, run, __ATOMIC_RELEASE);
+    if (_e2e_wait_flag(&shm->agent_done_run, run, shm->duration_ms + E2E_READY_TIMEOUT_MS) < 0) {
+        return -1;
+    }
+    _e2e_drain(shm);
+
+    result->num_sent = shm->num_sent;
+    result->num_failed = shm->num_failed;
+    result->send_ns = shm->send_end_ns - shm->send_start_ns;
+    end_ns = shm->send_end_ns;
+    if (__atomic_load_n(&shm->app_run, __ATOMIC_ACQUIRE) == run) {
+        result->num_received = shm->num_received;
+        result->num_reordered = shm->num_reordered;
+        result->hist = shm->hist;
+        if (shm->last_receive_ns > end_ns) {
+            end_ns = shm->last_receive_ns;
+        }
+    }
+    result->elapsed_ns = end_ns - shm->send_start_ns;
+    return 0;
+}
+
+static void
+_e2e_print_result(FILE* out, const struct jrtc_e2e_bench_shm* shm, const struct e2e_result* result, bool first)
+{
+    double send_secs = (double)result->send_ns / 1e9;
+    double secs = (double)result->elapsed_ns / 1e9;
+    bool first_bucket = true;
+
+    fprintf(
+        out,
+        "%s\n    {\"rate\": %u, \"payload_size\": %u, \"duration_ms\": %u, \"num_sent\": %lu, \"num_failed\": %lu, "
+        "\"num_received\": %lu, \"num_lost\": %lu, \"num_reordered\": %lu,\n",
+        first ? "" : ",",
+        shm->rate,
+        shm->payload_size,
+        shm->duration_ms,
+        result->num_sent,
+        result->num_failed,
+        result->num_received,
+        result->num_sent > result->num_received ? result->num_sent - result->num_received : 0,
+        result->num_reordered);
+    fprintf(
+        out,
+        "     \"send_msgs_per_s\": %.0f, \"receive_msgs_per_s\": %.0f,\n",
+        send_secs > 0 ? result->num_sent / send_secs : 0,
+        secs > 0 ? result->num_received / secs : 0);
+    fprintf(
+        out,
+        "     \"latency_ns\": {\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu},\n",
+        jrtc_bench_hist_percentile(&result->hist, 0.5),
+        jrtc_bench_hist_percentile(&result->hist, 0.9),
+        jrtc_bench_hist_percentile(&result->hist, 0.99),
+        jrtc_bench_hist_percentile(&result->hist, 0.999),
+        result->hist.max);
+
+    // The non-empty buckets, as [lowest latency in ns, count]
+    fprintf(out, "     \"histogram\": [");
+    for (uint32_t i = 0; i < JRTC_BENCH_HIST_NUM_BUCKETS; i++) {
+        if (result->hist.buckets[i] == 0) {
+            continue;
+        }
+        fprintf(out, "%s[%lu, %lu]", first_bucket ? "" : ", ", jrtc_bench_hist_value(i), result->hist.buckets[i]);
+        first_bucket = false;
+    }
+    fprintf(out, "]}");
+    fflush(out);
+}
+
+static void
+_e2e_usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-r <rates>] [-p <payload sizes>] [-d <duration ms>] [-q <app queue size>] [-e <channel size>]\n"
+        "          [-m <agent memory MB>] [-S] [-c <config yaml>] [-a <app .so>] [-o <output json>]\n"
+        "  -r  Comma-separated rates in messages per second, 0 for as fast as possible (default 1000,10000,100000)\n"
+        "  -p  Comma-separated payload sizes in bytes (default 64,1024)\n"
+        "  -S  The app polls with jrtc_router_receive() instead of waiting with jrtc_router_receive_timeout()\n",
+        prog);
+}
+
+int
+main(int argc, char** argv)
+{
+    struct e2e_opts opts = {
+        .duration_ms = 2000,
+        .app_queue_size = 4096,
+        .channel_size = 1024,
+        .memory_size_mb = 256,
+    };
+    struct jrtc_config config = {0};
+    struct jrtc_e2e_bench_shm* shm;
+    struct e2e_result* result = NULL;
+    pthread_t controller;
+    bool controller_started = false;
+    bool first = true;
+    FILE* out = stdout;
+    uint32_t run = 0;
+    pid_t agent_pid;
+    int opt, fd, res = 0;
+
+    jrtc_bench_parse_list("1000,10000,100000", &opts.rate, 0);
+    jrtc_bench_parse_list("64,1024", &opts.payload_size, sizeof(struct jrtc_e2e_bench_msg));
+
+    while ((opt = getopt(argc, argv, "r:p:d:q:e:m:Sc:a:o:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            res |= jrtc_bench_parse_list(optarg, &opts.rate, 0);
+            break;
+        case 'p':
+            res |= jrtc_bench_parse_list(optarg, &opts.payload_size, sizeof(struct jrtc_e2e_bench_msg));
+            break;
+        case 'd':
+            opts.duration_ms = atoi(optarg);
+            break;
+        case 'q':
+            opts.app_queue_size = atoi(optarg);
+            break;
+        case 'e':
+            opts.channel_size = atoi(optarg);
+            break;
+        case 'm':
+            opts.memory_size_mb = atoi(optarg);
+            break;
+        case 'S':
+            opts.spin = true;
+            break;
+        case 'c':
+            opts.config_file = optarg;
+            break;
+        case 'a':
+            opts.app_file = optarg;
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        default:
+            _e2e_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (res != 0 || opts.duration_ms <= 0 || opts.app_queue_size <= 0 || opts.channel_size <= 0 ||
+        opts.memory_size_mb <= 0) {
+        _e2e_usage(argv[0]);
+        return 1;
+    }
+
+    // The agent connects to the IPC name of the config of the controller
+    if (set_config_values(opts.config_file, &config) != 0) {
+        jrtc_logger(JRTC_ERROR, "Failed to read the config %s\n", opts.config_file);
+        return 1;
+    }
+
+    shm_unlink(JRTC_E2E_BENCH_SHM_NAME);
+    fd = shm_open(JRTC_E2E_BENCH_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct jrtc_e2e_bench_shm)) != 0) {
+        jrtc_logger(JRTC_ERROR, "Could not create the shared memory %s\n", JRTC_E2E_BENCH_SHM_NAME);
+        return 1;
+    }
+    shm = mmap(NULL, sizeof(struct jrtc_e2e_bench_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        shm_unlink(JRTC_E2E_BENCH_SHM_NAME);
+        return 1;
+    }
+
+    // The agent is forked before the controller starts its threads
+    agent_pid = fork();
+    if (agent_pid < 0) {
+        res = 1;
+        goto out;
+    }
+    if (agent_pid == 0) {
+        res = _e2e_agent_run(shm, config.jrtc_router_config.io_config.ipc_name, opts.memory_size_mb * 1024UL * 1024);
+        munmap(shm, sizeof(struct jrtc_e2e_bench_shm));
+        _exit(res == 0 ? 0 : 1);
+    }
+
+    if (opts.output_file) {
+        out = fopen(opts.output_file, "w");
+        if (!out) {
+            jrtc_logger(JRTC_ERROR, "Could not open %s\n", opts.output_file);
+            out = stdout;
+            res = 1;
+            goto out;
+        }
+    }
+
+    result = calloc(1, sizeof(struct e2e_result));
+    if (!result || pthread_create(&controller, NULL, _e2e_controller_run, (void*)opts.config_file) != 0) {
+        res = 1;
+        goto out;
+    }
+    controller_started = true;
+
+    if (_e2e_wait_router(config.jrtc_router_config.io_config.ipc_name) < 0) {
+        jrtc_logger(JRTC_ERROR, "The router did not start\n");
+        res = 1;
+        goto out;
+    }
+    __atomic_store_n(&shm->router_ready, 1, __ATOMIC_RELEASE);
+
+    if (_e2e_wait_flag(&shm->agent_ready, 1, E2E_READY_TIMEOUT_MS) < 0) {
+        jrtc_logger(JRTC_ERROR, "The agent did not start\n");
+        res = 1;
+        goto out;
+    }
+    if (_e2e_load_app(&opts, JRTC_E2E_BENCH_SHM_NAME) < 0 ||
+        _e2e_wait_flag(&shm->app_ready, 1, E2E_READY_TIMEOUT_MS) < 0) {
+        jrtc_logger(JRTC_ERROR, "The app did not start\n");
+        res = 1;
+        goto out;
+    }
+
+    fprintf(out, "{\"benchmark\": \"jrtc_e2e_bench\", \"spin\": %s, \"runs\": [", opts.spin ? "true" : "false");
+    for (int r = 0; r < opts.rate.num_values; r++) {
+        for (int p = 0; p < opts.payload_size.num_values; p++) {
+            shm->rate = opts.rate.values[r];
+            shm->payload_size = opts.payload_size.values[p];
+            shm->duration_ms = opts.duration_ms;
+            shm->channel_size = opts.channel_size;
+            if (_e2e_run(shm, ++run, result) < 0) {
+                jrtc_logger(JRTC_ERROR, "The agent did not complete run %u\n", run);
+                res = 1;
+                break;
+            }
+            _e2e_print_result(out, shm, result, first);
+            first = false;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+out:
+    __atomic_store_n(&shm->stop, 1, __ATOMIC_RELEASE);
+    if (agent_pid > 0) {
+        waitpid(agent_pid, NULL, 0);
+    }
+    // Unloads the app and stops the router
+    if (controller_started) {
+        stop_jrtc();
+        pthread_join(controller, NULL);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(result);
+    munmap(shm, sizeof(struct jrtc_e2e_bench_shm));
+    shm_unlink(JRTC_E2E_BENCH_SHM_NAME);
+    return res;
+}
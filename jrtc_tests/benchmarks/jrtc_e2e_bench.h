@@ -0,0 +1,58 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef JRTC_E2E_BENCH_H
+#define JRTC_E2E_BENCH_H
+
+#include <stdint.h>
+
+#include "jrtc_bench.h"
+
+// State shared by the processes of jrtc_e2e_bench, in a POSIX shared memory object: the benchmark, which runs the
+// controller and the app, and the agent, which is forked before the controller is started. The benchmark sets the
+// parameters of a run and then bumps run, the agent sends for the duration of the run and sets agent_done_run,
+// and the app measures the messages of the current run.
+
+#define JRTC_E2E_BENCH_SHM_NAME "/jrtc_e2e_bench"
+#define JRTC_E2E_BENCH_STREAM_PATH "E2EBench://agent"
+// The messages of run N are sent to the stream "run<N>"
+#define JRTC_E2E_BENCH_STREAM_NAME_FMT "run%u"
+
+// The header of every message, the rest of the payload is left as is
+struct jrtc_e2e_bench_msg
+{
+    uint64_t send_ns;
+    uint64_t seq;
+    uint32_t run;
+    uint32_t reserved;
+};
+
+struct jrtc_e2e_bench_shm
+{
+    // Written by the benchmark
+    uint32_t router_ready;
+    uint32_t stop;
+    uint32_t run;
+    uint32_t rate;
+    uint32_t payload_size;
+    uint32_t duration_ms;
+    uint32_t channel_size;
+    uint32_t reserved0;
+
+    // Written by the agent
+    uint32_t agent_ready;
+    uint32_t agent_done_run;
+    uint64_t num_sent;
+    uint64_t num_failed;
+    uint64_t send_start_ns;
+    uint64_t send_end_ns;
+
+    // Written by the app
+    uint32_t app_ready;
+    uint32_t app_run;
+    uint64_t num_received;
+    uint64_t num_reordered;
+    uint64_t last_receive_ns;
+    struct jrtc_bench_hist hist;
+};
+
+#endif
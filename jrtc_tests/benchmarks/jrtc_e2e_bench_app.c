@@ -0,0 +1,117 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+/**
+    The app of jrtc_e2e_bench, loaded into the controller with load_app(). It subscribes to all the streams of the
+    agent of the benchmark and records the time from the send at the agent to jrtc_router_receive() of the
+    messages of the current run in the shared memory of the benchmark.
+    Params:
+    - shm: The name of the shared memory object (default JRTC_E2E_BENCH_SHM_NAME)
+    - spin: "1" to poll with jrtc_router_receive() instead of waiting with jrtc_router_receive_timeout()
+ */
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "jrtc.h"
+#include "jrtc_router_app_api.h"
+#include "jrtc_router_stream_id.h"
+
+#include "jrtc_e2e_bench.h"
+
+#define DATA_ENTRIES_SIZE (64)
+#define RECEIVE_TIMEOUT_NS (1000 * 1000)
+
+static const char*
+_get_param(struct jrtc_app_env* env_ctx, const char* key, const char* default_val)
+{
+    for (int i = 0; i < MAX_APP_PARAMS; i++) {
+        if (env_ctx->params[i].key && env_ctx->params[i].val && strcmp(env_ctx->params[i].key, key) == 0) {
+            return env_ctx->params[i].val;
+        }
+    }
+    return default_val;
+}
+
+void*
+jrtc_start_app(void* args)
+{
+    struct jrtc_app_env* env_ctx = args;
+    struct jrtc_e2e_bench_shm* shm;
+    jrtc_router_stream_id_t sid;
+    jrtc_router_data_entry_t data_entries[DATA_ENTRIES_SIZE] = {0};
+    const struct jrtc_e2e_bench_msg* msg;
+    uint64_t now, last_seq = 0;
+    uint32_t run;
+    bool spin;
+    int fd, num_rcv;
+
+    fd = shm_open(_get_param(env_ctx, "shm", JRTC_E2E_BENCH_SHM_NAME), O_RDWR, 0);
+    if (fd < 0) {
+        printf("E2EBench: Could not open the shared memory of the benchmark\n");
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(struct jrtc_e2e_bench_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+    spin = strcmp(_get_param(env_ctx, "spin", "0"), "1") == 0;
+
+    jrtc_router_generate_stream_id(
+        &sid,
+        JRTC_ROUTER_REQ_DEST_ANY,
+        JRTC_ROUTER_REQ_DEVICE_ID_ANY,
+        JRTC_E2E_BENCH_STREAM_PATH,
+        JRTC_ROUTER_REQ_STREAM_NAME_ANY);
+    if (jrtc_router_channel_register_stream_id_req(env_ctx->dapp_ctx, sid) != 1) {
+        printf("E2EBench: Could not subscribe to the streams of the agent\n");
+        munmap(shm, sizeof(struct jrtc_e2e_bench_shm));
+        return NULL;
+    }
+    __atomic_store_n(&shm->app_ready, 1, __ATOMIC_RELEASE);
+
+    while (!atomic_load(&env_ctx->app_exit)) {
+        if (spin) {
+            num_rcv = jrtc_router_receive(env_ctx->dapp_ctx, data_entries, DATA_ENTRIES_SIZE);
+        } else {
+            num_rcv =
+                jrtc_router_receive_timeout(env_ctx->dapp_ctx, data_entries, DATA_ENTRIES_SIZE, RECEIVE_TIMEOUT_NS);
+        }
+        if (num_rcv <= 0) {
+            continue;
+        }
+
+        now = jrtc_bench_now_ns();
+        run = __atomic_load_n(&shm->run, __ATOMIC_ACQUIRE);
+        for (int i = 0; i < num_rcv; i++) {
+            msg = data_entries[i].data;
+            if (msg->run == run) {
+                // The stats are reset by the first message of a run, the benchmark only reads them once the run
+                // has drained
+                if (shm->app_run != run) {
+                    shm->num_reordered = 0;
+                    memset(&shm->hist, 0, sizeof(shm->hist));
+                    __atomic_store_n(&shm->num_received, 0, __ATOMIC_RELAXED);
+                    __atomic_store_n(&shm->app_run, run, __ATOMIC_RELEASE);
+                    last_seq = 0;
+                }
+                if (msg->seq < last_seq) {
+                    shm->num_reordered++;
+                }
+                last_seq = msg->seq;
+                jrtc_bench_hist_add(&shm->hist, now - msg->send_ns);
+                __atomic_store_n(&shm->last_receive_ns, now, __ATOMIC_RELAXED);
+                __atomic_store_n(&shm->num_received, shm->num_received + 1, __ATOMIC_RELEASE);
+            }
+            jrtc_router_channel_release_buf(data_entries[i].data);
+        }
+    }
+
+    jrtc_router_channel_deregister_stream_id_req(env_ctx->dapp_ctx, sid);
+    munmap(shm, sizeof(struct jrtc_e2e_bench_shm));
+
+    return NULL;
+}
@@ -0,0 +1,538 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+/**
+    This benchmark measures the forwarding cost of the router. It starts the router in-process and, for every
+    combination of the swept parameters, registers a source app with an output channel per stream and a number
+    of sink apps with exact and wildcard subscriptions. The source sends timestamped messages in batches, the
+    router thread forwards them to the queues of the sinks, and the sinks measure the time from the send to
+    jrtc_router_receive(). The results of all the runs are written as a JSON document.
+ */
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jrtc_router.h"
+#include "jrtc_router_app_api.h"
+#include "jrtc_router_stream_id.h"
+
+#include "jrtc_logging.h"
+
+#include "jrtc_config.h"
+#include "jrtc_config_int.h"
+
+#include "jrtc_bench.h"
+
+#define BENCH_IPC_NAME "jrtc_router_bench"
+#define BENCH_STREAM_PATH "router_bench"
+
+#define BENCH_MAX_APPS (1024)
+#define BENCH_MAX_STREAMS (4096)
+// The most messages sent back to back to a stream
+#define BENCH_MAX_BATCH (1024)
+#define BENCH_NUM_DEVICES (16)
+#define BENCH_RECEIVE_BATCH (64)
+#define BENCH_RECEIVE_TIMEOUT_NS (1000 * 1000)
+#define BENCH_DRAIN_CHECK_US (10 * 1000)
+#define BENCH_DRAIN_IDLE_CHECKS (10)
+
+// The header of every message, the rest of the payload is left as is
+struct bench_msg
+{
+    uint64_t send_ns;
+};
+
+struct bench_opts
+{
+    struct jrtc_bench_list num_apps;
+    struct jrtc_bench_list subs_per_app;
+    struct jrtc_bench_list wildcard_pct;
+    struct jrtc_bench_list batch_size;
+    struct jrtc_bench_list payload_size;
+    struct jrtc_bench_list queue_size;
+    int num_streams;
+    int num_msgs;
+    int num_warmup_msgs;
+    int channel_size;
+    const char* config_file;
+    const char* output_file;
+};
+
+struct bench_params
+{
+    int num_apps;
+    int subs_per_app;
+    int wildcard_pct;
+    int batch_size;
+    int payload_size;
+    int queue_size;
+};
+
+struct bench_sink
+{
+    pthread_t tid;
+    dapp_router_ctx_t app;
+    int num_subs;
+    uint64_t num_received;
+    uint64_t last_receive_ns;
+    struct jrtc_bench_hist hist;
+};
+
+struct bench_result
+{
+    uint64_t num_sent;
+    uint64_t num_delivered;
+    uint64_t num_dropped;
+    uint64_t num_subs;
+    uint64_t num_retries;
+    uint64_t elapsed_ns;
+    struct jrtc_bench_hist hist;
+};
+
+static struct bench_sink sinks[BENCH_MAX_APPS];
+static dapp_channel_ctx_t chans[BENCH_MAX_STREAMS];
+
+static int run_done;
+static uint64_t measure_start_ns;
+
+// Stream k is device k % BENCH_NUM_DEVICES of the group "g<k / BENCH_NUM_DEVICES>", so that a wildcard
+// subscription to a group matches BENCH_NUM_DEVICES streams
+static void
+_bench_stream_id(jrtc_router_stream_id_t* stream_id, int stream, bool wildcard)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "g%d", stream / BENCH_NUM_DEVICES);
+    if (wildcard) {
+        jrtc_router_generate_stream_id(
+            stream_id, JRTC_ROUTER_REQ_DEST_ANY, JRTC_ROUTER_REQ_DEVICE_ID_ANY, BENCH_STREAM_PATH, name);
+    } else {
+        jrtc_router_generate_stream_id(
+            stream_id, JRTC_ROUTER_DEST_NONE, stream % BENCH_NUM_DEVICES, BENCH_STREAM_PATH, name);
+    }
+}
+
+static void*
+_bench_sink_run(void* arg)
+{
+    struct bench_sink* sink = arg;
+    jrtc_router_data_entry_t entries[BENCH_RECEIVE_BATCH];
+    const struct bench_msg* msg;
+    uint64_t now, start_ns, num_measured;
+    int n;
+
+    for (;;) {
+        n = jrtc_router_receive_timeout(sink->app, entries, BENCH_RECEIVE_BATCH, BENCH_RECEIVE_TIMEOUT_NS);
+        if (n < 0) {
+            break;
+        }
+        if (n == 0) {
+            if (__atomic_load_n(&run_done, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            continue;
+        }
+
+        now = jrtc_bench_now_ns();
+        start_ns = __atomic_load_n(&measure_start_ns, __ATOMIC_ACQUIRE);
+        num_measured = 0;
+        for (int i = 0; i < n; i++) {
+            msg = entries[i].data;
+            // The warmup messages are not measured
+            if (start_ns > 0 && msg->send_ns >= start_ns) {
+                jrtc_bench_hist_add(&sink->hist, now - msg->send_ns);
+                num_measured++;
+            }
+            jrtc_router_channel_release_buf(entries[i].data);
+        }
+
+        // Read by the main thread while the run drains
+        if (num_measured > 0) {
+            __atomic_store_n(&sink->last_receive_ns, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&sink->num_received, sink->num_received + num_measured, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+// Sends num_msgs messages in batches, round-robin over the streams. Returns the number of messages sent.
+static uint64_t
+_bench_send(const struct bench_opts* opts, const struct bench_params* params, int num_msgs, uint64_t* num_retries)
+{
+    struct bench_msg* msg;
+    uint64_t num_sent = 0;
+    int stream = 0;
+    int batch, submitted;
+
+    msg = calloc(1, params->payload_size);
+    if (!msg) {
+        return 0;
+    }
+
+    while (num_sent < (uint64_t)num_msgs) {
+        batch = num_msgs - num_sent < (uint64_t)params->batch_size ? num_msgs - num_sent : params->batch_size;
+        submitted = 0;
+        while (submitted < batch) {
+            msg->send_ns = jrtc_bench_now_ns();
+            if (jrtc_router_channel_send_output_msg(chans[stream], msg, params->payload_size) == 0) {
+                submitted++;
+                continue;
+            }
+            // The channel is full, let the router catch up
+            (*num_retries)++;
+            sched_yield();
+        }
+        num_sent += batch;
+        stream = (stream + 1) % opts->num_streams;
+    }
+
+    free(msg);
+    return num_sent;
+}
+
+static uint64_t
+_bench_total_received(int num_apps)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < num_apps; i++) {
+        total += __atomic_load_n(&sinks[i].num_received, __ATOMIC_RELAXED);
+    }
+    return total;
+}
+
+// Waits until the sinks have received everything the router will deliver
+static void
+_bench_drain(int num_apps)
+{
+    uint64_t last = _bench_total_received(num_apps);
+    uint64_t total;
+    int idle = 0;
+
+    while (idle < BENCH_DRAIN_IDLE_CHECKS) {
+        usleep(BENCH_DRAIN_CHECK_US);
+        total = _bench_total_received(num_apps);
+        idle = total == last ? idle + 1 : 0;
+        last = total;
+    }
+}
+
+static int
+_bench_run(const struct bench_opts* opts, const struct bench_params* params, struct bench_result* result)
+{
+    jrtc_router_stream_id_t stream_id;
+    struct jrtc_router_app_stats app_stats;
+    dapp_router_ctx_t source = NULL;
+    uint64_t start_ns, end_ns;
+    uint64_t num_retries = 0;
+    int num_started = 0;
+    int num_chans = 0;
+    int num_apps = 0;
+    int sub, stream, res = -1;
+    bool wildcard;
+
+    memset(result, 0, sizeof(*result));
+    memset(sinks, 0, sizeof(struct bench_sink) * params->num_apps);
+    __atomic_store_n(&run_done, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&measure_start_ns, 0, __ATOMIC_RELEASE);
+
+    source = jrtc_router_register_app(params->queue_size);
+    if (!source) {
+        goto out;
+    }
+    for (; num_chans < opts->num_streams; num_chans++) {
+        _bench_stream_id(&stream_id, num_chans, false);
+        chans[num_chans] =
+            jrtc_router_channel_create(source, true, opts->channel_size, params->payload_size, stream_id, NULL, 0);
+        if (!chans[num_chans]) {
+            goto out;
+        }
+    }
+
+    // The subscriptions are spread over the streams, and wildcard_pct of them are evenly spread wildcards
+    for (; num_apps < params->num_apps; num_apps++) {
+        sinks[num_apps].app = jrtc_router_register_app(params->queue_size);
+        if (!sinks[num_apps].app) {
+            goto out;
+        }
+        for (int i = 0; i < params->subs_per_app; i++) {
+            sub = num_apps * params->subs_per_app + i;
+            wildcard = (sub + 1) * params->wildcard_pct / 100 > sub * params->wildcard_pct / 100;
+            // A wildcard subscribes to the group of the first stream it is given
+            stream = wildcard ? sub * BENCH_NUM_DEVICES : sub;
+            _bench_stream_id(&stream_id, stream % opts->num_streams, wildcard);
+            // A subscription made twice by the same app is only counted once
+            if (jrtc_router_channel_register_stream_id_req(sinks[num_apps].app, stream_id) == 1) {
+                sinks[num_apps].num_subs++;
+            }
+        }
+        result->num_subs += sinks[num_apps].num_subs;
+    }
+
+    for (; num_started < params->num_apps; num_started++) {
+        if (pthread_create(&sinks[num_started].tid, NULL, _bench_sink_run, &sinks[num_started]) != 0) {
+            goto out;
+        }
+    }
+
+    // The warmup fills the route caches of the shards
+    _bench_send(opts, params, opts->num_warmup_msgs, &num_retries);
+    _bench_drain(params->num_apps);
+
+    start_ns = jrtc_bench_now_ns();
+    __atomic_store_n(&measure_start_ns, start_ns, __ATOMIC_RELEASE);
+    num_retries = 0;
+    result->num_sent = _bench_send(opts, params, opts->num_msgs, &num_retries);
+    end_ns = jrtc_bench_now_ns();
+    _bench_drain(params->num_apps);
+
+    for (int i = 0; i < params->num_apps; i++) {
+        result->num_delivered += __atomic_load_n(&sinks[i].num_received, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&sinks[i].last_receive_ns, __ATOMIC_RELAXED) > end_ns) {
+            end_ns = __atomic_load_n(&sinks[i].last_receive_ns, __ATOMIC_RELAXED);
+        }
+    }
+    result->elapsed_ns = end_ns - start_ns;
+    result->num_retries = num_retries;
+    res = 0;
+
+out:
+    __atomic_store_n(&run_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(sinks[i].tid, NULL);
+        jrtc_bench_hist_merge(&result->hist, &sinks[i].hist);
+    }
+
+    for (int i = 0; i < num_apps; i++) {
+        if (jrtc_router_get_app_stats(sinks[i].app, &app_stats) == 0) {
+            result->num_dropped += app_stats.num_dropped;
+        }
+        jrtc_router_deregister_app(sinks[i].app);
+    }
+    for (int i = 0; i < num_chans; i++) {
+        jrtc_router_channel_destroy(chans[i]);
+    }
+    if (source) {
+        jrtc_router_deregister_app(source);
+    }
+
+    return res;
+}
+
+static void
+_bench_print_result(FILE* out, const struct bench_params* params, const struct bench_result* result, bool first)
+{
+    double secs = (double)result->elapsed_ns / 1e9;
+
+    fprintf(
+        out,
+        "%s\n    {\"num_apps\": %d, \"subs_per_app\": %d, \"wildcard_pct\": %d, \"batch_size\": %d, "
+        "\"payload_size\": %d, \"queue_size\": %d,\n",
+        first ? "" : ",",
+        params->num_apps,
+        params->subs_per_app,
+        params->wildcard_pct,
+        params->batch_size,
+        params->payload_size,
+        params->queue_size);
+    fprintf(
+        out,
+        "     \"num_subs\": %lu, \"num_sent\": %lu, \"num_delivered\": %lu, \"num_dropped\": %lu, "
+        "\"num_retries\": %lu, \"elapsed_ns\": %lu,\n",
+        result->num_subs,
+        result->num_sent,
+        result->num_delivered,
+        result->num_dropped,
+        result->num_retries,
+        result->elapsed_ns);
+    fprintf(
+        out,
+        "     \"msgs_per_s\": %.0f, \"deliveries_per_s\": %.0f, \"ns_per_msg\": %.1f, \"ns_per_delivery\": %.1f,\n",
+        secs > 0 ? result->num_sent / secs : 0,
+        secs > 0 ? result->num_delivered / secs : 0,
+        result->num_sent ? (double)result->elapsed_ns / result->num_sent : 0,
+        result->num_delivered ? (double)result->elapsed_ns / result->num_delivered : 0);
+    fprintf(
+        out,
+        "     \"latency_ns\": {\"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}}",
+        jrtc_bench_hist_percentile(&result->hist, 0.5),
+        jrtc_bench_hist_percentile(&result->hist, 0.99),
+        jrtc_bench_hist_percentile(&result->hist, 0.999),
+        result->hist.max);
+    fflush(out);
+}
+
+static void
+_bench_usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [-a <apps>] [-r <subs per app>] [-w <wildcard %%>] [-b <batch sizes>] [-p <payload sizes>]\n"
+        "          [-q <queue sizes>] [-s <streams>] [-n <msgs>] [-W <warmup msgs>] [-e <channel size>]\n"
+        "          [-c <config yaml>] [-o <output json>]\n"
+        "The options -a, -r, -w, -b, -p and -q take comma-separated lists of values, and every combination is run.\n",
+        prog);
+}
+
+int
+main(int argc, char** argv)
+{
+    struct bench_opts opts = {
+        .num_streams = 64,
+        .num_msgs = 200000,
+        .num_warmup_msgs = 10000,
+        .channel_size = 4096,
+    };
+    struct jrtc_config config = {0};
+    struct bench_params params;
+    struct bench_result* result;
+    FILE* out = stdout;
+    bool first = true;
+    int opt, res = 0;
+
+    jrtc_bench_parse_list("1,4,16", &opts.num_apps, 1);
+    jrtc_bench_parse_list("1,4", &opts.subs_per_app, 1);
+    jrtc_bench_parse_list("0,100", &opts.wildcard_pct, 0);
+    jrtc_bench_parse_list("1,32", &opts.batch_size, 1);
+    jrtc_bench_parse_list("64,1024", &opts.payload_size, sizeof(struct bench_msg));
+    jrtc_bench_parse_list("4096", &opts.queue_size, 1);
+
+    while ((opt = getopt(argc, argv, "a:r:w:b:p:q:s:n:W:e:c:o:h")) != -1) {
+        switch (opt) {
+        case 'a':
+            res |= jrtc_bench_parse_list(optarg, &opts.num_apps, 1);
+            break;
+        case 'r':
+            res |= jrtc_bench_parse_list(optarg, &opts.subs_per_app, 1);
+            break;
+        case 'w':
+            res |= jrtc_bench_parse_list(optarg, &opts.wildcard_pct, 0);
+            break;
+        case 'b':
+            res |= jrtc_bench_parse_list(optarg, &opts.batch_size, 1);
+            break;
+        case 'p':
+            res |= jrtc_bench_parse_list(optarg, &opts.payload_size, sizeof(struct bench_msg));
+            break;
+        case 'q':
+            res |= jrtc_bench_parse_list(optarg, &opts.queue_size, 1);
+            break;
+        case 's':
+            opts.num_streams = atoi(optarg);
+            break;
+        case 'n':
+            opts.num_msgs = atoi(optarg);
+            break;
+        case 'W':
+            opts.num_warmup_msgs = atoi(optarg);
+            break;
+        case 'e':
+            opts.channel_size = atoi(optarg);
+            break;
+        case 'c':
+            opts.config_file = optarg;
+            break;
+        case 'o':
+            opts.output_file = optarg;
+            break;
+        default:
+            _bench_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (res != 0 || opts.num_streams < 1 || opts.num_streams > BENCH_MAX_STREAMS || opts.num_msgs < 1 ||
+        opts.num_warmup_msgs < 0 || opts.channel_size < 1 || jrtc_bench_list_max(&opts.num_apps) > BENCH_MAX_APPS ||
+        jrtc_bench_list_max(&opts.wildcard_pct) > 100 || jrtc_bench_list_max(&opts.batch_size) > BENCH_MAX_BATCH) {
+        _bench_usage(argv[0]);
+        return 1;
+    }
+
+    result = calloc(1, sizeof(struct bench_result));
+    if (!result) {
+        return 1;
+    }
+
+    if (opts.output_file) {
+        out = fopen(opts.output_file, "w");
+        if (!out) {
+            jrtc_logger(JRTC_ERROR, "Could not open %s\n", opts.output_file);
+            free(result);
+            return 1;
+        }
+    }
+
+    // Keep the output clean of the logs of the router
+    jrtc_set_logging_level(JRTC_WARN_LEVEL);
+
+    if (set_config_values(opts.config_file, &config) != 0) {
+        jrtc_logger(JRTC_ERROR, "Failed to read the config %s\n", opts.config_file);
+        res = 1;
+        goto out;
+    }
+    strncpy(config.jrtc_router_config.io_config.ipc_name, BENCH_IPC_NAME, JBPF_IO_IPC_MAX_NAMELEN - 1);
+    strncpy(config.jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name, BENCH_IPC_NAME, JBPF_IO_IPC_MAX_NAMELEN - 1);
+    config.jrtc_router_config.capture.path[0] = '\0';
+    // The sinks and the source
+    if (config.jrtc_router_config.max_num_apps < (uint32_t)jrtc_bench_list_max(&opts.num_apps) + 1) {
+        config.jrtc_router_config.max_num_apps = jrtc_bench_list_max(&opts.num_apps) + 1;
+    }
+    if (config.jrtc_router_config.max_app_queue_size < (uint32_t)jrtc_bench_list_max(&opts.queue_size)) {
+        config.jrtc_router_config.max_app_queue_size = jrtc_bench_list_max(&opts.queue_size);
+    }
+
+    if (jrtc_router_init(&config) < 0) {
+        jrtc_logger(JRTC_ERROR, "Failed to initialize the router\n");
+        res = 1;
+        goto out;
+    }
+
+    fprintf(
+        out,
+        "{\"benchmark\": \"jrtc_router_bench\", \"num_streams\": %d, \"num_msgs\": %d, \"runs\": [",
+        opts.num_streams,
+        opts.num_msgs);
+
+    for (int a = 0; a < opts.num_apps.num_values; a++) {
+        for (int r = 0; r < opts.subs_per_app.num_values; r++) {
+            for (int w = 0; w < opts.wildcard_pct.num_values; w++) {
+                for (int b = 0; b < opts.batch_size.num_values; b++) {
+                    for (int p = 0; p < opts.payload_size.num_values; p++) {
+                        for (int q = 0; q < opts.queue_size.num_values; q++) {
+                            params.num_apps = opts.num_apps.values[a];
+                            params.subs_per_app = opts.subs_per_app.values[r];
+                            params.wildcard_pct = opts.wildcard_pct.values[w];
+                            params.batch_size = opts.batch_size.values[b];
+                            params.payload_size = opts.payload_size.values[p];
+                            params.queue_size = opts.queue_size.values[q];
+                            if (_bench_run(&opts, &params, result) < 0) {
+                                jrtc_logger(JRTC_ERROR, "Failed to set up the run, skipping it\n");
+                                res = 1;
+                                continue;
+                            }
+                            _bench_print_result(out, &params, result, first);
+                            first = false;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+    jrtc_router_stop();
+
+out:
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(result);
+    return res;
+}
@@ -5,6 +5,8 @@
     In the process of router, two applications are registered and data is sent and received between the agent and the
    applications. The test is successful if the data sent by the agent is received by the applications.
  */
+#define _GNU_SOURCE
+#include <stddef.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
@@ -15,9 +17,11 @@
 #include <semaphore.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <poll.h>
 
 #include "jrtc_router.h"
 #include "jrtc_router_app_api.h"
+#include "jrtc_router_stats.h"
 #include "jrtc_router_stream_id.h"
 
 #include "jrtc_logging.h"
@@ -60,6 +64,10 @@ test_app(void* args)
     jrtc_router_stream_id_t stream_id_req;
     int num_rcv, res;
     struct test_struct* data;
+    uint64_t total_received = 0;
+    struct jrtc_router_app_stats app_stats = {0};
+    struct jrtc_router_latency_stats latency_stats = {0};
+    jrtc_router_stream_id_t last_stream_id = {0};
 
     jrtc_router_data_entry_t data_entries[100] = {0};
 
@@ -88,9 +96,14 @@ test_app(void* args)
     while (!*done) {
         num_rcv = jrtc_router_receive(dapp_ctx, data_entries, 100);
         if (num_rcv > 0) {
+            total_received += num_rcv;
             for (int i = 0; i < num_rcv; i++) {
                 data = data_entries[i].data;
                 jrtc_logger(JRTC_INFO, "App 1: Received message %d\n", data->counter_a);
+                // The router takes CLOCK_MONOTONIC ingress timestamps by default
+                assert(data_entries[i].ingress_ts_ns != 0);
+                assert(data_entries[i].ingress_ts_ns <= jrtc_router_timestamp_now_ns());
+                last_stream_id = data_entries[i].stream_id;
                 jrtc_router_channel_release_buf(data);
             }
         }
@@ -99,6 +112,26 @@ test_app(void* args)
 
     jrtc_logger(JRTC_INFO, "App 1 exiting\n");
 
+    // Everything received must have been accounted for. The queue of 100 entries is a ring of 128 slots,
+    // one of which is always kept empty.
+    res = jrtc_router_get_app_stats(dapp_ctx, &app_stats);
+    assert(res == 0);
+    assert(app_stats.num_enqueued >= total_received);
+    assert(app_stats.high_watermark <= 127);
+
+    if (total_received > 0) {
+        res = jrtc_router_get_latency_stats(dapp_ctx, last_stream_id, &latency_stats);
+        assert(res == 0);
+        assert(latency_stats.count >= 1 && latency_stats.count <= total_received);
+        assert(latency_stats.min_ns <= latency_stats.p50_ns);
+        assert(latency_stats.p50_ns <= latency_stats.p99_ns);
+        assert(latency_stats.p99_ns <= latency_stats.max_ns);
+    }
+
+    // The app made a single request, which is dropped only once
+    assert(jrtc_router_channel_deregister_all_reqs(dapp_ctx) == 1);
+    assert(jrtc_router_channel_deregister_all_reqs(dapp_ctx) == 0);
+
     jrtc_router_deregister_app(dapp_ctx);
 
     return NULL;
@@ -132,6 +165,13 @@ test_app2(void* args)
         jrtc_logger(JRTC_INFO, "Stream id for app 2 registered successfully\n");
     }
 
+    // Streams announced by name can also be matched by path and name patterns
+    res = jrtc_router_stream_catalog_add("codelet1", "map1");
+    assert(res >= 0);
+    res = jrtc_router_channel_register_pattern_req(
+        dapp_ctx, JRTC_ROUTER_REQ_DEST_ANY, JRTC_ROUTER_REQ_DEVICE_ID_ANY, "codelet*", "map*");
+    assert(res == 1);
+
     while (!*done) {
         num_rcv = jrtc_router_receive(dapp_ctx, data_entries, 100);
         if (num_rcv > 0) {
@@ -153,11 +193,542 @@ test_app2(void* args)
 
     jrtc_router_channel_deregister_stream_id_req(dapp_ctx, stream_id_req);
 
+    assert(
+        jrtc_router_channel_deregister_pattern_req(
+            dapp_ctx, JRTC_ROUTER_REQ_DEST_ANY, JRTC_ROUTER_REQ_DEVICE_ID_ANY, "codelet*", "map*") == 1);
+    assert(
+        jrtc_router_channel_deregister_pattern_req(
+            dapp_ctx, JRTC_ROUTER_REQ_DEST_ANY, JRTC_ROUTER_REQ_DEVICE_ID_ANY, "codelet*", "map*") == 0);
+
     jrtc_router_deregister_app(dapp_ctx);
 
     return NULL;
 }
 
+// An app receives the messages sent to its input channels, with many channels of which few are ready
+void
+test_input_channels()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx[8];
+    jrtc_router_stream_id_t stream_id[8];
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct test_struct msg;
+    char name[16];
+    struct pollfd pfd;
+    int num_rcv = 0, res;
+
+    dapp_ctx = jrtc_router_register_app(100);
+    assert(dapp_ctx);
+
+    for (int i = 0; i < 8; i++) {
+        snprintf(name, sizeof(name), "input%d", i);
+        jrtc_router_generate_stream_id(&stream_id[i], JRTC_ROUTER_DEST_NONE, 0, "router_test", name);
+        chan_ctx[i] = jrtc_router_channel_create(dapp_ctx, false, 32, sizeof(struct test_struct), stream_id[i], NULL, 0);
+        assert(chan_ctx[i]);
+    }
+
+    // Only channels 2 and 5 get messages
+    for (int i = 0; i < 20; i++) {
+        msg.counter_a = i;
+        res = jrtc_router_channel_send_input_msg(stream_id[i % 2 ? 5 : 2], &msg, sizeof(msg));
+        assert(res == 0);
+    }
+
+    for (int tries = 0; tries < 1000 && num_rcv < 20; tries++) {
+        res = jrtc_router_receive(dapp_ctx, data_entries, 32);
+        for (int i = 0; i < res; i++) {
+            assert(
+                memcmp(&data_entries[i].stream_id, &stream_id[2], sizeof(jrtc_router_stream_id_t)) == 0 ||
+                memcmp(&data_entries[i].stream_id, &stream_id[5], sizeof(jrtc_router_stream_id_t)) == 0);
+            jrtc_router_channel_release_buf(data_entries[i].data);
+        }
+        num_rcv += res;
+    }
+    assert(num_rcv == 20);
+
+    // Nothing is left, so the wait times out
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000) == 0);
+
+    // The fd of an armed app is signaled by the next message, which is then received without waiting
+    pfd.fd = jrtc_router_get_fd(dapp_ctx);
+    pfd.events = POLLIN;
+    assert(pfd.fd >= 0);
+    assert(jrtc_router_arm_fd(dapp_ctx) == 0);
+    assert(poll(&pfd, 1, 0) == 0);
+    msg.counter_a = 20;
+    assert(jrtc_router_channel_send_input_msg(stream_id[7], &msg, sizeof(msg)) == 0);
+    assert(poll(&pfd, 1, 1000) == 1);
+    res = jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000);
+    assert(res == 1);
+    jrtc_router_channel_release_buf(data_entries[0].data);
+
+    for (int i = 0; i < 8; i++) {
+        jrtc_router_channel_destroy(chan_ctx[i]);
+    }
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
+// Sends num_msgs messages to an output channel, numbered from first. Returns the number of messages sent.
+static int
+_send_test_msgs(dapp_channel_ctx_t chan_ctx, uint32_t first, int num_msgs)
+{
+    struct test_struct msg = {0};
+    int num_sent;
+
+    for (num_sent = 0; num_sent < num_msgs; num_sent++) {
+        msg.counter_a = first + num_sent;
+        if (jrtc_router_channel_send_output_msg(chan_ctx, &msg, sizeof(msg)) < 0) {
+            break;
+        }
+    }
+    return num_sent;
+}
+
+// Messages sent back to back are forwarded to the subscribers in order
+void
+test_output_batch()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx;
+    jrtc_router_stream_id_t stream_id;
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct test_struct msg[2] = {0};
+    int num_rcv = 0, res;
+
+    dapp_ctx = jrtc_router_register_app(100);
+    assert(dapp_ctx);
+
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, 0, "router_test", "output_batch");
+    chan_ctx = jrtc_router_channel_create(dapp_ctx, true, 32, sizeof(struct test_struct), stream_id, NULL, 0);
+    assert(chan_ctx);
+    assert(jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id) == 1);
+
+    assert(_send_test_msgs(chan_ctx, 0, 10) == 10);
+    // A message larger than the elements of the channel is rejected
+    assert(jrtc_router_channel_send_output_msg(chan_ctx, msg, sizeof(struct test_struct) + 1) < 0);
+
+    while (num_rcv < 10) {
+        res = jrtc_router_receive_timeout(dapp_ctx, &data_entries[num_rcv], 32 - num_rcv, 1000 * 1000 * 1000);
+        assert(res > 0);
+        num_rcv += res;
+    }
+    for (int i = 0; i < num_rcv; i++) {
+        assert(((struct test_struct*)data_entries[i].data)->counter_a == i);
+        jrtc_router_channel_release_buf(data_entries[i].data);
+    }
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    jrtc_router_channel_destroy(chan_ctx);
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
+// One message sent to a wildcard stream id reaches every matching input channel
+void
+test_multicast()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx[3];
+    jbpf_io_channel_t* io_channel;
+    jrtc_router_stream_id_t stream_id, wildcard;
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct test_struct msg;
+    int num_rcv = 0, res;
+
+    dapp_ctx = jrtc_router_register_app(100);
+    assert(dapp_ctx);
+
+    for (int i = 0; i < 3; i++) {
+        jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, i + 1, "router_test", "mcast");
+        chan_ctx[i] = jrtc_router_channel_create(dapp_ctx, false, 32, sizeof(struct test_struct), stream_id, NULL, 0);
+        assert(chan_ctx[i]);
+    }
+
+    // The input channel of a codelet on an agent that the router has never seen
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_UDP, 100, "router_test", "mcast");
+    io_channel = jbpf_io_create_channel(
+        jbpf_io_get_ctx(),
+        JBPF_IO_CHANNEL_INPUT,
+        JBPF_IO_CHANNEL_QUEUE,
+        32,
+        sizeof(struct test_struct),
+        *(struct jbpf_io_stream_id*)&stream_id,
+        NULL,
+        0);
+    assert(io_channel);
+
+    jrtc_router_generate_stream_id(&wildcard, JRTC_ROUTER_DEST_ANY, JRTC_ROUTER_DEVICE_ID_ANY, "router_test", "mcast");
+    msg.counter_a = 1;
+    assert(jrtc_router_channel_multicast_input_msg(wildcard, &msg, sizeof(msg)) == 4);
+    // The second send uses the cached set of targets
+    msg.counter_a = 2;
+    assert(jrtc_router_channel_multicast_input_msg(wildcard, &msg, sizeof(msg)) == 4);
+
+    // The stream names cannot be enumerated, so a wildcard name is not resolved
+    jrtc_router_generate_stream_id(
+        &stream_id, JRTC_ROUTER_DEST_ANY, JRTC_ROUTER_DEVICE_ID_ANY, "router_test", JRTC_ROUTER_REQ_STREAM_NAME_ANY);
+    assert(jrtc_router_channel_multicast_input_msg(stream_id, &msg, sizeof(msg)) == JRTC_ROUTER_MULTICAST_UNRESOLVED);
+
+    while (num_rcv < 6) {
+        res = jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000);
+        assert(res > 0);
+        for (int i = 0; i < res; i++) {
+            assert(jrtc_router_stream_id_get_device_id(&data_entries[i].stream_id) >= 1);
+            assert(jrtc_router_stream_id_get_device_id(&data_entries[i].stream_id) <= 3);
+            jrtc_router_channel_release_buf(data_entries[i].data);
+        }
+        num_rcv += res;
+    }
+    assert(num_rcv == 6);
+
+    // A destroyed channel is no longer a target
+    jrtc_router_channel_destroy(chan_ctx[0]);
+    jbpf_io_destroy_channel(jbpf_io_get_ctx(), io_channel);
+    assert(jrtc_router_channel_multicast_input_msg(wildcard, &msg, sizeof(msg)) == 2);
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000) > 0);
+
+    for (int i = 1; i < 3; i++) {
+        jrtc_router_channel_destroy(chan_ctx[i]);
+    }
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
+// The context and the queue of an app are placed on the requested NUMA node and the page sizes are reported
+void
+test_numa()
+{
+    jrtc_router_app_config_t app_config = {.app_queue_size = 100, .has_numa_node = true, .numa_node = 0};
+    struct jrtc_router_app_numa_info app_info;
+    struct jrtc_router_numa_info info;
+    struct jrtc_router_mem_stats mem_stats;
+    dapp_router_ctx_t dapp_ctx;
+
+    // Every Linux machine has a node 0
+    dapp_ctx = jrtc_router_register_app_ex(&app_config);
+    assert(dapp_ctx);
+    assert(jrtc_router_get_app_numa_info(dapp_ctx, &app_info) == 0);
+    assert(app_info.numa_node == 0);
+    assert(app_info.ctx_node == 0 || app_info.ctx_node == -1);
+    assert(app_info.queue_node == 0 || app_info.queue_node == -1);
+    jrtc_router_deregister_app(dapp_ctx);
+
+    app_config.numa_node = -1;
+    dapp_ctx = jrtc_router_register_app_ex(&app_config);
+    assert(dapp_ctx);
+    assert(jrtc_router_get_app_numa_info(dapp_ctx, &app_info) == 0);
+    assert(app_info.numa_node == -1);
+    jrtc_router_deregister_app(dapp_ctx);
+
+    assert(jrtc_router_get_numa_info(jrtc_router_get_ctx(), &info) == 0);
+    assert(info.num_nodes >= 1);
+    assert(info.num_shards == 1);
+    assert(info.shard_nodes[1] == -1);
+
+    // The router runs with huge pages off, so its queues are on normal pages
+    assert(jrtc_router_get_mem_stats(jrtc_router_get_ctx(), &mem_stats) == 0);
+    assert(mem_stats.hugepages == JRTC_ROUTER_HUGEPAGES_NONE);
+    assert(mem_stats.mapped_4kb_kb > 0);
+}
+
+// CPU lists in the cpuset format, with CPUs beyond the 64 of an affinity mask
+void
+test_cpuset()
+{
+    cpu_set_t cpus;
+
+    assert(jrtc_router_parse_cpuset("3", &cpus) == 0);
+    assert(CPU_COUNT(&cpus) == 1 && CPU_ISSET(3, &cpus));
+    assert(jrtc_router_parse_cpuset("0-3,8,64-127", &cpus) == 0);
+    assert(CPU_COUNT(&cpus) == 69);
+    assert(CPU_ISSET(0, &cpus) && CPU_ISSET(3, &cpus) && !CPU_ISSET(4, &cpus) && CPU_ISSET(8, &cpus));
+    assert(CPU_ISSET(64, &cpus) && CPU_ISSET(127, &cpus) && !CPU_ISSET(128, &cpus));
+
+    assert(jrtc_router_parse_cpuset(NULL, &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("", &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("3-1", &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("1,,2", &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("1-", &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("a", &cpus) == -1);
+    assert(jrtc_router_parse_cpuset("0-100000", &cpus) == -1);
+}
+
+// An app with a latest-value request only receives the last message of a stream, however many were sent
+void
+test_latest()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx;
+    jrtc_router_stream_id_t stream_id;
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct jrtc_router_app_stats app_stats = {0};
+    uint32_t last = 0;
+
+    // The queue is smaller than the number of messages, but is not used for the stream
+    dapp_ctx = jrtc_router_register_app(4);
+    assert(dapp_ctx);
+
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, 0, "router_test", "latest");
+    chan_ctx = jrtc_router_channel_create(dapp_ctx, true, 32, sizeof(struct test_struct), stream_id, NULL, 0);
+    assert(chan_ctx);
+    assert(jrtc_router_channel_register_stream_id_req_ex(dapp_ctx, stream_id, JRTC_ROUTER_REQ_MODE_LATEST) == 1);
+
+    for (int round = 0; round < 2; round++) {
+        assert(_send_test_msgs(chan_ctx, round * 100, 20) == 20);
+
+        // Each receive returns at most one message, newer than the previous one
+        do {
+            assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000) == 1);
+            assert(((struct test_struct*)data_entries[0].data)->counter_a >= last);
+            last = ((struct test_struct*)data_entries[0].data)->counter_a;
+            jrtc_router_channel_release_buf(data_entries[0].data);
+        } while (last != round * 100 + 19);
+    }
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    assert(jrtc_router_get_app_stats(dapp_ctx, &app_stats) == 0);
+    assert(app_stats.num_enqueued == 40);
+    assert(app_stats.num_dropped == 0);
+    assert(app_stats.high_watermark == 0);
+
+    jrtc_router_channel_destroy(chan_ctx);
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
+// Sampled and rate limited requests only deliver the messages that pass their limit
+void
+test_limits()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx;
+    jrtc_router_stream_id_t stream_id;
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct jrtc_router_app_stats app_stats = {0};
+    struct jrtc_router_route_stats route_stats = {0};
+    struct jrtc_router_req_limit limit = {0};
+    int num_rcv = 0, res;
+
+    dapp_ctx = jrtc_router_register_app(100);
+    assert(dapp_ctx);
+
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, 0, "router_test", "limits");
+    chan_ctx = jrtc_router_channel_create(dapp_ctx, true, 32, sizeof(struct test_struct), stream_id, NULL, 0);
+    assert(chan_ctx);
+    assert(jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id) == 1);
+
+    // One in four messages
+    limit.sample_every = 4;
+    assert(jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, &limit) == 0);
+
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+
+    while (num_rcv < 5) {
+        res = jrtc_router_receive_timeout(dapp_ctx, &data_entries[num_rcv], 32 - num_rcv, 1000 * 1000 * 1000);
+        assert(res > 0);
+        num_rcv += res;
+    }
+    for (int i = 0; i < num_rcv; i++) {
+        assert(((struct test_struct*)data_entries[i].data)->counter_a == i * 4);
+        jrtc_router_channel_release_buf(data_entries[i].data);
+    }
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    // A burst of two messages, then one per second
+    limit.sample_every = 0;
+    limit.max_rate = 1;
+    limit.burst = 2;
+    assert(jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, &limit) == 0);
+
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+
+    num_rcv = 0;
+    while (num_rcv < 2) {
+        res = jrtc_router_receive_timeout(dapp_ctx, &data_entries[num_rcv], 32 - num_rcv, 1000 * 1000 * 1000);
+        assert(res > 0);
+        num_rcv += res;
+    }
+    for (int i = 0; i < num_rcv; i++) {
+        jrtc_router_channel_release_buf(data_entries[i].data);
+    }
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    assert(jrtc_router_get_app_stats(dapp_ctx, &app_stats) == 0);
+    assert(app_stats.num_enqueued == 7);
+    assert(app_stats.num_sampled_out == 15);
+    assert(app_stats.num_rate_limited == 18);
+    assert(jrtc_router_get_route_stats(jrtc_router_get_ctx(), &stream_id, &route_stats) == 0);
+    assert(route_stats.num_suppressed == 33);
+
+    // Without the limit, all the messages are delivered again
+    assert(jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, NULL) == 0);
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+    num_rcv = 0;
+    while (num_rcv < 20) {
+        res = jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000);
+        assert(res > 0);
+        for (int i = 0; i < res; i++) {
+            jrtc_router_channel_release_buf(data_entries[i].data);
+        }
+        num_rcv += res;
+    }
+    assert(num_rcv == 20);
+
+    jrtc_router_channel_destroy(chan_ctx);
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
+void
+test_filter()
+{
+    dapp_router_ctx_t dapp_ctx;
+    dapp_channel_ctx_t chan_ctx;
+    jrtc_router_stream_id_t stream_id;
+    jrtc_router_data_entry_t data_entries[32] = {0};
+    struct jrtc_router_app_stats app_stats = {0};
+    struct jrtc_router_route_stats route_stats = {0};
+    struct jrtc_router_req_filter filter = {0};
+    struct jrtc_router_req_limit limit = {0};
+    int num_rcv = 0, res;
+
+    dapp_ctx = jrtc_router_register_app(100);
+    assert(dapp_ctx);
+
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, 0, "router_test", "filter");
+    chan_ctx = jrtc_router_channel_create(dapp_ctx, true, 32, sizeof(struct test_struct), stream_id, NULL, 0);
+    assert(chan_ctx);
+    assert(jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id) == 1);
+
+    // Invalid filters are rejected
+    filter.num_conds = 1;
+    filter.conds[0].size = 3;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == -1);
+    filter.conds[0].size = 4;
+    filter.conds[0].op = JRTC_ROUTER_FILTER_NUM_OPS;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == -1);
+    filter.num_conds = JRTC_ROUTER_FILTER_MAX_CONDS + 1;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == -1);
+
+    // The odd counters from 10, then one in two of them
+    filter.num_conds = 2;
+    filter.conds[0].offset = offsetof(struct test_struct, counter_a);
+    filter.conds[0].size = sizeof(uint32_t);
+    filter.conds[0].op = JRTC_ROUTER_FILTER_GE;
+    filter.conds[0].value = 10;
+    filter.conds[1].offset = offsetof(struct test_struct, counter_a);
+    filter.conds[1].size = sizeof(uint32_t);
+    filter.conds[1].op = JRTC_ROUTER_FILTER_MASK_ANY;
+    filter.conds[1].value = 1;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == 0);
+    limit.sample_every = 2;
+    assert(jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, &limit) == 0);
+
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+
+    while (num_rcv < 3) {
+        res = jrtc_router_receive_timeout(dapp_ctx, &data_entries[num_rcv], 32 - num_rcv, 1000 * 1000 * 1000);
+        assert(res > 0);
+        num_rcv += res;
+    }
+    for (int i = 0; i < num_rcv; i++) {
+        assert(((struct test_struct*)data_entries[i].data)->counter_a == 11 + i * 4);
+        jrtc_router_channel_release_buf(data_entries[i].data);
+    }
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    // A signed condition on a field past the end of the messages never matches
+    assert(jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, NULL) == 0);
+    filter.num_conds = 1;
+    filter.conds[0].offset = sizeof(struct test_struct);
+    filter.conds[0].is_signed = 1;
+    filter.conds[0].op = JRTC_ROUTER_FILTER_GE;
+    filter.conds[0].value = (uint64_t)-1;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == 0);
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    assert(jrtc_router_get_app_stats(dapp_ctx, &app_stats) == 0);
+    assert(app_stats.num_enqueued == 3);
+    assert(app_stats.num_filtered_out == 35);
+    assert(app_stats.num_sampled_out == 2);
+    assert(jrtc_router_get_route_stats(jrtc_router_get_ctx(), &stream_id, &route_stats) == 0);
+    assert(route_stats.num_suppressed == 37);
+
+    // Without the filter, all the messages are delivered again
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, NULL) == 0);
+    assert(_send_test_msgs(chan_ctx, 0, 20) == 20);
+    num_rcv = 0;
+    while (num_rcv < 20) {
+        res = jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000);
+        assert(res > 0);
+        for (int i = 0; i < res; i++) {
+            jrtc_router_channel_release_buf(data_entries[i].data);
+        }
+        num_rcv += res;
+    }
+    assert(num_rcv == 20);
+
+    jrtc_router_channel_destroy(chan_ctx);
+
+    // The size of the messages of a channel that is not created through the router is learned from jbpf
+    jbpf_io_channel_t* io_channel;
+    struct test_struct* data;
+    uint64_t num_filtered_out;
+
+    jrtc_router_generate_stream_id(&stream_id, JRTC_ROUTER_DEST_NONE, 0, "router_test", "filter_jbpf");
+    io_channel = jbpf_io_create_channel(
+        jbpf_io_get_ctx(),
+        JBPF_IO_CHANNEL_OUTPUT,
+        JBPF_IO_CHANNEL_QUEUE,
+        32,
+        sizeof(struct test_struct),
+        *(struct jbpf_io_stream_id*)&stream_id,
+        NULL,
+        0);
+    assert(io_channel);
+    assert(jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id) == 1);
+
+    // A field inside the messages is read, one past their end never matches
+    filter.num_conds = 2;
+    filter.conds[0].offset = offsetof(struct test_struct, counter_a);
+    filter.conds[0].size = sizeof(uint32_t);
+    filter.conds[0].is_signed = 0;
+    filter.conds[0].op = JRTC_ROUTER_FILTER_EQ;
+    filter.conds[0].value = 5;
+    filter.conds[1].offset = sizeof(struct test_struct);
+    filter.conds[1].size = sizeof(uint32_t);
+    filter.conds[1].op = JRTC_ROUTER_FILTER_GE;
+    filter.conds[1].value = 0;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == 0);
+    assert(jrtc_router_get_app_stats(dapp_ctx, &app_stats) == 0);
+    num_filtered_out = app_stats.num_filtered_out;
+    for (int i = 0; i < 10; i++) {
+        data = jbpf_io_channel_reserve_buf(io_channel);
+        assert(data);
+        data->counter_a = i;
+        assert(jbpf_io_channel_submit_buf(io_channel) >= 0);
+    }
+    while (app_stats.num_filtered_out < num_filtered_out + 10) {
+        assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+        assert(jrtc_router_get_app_stats(dapp_ctx, &app_stats) == 0);
+    }
+
+    filter.num_conds = 1;
+    assert(jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, &filter) == 0);
+    for (int i = 0; i < 10; i++) {
+        data = jbpf_io_channel_reserve_buf(io_channel);
+        assert(data);
+        data->counter_a = i;
+        assert(jbpf_io_channel_submit_buf(io_channel) >= 0);
+    }
+    res = jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 1000 * 1000 * 1000);
+    assert(res == 1);
+    assert(((struct test_struct*)data_entries[0].data)->counter_a == 5);
+    jrtc_router_channel_release_buf(data_entries[0].data);
+    assert(jrtc_router_receive_timeout(dapp_ctx, data_entries, 32, 10 * 1000 * 1000) == 0);
+
+    jbpf_io_destroy_channel(jbpf_io_get_ctx(), io_channel);
+    jrtc_router_deregister_app(dapp_ctx);
+}
+
 int
 router_test()
 {
@@ -175,6 +746,8 @@ router_test()
     config.jrtc_router_config.thread_config.sched_config.sched_deadline = 30 * 1000 * 1000;
     config.jrtc_router_config.thread_config.sched_config.sched_runtime = 10 * 1000 * 1000;
     config.jrtc_router_config.thread_config.sched_config.sched_period = 30 * 1000 * 1000;
+    config.jrtc_router_config.max_num_apps = 8;
+    config.jrtc_router_config.max_app_queue_size = 1000;
 
     strncpy(config.jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name, "jrtc_router_test", JBPF_IO_IPC_MAX_NAMELEN);
 
@@ -186,6 +759,18 @@ router_test()
         jrtc_logger(JRTC_INFO, "Router initialized successfully\n");
     }
 
+    // Queues larger than the configured max are rejected
+    assert(jrtc_router_register_app(2000) == NULL);
+
+    test_input_channels();
+    test_output_batch();
+    test_multicast();
+    test_numa();
+    test_cpuset();
+    test_latest();
+    test_limits();
+    test_filter();
+
     // Create some test application thread
     pthread_create(&test_app_tid, NULL, test_app, NULL);
     pthread_create(&test_app2_tid, NULL, test_app2, NULL);
@@ -195,8 +780,52 @@ router_test()
     pthread_join(test_app_tid, NULL);
     pthread_join(test_app2_tid, NULL);
 
-    // TODO: uncomment when jrtc_router_stop is implemented
-    // jrtc_router_stop();
+    // The stream of the agent must have been resolved once and then served from the route cache
+    struct jrtc_router_route_stats route_stats = {0};
+    jrtc_router_stream_id_t agent_stream_id;
+    jrtc_router_generate_stream_id(&agent_stream_id, JRTC_ROUTER_DEST_UDP, 0, "codelet1", "map1");
+    res = jrtc_router_get_route_stats(jrtc_router_get_ctx(), &agent_stream_id, &route_stats);
+    assert(res == 0);
+    assert(route_stats.misses >= 1);
+    jrtc_logger(
+        JRTC_INFO, "Route cache hits %ld, misses %ld\n", (long)route_stats.hits, (long)route_stats.misses);
+
+    // The stream of the agent must also be visible to external readers of the stats region
+    struct jrtc_router_stats_header* stats_header;
+    struct jrtc_router_stream_stats stream_stats;
+    const struct jrtc_router_stream_stats* slot;
+    bool found = false;
+
+    stats_header = jrtc_router_stats_map(config.jrtc_router_config.io_config.ipc_name);
+    assert(stats_header);
+    assert(stats_header->version == JRTC_ROUTER_STATS_VERSION);
+    assert(stats_header->max_apps == 8);
+    for (uint32_t i = 0; i < stats_header->num_streams; i++) {
+        slot = jrtc_router_stats_stream_slot(stats_header, i);
+        jrtc_router_stats_read(&slot->seq, slot, &stream_stats, sizeof(stream_stats));
+        if (memcmp(stream_stats.stream_id, &agent_stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN) == 0) {
+            assert(stream_stats.num_msgs >= 1);
+            // The agent creates its channel with jbpf, so the router learns the size of the messages from jbpf
+            assert(stream_stats.elem_size == sizeof(struct test_struct));
+            assert(stream_stats.num_bytes == stream_stats.num_msgs * sizeof(struct test_struct));
+            assert(stream_stats.last_seen_ns >= stats_header->start_ns);
+            found = true;
+        }
+    }
+    assert(found);
+    jrtc_router_stats_unmap(stats_header);
+
+    // The stop is quiescent and releases the IPC name, so a second stop does nothing
+    assert(jrtc_router_stop() == 0);
+    assert(jrtc_router_stats_map(config.jrtc_router_config.io_config.ipc_name) == NULL);
+    assert(jrtc_router_stop() == 0);
+
+    // The stop frees everything, so the router can be started again in the same process
+    assert(jrtc_router_init(&config) == 0);
+    dapp_router_ctx_t app_ctx = jrtc_router_register_app(10);
+    assert(app_ctx);
+    jrtc_router_deregister_app(app_ctx);
+    assert(jrtc_router_stop() == 0);
     return 0;
 }
 
@@ -262,8 +891,7 @@ agent_test()
 
     jrtc_logger(JRTC_INFO, "Agent completed successfully\n");
     *done = true;
-    // TODO: uncomment when jrtc_router_stop is implemented
-    // jrtc_router_stop();
+    jrtc_router_stop();
     return 0;
 }
 
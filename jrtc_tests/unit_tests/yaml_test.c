@@ -3,6 +3,7 @@
 /**
     This test tests the yaml parsing functionality in jrtc_config.c
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +27,28 @@ test_yaml_parsing()
     {
         //   jrtc_router_config:
         //     ipc_name: "jrt-controller1234"
+        //     num_shards: 2
+        //     shard_partition: device_id
+        //     numa_shards: true
+        //     ingress_timestamp: tsc
+        //     hugepages: 2m
+        //     max_num_apps: 512
+        //     max_app_queue_size: 20000
+        //     init_num_req_entries: 4096
+        //     max_num_loaded_apps: 32
+        //     capture_path: "/tmp/jrtc_capture"
+        //     capture_segment_size_mb: 16
+        //     capture_max_segments: 4
+        //     shards:
+        //       - has_affinity_mask: true
+        //         affinity_mask: 4
+        //       - has_affinity_mask: true
+        //         affinity_mask: 8
+        //         cpus: "8,96-127"
+        //         has_sched_config: true
+        //         sched_config:
+        //           sched_policy: 1
+        //           sched_priority: 90
         //     thread_config:
         //       affinity_mask: 3
         //       has_sched_config: true
@@ -35,6 +58,10 @@ test_yaml_parsing()
         //         sched_deadline: 30000000
         //         sched_runtime: 10000000
         //         sched_period: 30000000
+        //       idle_config:
+        //         idle_policy: hybrid
+        //         spin_budget: 500
+        //         park_timeout_us: 2000
         //   jbpf_io_config:
         //     jbpf_namespace: "default"
         //     jbpf_path: "/var/lib/jbpf"
@@ -50,6 +77,35 @@ test_yaml_parsing()
         assert(config.jrtc_router_config.thread_config.sched_config.sched_runtime == 10000000);
         assert(config.jrtc_router_config.thread_config.sched_config.sched_period == 30000000);
         assert(config.jrtc_router_config.thread_config.sched_config.sched_priority == 99);
+        assert(config.jrtc_router_config.thread_config.idle_config.idle_policy == JRTC_ROUTER_IDLE_HYBRID);
+        assert(config.jrtc_router_config.thread_config.idle_config.spin_budget == 500);
+        assert(config.jrtc_router_config.thread_config.idle_config.park_timeout_us == 2000);
+        assert(config.jrtc_router_config.thread_config.idle_config.sleep_us == 5);
+        assert(config.jrtc_router_config.num_shards == 2);
+        assert(config.jrtc_router_config.shard_partition == JRTC_ROUTER_SHARD_BY_DEVICE_ID);
+        assert(config.jrtc_router_config.numa_shards == true);
+        assert(config.jrtc_router_config.timestamp_source == JRTC_ROUTER_TIMESTAMP_TSC);
+        assert(config.jrtc_router_config.hugepages == JRTC_ROUTER_HUGEPAGES_2MB);
+        assert(config.jrtc_router_config.max_num_apps == 512);
+        assert(config.jrtc_router_config.max_app_queue_size == 20000);
+        assert(config.jrtc_router_config.init_num_req_entries == 4096);
+        assert(config.max_num_loaded_apps == 32);
+        assert(strcmp(config.jrtc_router_config.capture.path, "/tmp/jrtc_capture") == 0);
+        assert(config.jrtc_router_config.capture.segment_size_mb == 16);
+        assert(config.jrtc_router_config.capture.max_segments == 4);
+        assert(config.jrtc_router_config.shard_thread_config[0].has_affinity_mask == 1);
+        assert(config.jrtc_router_config.shard_thread_config[0].affinity_mask == 4);
+        assert(CPU_COUNT(&config.jrtc_router_config.shard_thread_config[0].cpus) == 0);
+        assert(config.jrtc_router_config.shard_thread_config[0].has_sched_config == 0);
+        assert(config.jrtc_router_config.shard_thread_config[1].affinity_mask == 8);
+        assert(CPU_COUNT(&config.jrtc_router_config.shard_thread_config[1].cpus) == 33);
+        assert(CPU_ISSET(8, &config.jrtc_router_config.shard_thread_config[1].cpus));
+        assert(!CPU_ISSET(9, &config.jrtc_router_config.shard_thread_config[1].cpus));
+        assert(CPU_ISSET(127, &config.jrtc_router_config.shard_thread_config[1].cpus));
+        assert(config.jrtc_router_config.shard_thread_config[1].has_sched_config == 1);
+        assert(config.jrtc_router_config.shard_thread_config[1].sched_config.sched_policy == JRTC_ROUTER_FIFO);
+        assert(config.jrtc_router_config.shard_thread_config[1].sched_config.sched_priority == 90);
+        assert(config.jrtc_router_config.thread_config.has_affinity_mask == 0);
         assert(strcmp(config.jbpf_io_config.jbpf_namespace, "jrtc") == 0);
         assert(strcmp(config.jbpf_io_config.jbpf_path, "/var/run/jrtc") == 0);
         assert(strcmp(config.jrtc_router_config.io_config.ipc_name, "aaaaa") == 0);
@@ -102,6 +158,18 @@ test_yaml_parsing()
         assert(config.jrtc_router_config.thread_config.sched_config.sched_runtime == 10000000);
         assert(config.jrtc_router_config.thread_config.sched_config.sched_period == 30000000);
         assert(config.jrtc_router_config.thread_config.sched_config.sched_priority == 99);
+        assert(config.jrtc_router_config.thread_config.idle_config.idle_policy == JRTC_ROUTER_IDLE_SLEEP);
+        assert(config.jrtc_router_config.num_shards == 1);
+        assert(config.jrtc_router_config.numa_shards == false);
+        assert(config.jrtc_router_config.timestamp_source == JRTC_ROUTER_TIMESTAMP_MONOTONIC);
+        assert(config.jrtc_router_config.hugepages == JRTC_ROUTER_HUGEPAGES_NONE);
+        assert(config.jrtc_router_config.max_num_apps == JRTC_ROUTER_DEFAULT_MAX_NUM_APPS);
+        assert(config.jrtc_router_config.max_app_queue_size == JRTC_ROUTER_DEFAULT_MAX_APP_QUEUE_SIZE);
+        assert(config.jrtc_router_config.init_num_req_entries == JRTC_ROUTER_DEFAULT_INIT_NUM_REQ_ENTRIES);
+        assert(config.max_num_loaded_apps == DEFAULT_MAX_NUM_LOADED_APPS);
+        assert(config.jrtc_router_config.capture.path[0] == '\0');
+        assert(config.jrtc_router_config.capture.segment_size_mb == JRTC_ROUTER_DEFAULT_CAPTURE_SEGMENT_SIZE_MB);
+        assert(config.jrtc_router_config.capture.max_segments == 0);
         assert(config.port == DEFAULT_PORT);
         assert(strcmp(config.jbpf_io_config.jbpf_namespace, "jbpf") == 0);
         assert(strcmp(config.jbpf_io_config.jbpf_path, "/tmp") == 0);
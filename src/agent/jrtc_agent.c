@@ -5,9 +5,11 @@
 #include "jrtc_agent.h"
 #include "jrtc_agent_defs.h"
 #include "jrtc_router_stream_id.h"
+#include "jrtc_router_doorbell.h"
 
 int global_device_id;
 char* global_stream_path;
+jrtc_router_doorbell_t* global_doorbell;
 
 int
 agent_init(char* channel_name, size_t memory_size, int device_id, char* stream_path)
@@ -43,6 +45,9 @@ agent_init(char* channel_name, size_t memory_size, int device_id, char* stream_p
     if (global_stream_path == NULL)
         return -3;
 
+    // Optional, the router picks up the data on its next poll if there is no doorbell
+    global_doorbell = jrtc_router_doorbell_open(channel_name);
+
     jbpf_io_register_thread(
 
     );
@@ -55,6 +60,8 @@ agent_stop()
 {
     jbpf_io_stop();
     free(global_stream_path);
+    jrtc_router_doorbell_close(global_doorbell, NULL);
+    global_doorbell = NULL;
 }
 
 struct jbpf_io_stream_id
@@ -101,6 +108,25 @@ agent_create_output_channel(int fwd_dst, int num_elems, jrtc_agent_schema_defini
         schema_def->encoder_size);
 }
 
+int
+agent_channel_submit(jbpf_io_channel_t* io_channel)
+{
+    int res;
+
+    if (io_channel == NULL)
+        return -1;
+
+    res = jbpf_io_channel_submit_buf(io_channel);
+    jrtc_router_doorbell_ring(global_doorbell);
+    return res;
+}
+
+void
+agent_notify_router()
+{
+    jrtc_router_doorbell_ring(global_doorbell);
+}
+
 void
 agent_destroy_channel(jbpf_io_channel_t* io_channel)
 {
@@ -50,6 +50,23 @@ agent_create_input_channel(int fwd_dst, int num_elems, jrtc_agent_schema_definit
 jbpf_io_channel_t*
 agent_create_output_channel(int fwd_dst, int num_elems, jrtc_agent_schema_definition* schema_def);
 
+/**
+ * @brief Submit the reserved buffer of an output channel and wake up the router, if it is parked
+ * @ingroup agent
+ * @param io_channel The output channel
+ * @return 0 on success, -1 on failure
+ */
+int
+agent_channel_submit(jbpf_io_channel_t* io_channel);
+
+/**
+ * @brief Wake up the router, if it is parked. To be used by agents that submit to their channels
+ * directly through jbpf_io_channel_submit_buf()
+ * @ingroup agent
+ */
+void
+agent_notify_router();
+
 /**
  * @brief Destroy a channel
  * @ingroup agent
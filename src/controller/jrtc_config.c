@@ -83,6 +83,25 @@ init_jrtc_config(jrtc_config_t* config)
     config->jrtc_router_config.thread_config.sched_config.sched_deadline = 30 * 1000 * 1000;
     config->jrtc_router_config.thread_config.sched_config.sched_runtime = 10 * 1000 * 1000;
     config->jrtc_router_config.thread_config.sched_config.sched_period = 30 * 1000 * 1000;
+    config->jrtc_router_config.thread_config.idle_config.idle_policy = JRTC_ROUTER_IDLE_SLEEP;
+    config->jrtc_router_config.thread_config.idle_config.sleep_us = 5;
+    config->jrtc_router_config.thread_config.idle_config.spin_budget = 1000;
+    config->jrtc_router_config.thread_config.idle_config.park_timeout_us = 1000;
+
+    config->jrtc_router_config.num_shards = 1;
+    config->jrtc_router_config.shard_partition = JRTC_ROUTER_SHARD_BY_STREAM;
+    config->jrtc_router_config.numa_shards = false;
+    config->jrtc_router_config.timestamp_source = JRTC_ROUTER_TIMESTAMP_MONOTONIC;
+    config->jrtc_router_config.hugepages = JRTC_ROUTER_HUGEPAGES_NONE;
+    config->jrtc_router_config.max_num_apps = JRTC_ROUTER_DEFAULT_MAX_NUM_APPS;
+    config->jrtc_router_config.max_app_queue_size = JRTC_ROUTER_DEFAULT_MAX_APP_QUEUE_SIZE;
+    config->jrtc_router_config.init_num_req_entries = JRTC_ROUTER_DEFAULT_INIT_NUM_REQ_ENTRIES;
+    config->jrtc_router_config.capture.path[0] = '\0';
+    config->jrtc_router_config.capture.segment_size_mb = JRTC_ROUTER_DEFAULT_CAPTURE_SEGMENT_SIZE_MB;
+    config->jrtc_router_config.capture.max_segments = 0;
+    for (int i = 0; i < JRTC_ROUTER_MAX_NUM_SHARDS; i++) {
+        config->jrtc_router_config.shard_thread_config[i] = config->jrtc_router_config.thread_config;
+    }
 
     strncpy(config->jbpf_io_config.jbpf_path, JBPF_DEFAULT_RUN_PATH, JBPF_RUN_PATH_LEN - 1);
     config->jbpf_io_config.jbpf_path[JBPF_RUN_PATH_LEN - 1] = '\0';
@@ -95,6 +114,63 @@ init_jrtc_config(jrtc_config_t* config)
     config->jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name[JBPF_IO_IPC_MAX_NAMELEN - 1] = '\0';
 
     config->port = DEFAULT_PORT;
+    config->max_num_loaded_apps = DEFAULT_MAX_NUM_LOADED_APPS;
+}
+
+static jrtc_router_shard_partition_e
+get_shard_partition(const char* value)
+{
+    if (strcmp(value, "device_id") == 0) {
+        return JRTC_ROUTER_SHARD_BY_DEVICE_ID;
+    } else if (strcmp(value, "stream") == 0) {
+        return JRTC_ROUTER_SHARD_BY_STREAM;
+    }
+    return (jrtc_router_shard_partition_e)atoi(value);
+}
+
+static jrtc_router_hugepages_e
+get_hugepages(const char* value)
+{
+    if (strcmp(value, "none") == 0) {
+        return JRTC_ROUTER_HUGEPAGES_NONE;
+    } else if (strcmp(value, "thp") == 0) {
+        return JRTC_ROUTER_HUGEPAGES_THP;
+    } else if (strcmp(value, "2m") == 0) {
+        return JRTC_ROUTER_HUGEPAGES_2MB;
+    } else if (strcmp(value, "1g") == 0) {
+        return JRTC_ROUTER_HUGEPAGES_1GB;
+    }
+    return (jrtc_router_hugepages_e)atoi(value);
+}
+
+static jrtc_router_timestamp_source_e
+get_timestamp_source(const char* value)
+{
+    if (strcmp(value, "none") == 0) {
+        return JRTC_ROUTER_TIMESTAMP_NONE;
+    } else if (strcmp(value, "monotonic") == 0) {
+        return JRTC_ROUTER_TIMESTAMP_MONOTONIC;
+    } else if (strcmp(value, "monotonic_raw") == 0) {
+        return JRTC_ROUTER_TIMESTAMP_MONOTONIC_RAW;
+    } else if (strcmp(value, "tsc") == 0) {
+        return JRTC_ROUTER_TIMESTAMP_TSC;
+    }
+    return (jrtc_router_timestamp_source_e)atoi(value);
+}
+
+static jrtc_router_idle_policy_e
+get_idle_policy(const char* value)
+{
+    if (strcmp(value, "busy_poll") == 0) {
+        return JRTC_ROUTER_IDLE_BUSY_POLL;
+    } else if (strcmp(value, "park") == 0) {
+        return JRTC_ROUTER_IDLE_PARK;
+    } else if (strcmp(value, "hybrid") == 0) {
+        return JRTC_ROUTER_IDLE_HYBRID;
+    } else if (strcmp(value, "sleep") == 0) {
+        return JRTC_ROUTER_IDLE_SLEEP;
+    }
+    return (jrtc_router_idle_policy_e)atoi(value);
 }
 
 int
@@ -118,6 +194,9 @@ set_config_values(const char* filename, jrtc_config_t* config)
     int in_jrtc_router_config = 0;
     int in_thread_config = 0;
     int in_sched_config = 0;
+    int in_idle_config = 0;
+    int in_shards = 0;
+    int shard_idx = -1;
     int in_jbpf_io_config = 0;
     int in_logging = 0;
 
@@ -128,6 +207,10 @@ set_config_values(const char* filename, jrtc_config_t* config)
     }
     yaml_parser_set_input_file(&parser, file);
 
+    // Either the thread config of the router or the one of a shard
+    struct jrtc_router_thread_config* thread_config = &config->jrtc_router_config.thread_config;
+    struct jrtc_router_thread_config ignored_thread_config;
+
     while (1) {
         if (!yaml_parser_parse(&parser, &event)) {
             fprintf(stderr, "Failed to parse YAML file: %s\n", parser.problem);
@@ -149,24 +232,44 @@ set_config_values(const char* filename, jrtc_config_t* config)
                 // Second scalar is a value
                 char* expanded_value = expand_env_vars((char*)event.data.scalar.value);
 
-                if (in_thread_config && !in_sched_config) {
+                if (in_idle_config) {
+                    if (strcmp(key, "idle_policy") == 0) {
+                        thread_config->idle_config.idle_policy =
+                            get_idle_policy(expanded_value);
+                    } else if (strcmp(key, "sleep_us") == 0) {
+                        thread_config->idle_config.sleep_us = atoi(expanded_value);
+                    } else if (strcmp(key, "spin_budget") == 0) {
+                        thread_config->idle_config.spin_budget = atoi(expanded_value);
+                    } else if (strcmp(key, "park_timeout_us") == 0) {
+                        thread_config->idle_config.park_timeout_us = atoi(expanded_value);
+                    }
+                } else if (in_thread_config && !in_sched_config) {
                     if (strcmp(key, "affinity_mask") == 0) {
-                        config->jrtc_router_config.thread_config.affinity_mask = atoi(expanded_value);
+                        thread_config->affinity_mask = atoi(expanded_value);
+                    } else if (strcmp(key, "cpus") == 0) {
+                        // The cpuset list format, which also covers the CPUs beyond the 64 of affinity_mask
+                        if (jrtc_router_parse_cpuset(expanded_value, &thread_config->cpus) == 0) {
+                            thread_config->has_affinity_mask = 1;
+                        } else {
+                            jrtc_logger(JRTC_ERROR, "Invalid cpus: %s\n", expanded_value);
+                        }
+                    } else if (strcmp(key, "has_affinity_mask") == 0) {
+                        thread_config->has_affinity_mask = (strcmp(expanded_value, "true") == 0) ? 1 : 0;
                     } else if (strcmp(key, "has_sched_config") == 0) {
-                        config->jrtc_router_config.thread_config.has_sched_config =
+                        thread_config->has_sched_config =
                             (strcmp(expanded_value, "true") == 0) ? 1 : 0;
                     }
                 } else if (in_sched_config) {
                     if (strcmp(key, "sched_policy") == 0) {
-                        config->jrtc_router_config.thread_config.sched_config.sched_policy = atoi(expanded_value);
+                        thread_config->sched_config.sched_policy = atoi(expanded_value);
                     } else if (strcmp(key, "sched_priority") == 0) {
-                        config->jrtc_router_config.thread_config.sched_config.sched_priority = atoi(expanded_value);
+                        thread_config->sched_config.sched_priority = atoi(expanded_value);
                     } else if (strcmp(key, "sched_deadline") == 0) {
-                        config->jrtc_router_config.thread_config.sched_config.sched_deadline = atoll(expanded_value);
+                        thread_config->sched_config.sched_deadline = atoll(expanded_value);
                     } else if (strcmp(key, "sched_runtime") == 0) {
-                        config->jrtc_router_config.thread_config.sched_config.sched_runtime = atoll(expanded_value);
+                        thread_config->sched_config.sched_runtime = atoll(expanded_value);
                     } else if (strcmp(key, "sched_period") == 0) {
-                        config->jrtc_router_config.thread_config.sched_config.sched_period = atoll(expanded_value);
+                        thread_config->sched_config.sched_period = atoll(expanded_value);
                     }
                 } else if (in_jbpf_io_config) {
                     if (strcmp(key, "jbpf_namespace") == 0) {
@@ -192,6 +295,33 @@ set_config_values(const char* filename, jrtc_config_t* config)
                             sizeof(config->jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name) - 1);
                     } else if (strcmp(key, "port") == 0) {
                         config->port = atoi(expanded_value);
+                    } else if (strcmp(key, "num_shards") == 0) {
+                        config->jrtc_router_config.num_shards = atoi(expanded_value);
+                    } else if (strcmp(key, "shard_partition") == 0) {
+                        config->jrtc_router_config.shard_partition = get_shard_partition(expanded_value);
+                    } else if (strcmp(key, "numa_shards") == 0) {
+                        config->jrtc_router_config.numa_shards = (strcmp(expanded_value, "true") == 0) ? 1 : 0;
+                    } else if (strcmp(key, "ingress_timestamp") == 0) {
+                        config->jrtc_router_config.timestamp_source = get_timestamp_source(expanded_value);
+                    } else if (strcmp(key, "hugepages") == 0) {
+                        config->jrtc_router_config.hugepages = get_hugepages(expanded_value);
+                    } else if (strcmp(key, "max_num_apps") == 0) {
+                        config->jrtc_router_config.max_num_apps = atoi(expanded_value);
+                    } else if (strcmp(key, "max_app_queue_size") == 0) {
+                        config->jrtc_router_config.max_app_queue_size = atoi(expanded_value);
+                    } else if (strcmp(key, "init_num_req_entries") == 0) {
+                        config->jrtc_router_config.init_num_req_entries = atoi(expanded_value);
+                    } else if (strcmp(key, "capture_path") == 0) {
+                        strncpy(
+                            config->jrtc_router_config.capture.path,
+                            expanded_value,
+                            sizeof(config->jrtc_router_config.capture.path) - 1);
+                    } else if (strcmp(key, "capture_segment_size_mb") == 0) {
+                        config->jrtc_router_config.capture.segment_size_mb = atoi(expanded_value);
+                    } else if (strcmp(key, "capture_max_segments") == 0) {
+                        config->jrtc_router_config.capture.max_segments = atoi(expanded_value);
+                    } else if (strcmp(key, "max_num_loaded_apps") == 0) {
+                        config->max_num_loaded_apps = atoi(expanded_value);
                     }
                 } else if (in_logging) {
                     if (strcmp(key, "jrtc_level") == 0) {
@@ -218,8 +348,21 @@ set_config_values(const char* filename, jrtc_config_t* config)
                 in_jrtc_router_config = 1;
             } else if (strcmp(key, "thread_config") == 0 && in_jrtc_router_config) {
                 in_thread_config = 1;
+                thread_config = &config->jrtc_router_config.thread_config;
+            } else if (in_shards && !in_thread_config) {
+                // Each item of the shards sequence is the thread config of a shard
+                shard_idx++;
+                if (shard_idx < JRTC_ROUTER_MAX_NUM_SHARDS) {
+                    thread_config = &config->jrtc_router_config.shard_thread_config[shard_idx];
+                } else {
+                    jrtc_logger(JRTC_ERROR, "Too many shards in config, ignoring shard %d\n", shard_idx);
+                    thread_config = &ignored_thread_config;
+                }
+                in_thread_config = 1;
             } else if (strcmp(key, "sched_config") == 0 && in_thread_config) {
                 in_sched_config = 1;
+            } else if (strcmp(key, "idle_config") == 0 && in_thread_config) {
+                in_idle_config = 1;
             } else if (strcmp(key, "jbpf_io_config") == 0) {
                 in_jbpf_io_config = 1;
             } else if (strcmp(key, "logging") == 0) {
@@ -228,9 +371,22 @@ set_config_values(const char* filename, jrtc_config_t* config)
             key[0] = '\0'; // Reset key
             break;
 
+        case YAML_SEQUENCE_START_EVENT:
+            if (strcmp(key, "shards") == 0 && in_jrtc_router_config && !in_thread_config) {
+                in_shards = 1;
+            }
+            key[0] = '\0'; // Reset key
+            break;
+
+        case YAML_SEQUENCE_END_EVENT:
+            in_shards = 0;
+            break;
+
         case YAML_MAPPING_END_EVENT:
             if (in_sched_config) {
                 in_sched_config = 0;
+            } else if (in_idle_config) {
+                in_idle_config = 0;
             } else if (in_thread_config) {
                 in_thread_config = 0;
             } else if (in_jrtc_router_config) {
@@ -7,6 +7,7 @@
 
 #define DEFAULT_JRTC_NAME "jrt_controller"
 #define DEFAULT_PORT 3001
+#define DEFAULT_MAX_NUM_LOADED_APPS 64
 
 /**
  * @brief Expands environment variables in a given string (e.g., "Path: ${HOME}/test")
@@ -11,6 +11,8 @@ struct jrtc_config
     struct jrtc_router_config jrtc_router_config;
     struct jbpf_io_config jbpf_io_config;
     int port;
+    // The max number of apps loaded by the controller
+    int max_num_loaded_apps;
 };
 
 typedef struct jrtc_config jrtc_config_t;
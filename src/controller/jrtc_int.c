@@ -88,11 +88,12 @@ concat(const char* s1, const char* s2)
 #define MAX_NUM_APPS 20
 
 #define NORTH_IO_LIB "libjrtc_north_io.so"
-#define MAX_NUM_JRTC_APPS 64
 
 sem_t jrtc_stop;
 
-struct jrtc_app_env* app_envs[MAX_NUM_JRTC_APPS] = {NULL};
+// Sized by max_num_loaded_apps of the config
+struct jrtc_app_env** app_envs = NULL;
+int num_app_envs = 0;
 int next_available_app_env = 0;
 
 static char*
@@ -192,7 +193,8 @@ run_app(void* args)
     app_env->dapp_ctx = jrtc_router_register_app(app_env->io_queue_size);
     app_env->shared_python_state = &shared_python_state;
 
-    if (app_env->sched_config.sched_deadline_us > 0) {
+    // The CPUs and the scheduling policy are applied before the app starts
+    if (app_env->sched_config.sched_policy != JRTC_SCHED_NORMAL || app_env->sched_config.cpuset != NULL) {
         jrtc_thread_set_scheduler(app_env->app_tid, &app_env->sched_config);
     }
 
@@ -215,11 +217,11 @@ run_app(void* args)
 static int
 _jrtc_reserve_app_id(struct jrtc_app_env* app_env)
 {
-    for (int i = 0; i < MAX_NUM_JRTC_APPS; i++) {
-        int index = (next_available_app_env + i) % MAX_NUM_JRTC_APPS;
+    for (int i = 0; i < num_app_envs; i++) {
+        int index = (next_available_app_env + i) % num_app_envs;
         if (app_envs[index] == NULL) {
             app_envs[index] = app_env;
-            next_available_app_env = (index + 1) % MAX_NUM_JRTC_APPS;
+            next_available_app_env = (index + 1) % num_app_envs;
             return index;
         }
     }
@@ -229,7 +231,7 @@ _jrtc_reserve_app_id(struct jrtc_app_env* app_env)
 static void
 _jrtc_release_app_id(int app_id)
 {
-    if (app_id >= 0 && app_id < MAX_NUM_JRTC_APPS) {
+    if (app_id >= 0 && app_id < num_app_envs) {
         if (app_envs[app_id] == NULL) {
             return;
         }
@@ -250,7 +252,7 @@ _is_app_loaded(load_app_request_t* load_req)
         jrtc_logger(JRTC_DEBUG, "Checking if Python app %s is already loaded\n", load_req->app_name);
         // check the app_envs[].params[0]
         if (load_req->params[0].key != NULL && load_req->params[0].val != NULL) {
-            for (int i = 0; i < MAX_NUM_JRTC_APPS; i++) {
+            for (int i = 0; i < num_app_envs; i++) {
                 if (app_envs[i] != NULL && app_envs[i]->params[0].key != NULL &&
                     strcmp(app_envs[i]->params[0].key, load_req->params[0].key) == 0 &&
                     app_envs[i]->params[0].val != NULL &&
@@ -277,7 +279,7 @@ _is_app_loaded(load_app_request_t* load_req)
             load_req->app_name,
             load_req->app_path);
         if (load_req->app_path != NULL) {
-            for (int i = 0; i < MAX_NUM_JRTC_APPS; i++) {
+            for (int i = 0; i < num_app_envs; i++) {
                 if (app_envs[i] != NULL && app_envs[i]->app_path != NULL &&
                     strcmp(app_envs[i]->app_path, load_req->app_path) == 0) {
                     jrtc_logger(
@@ -301,12 +303,32 @@ load_app(load_app_request_t load_req)
 {
 
     struct jrtc_app_env* app_env;
+    jrtc_sched_policy_e sched_policy = JRTC_SCHED_NORMAL;
+    cpu_set_t cpus;
 
     if (!load_req.app || !load_req.app_size) {
         jrtc_logger(JRTC_CRITICAL, "Invalid app data or size for app %s\n", load_req.app_name);
         return -1;
     }
 
+    if (load_req.sched_policy && load_req.sched_policy[0] != '\0') {
+        if (jrtc_sched_policy_from_str(load_req.sched_policy, &sched_policy) < 0) {
+            jrtc_logger(
+                JRTC_ERROR, "Invalid scheduling policy %s for app %s\n", load_req.sched_policy, load_req.app_name);
+            return -1;
+        }
+    } else if (load_req.deadline_us > 0) {
+        sched_policy = JRTC_SCHED_DEADLINE;
+    }
+    if (sched_policy == JRTC_SCHED_FIFO && (load_req.sched_priority < 1 || load_req.sched_priority > 99)) {
+        jrtc_logger(JRTC_ERROR, "Invalid fifo priority %d for app %s\n", load_req.sched_priority, load_req.app_name);
+        return -1;
+    }
+    if (load_req.cpuset && load_req.cpuset[0] != '\0' && jrtc_router_parse_cpuset(load_req.cpuset, &cpus) < 0) {
+        jrtc_logger(JRTC_ERROR, "Invalid cpuset %s for app %s\n", load_req.cpuset, load_req.app_name);
+        return -1;
+    }
+
     // check if the app is already loaded
     jrtc_logger(JRTC_DEBUG, "Checking if app %s is already loaded\n", load_req.app_name);
     if (_is_app_loaded(&load_req)) {
@@ -329,6 +351,7 @@ load_app(load_app_request_t load_req)
 
     if (app_id < 0) {
         jrtc_logger(JRTC_CRITICAL, "Could not reserve resources for new app %s\n", load_req.app_name);
+        free(app_env);
         return -1;
     }
 
@@ -370,8 +393,9 @@ load_app(load_app_request_t load_req)
     app_env->sched_config.sched_runtime_us = load_req.runtime_us;
     app_env->sched_config.sched_period_us = load_req.period_us;
     app_env->sched_config.sched_deadline_us = load_req.deadline_us;
-    if (app_env->sched_config.sched_deadline_us > 0)
-        app_env->sched_config.sched_policy = JRTC_SCHED_DEADLINE;
+    app_env->sched_config.sched_policy = sched_policy;
+    app_env->sched_config.sched_priority = load_req.sched_priority;
+    app_env->sched_config.cpuset = (load_req.cpuset && load_req.cpuset[0] != '\0') ? strdup(load_req.cpuset) : NULL;
 
     if (load_req.app_name == NULL) {
         app_env->app_name = strdup("jrtc_app");
@@ -389,14 +413,17 @@ load_app(load_app_request_t load_req)
 load_app_error:
     dlclose(app_handle);
 error:
+    // Frees the app env
     _jrtc_release_app_id(app_id);
-    free(app_env);
     return -1;
 }
 
 int
 unload_app(int app_id)
 {
+    if (app_id < 0 || app_id >= num_app_envs) {
+        return -1;
+    }
     struct jrtc_app_env* env = app_envs[app_id];
     if (env == NULL) {
         return -1;
@@ -418,6 +445,7 @@ unload_app(int app_id)
     jrtc_logger(JRTC_INFO, "App %s shut down\n", env->app_name);
     free(env->app_name);
     free(env->app_path);
+    free(env->sched_config.cpuset);
     _jrtc_release_app_id(app_id);
     return 0;
 }
@@ -534,6 +562,16 @@ start_jrtc(const char* config_file)
         jrtc_logger(JRTC_ERROR, "Failed to read thread config from YAML file: %s (%d)\n", config_file, res);
         return -2;
     }
+
+    num_app_envs = jrtc_config.max_num_loaded_apps > 0 ? jrtc_config.max_num_loaded_apps : DEFAULT_MAX_NUM_LOADED_APPS;
+    app_envs = calloc(num_app_envs, sizeof(struct jrtc_app_env*));
+    if (app_envs == NULL) {
+        jrtc_logger(JRTC_CRITICAL, "Failed to allocate memory for %d apps\n", num_app_envs);
+        num_app_envs = 0;
+        return -1;
+    }
+    jrtc_logger(JRTC_INFO, "Up to %d apps can be loaded\n", num_app_envs);
+
     rest_server_handle = jrtc_create_rest_server();
     if (rest_server_handle == NULL) {
         jrtc_logger(JRTC_CRITICAL, "Failed to create rest server\n");
@@ -575,7 +613,7 @@ start_jrtc(const char* config_file)
     jrtc_logger(JRTC_INFO, "Stopping REST server\n");
     jrtc_stop_rest_server(rest_server_handle);
 
-    for (int i = 0; i < MAX_NUM_JRTC_APPS; i++) {
+    for (int i = 0; i < num_app_envs; i++) {
         if (app_envs[i] == NULL) {
             continue;
         }
@@ -597,6 +635,9 @@ start_jrtc(const char* config_file)
 
     sem_destroy(&jrtc_stop);
     free(rest_server_handle_args);
+    free(app_envs);
+    app_envs = NULL;
+    num_app_envs = 0;
     return res;
 }
 
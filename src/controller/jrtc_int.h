@@ -3,6 +3,9 @@
 #ifndef JRTC_INT_H
 #define JRTC_INT_H
 
+// Defined in jrtc_rest_server.h
+struct load_app_request;
+
 /**
  * @brief Concatenate two strings
  * @param s1 The first string
@@ -26,4 +29,20 @@ start_jrtc(const char* config_file);
 void
 stop_jrtc();
 
+/**
+ * @brief Load an app into the running controller, as done for the load requests of the REST API
+ * @param load_req The load request
+ * @return The id of the app on success, -1 on failure
+ */
+int
+load_app(struct load_app_request load_req);
+
+/**
+ * @brief Unload an app loaded with load_app()
+ * @param app_id The id of the app
+ * @return 0 on success, -1 on failure
+ */
+int
+unload_app(int app_id);
+
 #endif
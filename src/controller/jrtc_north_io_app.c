@@ -28,6 +28,8 @@
 #define AA_NET_IN_DEFAULT_PORT (1924)
 #define AA_NET_MAX_FQDN_SIZE (256)
 #define AA_NET_OUT_DEFAULT_FQDN "127.0.0.1"
+// Max time to wait for data before checking for exit
+#define AA_OUT_RECEIVE_TIMEOUT_NS (10 * 1000 * 1000)
 #define AA_NET_HEADROOM (128)
 #define AA_NET_ELEM_SIZE (65535 - AA_NET_HEADROOM)
 #define AA_NET_NUM_DATA_ELEM (4095U)
@@ -323,12 +325,11 @@ jrtc_start_app(struct jrtc_app_env* env_ctx)
 
     jrtc_logger(JRTC_INFO, "Starting the jrtc_north_io app\n");
     while (!atomic_load(&env_ctx->app_exit)) {
-        num_rcv = jrtc_router_receive(env_ctx->dapp_ctx, data_entries, AA_OUT_BUFS_BATCH_SIZE);
+        num_rcv = jrtc_router_receive_timeout(
+            env_ctx->dapp_ctx, data_entries, AA_OUT_BUFS_BATCH_SIZE, AA_OUT_RECEIVE_TIMEOUT_NS);
         if (num_rcv > 0) {
             aa_channel_encode_fwd_out_data(env_ctx->dapp_ctx, data_entries, num_rcv, &net_info);
         }
-
-        usleep(100);
     }
     jrtc_logger(JRTC_INFO, "Exiting the jrtc_north_io app\n");
 
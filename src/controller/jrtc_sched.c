@@ -2,11 +2,22 @@
 // Licensed under the MIT license.
 #define _GNU_SOURCE
 #include <linux/sched.h>
+#include <sched.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "jrtc_sched.h"
 #include "jrtc_logging.h"
+#include "jrtc_router.h"
+
+static const char* const sched_policy_names[] = {
+    [JRTC_SCHED_NORMAL] = "normal",
+    [JRTC_SCHED_FIFO] = "fifo",
+    [JRTC_SCHED_DEADLINE] = "deadline",
+};
+
+#define NUM_SCHED_POLICIES (sizeof(sched_policy_names) / sizeof(sched_policy_names[0]))
 
 static int
 sched_setattr(pid_t pid, const struct sched_attr* attr, unsigned int flags)
@@ -14,15 +25,55 @@ sched_setattr(pid_t pid, const struct sched_attr* attr, unsigned int flags)
     return syscall(__NR_sched_setattr, pid, attr, flags);
 }
 
+int
+jrtc_sched_policy_from_str(const char* name, jrtc_sched_policy_e* policy)
+{
+    if (!name || !policy)
+        return -1;
+
+    for (unsigned int i = 0; i < NUM_SCHED_POLICIES; i++) {
+        if (strcmp(name, sched_policy_names[i]) == 0) {
+            *policy = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char*
+jrtc_sched_policy_str(jrtc_sched_policy_e policy)
+{
+    if ((unsigned int)policy >= NUM_SCHED_POLICIES)
+        return NULL;
+    return sched_policy_names[policy];
+}
+
 int
 jrtc_thread_set_scheduler(pthread_t tid, struct jrtc_sched_config* sched_config)
 {
 
+    cpu_set_t cpus;
     int res;
 
     if (!sched_config)
         return -1;
 
+    if (sched_config->cpuset && sched_config->cpuset[0] != '\0') {
+        if (jrtc_router_parse_cpuset(sched_config->cpuset, &cpus) < 0) {
+            jrtc_logger(JRTC_ERROR, "Invalid cpuset %s\n", sched_config->cpuset);
+            return -1;
+        }
+        if (sched_config->sched_policy == JRTC_SCHED_DEADLINE) {
+            jrtc_logger(JRTC_WARN, "WARNING: SCHED_DEADLINE policy cannot be used in conjunction with a cpuset\n");
+        }
+        res = pthread_setaffinity_np(tid, sizeof(cpu_set_t), &cpus);
+        if (res != 0) {
+            jrtc_logger(JRTC_ERROR, "Error setting the CPUs %s: %s\n", sched_config->cpuset, strerror(res));
+            return -1;
+        }
+        jrtc_logger(JRTC_INFO, "Set the CPUs of the thread to %s\n", sched_config->cpuset);
+    }
+
     switch (sched_config->sched_policy) {
     case JRTC_SCHED_NORMAL:
         jrtc_logger(JRTC_WARN, "Using normal scheduling policy\n");
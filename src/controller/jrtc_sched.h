@@ -71,6 +71,7 @@ typedef enum
  * sched_runtime_us: The runtime in microseconds
  * sched_deadline_us: The deadline in microseconds
  * sched_period_us: The period in microseconds
+ * cpuset: The CPUs of the thread as a list like "2,4-7", NULL or empty for any CPU
  */
 typedef struct jrtc_sched_config
 {
@@ -79,10 +80,30 @@ typedef struct jrtc_sched_config
     uint64_t sched_runtime_us;
     uint64_t sched_deadline_us;
     uint64_t sched_period_us;
+    char* cpuset;
 } jrtc_sched_config_t;
 
 /**
- * @brief Set the scheduler
+ * @brief Get the scheduling policy of its name
+ * @ingroup controller
+ * @param name The name of the policy: "normal", "fifo" or "deadline"
+ * @param policy Set to the policy
+ * @return 0 on success, -1 if the name is unknown
+ */
+int
+jrtc_sched_policy_from_str(const char* name, jrtc_sched_policy_e* policy);
+
+/**
+ * @brief Get the name of a scheduling policy
+ * @ingroup controller
+ * @param policy The policy
+ * @return The name of the policy, NULL if the policy is unknown
+ */
+const char*
+jrtc_sched_policy_str(jrtc_sched_policy_e policy);
+
+/**
+ * @brief Set the scheduler. The CPUs of the cpuset are applied first.
  * @ingroup controller
  * @param tid The thread id
  * @param sched_config The scheduling configuration
@@ -17,6 +17,10 @@
  * period_us: The period in microseconds
  * ioq_size: The io queue size
  * app_path: The application path
+ * app_type: The application type
+ * cpuset: The CPUs of the application as a list like "2,4-7", NULL or empty for any CPU
+ * sched_policy: The scheduling policy, "normal", "fifo" or "deadline", NULL or empty to derive it from deadline_us
+ * sched_priority: The priority of the fifo scheduling policy
  * params: The application parameters
  */
 typedef struct load_app_request
@@ -30,6 +34,9 @@ typedef struct load_app_request
     uint32_t ioq_size;
     char* app_path;
     char* app_type;
+    char* cpuset;
+    char* sched_policy;
+    int32_t sched_priority;
     key_value_pair_t params[MAX_APP_PARAMS];
     key_value_pair_t device_mapping[MAX_DEVICE_MAPPING];
     char* app_modules[MAX_APP_MODULES];
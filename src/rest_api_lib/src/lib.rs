@@ -41,6 +41,9 @@ pub struct LoadAppRequest {
     pub ioq_size: u32,
     pub app_path: *mut c_char,
     pub app_type: *mut c_char,
+    pub cpuset: *mut c_char,
+    pub sched_policy: *mut c_char,
+    pub sched_priority: i32,
     pub app_params: [KeyValuePair; 255], // Fixed-size array
     pub device_mapping: [KeyValuePair; 255], // Fixed-size array
     pub app_modules: [*mut c_char; 255], // Fixed-size array
@@ -73,6 +76,12 @@ struct JrtcAppLoadRequest {
     ioq_size: u32,
     app_path: String,
     app_type: String,
+    #[serde(default)]
+    cpuset: String,
+    #[serde(default)]
+    sched_policy: String,
+    #[serde(default)]
+    sched_priority: i32,
     app_params: HashMap<String, String>,
     device_mapping: HashMap<String, String>,
     app_modules: Vec<String>,
@@ -185,6 +194,8 @@ async fn load_app(
     let app_name = payload_cloned.app_name;
     let app_path = payload_cloned.app_path;
     let app_type = payload_cloned.app_type;
+    let cpuset = payload_cloned.cpuset;
+    let sched_policy = payload_cloned.sched_policy;
     let app_params = payload_cloned.app_params;
     let device_mapping = payload_cloned.device_mapping;
     let app_modules = payload_cloned.app_modules;
@@ -231,6 +242,34 @@ async fn load_app(
         }
     };
 
+    let c_cpuset = match CString::new(cpuset.clone()) {
+        Ok(c) => c,
+        Err(_) => {
+            return (
+                StatusCode::BAD_REQUEST,
+                Json(JrtcAppError::Details(format!(
+                    "cpuset cannot be converted into c string = {}",
+                    cpuset.clone()
+                ))),
+            )
+            .into_response();
+        }
+    };
+
+    let c_sched_policy = match CString::new(sched_policy.clone()) {
+        Ok(c) => c,
+        Err(_) => {
+            return (
+                StatusCode::BAD_REQUEST,
+                Json(JrtcAppError::Details(format!(
+                    "sched_policy cannot be converted into c string = {}",
+                    sched_policy.clone()
+                ))),
+            )
+            .into_response();
+        }
+    };
+
     let mut c_app_params: [KeyValuePair; 255] = unsafe { std::mem::zeroed() }; // Initialize
     let mut c_device_mapping: [KeyValuePair; 255] = unsafe { std::mem::zeroed() }; // Initialize
 
@@ -273,6 +312,9 @@ async fn load_app(
         ioq_size: payload.ioq_size,
         app_path: c_app_path.into_raw(),
         app_type: c_app_type.into_raw(),
+        cpuset: c_cpuset.into_raw(),
+        sched_policy: c_sched_policy.into_raw(),
+        sched_priority: payload.sched_priority,
         app_params: c_app_params,
         device_mapping: c_device_mapping,
         app_modules: c_app_modules,
@@ -282,6 +324,8 @@ async fn load_app(
     let app_name_ptr = app_req.app_name;
     let app_path_ptr = app_req.app_path;
     let app_type_ptr = app_req.app_type;
+    let cpuset_ptr = app_req.cpuset;
+    let sched_policy_ptr = app_req.sched_policy;
 
     unsafe {
         response = match state.callbacks.load_app {
@@ -302,6 +346,8 @@ async fn load_app(
         let _ = CString::from_raw(app_name_ptr);
         let _ = CString::from_raw(app_path_ptr);
         let _ = CString::from_raw(app_type_ptr);
+        let _ = CString::from_raw(cpuset_ptr);
+        let _ = CString::from_raw(sched_policy_ptr);
     }
 
     match response {
@@ -6,6 +6,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "jbpf_io.h"
 #include "jbpf_io_channel.h"
@@ -31,10 +36,11 @@ struct dapp_channel_ctx
     jrtc_router_stream_id_t stream_id;
     dapp_router_ctx_t app_ctx;
     bool is_output;
+    // Slot of an input channel in the app
+    uint32_t slot;
+    uint32_t elem_size;
 };
 
-CK_EPOCH_CONTAINER(jrtc_router_req_entry_t, epoch_entry, epoch_container)
-
 #define round_up_pow_of_two(x) \
     ({                         \
         uint32_t v = x;        \
@@ -118,6 +124,25 @@ struct router_thread_args
     struct jrtc_router_config* config;
 };
 
+struct shard_thread_args
+{
+    struct jrtc_router_ctx* router_ctx;
+    jrtc_router_shard_t* shard;
+    struct jrtc_router_thread_config thread_config;
+};
+
+static int
+_jrtc_router_thread_set_scheduler(pthread_t thread_id, struct jrtc_router_sched_config* sched_config);
+
+static int
+_jrtc_router_thread_set_cpu_affinity(pthread_t thread_id, const cpu_set_t* cpus);
+
+static void
+_jrtc_router_thread_cpus(const struct jrtc_router_thread_config* thread_config, cpu_set_t* cpus);
+
+static int
+_jrtc_router_thread_set_numa_affinity(pthread_t thread_id, int numa_node);
+
 static int
 sched_setattr(pid_t pid, const struct sched_attr* attr, unsigned int flags)
 {
@@ -131,10 +156,11 @@ ht_hash_wrapper(struct ck_ht_hash* h, const void* key, size_t length, uint64_t s
     h->value = (unsigned long)MurmurHash64A(key, length, seed);
 }
 
+// The maps of the hash tables are probed for every message, so large ones are backed by huge pages
 static void*
 ht_malloc(size_t r)
 {
-    return jbpf_malloc(r);
+    return _jrtc_router_mem_calloc(r, -1);
 }
 
 static void
@@ -142,52 +168,41 @@ ht_free(void* p, size_t b, bool r)
 {
     (void)b;
     (void)r;
-    jbpf_free(p);
+    _jrtc_router_mem_free(p);
 }
 
 static struct ck_malloc ht_allocator = {.malloc = ht_malloc, .free = ht_free};
 
-static void
-_stream_id_req_destructor(ck_epoch_entry_t* p)
+static inline uint64_t
+_jrtc_router_now_ns()
 {
-    jrtc_router_req_entry_t* req_entry = epoch_container(p);
+    struct timespec ts;
 
-    jbpf_free(req_entry->bitmap);
-    jbpf_free(req_entry);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-void
-_jrtc_router_forward_msgs(
-    struct jbpf_io_channel* io_channel, struct jbpf_io_stream_id* stream_id, void** bufs, int num_bufs, void* ctx)
+static inline void
+_jrtc_router_stat_add(uint64_t* stat, uint64_t value)
+{
+    // Every set of stats is only updated by a single thread
+    ck_pr_store_64(stat, *stat + value);
+}
+
+// Probes the request table with all the wildcard variants of the stream id and
+// stores the union of the matching requests in lookup_res
+static void
+_jrtc_router_lookup_reqs(
+    jrtc_router_ctx_t router_ctx, jrtc_router_shard_t* shard, jrtc_router_stream_id_t* sid, ck_bitmap_t* lookup_res)
 {
-    jbpf_mbuf_t* mbuf;
-    jrtc_router_data_entry_t* data_entry;
     jrtc_router_req_entry_t* req_entry;
-    jrtc_router_ctx_t router_ctx;
-    jrtc_router_stream_id_t* sid;
     jrtc_router_stream_id_t lookup_id;
     ck_ht_hash_t h_req;
     ck_ht_entry_t req_table_entry;
-    ck_bitmap_t* lookup_res;
-    ck_bitmap_iterator_t iter;
-    struct dapp_router_ctx* dapp;
-    void* ptr;
-    unsigned int app_id;
-
-    if (!io_channel || num_bufs <= 0) {
-        return;
-    }
-
-    // print_stream_id("We have messages to process from stream_id %s\n",
-    // stream_id);
-
-    router_ctx = ctx;
-    sid = (jrtc_router_stream_id_t*)stream_id;
-    lookup_res = router_ctx->req_table.lookup_result;
 
     ck_bitmap_clear(lookup_res);
 
-    ck_epoch_begin(&router_ctx->req_table.router_epoch_record, NULL);
+    ck_epoch_begin(&shard->epoch_record, NULL);
 
     for (int i = 0; i < JRTC_ROUTER_NUM_REQ_LOOKUPS; i++) {
         lookup_id = *sid;
@@ -205,646 +220,2516 @@ _jrtc_router_forward_msgs(
         // apps
         if (ck_ht_get_spmc(&router_ctx->req_table.reqs, h_req, &req_table_entry)) {
             req_entry = ck_ht_entry_value(&req_table_entry);
-            ck_bitmap_union(lookup_res, req_entry->bitmap);
+            _jrtc_router_app_set_union(lookup_res, ck_pr_load_ptr(&req_entry->apps));
         }
     }
 
-    ck_epoch_end(&router_ctx->req_table.router_epoch_record, NULL);
+    ck_epoch_end(&shard->epoch_record, NULL);
 
-    ck_bitmap_iterator_init(&iter, lookup_res);
+    _jrtc_router_path_index_match(&router_ctx->req_table, sid, lookup_res);
+}
 
-    for (int i = 0; i < num_bufs; i++) {
-        for (int j = 0; ck_bitmap_next(lookup_res, &iter, &app_id) == true; j++) {
-            // Place to the ringbuffers of all the apps and release
-            dapp = router_ctx->app_metadata.ctx[app_id];
+static jrtc_router_route_entry_t*
+_jrtc_router_route_create(
+    jrtc_router_ctx_t router_ctx, jrtc_router_shard_t* shard, jrtc_router_stream_id_t* sid, ck_ht_hash_t h_route)
+{
+    jrtc_router_route_cache_t* cache;
+    jrtc_router_route_entry_t* route;
+    ck_ht_entry_t route_entry;
 
-            if (!dapp) {
-                continue;
-            }
+    cache = &shard->route_cache;
 
-            mbuf = jbpf_mbuf_alloc(dapp->data_entry_pool);
+    if (cache->num_routes >= JRTC_ROUTER_ROUTE_CACHE_MAX_ENTRIES) {
+        return NULL;
+    }
 
-            if (!mbuf) {
-                continue;
-            }
+    route = jbpf_calloc(1, sizeof(jrtc_router_route_entry_t));
+    if (!route) {
+        return NULL;
+    }
 
-            data_entry = (jrtc_router_data_entry_t*)mbuf->data;
+    route->stream_id = *sid;
+    // Not resolved yet
+    route->generation = UINT64_MAX;
+    route->stats = _jrtc_router_stats_get_stream(&router_ctx->stats, sid);
 
-            ptr = jbpf_io_channel_share_data_ptr(bufs[i]);
+    ck_ht_entry_set(&route_entry, h_route, &route->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, route);
+    if (!ck_ht_set_spmc(&cache->routes, h_route, &route_entry)) {
+        jbpf_free(route);
+        return NULL;
+    }
 
-            data_entry->data = ptr;
-            data_entry->stream_id = *sid;
+    cache->num_routes++;
+    jrtc_print_stream_id("Cached route for stream id %s\n", &route->stream_id);
 
-            ck_ring_enqueue_spsc(&dapp->ring, dapp->ringbuffer, data_entry);
-        }
-        jbpf_io_channel_release_buf(bufs[i]);
-    }
+    return route;
 }
 
-static void
-_jrtc_router_handle_incoming_msgs()
+// Returns the set of the apps subscribed to the stream id. The resolved set is cached
+// per stream id and only recomputed if the request table has changed since.
+// The cached route is returned in route_out, or NULL if the route could not be cached.
+static jrtc_router_app_set_t*
+_jrtc_router_resolve_route(
+    jrtc_router_ctx_t router_ctx,
+    jrtc_router_shard_t* shard,
+    jrtc_router_stream_id_t* sid,
+    jrtc_router_route_entry_t** route_out)
 {
-    jrtc_router_ctx_t router_ctx;
-    struct jbpf_io_ctx* io_ctx;
+    jrtc_router_route_entry_t* route;
+    jrtc_router_app_set_t* apps;
+    ck_ht_hash_t h_route;
+    ck_ht_entry_t route_entry;
+    uint64_t generation;
+
+    // Load the generation before probing the request table, so that any concurrent
+    // change causes a new lookup on the next batch
+    generation = ck_pr_load_64(&router_ctx->req_table.generation);
+    ck_pr_fence_load();
+
+    *route_out = NULL;
+
+    ck_ht_hash(&h_route, &shard->route_cache.routes, sid, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&route_entry, sid, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    if (ck_ht_get_spmc(&shard->route_cache.routes, h_route, &route_entry)) {
+        route = ck_ht_entry_value(&route_entry);
+        if (route->generation == generation) {
+            ck_pr_store_64(&route->hits, route->hits + 1);
+            *route_out = route;
+            return route->apps;
+        }
+    } else {
+        route = _jrtc_router_route_create(router_ctx, shard, sid, h_route);
+        if (!route) {
+            // The cache is full, so fall back to a lookup for every batch
+            _jrtc_router_lookup_reqs(router_ctx, shard, sid, shard->lookup_result);
+            _jrtc_router_app_set_fill(shard->lookup_set, shard->lookup_result, router_ctx->max_num_apps);
+            return shard->lookup_set;
+        }
+    }
 
-    router_ctx = jrtc_router_get_ctx();
+    _jrtc_router_lookup_reqs(router_ctx, shard, sid, shard->lookup_result);
+    ck_pr_store_64(&route->misses, route->misses + 1);
+    *route_out = route;
 
-    io_ctx = router_ctx->io_ctx;
+    // Only this shard reads the set of the route, so the old one can be freed right away
+    apps = _jrtc_router_app_set_from_bitmap(shard->lookup_result, router_ctx->max_num_apps);
+    if (!apps) {
+        // Keep the route stale, so that the set is resolved again on the next batch
+        _jrtc_router_app_set_fill(shard->lookup_set, shard->lookup_result, router_ctx->max_num_apps);
+        return shard->lookup_set;
+    }
 
-    if (!io_ctx || io_ctx->io_type == JBPF_IO_IPC_SECONDARY)
-        return;
+    jbpf_free(route->apps);
+    route->apps = apps;
 
-    jbpf_io_channel_handle_out_bufs(io_ctx, _jrtc_router_forward_msgs, router_ctx);
+    // On failure, the route stays stale and the limits are resolved again on the next batch
+    if (_jrtc_router_limit_resolve(router_ctx, route) < 0) {
+        return route->apps;
+    }
+    route->generation = generation;
+
+    return route->apps;
 }
 
-void*
-jrtc_router_thread_start(void* args)
+// Adds num_refs references to a buffer of an IO channel with a single atomic operation.
+// Buffers of IO channels are the data of a jbpf_mbuf_t, same as with jbpf_io_channel_share_data_ptr().
+static inline void
+_jrtc_router_buf_add_refs(void* data_ptr, uint32_t num_refs)
 {
+    jbpf_mbuf_t* mbuf;
 
-    struct router_thread_args* th_args;
-    struct jrtc_router_config* config;
-    struct jrtc_router_ctx* ctx;
-
-    th_args = args;
-    config = th_args->config;
-    ctx = th_args->router_ctx;
-    free(th_args);
+    mbuf = (jbpf_mbuf_t*)((uint8_t*)data_ptr - offsetof(jbpf_mbuf_t, data));
+    ck_pr_add_32(&mbuf->ref_cnt, num_refs);
+}
 
-    if (config->thread_config.has_sched_config && config->thread_config.has_affinity_mask) {
-        if (config->thread_config.sched_config.sched_policy == JRTC_ROUTER_DEADLINE) {
-            jrtc_logger(
-                JRTC_WARN,
-                "WARNING: SCHED_DEADLINE policy cannot be used in "
-                "conjunction with affinitized threads\n");
+static inline bool
+_jrtc_router_ring_enqueue(struct dapp_router_ctx* dapp, jrtc_router_data_entry_t* data_entry, bool multi_producer)
+{
+    // The queues that can be overwritten also have the router as a consumer
+    if (dapp->overflow_policy == JRTC_ROUTER_OVERFLOW_DROP_OLDEST) {
+        if (multi_producer) {
+            return CK_RING_ENQUEUE_MPMC(jrtc_router_data_entry, &dapp->ring, dapp->ringbuffer, data_entry);
         }
+        return CK_RING_ENQUEUE_SPMC(jrtc_router_data_entry, &dapp->ring, dapp->ringbuffer, data_entry);
     }
 
-    if (config->thread_config.has_affinity_mask) {
-        jrtc_router_set_cpu_affinity(ctx, config->thread_config.affinity_mask);
-    }
-
-    if (config->thread_config.has_sched_config) {
-        jrtc_router_set_scheduler(ctx, &config->thread_config.sched_config);
+    if (multi_producer) {
+        return CK_RING_ENQUEUE_MPSC(jrtc_router_data_entry, &dapp->ring, dapp->ringbuffer, data_entry);
     }
+    return CK_RING_ENQUEUE_SPSC(jrtc_router_data_entry, &dapp->ring, dapp->ringbuffer, data_entry);
+}
 
-    if (pthread_setname_np(pthread_self(), "jrtc_router")) {
-        jrtc_logger(JRTC_ERROR, "Error in setting app name to %s\n", "jrtc_router");
-    } else {
-        jrtc_logger(JRTC_INFO, "Set name %s successfully\n", "jrtc_router");
+// Wakes up the app if it waits for data. Must be called after the data has been queued.
+static inline void
+_jrtc_router_app_notify(struct dapp_router_ctx* dapp)
+{
+    // Pairs with the fence in jrtc_router_arm_fd()
+    ck_pr_fence_memory();
+    if (ck_pr_load_32(&dapp->wait_armed) && ck_pr_cas_32(&dapp->wait_armed, 1, 0)) {
+        eventfd_write(dapp->event_fd, 1);
     }
+}
 
-    jbpf_io_register_thread();
+// Drops the oldest message in the queue of an app. Returns false if the queue was empty.
+static bool
+_jrtc_router_drop_oldest(struct dapp_router_ctx* dapp)
+{
+    jrtc_router_data_entry_t data_entry;
 
-    while (1) {
-        _jrtc_router_handle_incoming_msgs();
-        usleep(5);
+    if (!CK_RING_DEQUEUE_MPMC(jrtc_router_data_entry, &dapp->ring, dapp->ringbuffer, &data_entry)) {
+        return false;
     }
 
-    return NULL;
+    jbpf_io_channel_release_buf(data_entry.data);
+
+    return true;
 }
 
-int
-jrtc_router_init(struct jrtc_config* config)
+// Raises a stat that is updated by several threads to value, if value is higher
+static inline void
+_jrtc_router_stat_max(uint64_t* stat, uint64_t value)
 {
+    uint64_t cur;
 
-    struct router_thread_args* thread_args;
-    unsigned int bytes;
-
-    unsigned int mode = CK_HT_MODE_BYTESTRING;
+    do {
+        cur = ck_pr_load_64(stat);
+    } while (value > cur && !ck_pr_cas_64(stat, cur, value));
+}
 
-    if (!config) {
-        return -1;
+// Places up to num_bufs buffers to the queue of an app, applying the overflow policy of
+// the app when the queue is full. The caller must already hold one reference per buffer
+// on behalf of the app. Returns the number of buffers that were queued and stores the
+// occupancy of the queue in occupancy. The references of the buffers that could not be
+// queued are left to the caller.
+static int
+_jrtc_router_enqueue_app(
+    struct dapp_router_ctx* dapp,
+    jrtc_router_stream_id_t* sid,
+    void** bufs,
+    int num_bufs,
+    uint64_t ingress_ts_ns,
+    bool multi_producer,
+    unsigned int* occupancy)
+{
+    jrtc_router_data_entry_t data_entry;
+    unsigned int free_slots;
+    uint64_t now, deadline;
+    uint32_t num_overwritten, num_retries;
+    int num_enqueued, max_enqueued;
+
+    max_enqueued = num_bufs;
+    if (!multi_producer && dapp->overflow_policy == JRTC_ROUTER_OVERFLOW_DROP_NEWEST) {
+        // With a single producer, the free space can only grow until we enqueue.
+        // One slot of the ring is always kept empty by ck_ring.
+        free_slots = ck_ring_capacity(&dapp->ring) - 1 - ck_ring_size(&dapp->ring);
+        if (free_slots < (unsigned int)max_enqueued) {
+            max_enqueued = free_slots;
+        }
     }
 
-    jrtc_logger(
-        JRTC_INFO,
-        "Initializing router with namespace %s and path %s, ipc_name %s\n",
-        config->jbpf_io_config.jbpf_namespace,
-        config->jbpf_io_config.jbpf_path,
-        config->jrtc_router_config.io_config.ipc_name);
+    deadline = 0;
+    num_overwritten = 0;
+    data_entry.stream_id = *sid;
+    data_entry.ingress_ts_ns = ingress_ts_ns;
+
+    for (num_enqueued = 0; num_enqueued < max_enqueued; num_enqueued++) {
+        data_entry.data = bufs[num_enqueued];
+        num_retries = 0;
+
+        while (!_jrtc_router_ring_enqueue(dapp, &data_entry, multi_producer)) {
+            if (dapp->overflow_policy == JRTC_ROUTER_OVERFLOW_DROP_OLDEST) {
+                if (_jrtc_router_drop_oldest(dapp)) {
+                    num_overwritten++;
+                    continue;
+                }
+                // The app emptied the queue concurrently, or other producers filled it up again
+                if (++num_retries < JRTC_ROUTER_MAX_OVERWRITE_RETRIES) {
+                    ck_pr_stall();
+                    continue;
+                }
+            } else if (dapp->overflow_policy == JRTC_ROUTER_OVERFLOW_BLOCK) {
+                // Wait for the app once per batch, the rest of the batch is dropped on timeout
+                now = _jrtc_router_now_ns();
+                if (deadline == 0) {
+                    deadline = now + (uint64_t)dapp->block_timeout_us * 1000;
+                }
+                if (now < deadline) {
+                    ck_pr_stall();
+                    continue;
+                }
+            }
 
-    g_router_ctx.io_ctx = jbpf_io_init(&config->jbpf_io_config);
-    if (g_router_ctx.io_ctx == NULL) {
-        jrtc_logger(JRTC_ERROR, "Could not initialize IO successfully\n");
-        goto error_io_init;
-    } else {
-        jrtc_logger(JRTC_INFO, "IO initilized successfully\n");
+            goto out;
+        }
     }
 
-    thread_args = malloc(sizeof(struct router_thread_args));
-    if (!thread_args) {
-        jrtc_logger(JRTC_ERROR, "Error allocating memory for thread args\n");
-        goto error_router_thread;
+out:
+    if (num_enqueued > 0) {
+        _jrtc_router_app_notify(dapp);
     }
 
-    thread_args->config = &config->jrtc_router_config;
-    thread_args->router_ctx = &g_router_ctx;
-
-    // Initialize the request tables and the app metadata
-    ck_spinlock_init(&g_router_ctx.req_table.lock);
+    *occupancy = ck_ring_size(&dapp->ring);
 
-    ck_epoch_init(&g_router_ctx.req_table.router_epoch);
-    ck_epoch_register(&g_router_ctx.req_table.router_epoch, &g_router_ctx.req_table.router_epoch_record, NULL);
-    for (int i = 0; i < JRTC_ROUTER_MAX_NUM_APPS; i++) {
-        ck_epoch_register(&g_router_ctx.req_table.router_epoch, &g_router_ctx.req_table.app_epoch_record[i], NULL);
+    ck_pr_add_64(&dapp->stats_slot->num_enqueued, num_enqueued);
+    if (num_enqueued < num_bufs) {
+        ck_pr_add_64(&dapp->stats_slot->num_dropped, num_bufs - num_enqueued);
+    }
+    if (num_overwritten > 0) {
+        ck_pr_add_64(&dapp->stats_slot->num_overwritten, num_overwritten);
     }
+    _jrtc_router_stat_max(&dapp->stats_slot->high_watermark, *occupancy);
 
-    bytes = ck_bitmap_size(JRTC_ROUTER_MAX_NUM_APPS);
+    return num_enqueued;
+}
 
-    g_router_ctx.req_table.lookup_result = jbpf_malloc(bytes);
+// Keeps the last buffer of a batch for an app with a latest-value request for the stream. Returns false if the
+// app has no slot left for the stream, in which case the batch is queued as usual.
+static bool
+_jrtc_router_deliver_latest(
+    struct dapp_router_ctx* dapp, jrtc_router_stream_id_t* sid, void** bufs, int num_bufs, uint64_t ingress_ts_ns)
+{
+    int num_replaced;
 
-    if (!g_router_ctx.req_table.lookup_result) {
-        goto error_thread_init;
+    num_replaced = _jrtc_router_latest_store(dapp, sid, bufs, num_bufs, ingress_ts_ns);
+    if (num_replaced < 0) {
+        return false;
     }
 
-    ck_bitmap_init(g_router_ctx.req_table.lookup_result, JRTC_ROUTER_MAX_NUM_APPS, false);
-
-    if (!ck_ht_init(
-            &g_router_ctx.req_table.reqs,
-            mode,
-            ht_hash_wrapper,
-            &ht_allocator,
-            JRTC_ROUTER_INIT_NUM_REQ_ENTRIES,
-            6602834)) {
+    _jrtc_router_app_notify(dapp);
 
-        goto error_lookup_res;
+    // Replaced messages are not dropped for the app, it just no longer needs them
+    ck_pr_add_64(&dapp->stats_slot->num_enqueued, num_bufs);
+    if (num_replaced > 0) {
+        ck_pr_add_64(&dapp->stats_slot->num_overwritten, num_replaced);
     }
+    return true;
+}
 
-    g_router_ctx.app_metadata.app_bitmap = jbpf_malloc(bytes);
+// Delivers the messages of a batch that pass the limits and filters of the apps with one on the stream, each with
+// a reference of its own. Returns the number of apps left in dapps, the ones without a limit or a filter.
+static int
+_jrtc_router_fan_out_limited(
+    jrtc_router_route_entry_t* route,
+    struct dapp_router_ctx** dapps,
+    int num_apps,
+    jrtc_router_stream_id_t* sid,
+    void** bufs,
+    int num_bufs,
+    uint64_t ingress_ts_ns,
+    bool multi_producer,
+    int* total_offered,
+    int* total_enqueued,
+    unsigned int* max_occupancy)
+{
+    jrtc_router_route_limit_t* limit;
+    void* passed[JRTC_ROUTER_SHARD_BATCH_SIZE];
+    uint32_t num_filtered_out, num_sampled_out, num_rate_limited;
+    uint32_t elem_size;
+    unsigned int occupancy;
+    uint64_t now_ns;
+    int num_left = 0, num_passed, num_enqueued, len;
+
+    // The rate limits use the time of arrival at the router, if there is one
+    now_ns = ingress_ts_ns ? ingress_ts_ns : jrtc_router_timestamp_now_ns();
+    // The filters do not read past the messages, and match nothing if their size is unknown
+    elem_size = route->elem_size == JRTC_ROUTER_ELEM_SIZE_UNKNOWN ? 0 : route->elem_size;
+
+    for (int j = 0; j < num_apps; j++) {
+        limit = _jrtc_router_limit_of(route, dapps[j]->app_id);
+        if (!limit) {
+            dapps[num_left++] = dapps[j];
+            continue;
+        }
 
-    if (!g_router_ctx.app_metadata.app_bitmap) {
-        goto error_app_metadata_init;
-    }
+        num_filtered_out = 0;
+        num_sampled_out = 0;
+        num_rate_limited = 0;
+        for (int start = 0; start < num_bufs; start += len) {
+            len = num_bufs - start < JRTC_ROUTER_SHARD_BATCH_SIZE ? num_bufs - start : JRTC_ROUTER_SHARD_BATCH_SIZE;
+            num_passed = _jrtc_router_limit_apply(
+                limit,
+                &bufs[start],
+                len,
+                elem_size,
+                now_ns,
+                passed,
+                &num_filtered_out,
+                &num_sampled_out,
+                &num_rate_limited);
+            if (num_passed == 0) {
+                continue;
+            }
 
-    ck_bitmap_init(g_router_ctx.app_metadata.app_bitmap, JRTC_ROUTER_MAX_NUM_APPS, false);
+            // The reference of the router is kept for the apps without a limit
+            for (int i = 0; i < num_passed; i++) {
+                _jrtc_router_buf_add_refs(passed[i], 1);
+            }
+            *total_offered += num_passed;
 
-    if (pthread_create(
-            &g_router_ctx.th_ctx.jrtc_router_thread_id, NULL, jrtc_router_thread_start, (void*)thread_args) != 0) {
-        jrtc_logger(JRTC_ERROR, "Error creating router thread\n");
-        goto error_thread_init;
-    }
+            if (ck_pr_load_ptr(&dapps[j]->latest_reqs) && _jrtc_router_latest_matches(dapps[j], sid) &&
+                _jrtc_router_deliver_latest(dapps[j], sid, passed, num_passed, ingress_ts_ns)) {
+                *total_enqueued += num_passed;
+                continue;
+            }
 
-    return 0;
+            num_enqueued = _jrtc_router_enqueue_app(
+                dapps[j], sid, passed, num_passed, ingress_ts_ns, multi_producer, &occupancy);
+            *total_enqueued += num_enqueued;
+            if (occupancy > *max_occupancy) {
+                *max_occupancy = occupancy;
+            }
+            for (int i = num_enqueued; i < num_passed; i++) {
+                jbpf_io_channel_release_buf(passed[i]);
+            }
+        }
 
-error_app_metadata_init:
-    ck_ht_destroy(&g_router_ctx.req_table.reqs);
-error_lookup_res:
-    jbpf_free(g_router_ctx.req_table.lookup_result);
-error_thread_init:
-    free(thread_args);
-error_router_thread:
-    jbpf_io_stop();
-error_io_init:
-    return -1;
-}
+        if (num_filtered_out > 0) {
+            ck_pr_add_64(&dapps[j]->stats_slot->num_filtered_out, num_filtered_out);
+        }
+        if (num_sampled_out > 0) {
+            ck_pr_add_64(&dapps[j]->stats_slot->num_sampled_out, num_sampled_out);
+        }
+        if (num_rate_limited > 0) {
+            ck_pr_add_64(&dapps[j]->stats_slot->num_rate_limited, num_rate_limited);
+        }
+        _jrtc_router_stat_add(&route->num_suppressed, num_filtered_out + num_sampled_out + num_rate_limited);
+    }
 
-int
-jrtc_router_stop()
-{
-    // TODO
-    // pthread_join(g_router_ctx.th_ctx.jrtc_router_thread_id, NULL);
-    return 0;
+    return num_left;
 }
 
-jrtc_router_ctx_t
-jrtc_router_get_ctx()
+// Publishes the counters of a batch of a stream to the stats region
+static inline void
+_jrtc_router_stream_stats_update(
+    struct jrtc_router_stream_stats* stats,
+    int num_bufs,
+    uint64_t num_delivered,
+    uint64_t num_dropped,
+    uint64_t ingress_ts_ns)
 {
-    return &g_router_ctx;
+    _jrtc_router_stats_write_begin(&stats->seq);
+    stats->num_msgs += num_bufs;
+    stats->num_bytes += (uint64_t)num_bufs * ck_pr_load_32(&stats->elem_size);
+    stats->num_delivered += num_delivered;
+    stats->num_dropped += num_dropped;
+    stats->last_seen_ns = ingress_ts_ns;
+    _jrtc_router_stats_write_end(&stats->seq);
 }
 
-int
-jrtc_router_set_scheduler(struct jrtc_router_ctx* router_ctx, struct jrtc_router_sched_config* sched_config)
+// Learns the size of the messages of a route and publishes it to the stats region. jbpf serializes a message as
+// its stream id followed by its payload, which copies the message, so it is only done once per route.
+static void
+_jrtc_router_route_learn_elem_size(
+    jrtc_router_ctx_t router_ctx, jrtc_router_shard_t* shard, jrtc_router_route_entry_t* route, void* buf)
 {
-    int res;
-
-    if (!router_ctx || !sched_config)
-        return -1;
+    int len;
+
+    len = jbpf_io_channel_pack_msg(
+        router_ctx->io_ctx,
+        buf,
+        shard->msg_scratch,
+        JRTC_ROUTER_STREAM_ID_BYTE_LEN + JRTC_ROUTER_MAX_LEARNED_ELEM_SIZE);
+    if (len <= JRTC_ROUTER_STREAM_ID_BYTE_LEN) {
+        jrtc_print_stream_id("Could not learn the message size of stream id %s\n", &route->stream_id);
+        route->elem_size = JRTC_ROUTER_ELEM_SIZE_UNKNOWN;
+        return;
+    }
 
-    switch (sched_config->sched_policy) {
-    case JRTC_ROUTER_NORMAL:
-        jrtc_logger(JRTC_INFO, "Using normal scheduling policy\n");
-        res = 0;
-        break;
+    route->elem_size = len - JRTC_ROUTER_STREAM_ID_BYTE_LEN;
+    if (route->stats) {
+        ck_pr_store_32(&route->stats->elem_size, route->elem_size);
+    }
+}
 
-    case JRTC_ROUTER_FIFO: {
-        int policy = SCHED_FIFO;
-        struct sched_param param;
-        param.sched_priority = sched_config->sched_priority;
-        jrtc_logger(
-            JRTC_INFO, "Setting router scheduling policy to SCHED_FIFO, with priority %d\n", param.sched_priority);
-        res = pthread_setschedparam(router_ctx->th_ctx.jrtc_router_thread_id, policy, &param);
-        break;
+// Delivers a batch of buffers of a stream to all the subscribed apps
+static void
+_jrtc_router_fan_out(
+    jrtc_router_ctx_t router_ctx,
+    jrtc_router_shard_t* shard,
+    jrtc_router_stream_id_t* sid,
+    void** bufs,
+    int num_bufs,
+    uint64_t ingress_ts_ns)
+{
+    jrtc_router_route_entry_t* route;
+    jrtc_router_app_set_t* apps;
+    jrtc_router_app_set_iterator_t iter;
+    struct dapp_router_ctx** dapps = shard->dapps;
+    unsigned int app_id, occupancy, max_occupancy;
+    int num_apps, num_enqueued, total_enqueued, total_offered;
+    bool multi_producer;
+
+    // Deregistering apps wait for the shards to leave this section before they are freed
+    ck_epoch_begin(&shard->epoch_record, NULL);
+
+    apps = _jrtc_router_resolve_route(router_ctx, shard, sid, &route);
+    if (route && route->elem_size == 0) {
+        _jrtc_router_route_learn_elem_size(router_ctx, shard, route, bufs[0]);
     }
 
-    case JRTC_ROUTER_DEADLINE: {
-        struct sched_attr attr;
-        attr.size = sizeof(attr);
-        attr.sched_flags = 0;
-        attr.sched_nice = 0;
-        attr.sched_priority = 0;
-        attr.sched_policy = SCHED_DEADLINE;
-        attr.sched_runtime = sched_config->sched_runtime;
-        attr.sched_period = sched_config->sched_period;
-        attr.sched_deadline = sched_config->sched_deadline;
-        jrtc_logger(
-            JRTC_INFO,
-            "Setting router scheduling policy to SCHED_DEADLINE, with "
-            "runtime %lld, period %lld and deadline %lld\n",
-            attr.sched_runtime,
-            attr.sched_period,
-            attr.sched_deadline);
-        res = sched_setattr(0, &attr, 0);
-        break;
+    // Compute the list of subscribers once for the whole batch
+    num_apps = 0;
+    _jrtc_router_app_set_iterator_init(&iter, apps);
+    while (_jrtc_router_app_set_next(&iter, &app_id)) {
+        struct dapp_router_ctx* dapp = ck_pr_load_ptr(&router_ctx->app_metadata.ctx[app_id]);
+        if (dapp) {
+            dapps[num_apps++] = dapp;
+        }
     }
 
-    default:
-        jrtc_logger(JRTC_ERROR, "Unknown router scheduling policy\n");
-        res = -2;
-        break;
+    _jrtc_router_stat_add(&shard->stats.num_msgs, num_bufs);
+    _jrtc_router_stat_add(&shard->stats.num_batches, 1);
+
+    // With more than one shard, the queues of the apps have multiple producers
+    multi_producer = router_ctx->num_shards > 1;
+
+    total_offered = 0;
+    total_enqueued = 0;
+    max_occupancy = 0;
+
+    // The apps with a limit on the stream only get the messages that pass it, so they are served on their own
+    if (route && route->num_limits > 0) {
+        num_apps = _jrtc_router_fan_out_limited(
+            route,
+            dapps,
+            num_apps,
+            sid,
+            bufs,
+            num_bufs,
+            ingress_ts_ns,
+            multi_producer,
+            &total_offered,
+            &total_enqueued,
+            &max_occupancy);
     }
 
-    if (res == 0) {
-        jrtc_logger(JRTC_INFO, "Scheduling policy applied successfully\n");
+    if (num_apps == 0) {
+        for (int i = 0; i < num_bufs; i++) {
+            jbpf_io_channel_release_buf(bufs[i]);
+        }
     } else {
-        jrtc_logger(JRTC_ERROR, "Error setting the scheduling policy of the router\n");
+        // Each app gets its own reference to each buffer. The reference of the router
+        // is handed over to the first app, so only the rest need to be added.
+        if (num_apps > 1) {
+            for (int i = 0; i < num_bufs; i++) {
+                _jrtc_router_buf_add_refs(bufs[i], num_apps - 1);
+            }
+        }
+        total_offered += num_apps * num_bufs;
     }
-    return res;
-}
-
-int
-jrtc_router_set_cpu_affinity(struct jrtc_router_ctx* router_ctx, jrtc_router_afinity_mask_t cpu_mask)
-{
 
-    cpu_set_t cpuset;
+    for (int j = 0; j < num_apps; j++) {
+        if (ck_pr_load_ptr(&dapps[j]->latest_reqs) && _jrtc_router_latest_matches(dapps[j], sid) &&
+            _jrtc_router_deliver_latest(dapps[j], sid, bufs, num_bufs, ingress_ts_ns)) {
+            total_enqueued += num_bufs;
+            continue;
+        }
 
-    if (!router_ctx)
-        return -1;
+        num_enqueued =
+            _jrtc_router_enqueue_app(dapps[j], sid, bufs, num_bufs, ingress_ts_ns, multi_producer, &occupancy);
+        total_enqueued += num_enqueued;
+        if (occupancy > max_occupancy) {
+            max_occupancy = occupancy;
+        }
 
-    CPU_ZERO(&cpuset); // Clear the CPU affinity mask
+        // The queue of the app is full, so drop the rest of the batch for this app
+        for (int i = num_enqueued; i < num_bufs; i++) {
+            jbpf_io_channel_release_buf(bufs[i]);
+        }
+    }
 
-    // Convert the uint64_t mask to a cpu_set_t
+    if (route) {
+        _jrtc_router_stat_add(&route->num_enqueued, total_enqueued);
+        _jrtc_router_stat_add(&route->num_dropped, total_offered - total_enqueued);
+        if (max_occupancy > route->queue_high_watermark) {
+            ck_pr_store_64(&route->queue_high_watermark, max_occupancy);
+        }
+        if (route->stats) {
+            _jrtc_router_stream_stats_update(
+                route->stats, num_bufs, total_enqueued, total_offered - total_enqueued, ingress_ts_ns);
+        }
+    }
+
+    ck_epoch_end(&shard->epoch_record, NULL);
+}
+
+static inline uint32_t
+_jrtc_router_shard_of(jrtc_router_ctx_t router_ctx, jrtc_router_stream_id_t* sid)
+{
+    if (router_ctx->num_shards <= 1) {
+        return 0;
+    }
+
+    if (router_ctx->shard_partition == JRTC_ROUTER_SHARD_BY_DEVICE_ID) {
+        return jrtc_router_stream_id_get_device_id(sid) % router_ctx->num_shards;
+    }
+
+    return MurmurHash64A(sid, JRTC_ROUTER_STREAM_ID_BYTE_LEN, 6602834) % router_ctx->num_shards;
+}
+
+// Hands a batch over to the shard that owns the stream. Since every stream is
+// always owned by the same shard and the queue of the shard is FIFO, the order
+// of the messages of each stream is preserved.
+static void
+_jrtc_router_shard_dispatch(
+    jrtc_router_shard_t* shard, jrtc_router_stream_id_t* sid, void** bufs, int num_bufs, uint64_t ingress_ts_ns)
+{
+    struct jrtc_router_shard_msg msg;
+    int i;
+
+    msg.stream_id = *sid;
+    msg.ingress_ts_ns = ingress_ts_ns;
+
+    for (i = 0; i < num_bufs; i++) {
+        msg.buf = bufs[i];
+        if (!CK_RING_ENQUEUE_SPSC(jrtc_router_shard_msg, &shard->ring, shard->ring_buffer, &msg)) {
+            break;
+        }
+    }
+
+    if (i < num_bufs) {
+        _jrtc_router_stat_add(&shard->stats.num_dropped, num_bufs - i);
+        for (; i < num_bufs; i++) {
+            jbpf_io_channel_release_buf(bufs[i]);
+        }
+    }
+
+    jrtc_router_doorbell_ring(&shard->doorbell);
+}
+
+void
+_jrtc_router_forward_msgs(
+    struct jbpf_io_channel* io_channel, struct jbpf_io_stream_id* stream_id, void** bufs, int num_bufs, void* ctx)
+{
+    jrtc_router_ctx_t router_ctx;
+    jrtc_router_stream_id_t* sid;
+    uint64_t ingress_ts_ns;
+
+    if (!io_channel || num_bufs <= 0) {
+        return;
+    }
+
+    router_ctx = ctx;
+
+    // A single timestamp for the whole batch, to keep the cost per message low
+    ingress_ts_ns = _jrtc_router_timebase_ingress_ns(&router_ctx->timebase);
+
+    // print_stream_id("We have messages to process from stream_id %s\n",
+    // stream_id);
+
+    sid = (jrtc_router_stream_id_t*)stream_id;
+    router_ctx->th_ctx.num_forwarded += num_bufs;
+
+    // The messages are captured before the fan-out hands them over to the apps
+    if (router_ctx->capture.header) {
+        _jrtc_router_capture_msgs(
+            &router_ctx->capture,
+            router_ctx->io_ctx,
+            bufs,
+            num_bufs,
+            ingress_ts_ns ? ingress_ts_ns : _jrtc_router_timebase_now_ns(&router_ctx->timebase));
+    }
+
+    if (router_ctx->num_shards <= 1) {
+        _jrtc_router_fan_out(router_ctx, &router_ctx->shards[0], sid, bufs, num_bufs, ingress_ts_ns);
+    } else {
+        _jrtc_router_shard_dispatch(
+            &router_ctx->shards[_jrtc_router_shard_of(router_ctx, sid)], sid, bufs, num_bufs, ingress_ts_ns);
+    }
+}
+
+static void
+_jrtc_router_handle_incoming_msgs()
+{
+    jrtc_router_ctx_t router_ctx;
+    struct jbpf_io_ctx* io_ctx;
+
+    router_ctx = jrtc_router_get_ctx();
+
+    io_ctx = router_ctx->io_ctx;
+
+    if (!io_ctx || io_ctx->io_type == JBPF_IO_IPC_SECONDARY)
+        return;
+
+    jbpf_io_channel_handle_out_bufs(io_ctx, _jrtc_router_forward_msgs, router_ctx);
+}
+
+// Polls the IO channels once and returns the number of buffers that were forwarded
+static uint64_t
+_jrtc_router_poll(struct jrtc_router_ctx* ctx)
+{
+    uint64_t num_forwarded;
+
+    num_forwarded = ctx->th_ctx.num_forwarded;
+    _jrtc_router_handle_incoming_msgs();
+    num_forwarded = ctx->th_ctx.num_forwarded - num_forwarded;
+
+    _jrtc_router_stat_add(&ctx->th_ctx.idle_stats.num_polls, 1);
+    if (num_forwarded == 0) {
+        _jrtc_router_stat_add(&ctx->th_ctx.idle_stats.num_empty_polls, 1);
+    }
+
+    return num_forwarded;
+}
+
+static void
+_jrtc_router_park(struct jrtc_router_ctx* ctx, uint32_t timeout_us)
+{
+    struct jrtc_router_idle_stats* stats;
+    uint64_t park_start, park_end, ring_ts;
+    uint32_t seq;
+
+    stats = &ctx->th_ctx.idle_stats;
+
+    // Without a doorbell, parking is just a sleep
+    if (!ctx->th_ctx.doorbell) {
+        park_start = _jrtc_router_now_ns();
+        usleep(timeout_us);
+        _jrtc_router_stat_add(&stats->idle_ns, _jrtc_router_now_ns() - park_start);
+        return;
+    }
+
+    seq = jrtc_router_doorbell_prepare_park(ctx->th_ctx.doorbell);
+
+    // Poll once more, in case something was submitted before the producer could see that we are parking
+    if (_jrtc_router_poll(ctx) > 0) {
+        jrtc_router_doorbell_cancel_park(ctx->th_ctx.doorbell);
+        return;
+    }
+
+    park_start = _jrtc_router_now_ns();
+    if (jrtc_router_doorbell_park(ctx->th_ctx.doorbell, seq, timeout_us, &ring_ts)) {
+        park_end = _jrtc_router_now_ns();
+        _jrtc_router_stat_add(&stats->num_wakeups, 1);
+        if (park_end > ring_ts) {
+            _jrtc_router_stat_add(&stats->wake_latency_total_ns, park_end - ring_ts);
+            if (park_end - ring_ts > stats->wake_latency_max_ns) {
+                ck_pr_store_64(&stats->wake_latency_max_ns, park_end - ring_ts);
+            }
+        }
+    } else {
+        park_end = _jrtc_router_now_ns();
+        _jrtc_router_stat_add(&stats->num_park_timeouts, 1);
+    }
+
+    _jrtc_router_stat_add(&stats->num_parks, 1);
+    _jrtc_router_stat_add(&stats->idle_ns, park_end - park_start);
+}
+
+static void
+_jrtc_router_run(struct jrtc_router_ctx* ctx, struct jrtc_router_idle_config* idle_config)
+{
+    uint64_t sleep_start;
+    uint32_t empty_polls = 0;
+
+    jrtc_logger(JRTC_INFO, "Router thread started with idle policy %d\n", idle_config->idle_policy);
+
+    while (ck_pr_load_int(&ctx->th_ctx.running)) {
+        if (_jrtc_router_poll(ctx) > 0) {
+            empty_polls = 0;
+            continue;
+        }
+
+        switch (idle_config->idle_policy) {
+        case JRTC_ROUTER_IDLE_BUSY_POLL:
+            ck_pr_stall();
+            break;
+
+        case JRTC_ROUTER_IDLE_HYBRID:
+            if (++empty_polls < idle_config->spin_budget) {
+                ck_pr_stall();
+                break;
+            }
+            empty_polls = 0;
+            _jrtc_router_park(ctx, idle_config->park_timeout_us);
+            break;
+
+        case JRTC_ROUTER_IDLE_PARK:
+            _jrtc_router_park(ctx, idle_config->park_timeout_us);
+            break;
+
+        case JRTC_ROUTER_IDLE_SLEEP:
+        default:
+            sleep_start = _jrtc_router_now_ns();
+            usleep(idle_config->sleep_us);
+            _jrtc_router_stat_add(&ctx->th_ctx.idle_stats.idle_ns, _jrtc_router_now_ns() - sleep_start);
+            break;
+        }
+    }
+}
+
+void*
+jrtc_router_thread_start(void* args)
+{
+
+    struct router_thread_args* th_args;
+    struct jrtc_router_config* config;
+    struct jrtc_router_ctx* ctx;
+    struct jrtc_router_idle_config idle_config;
+    cpu_set_t cpus;
+    int numa_node;
+
+    th_args = args;
+    config = th_args->config;
+    ctx = th_args->router_ctx;
+    idle_config = config->thread_config.idle_config;
+    free(th_args);
+
+    if (config->thread_config.has_sched_config && config->thread_config.has_affinity_mask) {
+        if (config->thread_config.sched_config.sched_policy == JRTC_ROUTER_DEADLINE) {
+            jrtc_logger(
+                JRTC_WARN,
+                "WARNING: SCHED_DEADLINE policy cannot be used in "
+                "conjunction with affinitized threads\n");
+        }
+    }
+
+    if (config->thread_config.has_affinity_mask) {
+        _jrtc_router_thread_cpus(&config->thread_config, &cpus);
+        _jrtc_router_thread_set_cpu_affinity(pthread_self(), &cpus);
+    }
+
+    // The router context is static, so it sits wherever it was first touched. Move it next to the router thread.
+    numa_node = _jrtc_router_numa_node_of_thread(pthread_self());
+    if (numa_node >= 0 && _jrtc_router_numa_move(ctx, sizeof(struct jrtc_router_ctx), numa_node) == 0) {
+        jrtc_logger(JRTC_INFO, "Moved the router context to NUMA node %d\n", numa_node);
+    }
+
+    if (config->thread_config.has_sched_config) {
+        jrtc_router_set_scheduler(ctx, &config->thread_config.sched_config);
+    }
+
+    if (pthread_setname_np(pthread_self(), "jrtc_router")) {
+        jrtc_logger(JRTC_ERROR, "Error in setting app name to %s\n", "jrtc_router");
+    } else {
+        jrtc_logger(JRTC_INFO, "Set name %s successfully\n", "jrtc_router");
+    }
+
+    jbpf_io_register_thread();
+
+    ctx->th_ctx.start_ns = _jrtc_router_now_ns();
+
+    _jrtc_router_run(ctx, &idle_config);
+
+    // The capture is only written by this thread, so it is closed once nothing more is forwarded
+    _jrtc_router_capture_close(&ctx->capture);
+    jrtc_logger(JRTC_INFO, "Router thread stopped\n");
+
+    return NULL;
+}
+
+// Waits for the router thread to dispatch more messages to the shard
+static void
+_jrtc_router_shard_idle(jrtc_router_shard_t* shard, struct jrtc_router_idle_config* idle_config, uint32_t* empty_polls)
+{
+    uint32_t seq;
+
+    switch (idle_config->idle_policy) {
+    case JRTC_ROUTER_IDLE_BUSY_POLL:
+        ck_pr_stall();
+        return;
+
+    case JRTC_ROUTER_IDLE_SLEEP:
+        usleep(idle_config->sleep_us);
+        return;
+
+    case JRTC_ROUTER_IDLE_HYBRID:
+        if (++(*empty_polls) < idle_config->spin_budget) {
+            ck_pr_stall();
+            return;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    *empty_polls = 0;
+    seq = jrtc_router_doorbell_prepare_park(&shard->doorbell);
+    if (ck_ring_size(&shard->ring) > 0) {
+        jrtc_router_doorbell_cancel_park(&shard->doorbell);
+        return;
+    }
+    jrtc_router_doorbell_park(&shard->doorbell, seq, idle_config->park_timeout_us, NULL);
+}
+
+void*
+jrtc_router_shard_thread_start(void* args)
+{
+    struct shard_thread_args* th_args;
+    struct jrtc_router_ctx* ctx;
+    jrtc_router_shard_t* shard;
+    struct jrtc_router_thread_config thread_config;
+    struct jrtc_router_shard_msg msgs[JRTC_ROUTER_SHARD_BATCH_SIZE];
+    void* bufs[JRTC_ROUTER_SHARD_BATCH_SIZE];
+    cpu_set_t cpus;
+    char name[16];
+    int num_msgs, start, num_bufs;
+    uint32_t empty_polls = 0;
+
+    th_args = args;
+    ctx = th_args->router_ctx;
+    shard = th_args->shard;
+    thread_config = th_args->thread_config;
+    free(th_args);
+
+    if (thread_config.has_affinity_mask) {
+        _jrtc_router_thread_cpus(&thread_config, &cpus);
+        _jrtc_router_thread_set_cpu_affinity(pthread_self(), &cpus);
+    } else if (ctx->numa_shards && shard->numa_node >= 0) {
+        _jrtc_router_thread_set_numa_affinity(pthread_self(), shard->numa_node);
+    }
+
+    if (thread_config.has_sched_config) {
+        _jrtc_router_thread_set_scheduler(pthread_self(), &thread_config.sched_config);
+    }
+
+    snprintf(name, sizeof(name), "jrtc_router_%u", shard->shard_id);
+    if (pthread_setname_np(pthread_self(), name)) {
+        jrtc_logger(JRTC_ERROR, "Error in setting app name to %s\n", name);
+    } else {
+        jrtc_logger(JRTC_INFO, "Set name %s successfully\n", name);
+    }
+
+    jbpf_io_register_thread();
+
+    while (1) {
+        num_msgs = 0;
+        while (num_msgs < JRTC_ROUTER_SHARD_BATCH_SIZE &&
+               CK_RING_DEQUEUE_SPSC(jrtc_router_shard_msg, &shard->ring, shard->ring_buffer, &msgs[num_msgs])) {
+            num_msgs++;
+        }
+
+        if (num_msgs == 0) {
+            // The router thread has stopped before the shard is stopped, so the queue is drained once empty
+            if (!ck_pr_load_int(&shard->running)) {
+                break;
+            }
+            _jrtc_router_shard_idle(shard, &thread_config.idle_config, &empty_polls);
+            continue;
+        }
+        empty_polls = 0;
+
+        // Forward every run of messages of the same stream and ingress time as a single batch
+        start = 0;
+        while (start < num_msgs) {
+            num_bufs = 0;
+            bufs[num_bufs++] = msgs[start].buf;
+            while (start + num_bufs < num_msgs && msgs[start + num_bufs].ingress_ts_ns == msgs[start].ingress_ts_ns &&
+                   memcmp(&msgs[start + num_bufs].stream_id, &msgs[start].stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN) ==
+                       0) {
+                bufs[num_bufs] = msgs[start + num_bufs].buf;
+                num_bufs++;
+            }
+            _jrtc_router_fan_out(ctx, shard, &msgs[start].stream_id, bufs, num_bufs, msgs[start].ingress_ts_ns);
+            start += num_bufs;
+        }
+    }
+
+    return NULL;
+}
+
+// The node of the CPUs a shard runs on, -1 if none. With a single shard, the router thread forwards the messages.
+static int
+_jrtc_router_shard_numa_node(struct jrtc_router_config* config, uint32_t shard_id, uint32_t num_shards)
+{
+    struct jrtc_router_thread_config* thread_config;
+    cpu_set_t cpus;
+    int node;
+
+    thread_config = num_shards > 1 ? &config->shard_thread_config[shard_id] : &config->thread_config;
+    if (thread_config->has_affinity_mask) {
+        _jrtc_router_thread_cpus(thread_config, &cpus);
+        return _jrtc_router_numa_node_of_cpus(&cpus);
+    }
+
+    if (!config->numa_shards || num_shards <= 1 || _jrtc_router_numa_num_nodes() <= 1) {
+        return -1;
+    }
+
+    node = shard_id % _jrtc_router_numa_num_nodes();
+    return _jrtc_router_numa_node_cpus(node, &cpus) == 0 ? node : -1;
+}
+
+static int
+_jrtc_router_shard_init(
+    jrtc_router_shard_t* shard, uint32_t shard_id, bool has_queue, uint32_t max_num_apps, int numa_node)
+{
+    memset(shard, 0, sizeof(jrtc_router_shard_t));
+    shard->shard_id = shard_id;
+    shard->numa_node = numa_node;
+
+    // The scratch state is touched for every message, so it is placed on the node of the shard
+    shard->lookup_result = _jrtc_router_mem_calloc(ck_bitmap_size(max_num_apps), numa_node);
+    shard->lookup_set = _jrtc_router_app_set_create(max_num_apps, true);
+    shard->dapps = _jrtc_router_mem_calloc(max_num_apps * sizeof(struct dapp_router_ctx*), numa_node);
+    shard->msg_scratch =
+        _jrtc_router_mem_calloc(JRTC_ROUTER_STREAM_ID_BYTE_LEN + JRTC_ROUTER_MAX_LEARNED_ELEM_SIZE, numa_node);
+    if (!shard->lookup_result || !shard->lookup_set || !shard->dapps || !shard->msg_scratch) {
+        goto error_lookup_res;
+    }
+    ck_bitmap_init(shard->lookup_result, max_num_apps, false);
+
+    if (!ck_ht_init(
+            &shard->route_cache.routes,
+            CK_HT_MODE_BYTESTRING,
+            ht_hash_wrapper,
+            &ht_allocator,
+            JRTC_ROUTER_ROUTE_CACHE_INIT_ENTRIES,
+            6602834)) {
+        goto error_lookup_res;
+    }
+
+    if (has_queue) {
+        shard->ring_buffer =
+            _jrtc_router_mem_calloc(JRTC_ROUTER_SHARD_QUEUE_SIZE * sizeof(struct jrtc_router_shard_msg), numa_node);
+        if (!shard->ring_buffer) {
+            goto error_route_cache;
+        }
+        ck_ring_init(&shard->ring, JRTC_ROUTER_SHARD_QUEUE_SIZE);
+    }
+
+    ck_epoch_register(&g_router_ctx.req_table.router_epoch, &shard->epoch_record, NULL);
+
+    return 0;
+
+error_route_cache:
+    ck_ht_destroy(&shard->route_cache.routes);
+error_lookup_res:
+    _jrtc_router_mem_free(shard->msg_scratch);
+    _jrtc_router_mem_free(shard->dapps);
+    jbpf_free(shard->lookup_set);
+    _jrtc_router_mem_free(shard->lookup_result);
+    return -1;
+}
+
+static void
+_jrtc_router_shard_destroy(jrtc_router_shard_t* shard)
+{
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+    jrtc_router_route_entry_t* route;
+
+    while (ck_ht_next(&shard->route_cache.routes, &iterator, &cursor)) {
+        route = ck_ht_entry_value(cursor);
+        jbpf_free(route->apps);
+        jbpf_free(route->limits);
+        jbpf_free(route);
+    }
+
+    ck_ht_destroy(&shard->route_cache.routes);
+    _jrtc_router_mem_free(shard->msg_scratch);
+    _jrtc_router_mem_free(shard->dapps);
+    jbpf_free(shard->lookup_set);
+    _jrtc_router_mem_free(shard->lookup_result);
+    _jrtc_router_mem_free(shard->ring_buffer);
+}
+
+// Stops the shard threads that are running. The messages that are already in their queues are forwarded first.
+static void
+_jrtc_router_shards_stop(struct jrtc_router_ctx* ctx)
+{
+    for (int i = 0; i < ctx->num_shards; i++) {
+        if (!ck_pr_load_int(&ctx->shards[i].running)) {
+            continue;
+        }
+        ck_pr_store_int(&ctx->shards[i].running, 0);
+        jrtc_router_doorbell_ring(&ctx->shards[i].doorbell);
+        if (pthread_join(ctx->shards[i].thread_id, NULL) != 0) {
+            jrtc_logger(JRTC_ERROR, "Error joining router shard thread %d\n", i);
+        }
+    }
+}
+
+int
+jrtc_router_init(struct jrtc_config* config)
+{
+
+    struct router_thread_args* thread_args;
+    struct shard_thread_args* shard_args;
+    unsigned int bytes;
+    int num_shards_init = 0;
+
+    if (!config) {
+        return -1;
+    }
+
+    jrtc_logger(
+        JRTC_INFO,
+        "Initializing router with namespace %s and path %s, ipc_name %s\n",
+        config->jbpf_io_config.jbpf_namespace,
+        config->jbpf_io_config.jbpf_path,
+        config->jrtc_router_config.io_config.ipc_name);
+
+    g_router_ctx.io_ctx = jbpf_io_init(&config->jbpf_io_config);
+    if (g_router_ctx.io_ctx == NULL) {
+        jrtc_logger(JRTC_ERROR, "Could not initialize IO successfully\n");
+        goto error_io_init;
+    } else {
+        jrtc_logger(JRTC_INFO, "IO initilized successfully\n");
+    }
+
+    thread_args = malloc(sizeof(struct router_thread_args));
+    if (!thread_args) {
+        jrtc_logger(JRTC_ERROR, "Error allocating memory for thread args\n");
+        goto error_router_thread;
+    }
+
+    thread_args->config = &config->jrtc_router_config;
+    thread_args->router_ctx = &g_router_ctx;
+
+    _jrtc_router_mem_init(config->jrtc_router_config.hugepages);
+
+    // The capacities of the router
+    g_router_ctx.max_num_apps = config->jrtc_router_config.max_num_apps;
+    if (g_router_ctx.max_num_apps < 1) {
+        g_router_ctx.max_num_apps = JRTC_ROUTER_DEFAULT_MAX_NUM_APPS;
+    } else if (g_router_ctx.max_num_apps > JRTC_ROUTER_MAX_NUM_APPS_LIMIT) {
+        jrtc_logger(JRTC_WARN, "Too many router apps requested, using %d instead\n", JRTC_ROUTER_MAX_NUM_APPS_LIMIT);
+        g_router_ctx.max_num_apps = JRTC_ROUTER_MAX_NUM_APPS_LIMIT;
+    }
+    g_router_ctx.max_app_queue_size = config->jrtc_router_config.max_app_queue_size;
+    if (g_router_ctx.max_app_queue_size < 1) {
+        g_router_ctx.max_app_queue_size = JRTC_ROUTER_DEFAULT_MAX_APP_QUEUE_SIZE;
+    } else if (g_router_ctx.max_app_queue_size > JRTC_ROUTER_MAX_APP_QUEUE_SIZE_LIMIT) {
+        jrtc_logger(
+            JRTC_WARN, "Too large app queue size requested, using %d instead\n", JRTC_ROUTER_MAX_APP_QUEUE_SIZE_LIMIT);
+        g_router_ctx.max_app_queue_size = JRTC_ROUTER_MAX_APP_QUEUE_SIZE_LIMIT;
+    }
+    jrtc_logger(
+        JRTC_INFO,
+        "Router capacities: %u apps, app queue size %u, %u initial request entries\n",
+        g_router_ctx.max_num_apps,
+        g_router_ctx.max_app_queue_size,
+        config->jrtc_router_config.init_num_req_entries);
+
+    // Initialize the request tables and the app metadata
+    bytes = ck_bitmap_size(g_router_ctx.max_num_apps);
+
+    if (_jrtc_router_req_table_init(
+            &g_router_ctx.req_table,
+            g_router_ctx.max_num_apps,
+            config->jrtc_router_config.init_num_req_entries > 0 ? config->jrtc_router_config.init_num_req_entries
+                                                                : JRTC_ROUTER_DEFAULT_INIT_NUM_REQ_ENTRIES) < 0) {
+        goto error_thread_init;
+    }
+
+    // Initialize the forwarding shards
+    g_router_ctx.num_shards = config->jrtc_router_config.num_shards;
+    if (g_router_ctx.num_shards < 1) {
+        g_router_ctx.num_shards = 1;
+    } else if (g_router_ctx.num_shards > JRTC_ROUTER_MAX_NUM_SHARDS) {
+        jrtc_logger(
+            JRTC_WARN, "Too many router shards requested, using %d instead\n", JRTC_ROUTER_MAX_NUM_SHARDS);
+        g_router_ctx.num_shards = JRTC_ROUTER_MAX_NUM_SHARDS;
+    }
+    g_router_ctx.shard_partition = config->jrtc_router_config.shard_partition;
+    g_router_ctx.numa_shards = config->jrtc_router_config.numa_shards;
+
+    for (num_shards_init = 0; num_shards_init < g_router_ctx.num_shards; num_shards_init++) {
+        if (_jrtc_router_shard_init(
+                &g_router_ctx.shards[num_shards_init],
+                num_shards_init,
+                g_router_ctx.num_shards > 1,
+                g_router_ctx.max_num_apps,
+                _jrtc_router_shard_numa_node(
+                    &config->jrtc_router_config, num_shards_init, g_router_ctx.num_shards)) < 0) {
+            jrtc_logger(JRTC_ERROR, "Error initializing router shard %d\n", num_shards_init);
+            goto error_shards_init;
+        }
+        jrtc_logger(
+            JRTC_INFO,
+            "Router shard %d is placed on NUMA node %d\n",
+            num_shards_init,
+            g_router_ctx.shards[num_shards_init].numa_node);
+    }
+
+    g_router_ctx.app_metadata.app_bitmap = jbpf_malloc(bytes);
+    g_router_ctx.app_metadata.ctx = jbpf_calloc(g_router_ctx.max_num_apps, sizeof(struct dapp_router_ctx*));
+
+    if (!g_router_ctx.app_metadata.app_bitmap || !g_router_ctx.app_metadata.ctx) {
+        goto error_app_metadata_init;
+    }
+
+    ck_bitmap_init(g_router_ctx.app_metadata.app_bitmap, g_router_ctx.max_num_apps, false);
+
+    if (!ck_ht_init(
+            &g_router_ctx.in_channel_registry,
+            CK_HT_MODE_BYTESTRING,
+            ht_hash_wrapper,
+            &ht_allocator,
+            JRTC_ROUTER_NUM_APP_CHANNELS,
+            6602834)) {
+        goto error_app_metadata_init;
+    }
+    ck_rwlock_init(&g_router_ctx.in_channel_lock);
+
+    if (_jrtc_router_multicast_init(&g_router_ctx.multicast) < 0) {
+        goto error_multicast_init;
+    }
+
+    // The router can run without a doorbell, parking then falls back to sleeping
+    memset(&g_router_ctx.th_ctx.idle_stats, 0, sizeof(g_router_ctx.th_ctx.idle_stats));
+    strncpy(
+        g_router_ctx.th_ctx.ipc_name,
+        config->jrtc_router_config.io_config.ipc_name,
+        sizeof(g_router_ctx.th_ctx.ipc_name) - 1);
+    g_router_ctx.th_ctx.doorbell = jrtc_router_doorbell_create(g_router_ctx.th_ctx.ipc_name);
+    if (!g_router_ctx.th_ctx.doorbell) {
+        jrtc_logger(JRTC_WARN, "Could not create the doorbell of the router\n");
+    }
+
+    _jrtc_router_timebase_init(&g_router_ctx.timebase, config->jrtc_router_config.timestamp_source);
+
+    if (_jrtc_router_capture_init(
+            &g_router_ctx.capture,
+            &config->jrtc_router_config.capture,
+            g_router_ctx.timebase.source,
+            _jrtc_router_timebase_now_ns(&g_router_ctx.timebase)) < 0) {
+        jrtc_logger(JRTC_WARN, "Could not start the capture of the router\n");
+    }
+
+    if (_jrtc_router_stats_create(
+            &g_router_ctx.stats,
+            g_router_ctx.th_ctx.ipc_name,
+            JRTC_ROUTER_STATS_MAX_STREAMS,
+            g_router_ctx.max_num_apps,
+            _jrtc_router_timebase_now_ns(&g_router_ctx.timebase),
+            g_router_ctx.timebase.source) < 0) {
+        jrtc_logger(JRTC_WARN, "Could not create the stats region of the router\n");
+    }
+
+    // With more than one shard, the router thread only dispatches the messages to the shard threads
+    if (g_router_ctx.num_shards > 1) {
+        for (int i = 0; i < g_router_ctx.num_shards; i++) {
+            shard_args = malloc(sizeof(struct shard_thread_args));
+            if (!shard_args) {
+                jrtc_logger(JRTC_ERROR, "Error allocating memory for shard thread args\n");
+                goto error_threads_start;
+            }
+            shard_args->router_ctx = &g_router_ctx;
+            shard_args->shard = &g_router_ctx.shards[i];
+            shard_args->thread_config = config->jrtc_router_config.shard_thread_config[i];
+
+            ck_pr_store_int(&g_router_ctx.shards[i].running, 1);
+            if (pthread_create(&g_router_ctx.shards[i].thread_id, NULL, jrtc_router_shard_thread_start, shard_args) !=
+                0) {
+                jrtc_logger(JRTC_ERROR, "Error creating router shard thread %d\n", i);
+                ck_pr_store_int(&g_router_ctx.shards[i].running, 0);
+                free(shard_args);
+                goto error_threads_start;
+            }
+        }
+        jrtc_logger(JRTC_INFO, "Started %d router shards\n", g_router_ctx.num_shards);
+    }
+
+    _jrtc_router_mem_log_stats(config->jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name);
+
+    ck_pr_store_int(&g_router_ctx.th_ctx.running, 1);
+    if (pthread_create(
+            &g_router_ctx.th_ctx.jrtc_router_thread_id, NULL, jrtc_router_thread_start, (void*)thread_args) != 0) {
+        jrtc_logger(JRTC_ERROR, "Error creating router thread\n");
+        ck_pr_store_int(&g_router_ctx.th_ctx.running, 0);
+        goto error_threads_start;
+    }
+
+    return 0;
+
+error_threads_start:
+    // The shard threads that were started read the state below, so they are stopped before it is freed
+    _jrtc_router_shards_stop(&g_router_ctx);
+    _jrtc_router_stats_destroy(&g_router_ctx.stats);
+    _jrtc_router_capture_close(&g_router_ctx.capture);
+    jrtc_router_doorbell_close(g_router_ctx.th_ctx.doorbell, g_router_ctx.th_ctx.ipc_name);
+    g_router_ctx.th_ctx.doorbell = NULL;
+    _jrtc_router_multicast_destroy(&g_router_ctx.multicast);
+error_multicast_init:
+    ck_ht_destroy(&g_router_ctx.in_channel_registry);
+error_app_metadata_init:
+    jbpf_free(g_router_ctx.app_metadata.ctx);
+    jbpf_free(g_router_ctx.app_metadata.app_bitmap);
+    g_router_ctx.app_metadata.ctx = NULL;
+    g_router_ctx.app_metadata.app_bitmap = NULL;
+error_shards_init:
+    for (int i = 0; i < num_shards_init; i++) {
+        _jrtc_router_shard_destroy(&g_router_ctx.shards[i]);
+    }
+    _jrtc_router_req_table_destroy(&g_router_ctx.req_table);
+error_thread_init:
+    free(thread_args);
+error_router_thread:
+    jbpf_io_stop();
+error_io_init:
+    return -1;
+}
+
+int
+jrtc_router_stop()
+{
+    struct jrtc_router_idle_stats stats;
+
+    if (!ck_pr_load_int(&g_router_ctx.th_ctx.running)) {
+        return 0;
+    }
+
+    if (jrtc_router_get_idle_stats(&g_router_ctx, &stats) == 0) {
+        jrtc_logger(
+            JRTC_INFO,
+            "Router idle stats: polls %lu (empty %lu), parks %lu (wakeups %lu, timeouts %lu), "
+            "avg wake latency %lu ns, max wake latency %lu ns, idle %lu ms, cpu %lu ms, wall %lu ms\n",
+            stats.num_polls,
+            stats.num_empty_polls,
+            stats.num_parks,
+            stats.num_wakeups,
+            stats.num_park_timeouts,
+            stats.num_wakeups ? stats.wake_latency_total_ns / stats.num_wakeups : 0,
+            stats.wake_latency_max_ns,
+            stats.idle_ns / 1000000,
+            stats.cpu_ns / 1000000,
+            stats.wall_ns / 1000000);
+    }
+
+    // The router thread stops first, so that nothing more is dispatched to the shards. The messages that are
+    // already in their queues are still forwarded before the shard threads stop.
+    ck_pr_store_int(&g_router_ctx.th_ctx.running, 0);
+    jrtc_router_doorbell_ring(g_router_ctx.th_ctx.doorbell);
+    if (pthread_join(g_router_ctx.th_ctx.jrtc_router_thread_id, NULL) != 0) {
+        jrtc_logger(JRTC_ERROR, "Error joining the router thread\n");
+        return -1;
+    }
+
+    _jrtc_router_shards_stop(&g_router_ctx);
+
+    // Nothing runs anymore, so all that init allocated is freed in reverse order. The IPC name can then be taken
+    // over, e.g. by a new controller, or by the next jrtc_router_init().
+    _jrtc_router_stats_destroy(&g_router_ctx.stats);
+    _jrtc_router_capture_close(&g_router_ctx.capture);
+    jrtc_router_doorbell_close(g_router_ctx.th_ctx.doorbell, g_router_ctx.th_ctx.ipc_name);
+    g_router_ctx.th_ctx.doorbell = NULL;
+    _jrtc_router_multicast_destroy(&g_router_ctx.multicast);
+    ck_ht_destroy(&g_router_ctx.in_channel_registry);
+    jbpf_free(g_router_ctx.app_metadata.ctx);
+    jbpf_free(g_router_ctx.app_metadata.app_bitmap);
+    g_router_ctx.app_metadata.ctx = NULL;
+    g_router_ctx.app_metadata.app_bitmap = NULL;
+    for (int i = 0; i < g_router_ctx.num_shards; i++) {
+        _jrtc_router_shard_destroy(&g_router_ctx.shards[i]);
+    }
+    _jrtc_router_req_table_destroy(&g_router_ctx.req_table);
+    jbpf_io_stop();
+    g_router_ctx.io_ctx = NULL;
+
+    jrtc_logger(JRTC_INFO, "Router stopped\n");
+    return 0;
+}
+
+jrtc_router_ctx_t
+jrtc_router_get_ctx()
+{
+    return &g_router_ctx;
+}
+
+int
+jrtc_router_get_route_stats(
+    struct jrtc_router_ctx* router_ctx, struct jrtc_router_stream_id* stream_id, struct jrtc_router_route_stats* stats)
+{
+    jrtc_router_route_entry_t* route;
+    jrtc_router_shard_t* shard;
+    ck_ht_hash_t h_route;
+    ck_ht_entry_t route_entry;
+
+    if (!router_ctx || !stream_id || !stats) {
+        return -1;
+    }
+
+    // The route is cached by the shard that owns the stream
+    shard = &router_ctx->shards[_jrtc_router_shard_of(router_ctx, (jrtc_router_stream_id_t*)stream_id)];
+
+    ck_ht_hash(&h_route, &shard->route_cache.routes, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&route_entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    if (!ck_ht_get_spmc(&shard->route_cache.routes, h_route, &route_entry)) {
+        return -1;
+    }
+
+    // Routes are never removed while the router is running, so this is safe to read
+    route = ck_ht_entry_value(&route_entry);
+    stats->hits = ck_pr_load_64(&route->hits);
+    stats->misses = ck_pr_load_64(&route->misses);
+    stats->num_enqueued = ck_pr_load_64(&route->num_enqueued);
+    stats->num_dropped = ck_pr_load_64(&route->num_dropped);
+    stats->queue_high_watermark = ck_pr_load_64(&route->queue_high_watermark);
+    stats->num_suppressed = ck_pr_load_64(&route->num_suppressed);
+
+    return 0;
+}
+
+int
+jrtc_router_get_shard_stats(struct jrtc_router_ctx* router_ctx, uint32_t shard_id, struct jrtc_router_shard_stats* stats)
+{
+    jrtc_router_shard_t* shard;
+
+    if (!router_ctx || !stats || shard_id >= router_ctx->num_shards) {
+        return -1;
+    }
+
+    shard = &router_ctx->shards[shard_id];
+    stats->num_msgs = ck_pr_load_64(&shard->stats.num_msgs);
+    stats->num_batches = ck_pr_load_64(&shard->stats.num_batches);
+    stats->num_dropped = ck_pr_load_64(&shard->stats.num_dropped);
+
+    return 0;
+}
+
+int
+jrtc_router_get_mem_stats(struct jrtc_router_ctx* router_ctx, struct jrtc_router_mem_stats* stats)
+{
+    if (!router_ctx || !stats) {
+        return -1;
+    }
+
+    return _jrtc_router_mem_read_stats(router_ctx->th_ctx.ipc_name, stats);
+}
+
+int
+jrtc_router_get_numa_info(struct jrtc_router_ctx* router_ctx, struct jrtc_router_numa_info* info)
+{
+    if (!router_ctx || !info) {
+        return -1;
+    }
+
+    info->num_nodes = _jrtc_router_numa_num_nodes();
+    info->ctx_node = _jrtc_router_numa_node_of_addr(router_ctx);
+    info->num_shards = router_ctx->num_shards;
+    for (uint32_t i = 0; i < JRTC_ROUTER_MAX_NUM_SHARDS; i++) {
+        info->shard_nodes[i] = i < router_ctx->num_shards ? _jrtc_router_numa_node_of_addr(router_ctx->shards[i].dapps) : -1;
+    }
+
+    return 0;
+}
+
+int
+jrtc_router_get_idle_stats(struct jrtc_router_ctx* router_ctx, struct jrtc_router_idle_stats* stats)
+{
+    struct jrtc_router_idle_stats* idle_stats;
+    clockid_t cid;
+    struct timespec ts;
+    uint64_t start_ns;
+
+    if (!router_ctx || !stats) {
+        return -1;
+    }
+
+    idle_stats = &router_ctx->th_ctx.idle_stats;
+    stats->num_polls = ck_pr_load_64(&idle_stats->num_polls);
+    stats->num_empty_polls = ck_pr_load_64(&idle_stats->num_empty_polls);
+    stats->num_parks = ck_pr_load_64(&idle_stats->num_parks);
+    stats->num_wakeups = ck_pr_load_64(&idle_stats->num_wakeups);
+    stats->num_park_timeouts = ck_pr_load_64(&idle_stats->num_park_timeouts);
+    stats->wake_latency_total_ns = ck_pr_load_64(&idle_stats->wake_latency_total_ns);
+    stats->wake_latency_max_ns = ck_pr_load_64(&idle_stats->wake_latency_max_ns);
+    stats->idle_ns = ck_pr_load_64(&idle_stats->idle_ns);
+
+    stats->cpu_ns = 0;
+    if (pthread_getcpuclockid(router_ctx->th_ctx.jrtc_router_thread_id, &cid) == 0 &&
+        clock_gettime(cid, &ts) == 0) {
+        stats->cpu_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    start_ns = ck_pr_load_64(&router_ctx->th_ctx.start_ns);
+    stats->wall_ns = start_ns ? _jrtc_router_now_ns() - start_ns : 0;
+
+    return 0;
+}
+
+static int
+_jrtc_router_thread_set_scheduler(pthread_t thread_id, struct jrtc_router_sched_config* sched_config)
+{
+    int res;
+
+    if (!sched_config)
+        return -1;
+
+    switch (sched_config->sched_policy) {
+    case JRTC_ROUTER_NORMAL:
+        jrtc_logger(JRTC_INFO, "Using normal scheduling policy\n");
+        res = 0;
+        break;
+
+    case JRTC_ROUTER_FIFO: {
+        int policy = SCHED_FIFO;
+        struct sched_param param;
+        param.sched_priority = sched_config->sched_priority;
+        jrtc_logger(
+            JRTC_INFO, "Setting router scheduling policy to SCHED_FIFO, with priority %d\n", param.sched_priority);
+        res = pthread_setschedparam(thread_id, policy, &param);
+        break;
+    }
+
+    case JRTC_ROUTER_DEADLINE: {
+        struct sched_attr attr;
+        attr.size = sizeof(attr);
+        attr.sched_flags = 0;
+        attr.sched_nice = 0;
+        attr.sched_priority = 0;
+        attr.sched_policy = SCHED_DEADLINE;
+        attr.sched_runtime = sched_config->sched_runtime;
+        attr.sched_period = sched_config->sched_period;
+        attr.sched_deadline = sched_config->sched_deadline;
+        jrtc_logger(
+            JRTC_INFO,
+            "Setting router scheduling policy to SCHED_DEADLINE, with "
+            "runtime %lld, period %lld and deadline %lld\n",
+            attr.sched_runtime,
+            attr.sched_period,
+            attr.sched_deadline);
+        res = sched_setattr(0, &attr, 0);
+        break;
+    }
+
+    default:
+        jrtc_logger(JRTC_ERROR, "Unknown router scheduling policy\n");
+        res = -2;
+        break;
+    }
+
+    if (res == 0) {
+        jrtc_logger(JRTC_INFO, "Scheduling policy applied successfully\n");
+    } else {
+        jrtc_logger(JRTC_ERROR, "Error setting the scheduling policy of the router\n");
+    }
+    return res;
+}
+
+int
+jrtc_router_set_scheduler(struct jrtc_router_ctx* router_ctx, struct jrtc_router_sched_config* sched_config)
+{
+    if (!router_ctx)
+        return -1;
+
+    return _jrtc_router_thread_set_scheduler(router_ctx->th_ctx.jrtc_router_thread_id, sched_config);
+}
+
+static void
+_jrtc_router_mask_to_cpus(jrtc_router_afinity_mask_t cpu_mask, cpu_set_t* cpus)
+{
+    CPU_ZERO(cpus);
+
+    // Convert the uint64_t mask to a cpu_set_t
     for (int i = 0; i < sizeof(jrtc_router_afinity_mask_t) * 8; i++) {
         if (cpu_mask & ((jrtc_router_afinity_mask_t)1 << i)) {
-            CPU_SET(i, &cpuset);
+            CPU_SET(i, cpus);
+        }
+    }
+}
+
+// The CPUs of a thread config: its cpus if set, else its affinity mask
+static void
+_jrtc_router_thread_cpus(const struct jrtc_router_thread_config* thread_config, cpu_set_t* cpus)
+{
+    if (CPU_COUNT(&thread_config->cpus) > 0) {
+        *cpus = thread_config->cpus;
+    } else {
+        _jrtc_router_mask_to_cpus(thread_config->affinity_mask, cpus);
+    }
+}
+
+static int
+_jrtc_router_thread_set_cpu_affinity(pthread_t thread_id, const cpu_set_t* cpus)
+{
+    if (pthread_setaffinity_np(thread_id, sizeof(cpu_set_t), cpus) != 0) {
+        jrtc_logger(JRTC_ERROR, "Error setting affinity of router thread\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+_jrtc_router_thread_set_numa_affinity(pthread_t thread_id, int numa_node)
+{
+    cpu_set_t cpuset;
+
+    if (_jrtc_router_numa_node_cpus(numa_node, &cpuset) < 0) {
+        jrtc_logger(JRTC_ERROR, "Could not read the CPUs of NUMA node %d\n", numa_node);
+        return -1;
+    }
+
+    if (pthread_setaffinity_np(thread_id, sizeof(cpu_set_t), &cpuset) != 0) {
+        jrtc_logger(JRTC_ERROR, "Error setting affinity of router thread to NUMA node %d\n", numa_node);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+jrtc_router_set_cpu_affinity(struct jrtc_router_ctx* router_ctx, jrtc_router_afinity_mask_t cpu_mask)
+{
+    cpu_set_t cpus;
+
+    if (!router_ctx)
+        return -1;
+
+    _jrtc_router_mask_to_cpus(cpu_mask, &cpus);
+    return _jrtc_router_thread_set_cpu_affinity(router_ctx->th_ctx.jrtc_router_thread_id, &cpus);
+}
+
+int
+jrtc_router_parse_cpuset(const char* cpuset, cpu_set_t* cpus)
+{
+    const char* pos;
+    char* end;
+    unsigned long first, last;
+
+    CPU_ZERO(cpus);
+    if (!cpuset) {
+        return -1;
+    }
+
+    // Comma-separated CPUs and ranges of CPUs
+    pos = cpuset;
+    while (*pos != '\0') {
+        if (*pos < '0' || *pos > '9') {
+            return -1;
+        }
+        first = strtoul(pos, &end, 10);
+        last = first;
+        if (*end == '-') {
+            pos = end + 1;
+            if (*pos < '0' || *pos > '9') {
+                return -1;
+            }
+            last = strtoul(pos, &end, 10);
+        }
+        if (last < first || last >= CPU_SETSIZE) {
+            return -1;
+        }
+        for (unsigned long cpu = first; cpu <= last; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+
+        pos = end;
+        if (*pos == ',') {
+            pos++;
+        } else if (*pos != '\0') {
+            return -1;
+        }
+    }
+
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+///////////////////// Internal functionality of the router //////////////////
+
+dapp_id_t
+_jrtc_router_reserve_new_app(jrtc_router_ctx_t ctx)
+{
+
+    ck_bitmap_iterator_t iter;
+    int i;
+
+    ck_bitmap_iterator_init(&iter, ctx->app_metadata.app_bitmap);
+
+    for (i = 0; i < ck_bitmap_bits(ctx->app_metadata.app_bitmap); i++) {
+        if (!ck_bitmap_bts(ctx->app_metadata.app_bitmap, i)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void
+_jrtc_router_release_app(jrtc_router_ctx_t ctx, dapp_id_t app_id)
+{
+    ck_bitmap_reset(ctx->app_metadata.app_bitmap, app_id);
+}
+
+void
+_jrtc_router_in_channel_set_ready(jrtc_router_ctx_t router_ctx, jrtc_router_stream_id_t* stream_id)
+{
+    struct dapp_channel_ctx* dapp_channel;
+    ck_ht_hash_t h_chan;
+    ck_ht_entry_t channel_entry;
+
+    ck_ht_hash(&h_chan, &router_ctx->in_channel_registry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&channel_entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    // The channel cannot be destroyed while the lock is held
+    ck_rwlock_read_lock(&router_ctx->in_channel_lock);
+    if (ck_ht_get_spmc(&router_ctx->in_channel_registry, h_chan, &channel_entry)) {
+        dapp_channel = ck_ht_entry_value(&channel_entry);
+        // The message must be visible before the ready bit
+        ck_pr_fence_store();
+        ck_pr_or_64(&dapp_channel->app_ctx->in_ready[dapp_channel->slot / 64], 1ULL << (dapp_channel->slot % 64));
+        _jrtc_router_app_notify(dapp_channel->app_ctx);
+    }
+    ck_rwlock_read_unlock(&router_ctx->in_channel_lock);
+}
+
+// Adds an input channel to a free slot of its app and to the registry of the router
+static int
+_jrtc_router_in_channel_register(jrtc_router_ctx_t router_ctx, struct dapp_channel_ctx* dapp_channel)
+{
+    dapp_router_ctx_t app_ctx = dapp_channel->app_ctx;
+    ck_ht_hash_t h_chan;
+    ck_ht_entry_t channel_entry;
+    uint32_t slot;
+    bool added;
+
+    for (slot = 0; slot < JRTC_ROUTER_MAX_APP_IN_CHANNELS && app_ctx->in_channels[slot]; slot++) {
+    }
+    if (slot == JRTC_ROUTER_MAX_APP_IN_CHANNELS) {
+        jrtc_logger(
+            JRTC_ERROR,
+            "Application %d has reached the max of %d input channels\n",
+            app_ctx->app_id,
+            JRTC_ROUTER_MAX_APP_IN_CHANNELS);
+        return -1;
+    }
+
+    dapp_channel->slot = slot;
+
+    // The key is stored by reference, so it must point into the channel
+    ck_ht_hash(
+        &h_chan, &router_ctx->in_channel_registry, &dapp_channel->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_set(&channel_entry, h_chan, &dapp_channel->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, dapp_channel);
+
+    ck_rwlock_write_lock(&router_ctx->in_channel_lock);
+    added = ck_ht_set_spmc(&router_ctx->in_channel_registry, h_chan, &channel_entry);
+    ck_rwlock_write_unlock(&router_ctx->in_channel_lock);
+
+    if (!added) {
+        return -1;
+    }
+
+    app_ctx->in_channels[slot] = dapp_channel;
+    app_ctx->in_slots[slot / 64] |= 1ULL << (slot % 64);
+    _jrtc_router_multicast_learn(&router_ctx->multicast, &dapp_channel->stream_id);
+
+    // Messages may have been sent before the channel was registered
+    ck_pr_or_64(&app_ctx->in_ready[slot / 64], 1ULL << (slot % 64));
+
+    return 0;
+}
+
+static void
+_jrtc_router_in_channel_unregister(jrtc_router_ctx_t router_ctx, struct dapp_channel_ctx* dapp_channel)
+{
+    dapp_router_ctx_t app_ctx = dapp_channel->app_ctx;
+    ck_ht_hash_t h_chan;
+    ck_ht_entry_t channel_entry;
+
+    if (app_ctx->in_channels[dapp_channel->slot] != dapp_channel) {
+        return;
+    }
+
+    ck_ht_hash(
+        &h_chan, &router_ctx->in_channel_registry, &dapp_channel->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&channel_entry, &dapp_channel->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    ck_rwlock_write_lock(&router_ctx->in_channel_lock);
+    ck_ht_remove_spmc(&router_ctx->in_channel_registry, h_chan, &channel_entry);
+    ck_rwlock_write_unlock(&router_ctx->in_channel_lock);
+
+    app_ctx->in_channels[dapp_channel->slot] = NULL;
+    app_ctx->in_slots[dapp_channel->slot / 64] &= ~(1ULL << (dapp_channel->slot % 64));
+}
+
+//////////////////////////// APP API CALLS ////////////////////////////////////
+
+dapp_router_ctx_t
+jrtc_router_register_app(size_t app_queue_size)
+{
+    jrtc_router_app_config_t app_config = {
+        .app_queue_size = app_queue_size,
+        .overflow_policy = JRTC_ROUTER_OVERFLOW_DROP_NEWEST,
+        .block_timeout_us = 0,
+    };
+
+    return jrtc_router_register_app_ex(&app_config);
+}
+
+dapp_router_ctx_t
+jrtc_router_register_app_ex(const jrtc_router_app_config_t* app_config)
+{
+
+    jrtc_router_ctx_t router_ctx;
+    dapp_router_ctx_t dapp;
+    dapp_id_t app_id;
+    size_t app_queue_size;
+    uint32_t ring_size;
+    int numa_node;
+
+    unsigned int mode = CK_HT_MODE_BYTESTRING;
+
+    router_ctx = jrtc_router_get_ctx();
+
+    if (!app_config) {
+        return NULL;
+    }
+
+    app_queue_size = app_config->app_queue_size;
+
+    if (app_config->overflow_policy > JRTC_ROUTER_OVERFLOW_BLOCK) {
+        jrtc_logger(JRTC_ERROR, "Invalid overflow policy %d\n", app_config->overflow_policy);
+        return NULL;
+    }
+
+    if (app_queue_size > router_ctx->max_app_queue_size) {
+        jrtc_logger(
+            JRTC_ERROR,
+            "Cannot create queue of size %ld. The max queue size is %u\n",
+            app_queue_size,
+            router_ctx->max_app_queue_size);
+        return NULL;
+    }
+
+    // First we check if there is any space for the new app
+    app_id = _jrtc_router_reserve_new_app(router_ctx);
+
+    if (app_id < 0) {
+        jrtc_logger(JRTC_ERROR, "Could not reserve an app id\n");
+        return NULL;
+    }
+
+    // The app dequeues from its own thread, so its context and queue go on the node of that thread
+    if (app_config->has_numa_node) {
+        numa_node = app_config->numa_node;
+    } else {
+        numa_node = _jrtc_router_numa_node_of_thread(pthread_self());
+    }
+
+    dapp = _jrtc_router_mem_calloc(sizeof(struct dapp_router_ctx), numa_node);
+
+    if (!dapp) {
+        goto error;
+    }
+
+    dapp->app_id = app_id;
+    dapp->numa_node = numa_node;
+    dapp->overflow_policy = app_config->overflow_policy;
+    dapp->block_timeout_us =
+        app_config->block_timeout_us ? app_config->block_timeout_us : JRTC_ROUTER_DEFAULT_BLOCK_TIMEOUT_US;
+    if (dapp->block_timeout_us > JRTC_ROUTER_MAX_BLOCK_TIMEOUT_US) {
+        jrtc_logger(
+            JRTC_WARN,
+            "Block timeout of %u us of app %d is too long, using %d us instead\n",
+            dapp->block_timeout_us,
+            app_id,
+            JRTC_ROUTER_MAX_BLOCK_TIMEOUT_US);
+        dapp->block_timeout_us = JRTC_ROUTER_MAX_BLOCK_TIMEOUT_US;
+    }
+
+    dapp->stats_slot = _jrtc_router_stats_get_app(&router_ctx->stats, app_id);
+    if (!dapp->stats_slot) {
+        dapp->stats_slot = &dapp->local_stats_slot;
+    }
+    // The seq counters must stay even while the slot is reset
+    memset(dapp->stats_slot, 0, sizeof(struct jrtc_router_app_stats_slot));
+    dapp->stats_slot->app_id = app_id;
+
+    ring_size = round_up_pow_of_two(app_queue_size + 1);
+
+    dapp->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (dapp->event_fd < 0) {
+        jrtc_logger(JRTC_ERROR, "Could not create the eventfd of app %d\n", app_id);
+        goto dapp_error;
+    }
+
+    dapp->ringbuffer = _jrtc_router_mem_calloc(ring_size * sizeof(jrtc_router_data_entry_t), numa_node);
+
+    if (!dapp->ringbuffer) {
+        goto dapp_event_fd_error;
+    }
+
+    if (!ck_ht_init(
+            &dapp->app_out_channel_list, mode, ht_hash_wrapper, &ht_allocator, JRTC_ROUTER_NUM_APP_CHANNELS, 6602834)) {
+
+        goto dapp_ring_error;
+    }
+
+    if (!ck_ht_init(
+            &dapp->app_in_channel_list, mode, ht_hash_wrapper, &ht_allocator, JRTC_ROUTER_NUM_APP_CHANNELS, 6602834)) {
+
+        ck_ht_destroy(&dapp->app_out_channel_list);
+        goto dapp_ring_error;
+    }
+
+    // Initialize the queue of the app
+    ck_ring_init(&dapp->ring, ring_size);
+
+    // Store the app in the registry of the router
+    router_ctx->app_metadata.ctx[app_id] = dapp;
+    ck_pr_store_32(&dapp->stats_slot->in_use, 1);
+
+    jbpf_io_register_thread();
+
+    jrtc_logger(
+        JRTC_INFO,
+        "Registered app with id %d, overflow policy %d and NUMA node %d\n",
+        dapp->app_id,
+        dapp->overflow_policy,
+        dapp->numa_node);
+
+    return dapp;
+
+dapp_ring_error:
+    _jrtc_router_mem_free(dapp->ringbuffer);
+dapp_event_fd_error:
+    close(dapp->event_fd);
+dapp_error:
+    _jrtc_router_mem_free(dapp);
+error:
+    _jrtc_router_release_app(router_ctx, app_id);
+    return NULL;
+}
+
+void
+jrtc_router_deregister_app(dapp_router_ctx_t app_ctx)
+{
+
+    dapp_id_t app_id;
+    jrtc_router_ctx_t router_ctx;
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+
+    if (!app_ctx) {
+        return;
+    }
+
+    router_ctx = jrtc_router_get_ctx();
+    app_id = app_ctx->app_id;
+
+    // Drop the subscriptions of the app, so that a new app with the same id does not inherit them,
+    // and wait until no shard can still be forwarding to the app
+    _jrtc_router_req_table_remove_app(&router_ctx->req_table, app_id);
+    ck_pr_store_ptr(&router_ctx->app_metadata.ctx[app_id], NULL);
+    ck_epoch_synchronize(&router_ctx->req_table.app_epoch_record[app_id]);
+    _jrtc_router_latest_destroy(app_ctx);
+    _jrtc_router_limit_destroy(app_ctx);
+
+    // Destroy all channels created for this app
+    while (ck_ht_next(&app_ctx->app_out_channel_list, &iterator, &cursor) == true) {
+        struct dapp_channel_ctx* dapp_channel = ck_ht_entry_value(cursor);
+        jbpf_io_destroy_channel(router_ctx->io_ctx, dapp_channel->io_channel);
+        jbpf_free(dapp_channel);
+    }
+
+    ck_ht_destroy(&app_ctx->app_out_channel_list);
+
+    ck_ht_iterator_init(&iterator);
+    while (ck_ht_next(&app_ctx->app_in_channel_list, &iterator, &cursor) == true) {
+        struct dapp_channel_ctx* dapp_channel = ck_ht_entry_value(cursor);
+        _jrtc_router_in_channel_unregister(router_ctx, dapp_channel);
+        jbpf_io_destroy_channel(router_ctx->io_ctx, dapp_channel->io_channel);
+        jbpf_free(dapp_channel);
+    }
+
+    ck_ht_destroy(&app_ctx->app_in_channel_list);
+
+    jrtc_logger(
+        JRTC_INFO,
+        "App %d queue stats: enqueued %lu, dropped %lu, overwritten %lu, high watermark %lu, filtered out %lu, "
+        "sampled out %lu, rate limited %lu\n",
+        app_id,
+        ck_pr_load_64(&app_ctx->stats_slot->num_enqueued),
+        ck_pr_load_64(&app_ctx->stats_slot->num_dropped),
+        ck_pr_load_64(&app_ctx->stats_slot->num_overwritten),
+        ck_pr_load_64(&app_ctx->stats_slot->high_watermark),
+        ck_pr_load_64(&app_ctx->stats_slot->num_filtered_out),
+        ck_pr_load_64(&app_ctx->stats_slot->num_sampled_out),
+        ck_pr_load_64(&app_ctx->stats_slot->num_rate_limited));
+    ck_pr_store_32(&app_ctx->stats_slot->in_use, 0);
+
+    for (uint32_t i = 0; i < app_ctx->num_latency_hists; i++) {
+        struct jrtc_router_latency_stats latency_stats;
+
+        _jrtc_router_latency_hist_read(app_ctx->latency_hists[i], &latency_stats);
+        jrtc_print_stream_id("App latency stats of stream %s\n", &app_ctx->latency_hists[i]->stream_id);
+        jrtc_logger(
+            JRTC_INFO,
+            "App %d latency: count %lu, min %lu ns, mean %lu ns, p50 %lu ns, p99 %lu ns, p99.9 %lu ns, max %lu ns\n",
+            app_id,
+            latency_stats.count,
+            latency_stats.min_ns,
+            latency_stats.mean_ns,
+            latency_stats.p50_ns,
+            latency_stats.p99_ns,
+            latency_stats.p999_ns,
+            latency_stats.max_ns);
+        jbpf_free(app_ctx->latency_hists[i]);
+    }
+
+    close(app_ctx->event_fd);
+    _jrtc_router_mem_free(app_ctx->ringbuffer);
+    _jrtc_router_mem_free(app_ctx);
+
+    _jrtc_router_release_app(router_ctx, app_id);
+}
+
+int
+jrtc_router_get_app_stats(dapp_router_ctx_t app_ctx, struct jrtc_router_app_stats* stats)
+{
+    if (!app_ctx || !stats) {
+        return -1;
+    }
+
+    stats->num_enqueued = ck_pr_load_64(&app_ctx->stats_slot->num_enqueued);
+    stats->num_dropped = ck_pr_load_64(&app_ctx->stats_slot->num_dropped);
+    stats->num_overwritten = ck_pr_load_64(&app_ctx->stats_slot->num_overwritten);
+    stats->high_watermark = ck_pr_load_64(&app_ctx->stats_slot->high_watermark);
+    stats->num_sampled_out = ck_pr_load_64(&app_ctx->stats_slot->num_sampled_out);
+    stats->num_rate_limited = ck_pr_load_64(&app_ctx->stats_slot->num_rate_limited);
+    stats->num_filtered_out = ck_pr_load_64(&app_ctx->stats_slot->num_filtered_out);
+
+    return 0;
+}
+
+int
+jrtc_router_get_app_numa_info(dapp_router_ctx_t app_ctx, struct jrtc_router_app_numa_info* info)
+{
+    if (!app_ctx || !info) {
+        return -1;
+    }
+
+    info->numa_node = app_ctx->numa_node;
+    info->ctx_node = _jrtc_router_numa_node_of_addr(app_ctx);
+    info->queue_node = _jrtc_router_numa_node_of_addr(app_ctx->ringbuffer);
+
+    return 0;
+}
+
+int
+jrtc_router_get_latency_stats(
+    dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, struct jrtc_router_latency_stats* stats)
+{
+    uint32_t num_hists;
+
+    if (!app_ctx || !stats) {
+        return -1;
+    }
+
+    num_hists = ck_pr_load_32(&app_ctx->num_latency_hists);
+    ck_pr_fence_load();
+
+    for (uint32_t i = 0; i < num_hists; i++) {
+        if (memcmp(&app_ctx->latency_hists[i]->stream_id, &stream_id, sizeof(jrtc_router_stream_id_t)) == 0) {
+            _jrtc_router_latency_hist_read(app_ctx->latency_hists[i], stats);
+            return 0;
         }
     }
 
-    if (pthread_setaffinity_np(router_ctx->th_ctx.jrtc_router_thread_id, sizeof(cpu_set_t), &cpuset) != 0) {
-        jrtc_logger(JRTC_ERROR, "Error setting affinity of router thread\n");
+    return -1;
+}
+
+uint64_t
+jrtc_router_timestamp_now_ns(void)
+{
+    return _jrtc_router_timebase_now_ns(&jrtc_router_get_ctx()->timebase);
+}
+
+int
+jrtc_router_channel_register_req(
+    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* stream_path, const char* stream_name)
+{
+
+    jrtc_router_stream_id_t stream_id_req;
+    jrtc_router_generate_stream_id(&stream_id_req, fwd_dst, device_id, stream_path, stream_name);
+
+    // Streams requested by name can also be matched by the pattern requests
+    if (stream_path && stream_name) {
+        jrtc_router_stream_catalog_add(stream_path, stream_name);
+    }
+
+    return jrtc_router_channel_register_stream_id_req(app_ctx, stream_id_req);
+}
+
+int
+jrtc_router_channel_register_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id)
+{
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps) {
+        return -1;
+    }
+
+    return _jrtc_router_req_table_add(&jrtc_router_get_ctx()->req_table, app_ctx->app_id, &stream_id);
+}
+
+int
+jrtc_router_channel_register_stream_id_req_ex(
+    dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, jrtc_router_req_mode_e mode)
+{
+    jrtc_router_req_table_t* req_table;
+    int res;
+
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps ||
+        mode > JRTC_ROUTER_REQ_MODE_LATEST) {
+        return -1;
+    }
+
+    req_table = &jrtc_router_get_ctx()->req_table;
+
+    // The mode is set first, so that no message of the request is delivered in the wrong one
+    if (_jrtc_router_latest_req_update(req_table, app_ctx, &stream_id, mode == JRTC_ROUTER_REQ_MODE_LATEST) < 0) {
+        return -1;
+    }
+
+    res = _jrtc_router_req_table_add(req_table, app_ctx->app_id, &stream_id);
+    if (res < 0 && mode == JRTC_ROUTER_REQ_MODE_LATEST) {
+        _jrtc_router_latest_req_update(req_table, app_ctx, &stream_id, false);
+    }
+    return res;
+}
+
+void
+jrtc_router_channel_deregister_req(
+    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* stream_path, const char* stream_name)
+{
+
+    jrtc_router_stream_id_t stream_id_req;
+    jrtc_router_generate_stream_id(&stream_id_req, fwd_dst, device_id, stream_path, stream_name);
+    jrtc_router_channel_deregister_stream_id_req(app_ctx, stream_id_req);
+}
+
+void
+jrtc_router_channel_deregister_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id)
+{
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps) {
+        return;
+    }
+
+    _jrtc_router_req_table_remove(&jrtc_router_get_ctx()->req_table, app_ctx->app_id, &stream_id);
+    _jrtc_router_latest_req_update(&jrtc_router_get_ctx()->req_table, app_ctx, &stream_id, false);
+    _jrtc_router_limit_remove(&jrtc_router_get_ctx()->req_table, app_ctx, &stream_id);
+}
+
+int
+jrtc_router_channel_set_req_limit(
+    dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, const struct jrtc_router_req_limit* limit)
+{
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps) {
+        return -1;
+    }
+
+    return _jrtc_router_limit_update(&jrtc_router_get_ctx()->req_table, app_ctx, &stream_id, limit) < 0 ? -1 : 0;
+}
+
+int
+jrtc_router_channel_set_req_filter(
+    dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, const struct jrtc_router_req_filter* filter)
+{
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps) {
         return -1;
     }
 
-    return 0;
+    return _jrtc_router_filter_update(&jrtc_router_get_ctx()->req_table, app_ctx, &stream_id, filter) < 0 ? -1 : 0;
 }
 
-///////////////////// Internal functionality of the router //////////////////
-
-dapp_id_t
-_jrtc_router_reserve_new_app(jrtc_router_ctx_t ctx)
+int
+jrtc_router_channel_deregister_all_reqs(dapp_router_ctx_t app_ctx)
 {
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps) {
+        return -1;
+    }
 
-    ck_bitmap_iterator_t iter;
-    int i;
-
-    ck_bitmap_iterator_init(&iter, ctx->app_metadata.app_bitmap);
+    _jrtc_router_latest_req_clear(&jrtc_router_get_ctx()->req_table, app_ctx);
+    _jrtc_router_limit_clear(&jrtc_router_get_ctx()->req_table, app_ctx);
+    return _jrtc_router_req_table_remove_app(&jrtc_router_get_ctx()->req_table, app_ctx->app_id);
+}
 
-    for (i = 0; i < ck_bitmap_bits(ctx->app_metadata.app_bitmap); i++) {
-        if (!ck_bitmap_bts(ctx->app_metadata.app_bitmap, i)) {
-            return i;
-        }
+int
+jrtc_router_channel_register_pattern_req(
+    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* path_pattern, const char* name_pattern)
+{
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps || !path_pattern) {
+        return -1;
     }
 
-    return -1;
+    return _jrtc_router_path_index_add(
+        &jrtc_router_get_ctx()->req_table, app_ctx->app_id, fwd_dst, device_id, path_pattern, name_pattern);
 }
 
-void
-_jrtc_router_release_app(jrtc_router_ctx_t ctx, dapp_id_t app_id)
+int
+jrtc_router_channel_deregister_pattern_req(
+    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* path_pattern, const char* name_pattern)
 {
-    ck_bitmap_reset(ctx->app_metadata.app_bitmap, app_id);
-}
+    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= jrtc_router_get_ctx()->max_num_apps || !path_pattern) {
+        return -1;
+    }
 
-//////////////////////////// APP API CALLS ////////////////////////////////////
+    return _jrtc_router_path_index_remove(
+        &jrtc_router_get_ctx()->req_table, app_ctx->app_id, fwd_dst, device_id, path_pattern, name_pattern);
+}
 
-dapp_router_ctx_t
-jrtc_router_register_app(size_t app_queue_size)
+int
+jrtc_router_stream_catalog_add(const char* stream_path, const char* stream_name)
 {
+    return _jrtc_router_path_index_catalog_add(&jrtc_router_get_ctx()->req_table, stream_path, stream_name);
+}
 
-    jrtc_router_ctx_t router_ctx;
-    dapp_router_ctx_t dapp;
-    dapp_id_t app_id;
-
-    unsigned int mode = CK_HT_MODE_BYTESTRING;
+// Dequeues up to num_entries entries from the queue of an app straight into data_entries.
+// The queue has a single consumer, so all the available entries can be copied at once and
+// handed back to the producers with a single update of the consumer index. This follows the
+// single consumer dequeue of ck_ring.
+static int
+_jrtc_router_app_dequeue_bulk(struct dapp_router_ctx* dapp, jrtc_router_data_entry_t* data_entries, size_t num_entries)
+{
+    unsigned int consumer, producer, idx, num_avail, num_first;
 
-    router_ctx = jrtc_router_get_ctx();
+    consumer = dapp->ring.c_head;
+    producer = ck_pr_load_uint(&dapp->ring.p_tail);
 
-    if (app_queue_size > JRTC_ROUTER_MAX_APP_QUEUE_SIZE) {
-        jrtc_logger(
-            JRTC_ERROR,
-            "Cannot create queue of size %ld. The max queue size is %d\n",
-            app_queue_size,
-            JRTC_ROUTER_MAX_APP_QUEUE_SIZE);
-        return NULL;
+    num_avail = producer - consumer;
+    if (num_avail == 0) {
+        return 0;
     }
-
-    // First we check if there is any space for the new app
-    app_id = _jrtc_router_reserve_new_app(router_ctx);
-
-    if (app_id < 0) {
-        jrtc_logger(JRTC_ERROR, "Could not reserve an app id\n");
-        return NULL;
+    if (num_avail > num_entries) {
+        num_avail = num_entries;
     }
 
-    dapp = jbpf_calloc(1, sizeof(struct dapp_router_ctx));
+    // Make sure the entries are read after the producer index
+    ck_pr_fence_load();
 
-    if (!dapp) {
-        goto error;
+    idx = consumer & dapp->ring.mask;
+    num_first = dapp->ring.size - idx;
+    if (num_first > num_avail) {
+        num_first = num_avail;
     }
 
-    dapp->app_id = app_id;
+    memcpy(data_entries, &dapp->ringbuffer[idx], num_first * sizeof(jrtc_router_data_entry_t));
+    memcpy(&data_entries[num_first], dapp->ringbuffer, (num_avail - num_first) * sizeof(jrtc_router_data_entry_t));
 
-    dapp->ringbuffer = jbpf_calloc(app_queue_size + 1, sizeof(ck_ring_buffer_t));
+    // Make sure the copy is complete before the slots are handed back to the producers
+    ck_pr_fence_store();
+    ck_pr_store_uint(&dapp->ring.c_head, consumer + num_avail);
 
-    if (!dapp->ringbuffer) {
-        goto dapp_error;
-    }
+    return num_avail;
+}
 
-    dapp->data_entry_pool = jbpf_init_mempool(app_queue_size, sizeof(jrtc_router_data_entry_t), JBPF_MEMPOOL_MP);
+// Returns the latency histogram of a stream, creating it if the app has not received the stream before.
+// Only called by the app.
+static jrtc_router_latency_hist_t*
+_jrtc_router_app_latency_hist(struct dapp_router_ctx* dapp, jrtc_router_stream_id_t* sid)
+{
+    jrtc_router_latency_hist_t* hist;
 
-    if (!dapp->data_entry_pool) {
-        goto dapp_ring_error;
+    hist = dapp->last_latency_hist;
+    if (hist && memcmp(&hist->stream_id, sid, sizeof(jrtc_router_stream_id_t)) == 0) {
+        return hist;
     }
 
-    if (!ck_ht_init(
-            &dapp->app_out_channel_list, mode, ht_hash_wrapper, &ht_allocator, JRTC_ROUTER_NUM_APP_CHANNELS, 6602834)) {
-
-        goto dapp_destroy_mempool;
+    for (uint32_t i = 0; i < dapp->num_latency_hists; i++) {
+        if (memcmp(&dapp->latency_hists[i]->stream_id, sid, sizeof(jrtc_router_stream_id_t)) == 0) {
+            dapp->last_latency_hist = dapp->latency_hists[i];
+            return dapp->latency_hists[i];
+        }
     }
 
-    if (!ck_ht_init(
-            &dapp->app_in_channel_list, mode, ht_hash_wrapper, &ht_allocator, JRTC_ROUTER_NUM_APP_CHANNELS, 6602834)) {
-
-        ck_ht_destroy(&dapp->app_out_channel_list);
-        goto dapp_destroy_mempool;
+    if (dapp->num_latency_hists == JRTC_ROUTER_MAX_LATENCY_STREAMS) {
+        return NULL;
     }
 
-    // Initialize the queue of the app
-    ck_ring_init(&dapp->ring, round_up_pow_of_two(app_queue_size + 1));
-
-    // Store the app in the registry of the router
-    router_ctx->app_metadata.ctx[app_id] = dapp;
-
-    jbpf_io_register_thread();
+    hist = jbpf_calloc(1, sizeof(jrtc_router_latency_hist_t));
+    if (!hist) {
+        return NULL;
+    }
 
-    jrtc_logger(JRTC_INFO, "Registered app with id %d\n", dapp->app_id);
+    hist->stream_id = *sid;
+    hist->min_ns = UINT64_MAX;
 
-    return dapp;
+    // Readers may look up the histograms from other threads
+    dapp->latency_hists[dapp->num_latency_hists] = hist;
+    ck_pr_fence_store();
+    ck_pr_store_32(&dapp->num_latency_hists, dapp->num_latency_hists + 1);
 
-dapp_destroy_mempool:
-    jbpf_destroy_mempool(dapp->data_entry_pool);
-dapp_ring_error:
-    jbpf_free(dapp->ringbuffer);
-dapp_error:
-    jbpf_free(dapp);
-error:
-    _jrtc_router_release_app(router_ctx, app_id);
-    return NULL;
+    dapp->last_latency_hist = hist;
+    return hist;
 }
 
-void
-jrtc_router_deregister_app(dapp_router_ctx_t app_ctx)
+static inline void
+_jrtc_router_latency_hist_record(jrtc_router_latency_hist_t* hist, uint64_t delay_ns)
 {
+    unsigned int bucket = _jrtc_router_latency_bucket(delay_ns);
 
-    dapp_id_t app_id;
-    jrtc_router_ctx_t router_ctx;
-    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
-    ck_ht_entry_t* cursor;
-
-    if (!app_ctx) {
-        return;
+    ck_pr_store_64(&hist->buckets[bucket], hist->buckets[bucket] + 1);
+    ck_pr_store_64(&hist->sum_ns, hist->sum_ns + delay_ns);
+    if (delay_ns < hist->min_ns) {
+        ck_pr_store_64(&hist->min_ns, delay_ns);
     }
-
-    router_ctx = jrtc_router_get_ctx();
-    app_id = app_ctx->app_id;
-
-    // Destroy all channels created for this app
-    while (ck_ht_next(&app_ctx->app_out_channel_list, &iterator, &cursor) == true) {
-        struct dapp_channel_ctx* dapp_channel = ck_ht_entry_value(cursor);
-        jbpf_io_destroy_channel(router_ctx->io_ctx, dapp_channel->io_channel);
-        jbpf_free(dapp_channel);
+    if (delay_ns > hist->max_ns) {
+        ck_pr_store_64(&hist->max_ns, delay_ns);
     }
+}
 
-    ck_ht_destroy(&app_ctx->app_out_channel_list);
+// Publishes the counters of the entries received from the queue of an app. Only called by the app.
+static void
+_jrtc_router_app_rx_stats_update(struct dapp_router_ctx* dapp, jrtc_router_data_entry_t* data_entries, int num_entries)
+{
+    struct jrtc_router_app_stats_slot* slot;
+    jrtc_router_latency_hist_t* hist;
+    uint64_t now, delay_ns;
+
+    slot = dapp->stats_slot;
+    now = jrtc_router_timestamp_now_ns();
+
+    _jrtc_router_stats_write_begin(&slot->rx_seq);
+    slot->num_received += num_entries;
+    slot->last_receive_ns = now;
+    for (int i = 0; i < num_entries; i++) {
+        if (data_entries[i].ingress_ts_ns == 0) {
+            continue;
+        }
+        // The TSC of the router thread may be slightly ahead of the one of the app
+        delay_ns = now > data_entries[i].ingress_ts_ns ? now - data_entries[i].ingress_ts_ns : 0;
+        slot->delay_hist[_jrtc_router_stats_delay_bucket(delay_ns)]++;
 
-    ck_ht_iterator_init(&iterator);
-    while (ck_ht_next(&app_ctx->app_in_channel_list, &iterator, &cursor) == true) {
-        struct dapp_channel_ctx* dapp_channel = ck_ht_entry_value(cursor);
-        jbpf_io_destroy_channel(router_ctx->io_ctx, dapp_channel->io_channel);
-        jbpf_free(dapp_channel);
+        hist = _jrtc_router_app_latency_hist(dapp, &data_entries[i].stream_id);
+        if (hist) {
+            _jrtc_router_latency_hist_record(hist, delay_ns);
+        }
     }
-
-    ck_ht_destroy(&app_ctx->app_in_channel_list);
-
-    jbpf_free(app_ctx->ringbuffer);
-    jbpf_destroy_mempool(app_ctx->data_entry_pool);
-    jbpf_free(app_ctx);
-
-    router_ctx->app_metadata.ctx[app_id] = NULL;
-
-    _jrtc_router_release_app(router_ctx, app_id);
+    _jrtc_router_stats_write_end(&slot->rx_seq);
 }
 
-int
-jrtc_router_channel_register_req(
-    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* stream_path, const char* stream_name)
+// Finds the first ready slot at or after slot from, wrapping around
+static inline bool
+_jrtc_router_in_ready_next(const uint64_t* pending, unsigned int from, unsigned int* slot)
 {
+    unsigned int word = from / 64;
+    uint64_t bits = pending[word] & (~0ULL << (from % 64));
 
-    jrtc_router_stream_id_t stream_id_req;
-    jrtc_router_generate_stream_id(&stream_id_req, fwd_dst, device_id, stream_path, stream_name);
-    return jrtc_router_channel_register_stream_id_req(app_ctx, stream_id_req);
+    for (int i = 0; i <= JRTC_ROUTER_APP_IN_READY_WORDS; i++) {
+        if (bits) {
+            *slot = word * 64 + __builtin_ctzll(bits);
+            return true;
+        }
+        word = (word + 1) % JRTC_ROUTER_APP_IN_READY_WORDS;
+        bits = pending[word];
+    }
+
+    return false;
 }
 
-int
-jrtc_router_channel_register_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id)
+// Receives from the ready input channels of an app, in round-robin order and at most
+// JRTC_ROUTER_IN_CHANNEL_BUDGET messages from each channel per pass, so that a busy channel cannot starve the others
+static int
+_jrtc_router_receive_in_channels(
+    dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, int entries_added, size_t num_entries)
 {
-    jrtc_router_ctx_t router_ctx;
-    ck_ht_hash_t h_req;
-    ck_ht_entry_t req_table_entry, req_entry;
-    int app_id;
-    unsigned int bytes;
-    jrtc_router_req_entry_t* entry;
-    int res = 1;
-
-    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= JRTC_ROUTER_MAX_NUM_APPS) {
-        return -1;
+    jbpf_channel_buf_ptr data_ptrs[JRTC_ROUTER_IN_CHANNEL_BUDGET];
+    uint64_t pending[JRTC_ROUTER_APP_IN_READY_WORDS];
+    struct dapp_channel_ctx* dapp_channel;
+    unsigned int slot;
+    uint64_t bit;
+    bool sweep;
+    int nreqs, in_entries;
+
+    // Take the ready bits, the producers set them again for new messages
+    sweep = (app_ctx->num_receive_calls++ % JRTC_ROUTER_IN_CHANNEL_SWEEP_PERIOD) == 0;
+    for (int i = 0; i < JRTC_ROUTER_APP_IN_READY_WORDS; i++) {
+        pending[i] = ck_pr_load_64(&app_ctx->in_ready[i]) ? ck_pr_fas_64(&app_ctx->in_ready[i], 0) : 0;
+        if (sweep) {
+            pending[i] |= app_ctx->in_slots[i];
+        }
     }
 
-    app_id = app_ctx->app_id;
+    while (entries_added < num_entries && _jrtc_router_in_ready_next(pending, app_ctx->in_next_slot, &slot)) {
+        bit = 1ULL << (slot % 64);
+        pending[slot / 64] &= ~bit;
+        app_ctx->in_next_slot = (slot + 1) % JRTC_ROUTER_MAX_APP_IN_CHANNELS;
 
-    router_ctx = jrtc_router_get_ctx();
+        dapp_channel = app_ctx->in_channels[slot];
+        if (!dapp_channel) {
+            continue;
+        }
 
-    ck_spinlock_lock(&router_ctx->req_table.lock);
-    // For each table, check if the corresponding key exists. If it does, just get
-    // the value (bitmap) and add one more bit. If it doesn't, then create a new
-    // bitmap with the value. We use a spinlock for the updates, so it should be
-    // safe to do so.
-    ck_ht_hash(&h_req, &router_ctx->req_table.reqs, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
-    ck_ht_entry_key_set(&req_table_entry, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
-
-    if (ck_ht_get_spmc(&router_ctx->req_table.reqs, h_req, &req_table_entry) == false) {
-        // Add new entry
-        entry = jbpf_malloc(sizeof(jrtc_router_req_entry_t));
-        if (!entry) {
-            res = -1;
-            goto out;
+        nreqs = num_entries - entries_added;
+        if (nreqs > JRTC_ROUTER_IN_CHANNEL_BUDGET) {
+            nreqs = JRTC_ROUTER_IN_CHANNEL_BUDGET;
         }
 
-        entry->stream_id = stream_id;
+        in_entries = jbpf_io_channel_recv_data(dapp_channel->io_channel, data_ptrs, nreqs);
 
-        bytes = ck_bitmap_size(JRTC_ROUTER_MAX_NUM_APPS);
+        for (int entries_idx = 0; entries_idx < in_entries; entries_idx++) {
+            data_entries[entries_added].data = data_ptrs[entries_idx];
+            data_entries[entries_added].stream_id = dapp_channel->stream_id;
+            data_entries[entries_added].ingress_ts_ns = 0;
+            entries_added++;
+        }
 
-        entry->bitmap = jbpf_malloc(bytes);
+        // The channel may hold more messages, so it is visited again on the next pass
+        if (in_entries == nreqs) {
+            ck_pr_or_64(&app_ctx->in_ready[slot / 64], bit);
+        }
+    }
 
-        if (!entry->bitmap) {
-            res = -1;
-            jbpf_free(entry);
-            goto out;
+    // Keep the ready channels that were not visited for the next call
+    for (int i = 0; i < JRTC_ROUTER_APP_IN_READY_WORDS; i++) {
+        if (pending[i]) {
+            ck_pr_or_64(&app_ctx->in_ready[i], pending[i]);
         }
+    }
 
-        ck_bitmap_init(entry->bitmap, JRTC_ROUTER_MAX_NUM_APPS, false);
-        ck_bitmap_set(entry->bitmap, app_id);
+    return entries_added;
+}
 
-        ck_ht_entry_set(&req_entry, h_req, &entry->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, entry);
-        if (!ck_ht_set_spmc(&router_ctx->req_table.reqs, h_req, &req_entry)) {
-            res = -1;
-        } else {
-            jrtc_print_stream_id("Added stream id %s\n", &entry->stream_id);
-        }
+int
+jrtc_router_receive(dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, size_t num_entries)
+{
 
+    int entries_added = 0;
+
+    if (app_ctx->overflow_policy == JRTC_ROUTER_OVERFLOW_DROP_OLDEST) {
+        // The router may also dequeue from the queue, to drop the oldest entries
+        while (entries_added < num_entries &&
+               CK_RING_DEQUEUE_MPMC(
+                   jrtc_router_data_entry, &app_ctx->ring, app_ctx->ringbuffer, &data_entries[entries_added])) {
+            entries_added++;
+        }
     } else {
-        jrtc_logger(JRTC_INFO, "Request already existed. Updating registered apps\n");
-        // Just update bitmap of apps, since the request already exists
-        entry = ck_ht_entry_value(&req_table_entry);
-        ck_bitmap_set(entry->bitmap, app_id);
+        entries_added = _jrtc_router_app_dequeue_bulk(app_ctx, data_entries, num_entries);
     }
 
-out:
-    ck_spinlock_unlock(&router_ctx->req_table.lock);
-    return res;
+    // Then the latest values of the streams with a latest-value request
+    if (entries_added < num_entries && app_ctx->latest_table) {
+        entries_added = _jrtc_router_latest_receive(app_ctx, data_entries, entries_added, num_entries);
+    }
+
+    if (entries_added > 0) {
+        _jrtc_router_app_rx_stats_update(app_ctx, data_entries, entries_added);
+    }
+
+    // Also check the input channels that are ready
+    if (entries_added < num_entries) {
+        entries_added = _jrtc_router_receive_in_channels(app_ctx, data_entries, entries_added, num_entries);
+    }
+
+    return entries_added;
 }
 
-void
-jrtc_router_channel_deregister_req(
-    dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* stream_path, const char* stream_name)
+int
+jrtc_router_get_fd(dapp_router_ctx_t app_ctx)
 {
+    if (!app_ctx) {
+        return -1;
+    }
 
-    jrtc_router_stream_id_t stream_id_req;
-    jrtc_router_generate_stream_id(&stream_id_req, fwd_dst, device_id, stream_path, stream_name);
-    jrtc_router_channel_deregister_stream_id_req(app_ctx, stream_id_req);
+    return app_ctx->event_fd;
 }
 
-void
-jrtc_router_channel_deregister_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id)
+int
+jrtc_router_arm_fd(dapp_router_ctx_t app_ctx)
 {
+    eventfd_t value;
+    bool has_data;
 
-    jrtc_router_ctx_t router_ctx;
-    ck_ht_hash_t h_req;
-    ck_ht_entry_t req_table_entry;
-    int app_id;
-    jrtc_router_req_entry_t* req_entry;
-
-    if (!app_ctx || app_ctx->app_id < 0 || app_ctx->app_id >= JRTC_ROUTER_MAX_NUM_APPS) {
-        return;
+    if (!app_ctx) {
+        return -1;
     }
 
-    app_id = app_ctx->app_id;
+    // Consume the previous wake up, the eventfd is non-blocking
+    eventfd_read(app_ctx->event_fd, &value);
 
-    router_ctx = jrtc_router_get_ctx();
+    ck_pr_store_32(&app_ctx->wait_armed, 1);
 
-    ck_spinlock_lock(&router_ctx->req_table.lock);
+    // Pairs with the fence in _jrtc_router_app_notify()
+    ck_pr_fence_memory();
 
-    ck_ht_hash(&h_req, &router_ctx->req_table.reqs, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
-    ck_ht_entry_key_set(&req_table_entry, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    has_data = ck_ring_size(&app_ctx->ring) > 0;
+    for (int i = 0; i < JRTC_ROUTER_APP_IN_READY_WORDS && !has_data; i++) {
+        has_data = ck_pr_load_64(&app_ctx->in_ready[i]) != 0;
+    }
+    if (!has_data) {
+        has_data = _jrtc_router_latest_pending(app_ctx);
+    }
 
-    if (ck_ht_get_spmc(&router_ctx->req_table.reqs, h_req, &req_table_entry) == false) {
-        goto out;
-    } else {
-        // Remove the app from the request and if the request has no registered app,
-        // delete it
-        req_entry = ck_ht_entry_value(&req_table_entry);
-        ck_bitmap_reset(req_entry->bitmap, app_id);
-        if (ck_bitmap_empty(req_entry->bitmap, JRTC_ROUTER_MAX_NUM_APPS)) {
-            ck_epoch_begin(&router_ctx->req_table.app_epoch_record[app_id], NULL);
-            ck_ht_remove_spmc(&router_ctx->req_table.reqs, h_req, &req_table_entry);
-            ck_epoch_end(&router_ctx->req_table.app_epoch_record[app_id], NULL);
-
-            ck_epoch_call(
-                &router_ctx->req_table.app_epoch_record[app_id], &req_entry->epoch_entry, _stream_id_req_destructor);
-            ck_epoch_barrier(&router_ctx->req_table.app_epoch_record[app_id]);
-        }
+    if (has_data) {
+        ck_pr_store_32(&app_ctx->wait_armed, 0);
+        return 1;
     }
 
-out:
-    ck_spinlock_unlock(&router_ctx->req_table.lock);
+    return 0;
 }
 
 int
-jrtc_router_receive(dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, size_t num_entries)
+jrtc_router_receive_timeout(
+    dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, size_t num_entries, uint64_t timeout_ns)
 {
+    struct pollfd pfd;
+    struct timespec ts;
+    uint64_t now, deadline;
+    int num_rcv, res;
 
-    int entries_added = 0;
-    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
-    ck_ht_entry_t* cursor;
-
-    jrtc_router_data_entry_t* de;
+    if (!app_ctx) {
+        return -1;
+    }
 
-    while (entries_added < num_entries && ck_ring_dequeue_spsc(&app_ctx->ring, app_ctx->ringbuffer, &de)) {
-        data_entries[entries_added] = *de;
-        entries_added++;
-        jbpf_mbuf_free_from_data_ptr(de, false);
+    num_rcv = jrtc_router_receive(app_ctx, data_entries, num_entries);
+    if (num_rcv != 0 || timeout_ns == 0) {
+        return num_rcv;
     }
 
-    // Also check input channels
-    while (entries_added < num_entries && ck_ht_next(&app_ctx->app_in_channel_list, &iterator, &cursor) == true) {
-        struct dapp_channel_ctx* dapp_channel = ck_ht_entry_value(cursor);
+    deadline = _jrtc_router_now_ns() + timeout_ns;
+    pfd.fd = app_ctx->event_fd;
+    pfd.events = POLLIN;
 
-        jbpf_channel_buf_ptr data_ptrs[JRTC_ROUTER_DATA_BATCH_SIZE];
+    while (true) {
+        res = jrtc_router_arm_fd(app_ctx);
+        now = _jrtc_router_now_ns();
 
-        int pending_reqs = num_entries - entries_added;
-        int nreqs = JRTC_ROUTER_DATA_BATCH_SIZE > pending_reqs ? pending_reqs : JRTC_ROUTER_DATA_BATCH_SIZE;
+        if (res == 0) {
+            if (now >= deadline) {
+                ck_pr_store_32(&app_ctx->wait_armed, 0);
+                return 0;
+            }
 
-        int in_entries = jbpf_io_channel_recv_data(dapp_channel->io_channel, data_ptrs, nreqs);
+            ts.tv_sec = (deadline - now) / 1000000000ULL;
+            ts.tv_nsec = (deadline - now) % 1000000000ULL;
+            ppoll(&pfd, 1, &ts, NULL);
 
-        for (int entries_idx = 0; entries_idx < in_entries; entries_idx++) {
-            data_entries[entries_added].data = data_ptrs[entries_idx];
-            data_entries[entries_added].stream_id = dapp_channel->stream_id;
-            entries_added++;
+            // Spares the producers the eventfd write, if the wait timed out
+            ck_pr_store_32(&app_ctx->wait_armed, 0);
+            now = _jrtc_router_now_ns();
         }
-    }
 
-    return entries_added;
+        num_rcv = jrtc_router_receive(app_ctx, data_entries, num_entries);
+        if (num_rcv != 0 || now >= deadline) {
+            return num_rcv;
+        }
+    }
 }
 
 int
 jrtc_router_channel_send_output(dapp_channel_ctx_t dapp_chan_ctx)
 {
 
+    int res;
+
     if (!dapp_chan_ctx) {
         return -1;
     }
 
-    return jbpf_io_channel_submit_buf(dapp_chan_ctx->io_channel);
+    res = jbpf_io_channel_submit_buf(dapp_chan_ctx->io_channel);
+    if (res >= 0) {
+        jrtc_router_doorbell_ring(jrtc_router_get_ctx()->th_ctx.doorbell);
+    }
+    return res;
 }
 
 int
 jrtc_router_channel_send_output_msg(dapp_channel_ctx_t dapp_chan_ctx, void* data, size_t data_len)
 {
+    int res;
+
     if (!dapp_chan_ctx) {
         return -1;
     }
     if (!data) {
         return -1;
     }
-    if (data_len == 0) {
+    if (data_len == 0 || data_len > dapp_chan_ctx->elem_size) {
         return -1;
     }
 
@@ -853,7 +2738,11 @@ jrtc_router_channel_send_output_msg(dapp_channel_ctx_t dapp_chan_ctx, void* data
         return -1;
     }
     memcpy(data_buf, data, data_len);
-    return jbpf_io_channel_submit_buf(dapp_chan_ctx->io_channel);
+    res = jbpf_io_channel_submit_buf(dapp_chan_ctx->io_channel);
+    if (res >= 0) {
+        jrtc_router_doorbell_ring(jrtc_router_get_ctx()->th_ctx.doorbell);
+    }
+    return res;
 }
 
 int
@@ -862,10 +2751,33 @@ jrtc_router_channel_send_input_msg(struct jrtc_router_stream_id stream_id, void*
 
     jrtc_router_ctx_t router_ctx;
     struct jbpf_io_stream_id* sid;
+    int res;
 
     router_ctx = jrtc_router_get_ctx();
     sid = (struct jbpf_io_stream_id*)&stream_id;
-    return jbpf_io_channel_send_msg(router_ctx->io_ctx, sid, data, data_len);
+    res = jbpf_io_channel_send_msg(router_ctx->io_ctx, sid, data, data_len);
+
+    // A spurious ready bit only costs an empty poll, so the channel is marked ready whatever the result
+    _jrtc_router_in_channel_set_ready(router_ctx, &stream_id);
+
+    // The channel exists, so it can also be reached by multicast
+    if (res == 0) {
+        _jrtc_router_multicast_learn(&router_ctx->multicast, &stream_id);
+    }
+    return res;
+}
+
+int
+jrtc_router_channel_multicast_input_msg(struct jrtc_router_stream_id stream_id, void* data, size_t data_len)
+{
+    jrtc_router_ctx_t router_ctx;
+
+    if (!data || data_len == 0) {
+        return -1;
+    }
+
+    router_ctx = jrtc_router_get_ctx();
+    return _jrtc_router_multicast_send(router_ctx, &stream_id, data, data_len);
 }
 
 void*
@@ -904,6 +2816,7 @@ jrtc_router_channel_create(
     jrtc_router_ctx_t router_ctx;
     ck_ht_hash_t h_req;
     ck_ht_entry_t channel_entry;
+    struct jrtc_router_stream_stats* stream_stats;
 
     if (!app_ctx) {
         jrtc_logger(JRTC_ERROR, "Application context is null.\n");
@@ -941,12 +2854,21 @@ jrtc_router_channel_create(
         router_ctx->io_ctx, direction, JBPF_IO_CHANNEL_QUEUE, num_elems, elem_size, *sid, descriptor, descriptor_size);
 
     channel->is_output = is_output;
+    channel->elem_size = elem_size;
 
     if (!channel->io_channel) {
         jrtc_logger(JRTC_ERROR, "Error creating IO channel for application %d\n", app_ctx->app_id);
         goto alloc_error;
     }
 
+    // The size is published before the first message, the forwarding learns it again from jbpf
+    if (is_output) {
+        stream_stats = _jrtc_router_stats_get_stream(&router_ctx->stats, &stream_id);
+        if (stream_stats) {
+            ck_pr_store_32(&stream_stats->elem_size, elem_size);
+        }
+    }
+
     if (is_output) {
         ck_ht_hash(&h_req, &app_ctx->app_out_channel_list, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
         ck_ht_entry_set(&channel_entry, h_req, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, channel);
@@ -961,8 +2883,14 @@ jrtc_router_channel_create(
         ck_ht_hash(&h_req, &app_ctx->app_in_channel_list, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
         ck_ht_entry_set(&channel_entry, h_req, &stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, channel);
 
+        if (_jrtc_router_in_channel_register(router_ctx, channel) < 0) {
+            jrtc_logger(JRTC_ERROR, "Error registering input channel of application %d\n", app_ctx->app_id);
+            goto channel_error;
+        }
+
         if (!ck_ht_set_spmc(&app_ctx->app_in_channel_list, h_req, &channel_entry)) {
             jrtc_logger(JRTC_ERROR, "Error adding channel to application %d\n", app_ctx->app_id);
+            _jrtc_router_in_channel_unregister(router_ctx, channel);
             goto channel_error;
         } else {
             jrtc_logger(JRTC_INFO, "Added channel to application %d\n", app_ctx->app_id);
@@ -1017,6 +2945,7 @@ jrtc_router_channel_destroy(dapp_channel_ctx_t dapp_chan_ctx)
         ck_ht_entry_key_set(&channel_entry, &dapp_chan_ctx->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
 
         if (ck_ht_remove_spmc(&dapp_chan_ctx->app_ctx->app_in_channel_list, h_req, &channel_entry)) {
+            _jrtc_router_in_channel_unregister(router_ctx, dapp_chan_ctx);
             jbpf_io_destroy_channel(router_ctx->io_ctx, dapp_chan_ctx->io_channel);
             jbpf_free(dapp_chan_ctx);
             jrtc_logger(JRTC_INFO, "Channel found and destroyed successfully\n");
@@ -1041,6 +2970,8 @@ jrtc_router_input_channel_exists(struct jrtc_router_stream_id stream_id)
     }
     struct jbpf_io_stream_id _stream_id = *(struct jbpf_io_stream_id*)&stream_id;
     if (jbpf_io_find_channel(router_ctx->io_ctx, _stream_id, false)) {
+        // Apps check for the input channels of the codelets they control, so they can also be multicast to
+        _jrtc_router_multicast_learn(&router_ctx->multicast, &stream_id);
         return 1;
     }
     return 0;
@@ -3,6 +3,7 @@
 #ifndef JRTC_ROUTER_H
 #define JRTC_ROUTER_H
 
+#include <sched.h>
 #include <stdbool.h>
 #include "jbpf_io_defs.h"
 
@@ -45,22 +46,134 @@ struct jrtc_router_sched_config
     uint64_t sched_period;
 };
 
+/**
+ * @brief The jrtc_router_idle_policy_e enum
+ * @ingroup router
+ * What the router thread does when there are no messages to forward
+ * JRTC_ROUTER_IDLE_SLEEP: Sleep for a fixed time between polls
+ * JRTC_ROUTER_IDLE_BUSY_POLL: Poll continuously
+ * JRTC_ROUTER_IDLE_PARK: Park until a producer rings the doorbell of the router
+ * JRTC_ROUTER_IDLE_HYBRID: Poll for a number of empty polls and then park
+ */
+typedef enum
+{
+    JRTC_ROUTER_IDLE_SLEEP = 0,
+    JRTC_ROUTER_IDLE_BUSY_POLL,
+    JRTC_ROUTER_IDLE_PARK,
+    JRTC_ROUTER_IDLE_HYBRID,
+} jrtc_router_idle_policy_e;
+
+/**
+ * @brief The jrtc_router_idle_config struct
+ * @ingroup router
+ * The idle configuration of the router thread
+ * idle_policy: The idle policy
+ * sleep_us: The sleep time between polls, for JRTC_ROUTER_IDLE_SLEEP
+ * spin_budget: The number of empty polls before parking, for JRTC_ROUTER_IDLE_HYBRID
+ * park_timeout_us: The max park time. Producers that do not ring the doorbell are picked up after this time.
+ */
+struct jrtc_router_idle_config
+{
+    jrtc_router_idle_policy_e idle_policy;
+    uint32_t sleep_us;
+    uint32_t spin_budget;
+    uint32_t park_timeout_us;
+};
+
 /**
  * @brief The jrtc_router_thread_config struct
  * @ingroup router
  * The thread configuration
  * has_affinity_mask: The affinity mask
  * affinity_mask: The affinity mask
+ * cpus: The CPUs of the thread, used instead of affinity_mask when not empty, for more than 64 CPUs
  * has_sched_config: The scheduling configuration
+ * idle_config: The idle configuration
  */
 struct jrtc_router_thread_config
 {
     bool has_affinity_mask;
     jrtc_router_afinity_mask_t affinity_mask;
+    cpu_set_t cpus;
     bool has_sched_config;
     struct jrtc_router_sched_config sched_config;
+    struct jrtc_router_idle_config idle_config;
 };
 
+/**
+ * @brief The max number of forwarding shards of the router
+ * @ingroup router
+ */
+#define JRTC_ROUTER_MAX_NUM_SHARDS (16)
+
+/**
+ * @brief The jrtc_router_shard_partition_e enum
+ * @ingroup router
+ * How the streams are partitioned across the forwarding shards.
+ * All the messages of a stream are always forwarded by the same shard.
+ * JRTC_ROUTER_SHARD_BY_STREAM: By the hash of the stream id
+ * JRTC_ROUTER_SHARD_BY_DEVICE_ID: By the device id of the stream
+ */
+typedef enum
+{
+    JRTC_ROUTER_SHARD_BY_STREAM = 0,
+    JRTC_ROUTER_SHARD_BY_DEVICE_ID,
+} jrtc_router_shard_partition_e;
+
+/**
+ * @brief The jrtc_router_hugepages_e enum
+ * @ingroup router
+ * The pages backing the queues of the apps and of the shards, the scratch state of the shards and the hash tables
+ * of the router. Only allocations of at least 256 kB use huge pages.
+ * JRTC_ROUTER_HUGEPAGES_NONE: Normal pages
+ * JRTC_ROUTER_HUGEPAGES_THP: Transparent huge pages, requested with madvise()
+ * JRTC_ROUTER_HUGEPAGES_2MB: 2 MB pages of the hugetlb pool, falling back to transparent huge pages
+ * JRTC_ROUTER_HUGEPAGES_1GB: 1 GB pages of the hugetlb pool for allocations above 512 MB, 2 MB pages otherwise
+ */
+typedef enum
+{
+    JRTC_ROUTER_HUGEPAGES_NONE = 0,
+    JRTC_ROUTER_HUGEPAGES_THP,
+    JRTC_ROUTER_HUGEPAGES_2MB,
+    JRTC_ROUTER_HUGEPAGES_1GB,
+} jrtc_router_hugepages_e;
+
+/**
+ * @brief The jrtc_router_timestamp_source_e enum
+ * @ingroup router
+ * The clock used for the ingress timestamps of the messages and for the latency stats of the apps
+ * JRTC_ROUTER_TIMESTAMP_NONE: No ingress timestamps are taken and no latency stats are kept
+ * JRTC_ROUTER_TIMESTAMP_MONOTONIC: CLOCK_MONOTONIC
+ * JRTC_ROUTER_TIMESTAMP_MONOTONIC_RAW: CLOCK_MONOTONIC_RAW, which is not slewed by NTP
+ * JRTC_ROUTER_TIMESTAMP_TSC: The TSC of the CPU, converted to CLOCK_MONOTONIC_RAW nanoseconds.
+ * Requires an invariant TSC and falls back to CLOCK_MONOTONIC_RAW on other CPUs.
+ */
+typedef enum
+{
+    JRTC_ROUTER_TIMESTAMP_NONE = 0,
+    JRTC_ROUTER_TIMESTAMP_MONOTONIC,
+    JRTC_ROUTER_TIMESTAMP_MONOTONIC_RAW,
+    JRTC_ROUTER_TIMESTAMP_TSC,
+} jrtc_router_timestamp_source_e;
+
+/**
+ * @brief The default capacities of the router
+ * @ingroup router
+ * JRTC_ROUTER_DEFAULT_MAX_NUM_APPS: The default max number of apps registered with the router
+ * JRTC_ROUTER_DEFAULT_MAX_APP_QUEUE_SIZE: The default max queue size of an app
+ * JRTC_ROUTER_DEFAULT_INIT_NUM_REQ_ENTRIES: The default initial size of the request table
+ */
+#define JRTC_ROUTER_DEFAULT_MAX_NUM_APPS (128)
+#define JRTC_ROUTER_DEFAULT_MAX_APP_QUEUE_SIZE (10000)
+#define JRTC_ROUTER_DEFAULT_INIT_NUM_REQ_ENTRIES (2048)
+
+/**
+ * @brief The upper limits of the configurable capacities of the router
+ * @ingroup router
+ */
+#define JRTC_ROUTER_MAX_NUM_APPS_LIMIT (4096)
+#define JRTC_ROUTER_MAX_APP_QUEUE_SIZE_LIMIT (1 << 24)
+
 /**
  * @brief The jrtc_router_io_config struct
  * @ingroup router
@@ -72,21 +185,178 @@ struct jrtc_router_io_config
     char ipc_name[32];
 };
 
+/**
+ * @brief The default size of the segments of a capture, in MB
+ * @ingroup router
+ */
+#define JRTC_ROUTER_DEFAULT_CAPTURE_SEGMENT_SIZE_MB (64)
+#define JRTC_ROUTER_CAPTURE_PATH_LEN (256)
+
+/**
+ * @brief The jrtc_router_capture_config struct
+ * @ingroup router
+ * Captures the messages received by the router, see jrtc_router_capture.h
+ * path: The path of the capture, to which the number of each segment is appended. Empty to not capture.
+ * segment_size_mb: The size of each segment file, in MB
+ * max_segments: The number of segments kept, the oldest one is deleted when a new one is started. 0 for no limit.
+ */
+struct jrtc_router_capture_config
+{
+    char path[JRTC_ROUTER_CAPTURE_PATH_LEN];
+    uint32_t segment_size_mb;
+    uint32_t max_segments;
+};
+
 /**
  * @brief The jrtc_router_config struct
  * @ingroup router
  * The router configuration
  * thread_config: The thread configuration
  * io_config: The io configuration
+ * num_shards: The number of forwarding shards. With one shard, the router thread forwards the messages itself.
+ * shard_partition: How the streams are partitioned across the shards
+ * numa_shards: Spread the shards without an affinity mask over the NUMA nodes, shard i runs on the CPUs of node
+ * i % number of nodes. The state of a shard is placed on the node it runs on, also without numa_shards.
+ * shard_thread_config: The thread configuration of each shard
+ * timestamp_source: The clock used for the ingress timestamps
+ * hugepages: The pages backing the state of the router that is touched on every message
+ * max_num_apps: The max number of apps registered with the router, up to JRTC_ROUTER_MAX_NUM_APPS_LIMIT
+ * max_app_queue_size: The max queue size of an app, up to JRTC_ROUTER_MAX_APP_QUEUE_SIZE_LIMIT
+ * init_num_req_entries: The initial size of the request table, which grows as needed
+ * capture: The capture of the messages received by the router
  */
 struct jrtc_router_config
 {
     struct jrtc_router_thread_config thread_config;
     struct jrtc_router_io_config io_config;
+    uint32_t num_shards;
+    jrtc_router_shard_partition_e shard_partition;
+    bool numa_shards;
+    struct jrtc_router_thread_config shard_thread_config[JRTC_ROUTER_MAX_NUM_SHARDS];
+    jrtc_router_timestamp_source_e timestamp_source;
+    jrtc_router_hugepages_e hugepages;
+    uint32_t max_num_apps;
+    uint32_t max_app_queue_size;
+    uint32_t init_num_req_entries;
+    struct jrtc_router_capture_config capture;
 };
 
 typedef struct jrtc_router_ctx* jrtc_router_ctx_t;
 
+struct jrtc_router_stream_id;
+
+/**
+ * @brief The jrtc_router_route_stats struct
+ * @ingroup router
+ * The route cache and delivery counters of a stream
+ * hits: Number of batches forwarded using the cached route
+ * misses: Number of batches that required a lookup of the request table
+ * num_enqueued: Number of messages placed in the queues of the subscribed apps (one per app)
+ * num_dropped: Number of messages that could not be placed in the queues of the subscribed apps (one per app)
+ * queue_high_watermark: The max occupancy of the queues of the subscribed apps after a delivery of the stream
+ * num_suppressed: Number of messages not delivered to the subscribed apps because of the limits or filters of their
+ * requests (one per app)
+ */
+struct jrtc_router_route_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t num_enqueued;
+    uint64_t num_dropped;
+    uint64_t queue_high_watermark;
+    uint64_t num_suppressed;
+};
+
+/**
+ * @brief The jrtc_router_numa_info struct
+ * @ingroup router
+ * The NUMA nodes the state of the router sits on. -1 means unknown.
+ * num_nodes: The number of NUMA nodes of the machine
+ * ctx_node: The node of the router context, which follows the affinity mask of the router thread
+ * num_shards: The number of forwarding shards
+ * shard_nodes: The node of the scratch state and the queue of each shard
+ */
+struct jrtc_router_numa_info
+{
+    int32_t num_nodes;
+    int32_t ctx_node;
+    uint32_t num_shards;
+    int32_t shard_nodes[JRTC_ROUTER_MAX_NUM_SHARDS];
+};
+
+/**
+ * @brief The jrtc_router_mem_stats struct
+ * @ingroup router
+ * The page sizes of the memory of the process, to tell how many TLB entries the router needs
+ * hugepages: The configured huge pages of the router
+ * mapped_4kb_kb: kB mapped with 4 kB pages, including transparent huge pages
+ * mapped_2mb_kb: kB mapped with 2 MB pages of the hugetlb pool
+ * mapped_1gb_kb: kB mapped with 1 GB pages of the hugetlb pool
+ * thp_kb: kB of anonymous memory backed by transparent huge pages
+ * ipc_kb: kB of the IPC segment shared with the agents
+ * ipc_page_size_kb: The page size of the IPC segment
+ * hugetlb_pages_total: The pages of the default size in the hugetlb pool
+ * hugetlb_pages_free: The free pages of the default size in the hugetlb pool
+ * hugetlb_page_size_kb: The default huge page size
+ */
+struct jrtc_router_mem_stats
+{
+    jrtc_router_hugepages_e hugepages;
+    uint64_t mapped_4kb_kb;
+    uint64_t mapped_2mb_kb;
+    uint64_t mapped_1gb_kb;
+    uint64_t thp_kb;
+    uint64_t ipc_kb;
+    uint64_t ipc_page_size_kb;
+    uint64_t hugetlb_pages_total;
+    uint64_t hugetlb_pages_free;
+    uint64_t hugetlb_page_size_kb;
+};
+
+/**
+ * @brief The jrtc_router_shard_stats struct
+ * @ingroup router
+ * The counters of a forwarding shard
+ * num_msgs: Number of messages forwarded by the shard
+ * num_batches: Number of batches forwarded by the shard
+ * num_dropped: Number of messages dropped because the queue of the shard was full
+ */
+struct jrtc_router_shard_stats
+{
+    uint64_t num_msgs;
+    uint64_t num_batches;
+    uint64_t num_dropped;
+};
+
+/**
+ * @brief The jrtc_router_idle_stats struct
+ * @ingroup router
+ * The counters of the idle policy of the router thread
+ * num_polls: Number of polls of the IO channels
+ * num_empty_polls: Number of polls that found no messages
+ * num_parks: Number of times the router parked
+ * num_wakeups: Number of parks that ended with a ring of the doorbell
+ * num_park_timeouts: Number of parks that ended with a timeout
+ * wake_latency_total_ns: Sum of the times from a ring of the doorbell to the router running again
+ * wake_latency_max_ns: Max time from a ring of the doorbell to the router running again
+ * idle_ns: Time spent sleeping or parked
+ * cpu_ns: CPU time used by the router thread
+ * wall_ns: Time since the router thread started
+ */
+struct jrtc_router_idle_stats
+{
+    uint64_t num_polls;
+    uint64_t num_empty_polls;
+    uint64_t num_parks;
+    uint64_t num_wakeups;
+    uint64_t num_park_timeouts;
+    uint64_t wake_latency_total_ns;
+    uint64_t wake_latency_max_ns;
+    uint64_t idle_ns;
+    uint64_t cpu_ns;
+    uint64_t wall_ns;
+};
+
 /**
  * @brief Initialize the router
  * @ingroup router
@@ -117,7 +387,21 @@ int
 jrtc_router_set_cpu_affinity(struct jrtc_router_ctx* router_ctx, jrtc_router_afinity_mask_t cpu_mask);
 
 /**
- * @brief Stop the router
+ * @brief Parse a list of CPUs in the cpuset list format, e.g. "0-3,8,64-127"
+ * @ingroup router
+ * @param cpuset The list of CPUs
+ * @param cpus Set to the CPUs of the list
+ * @return 0 on success, -1 if the list is empty or invalid, or has a CPU beyond CPU_SETSIZE
+ */
+int
+jrtc_router_parse_cpuset(const char* cpuset, cpu_set_t* cpus);
+
+/**
+ * @brief Stop the router. The router thread stops polling the IO channels, the shard threads forward the messages
+ * already dispatched to them and then stop, and the capture is closed. Everything that jrtc_router_init()
+ * allocated is freed and the IO is stopped, so another router can then be started with the same IPC name, also by
+ * calling jrtc_router_init() again. All the apps must have been deregistered.
+ * Does nothing if the router is not running.
  * @ingroup router
  * @return 0 on success, -1 on failure
  */
@@ -132,4 +416,58 @@ jrtc_router_stop();
 jrtc_router_ctx_t
 jrtc_router_get_ctx();
 
+/**
+ * @brief Get the route cache and delivery counters of a stream
+ * @ingroup router
+ * @param router_ctx The router context
+ * @param stream_id The concrete stream id of the stream
+ * @param stats The counters of the stream
+ * @return 0 on success, -1 if the router has not seen the stream
+ */
+int
+jrtc_router_get_route_stats(
+    struct jrtc_router_ctx* router_ctx, struct jrtc_router_stream_id* stream_id, struct jrtc_router_route_stats* stats);
+
+/**
+ * @brief Get the counters of a forwarding shard
+ * @ingroup router
+ * @param router_ctx The router context
+ * @param shard_id The id of the shard
+ * @param stats The counters
+ * @return 0 on success, -1 on failure
+ */
+int
+jrtc_router_get_shard_stats(
+    struct jrtc_router_ctx* router_ctx, uint32_t shard_id, struct jrtc_router_shard_stats* stats);
+
+/**
+ * @brief Get the page sizes of the memory of the process, read from /proc/self/smaps
+ * @ingroup router
+ * @param router_ctx The router context
+ * @param stats The page sizes
+ * @return 0 on success, -1 on failure
+ */
+int
+jrtc_router_get_mem_stats(struct jrtc_router_ctx* router_ctx, struct jrtc_router_mem_stats* stats);
+
+/**
+ * @brief Get the NUMA nodes the state of the router sits on
+ * @ingroup router
+ * @param router_ctx The router context
+ * @param info The nodes
+ * @return 0 on success, -1 on failure
+ */
+int
+jrtc_router_get_numa_info(struct jrtc_router_ctx* router_ctx, struct jrtc_router_numa_info* info);
+
+/**
+ * @brief Get the counters of the idle policy of the router thread
+ * @ingroup router
+ * @param router_ctx The router context
+ * @param stats The counters
+ * @return 0 on success, -1 on failure
+ */
+int
+jrtc_router_get_idle_stats(struct jrtc_router_ctx* router_ctx, struct jrtc_router_idle_stats* stats);
+
 #endif
\ No newline at end of file
@@ -24,14 +24,220 @@ extern "C"
      * @ingroup router
      * stream_id: The stream id
      * data: The data
+     * ingress_ts_ns: The time in ns at which the router received the data, in the clock returned by
+     * jrtc_router_timestamp_now_ns(). 0 for data read from the input channels of the app, or if the router
+     * was configured without ingress timestamps.
      */
     typedef struct jrtc_router_data_entry
     {
         struct jrtc_router_stream_id stream_id;
         void* data;
+        uint64_t ingress_ts_ns;
     } jrtc_router_data_entry_t;
 
-    /// @brief Registers an app to the jrtc router.
+    /**
+     * @brief The policy of the router when the queue of an app is full
+     * @ingroup router
+     * JRTC_ROUTER_OVERFLOW_DROP_NEWEST: The new messages are dropped (default)
+     * JRTC_ROUTER_OVERFLOW_DROP_OLDEST: The oldest queued messages are dropped to make space for the new ones
+     * JRTC_ROUTER_OVERFLOW_BLOCK: The router waits for the app to make space for up to block_timeout_us and then
+     * drops the new messages. The wait stalls the forwarding shard of the stream, which delays all the other apps
+     * served by the shard, once per batch of messages. It should only be used by critical apps that drain their
+     * queue fast, and the apps with deadlines should be placed on other shards.
+     */
+    typedef enum jrtc_router_overflow_policy
+    {
+        JRTC_ROUTER_OVERFLOW_DROP_NEWEST = 0,
+        JRTC_ROUTER_OVERFLOW_DROP_OLDEST,
+        JRTC_ROUTER_OVERFLOW_BLOCK,
+    } jrtc_router_overflow_policy_e;
+
+    /**
+     * @brief How the messages of the streams matched by a request are delivered to the app
+     * @ingroup router
+     * JRTC_ROUTER_REQ_MODE_QUEUE: Every message is placed in the queue of the app (default)
+     * JRTC_ROUTER_REQ_MODE_LATEST: Only the last message of each stream is kept for the app and replaces the one the
+     * app has not received yet. The app receives at most one message per stream per call, with the latest value,
+     * and its queue is not used for these streams. Meant for apps that only need the current state of the streams.
+     */
+    typedef enum jrtc_router_req_mode
+    {
+        JRTC_ROUTER_REQ_MODE_QUEUE = 0,
+        JRTC_ROUTER_REQ_MODE_LATEST,
+    } jrtc_router_req_mode_e;
+
+    /**
+     * @brief The jrtc_router_req_limit struct
+     * @ingroup router
+     * Limits the messages of each stream matched by a request that are delivered to an app. The router applies the
+     * limits before it queues the messages, so the app does not pay for the messages it does not want.
+     * sample_every: Deliver one in sample_every messages of each stream, starting with the first. 0 or 1 for all.
+     * max_rate: The max number of messages per second delivered for each stream, 0 for no limit. Applied to the
+     * messages that are sampled.
+     * burst: The max number of messages delivered at once above max_rate, e.g. after a quiet period.
+     * 0 means max_rate.
+     */
+    struct jrtc_router_req_limit
+    {
+        uint32_t sample_every;
+        uint32_t max_rate;
+        uint32_t burst;
+    };
+
+#define JRTC_ROUTER_FILTER_MAX_CONDS (8)
+#define JRTC_ROUTER_FILTER_MAX_OFFSET (65536)
+
+// Returned by jrtc_router_channel_multicast_input_msg() for the stream ids it cannot resolve to their channels
+#define JRTC_ROUTER_MULTICAST_UNRESOLVED (-2)
+
+    /**
+     * @brief The comparison of a condition of a jrtc_router_req_filter
+     * @ingroup router
+     * JRTC_ROUTER_FILTER_EQ, _NE, _LT, _LE, _GT, _GE: field == value, field != value, field < value, ...
+     * JRTC_ROUTER_FILTER_MASK_ANY: (field & value) != 0
+     * JRTC_ROUTER_FILTER_MASK_ALL: (field & value) == value
+     */
+    typedef enum jrtc_router_filter_op
+    {
+        JRTC_ROUTER_FILTER_EQ = 0,
+        JRTC_ROUTER_FILTER_NE,
+        JRTC_ROUTER_FILTER_LT,
+        JRTC_ROUTER_FILTER_LE,
+        JRTC_ROUTER_FILTER_GT,
+        JRTC_ROUTER_FILTER_GE,
+        JRTC_ROUTER_FILTER_MASK_ANY,
+        JRTC_ROUTER_FILTER_MASK_ALL,
+        JRTC_ROUTER_FILTER_NUM_OPS,
+    } jrtc_router_filter_op_e;
+
+    /**
+     * @brief The jrtc_router_filter_cond struct
+     * @ingroup router
+     * A condition on an integer field of the payload of the messages
+     * offset: The offset of the field in the payload, in bytes. The field needs no alignment.
+     * size: The size of the field in bytes, 1, 2, 4 or 8. The field is in the byte order of the host.
+     * is_signed: Whether the field and value are compared as signed integers
+     * op: A jrtc_router_filter_op_e
+     * value: The value the field is compared with
+     */
+    struct jrtc_router_filter_cond
+    {
+        uint32_t offset;
+        uint8_t size;
+        uint8_t is_signed;
+        uint8_t op;
+        uint8_t reserved;
+        uint64_t value;
+    };
+
+    /**
+     * @brief The jrtc_router_req_filter struct
+     * @ingroup router
+     * Only delivers the messages of a request whose payload meets all the conditions, e.g. the messages of a given
+     * cell or UE. The router checks the filter when it is set and runs it before it queues the messages. Messages
+     * that are too small for a condition do not match, and neither do the messages of streams whose message size
+     * jbpf cannot report to the router.
+     * num_conds: The number of conditions, up to JRTC_ROUTER_FILTER_MAX_CONDS. 0 for no filter.
+     * conds: The conditions, which must all hold
+     */
+    struct jrtc_router_req_filter
+    {
+        uint32_t num_conds;
+        uint32_t reserved;
+        struct jrtc_router_filter_cond conds[JRTC_ROUTER_FILTER_MAX_CONDS];
+    };
+
+#define JRTC_ROUTER_DEFAULT_BLOCK_TIMEOUT_US (20)
+// The waits of JRTC_ROUTER_OVERFLOW_BLOCK stall the forwarding thread, so they are kept short
+#define JRTC_ROUTER_MAX_BLOCK_TIMEOUT_US (50)
+
+/**
+ * @brief The max number of streams per app for which latency stats are kept
+ * @ingroup router
+ */
+#define JRTC_ROUTER_MAX_LATENCY_STREAMS (64)
+
+    /**
+     * @brief The jrtc_router_app_config struct
+     * @ingroup router
+     * app_queue_size: The queue size used for storing incoming messages from the subscribed channels of the app
+     * overflow_policy: What to do with new messages when the queue is full
+     * block_timeout_us: The max time the router waits for space with JRTC_ROUTER_OVERFLOW_BLOCK, per batch of
+     * messages. 0 means JRTC_ROUTER_DEFAULT_BLOCK_TIMEOUT_US, and it is capped to JRTC_ROUTER_MAX_BLOCK_TIMEOUT_US.
+     * has_numa_node: Whether numa_node is set. Otherwise the context and the queue of the app are placed on the
+     * NUMA node of the CPU affinity of the registering thread, if all its CPUs are on the same node.
+     * numa_node: The NUMA node to place the context and the queue of the app on, -1 for no placement
+     */
+    typedef struct jrtc_router_app_config
+    {
+        size_t app_queue_size;
+        jrtc_router_overflow_policy_e overflow_policy;
+        uint32_t block_timeout_us;
+        bool has_numa_node;
+        int numa_node;
+    } jrtc_router_app_config_t;
+
+    /**
+     * @brief The jrtc_router_app_numa_info struct
+     * @ingroup router
+     * The NUMA nodes an app sits on. -1 means no placement or unknown.
+     * numa_node: The node the app was placed on when it registered
+     * ctx_node: The node the context of the app currently sits on
+     * queue_node: The node the queue of the app currently sits on
+     */
+    struct jrtc_router_app_numa_info
+    {
+        int32_t numa_node;
+        int32_t ctx_node;
+        int32_t queue_node;
+    };
+
+    /**
+     * @brief The jrtc_router_app_stats struct
+     * @ingroup router
+     * num_enqueued: Messages placed in the queue of the app
+     * num_dropped: New messages dropped because the queue was full
+     * num_overwritten: Queued messages dropped to make space for new ones (JRTC_ROUTER_OVERFLOW_DROP_OLDEST)
+     * high_watermark: The max number of messages found in the queue after an enqueue
+     * num_sampled_out: Messages not delivered because of the sampling of a request, see jrtc_router_req_limit
+     * num_rate_limited: Messages not delivered because of the rate limit of a request
+     * num_filtered_out: Messages not delivered because they did not match the filter of a request, see
+     * jrtc_router_req_filter
+     */
+    struct jrtc_router_app_stats
+    {
+        uint64_t num_enqueued;
+        uint64_t num_dropped;
+        uint64_t num_overwritten;
+        uint64_t high_watermark;
+        uint64_t num_sampled_out;
+        uint64_t num_rate_limited;
+        uint64_t num_filtered_out;
+    };
+
+    /**
+     * @brief The jrtc_router_latency_stats struct
+     * @ingroup router
+     * The time from the arrival of the messages of a stream at the router until the app received them with
+     * jrtc_router_receive(). The percentiles are taken from a log-linear histogram and have a relative error
+     * below 1/16. Delays above 2^36 ns (about 68s) are counted as 2^36 ns.
+     * count: The number of messages
+     * min_ns, max_ns, mean_ns: The min, max and mean delay
+     * p50_ns, p90_ns, p99_ns, p999_ns: The 50th, 90th, 99th and 99.9th percentile of the delay
+     */
+    struct jrtc_router_latency_stats
+    {
+        uint64_t count;
+        uint64_t min_ns;
+        uint64_t max_ns;
+        uint64_t mean_ns;
+        uint64_t p50_ns;
+        uint64_t p90_ns;
+        uint64_t p99_ns;
+        uint64_t p999_ns;
+    };
+
+    /// @brief Registers an app to the jrtc router. When the queue of the app is full, new messages are dropped.
     /// @ingroup router
     /// @param app_queue_size The queue size used for storing incoming messages from the subscribed channels of this
     /// application
@@ -39,7 +245,50 @@ extern "C"
     dapp_router_ctx_t
     jrtc_router_register_app(size_t app_queue_size);
 
-    /// @brief Deregisters an app from the router
+    /// @brief Registers an app to the jrtc router, with a custom overflow policy.
+    /// @ingroup router
+    /// @param app_config The configuration of the app.
+    /// @return A handler to the router context if successful or NULL otherewise.
+    dapp_router_ctx_t
+    jrtc_router_register_app_ex(const jrtc_router_app_config_t* app_config);
+
+    /// @brief Returns the queue counters of an app.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param stats Stores the counters.
+    /// @return 0 if successful or a negative value otherwise.
+    int
+    jrtc_router_get_app_stats(dapp_router_ctx_t app_ctx, struct jrtc_router_app_stats* stats);
+
+    /// @brief Returns the NUMA nodes the context and the queue of an app sit on.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param info Stores the nodes.
+    /// @return 0 if successful or a negative value otherwise.
+    int
+    jrtc_router_get_app_numa_info(dapp_router_ctx_t app_ctx, struct jrtc_router_app_numa_info* info);
+
+    /// @brief Returns the router-to-app latency of the messages of a stream received by an app.
+    /// The stats are kept for the first JRTC_ROUTER_MAX_LATENCY_STREAMS streams received by each app.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param stream_id The exact stream id of the messages (not a request with wildcards).
+    /// @param stats Stores the stats.
+    /// @return 0 if successful or a negative value if the app has not received any timestamped messages of the
+    /// stream.
+    int
+    jrtc_router_get_latency_stats(
+        dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, struct jrtc_router_latency_stats* stats);
+
+    /// @brief Returns the current time in the clock of the ingress timestamps of the router, so that apps can
+    /// measure their own processing time against jrtc_router_data_entry_t.ingress_ts_ns.
+    /// @ingroup router
+    /// @return The time in ns. CLOCK_MONOTONIC if the router does not take ingress timestamps.
+    uint64_t
+    jrtc_router_timestamp_now_ns(void);
+
+    /// @brief Deregisters an app from the router and drops all its channel subscription requests.
+    /// Waits until the router is no longer forwarding messages to the app.
     /// @ingroup router
     /// @param app_ctx The context of the app.
     void
@@ -73,6 +322,19 @@ extern "C"
     int
     jrtc_router_channel_register_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id);
 
+    /// @brief Same as jrtc_router_channel_register_stream_id_req(), with the delivery mode of the request.
+    /// With JRTC_ROUTER_REQ_MODE_LATEST, the app keeps one message per matched stream, up to 1024 streams. The
+    /// streams matched beyond that are queued. Registering an existing request again changes its mode.
+    /// If a stream matches both kinds of requests of the app, it is delivered in the latest-value mode.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param stream_id Can be an exact stream_id or can have some of its fields replaced with wildcards.
+    /// @param mode The delivery mode of the request.
+    /// @return 1 if the request was successful or negative value otherwise.
+    int
+    jrtc_router_channel_register_stream_id_req_ex(
+        dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, jrtc_router_req_mode_e mode);
+
     /// @brief Unsubscribes an app from a channel subscription request, if the request exists.
     /// @ingroup router
     /// @param app_ctx The context of the app.
@@ -84,6 +346,34 @@ extern "C"
     jrtc_router_channel_deregister_req(
         dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* stream_path, const char* stream_name);
 
+    /// @brief Samples or rate limits the messages delivered to the app for the streams that match a stream id,
+    /// usually the one of a request of the app. Each stream has its own sample counter and token bucket. If a stream
+    /// matches the stream ids of several limits of the app, the first limit set applies. Setting the limit of a
+    /// stream id again replaces it, and the counters restart if the limit changed. Up to 64 limits per app.
+    /// The limit is removed with the request, by jrtc_router_channel_deregister_stream_id_req().
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param stream_id Can be an exact stream_id or can have some of its fields replaced with wildcards.
+    /// @param limit The limit, or NULL to remove the limit of the stream id.
+    /// @return 0 on success, -1 otherwise.
+    int
+    jrtc_router_channel_set_req_limit(
+        dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, const struct jrtc_router_req_limit* limit);
+
+    /// @brief Only delivers to the app the messages of the streams that match a stream id, usually the one of a
+    /// request of the app, whose payload matches a filter. The filter is applied before the limit set for the same
+    /// stream id, if any, and the messages it rejects do not count for the limit. Filters and limits share the same
+    /// rules: if a stream matches several stream ids with a filter or a limit, the first one set applies, and the
+    /// filter is removed with the request, by jrtc_router_channel_deregister_stream_id_req().
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param stream_id Can be an exact stream_id or can have some of its fields replaced with wildcards.
+    /// @param filter The filter, or NULL to remove the filter of the stream id.
+    /// @return 0 on success, -1 if the filter is invalid or on failure.
+    int
+    jrtc_router_channel_set_req_filter(
+        dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id, const struct jrtc_router_req_filter* filter);
+
     /// @brief Unsubscribes an app from a channel subscription request, if the request exists
     /// @ingroup router
     /// @param app_ctx The context of the app.
@@ -91,7 +381,56 @@ extern "C"
     void
     jrtc_router_channel_deregister_stream_id_req(dapp_router_ctx_t app_ctx, struct jrtc_router_stream_id stream_id);
 
+    /// @brief Unsubscribes an app from all its channel subscription requests. Called by jrtc_router_deregister_app().
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @return The number of requests the app was unsubscribed from, or a negative value otherwise.
+    int
+    jrtc_router_channel_deregister_all_reqs(dapp_router_ctx_t app_ctx);
+
+    /// @brief Requests to receive data from all the streams whose path and name match a pattern.
+    /// Paths are split in segments at '/'. A segment of the pattern can be a glob (e.g. "codelet_*") that matches a
+    /// single segment, and a last segment of "*" matches everything under the preceding segments, e.g.
+    /// "AdvancedExample1://jbpf_agent/*". Since stream ids only carry hashes of the path and the name, only the
+    /// streams known to the stream catalog are matched, see jrtc_router_stream_catalog_add().
+    /// A pattern is matched once for every new stream id and the result is kept in the route cache of the router.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param fwd_dst Destination endpoint(s) for channel data, or JRTC_ROUTER_DEST_ANY for wildcard.
+    /// @param device_id The device of origin of the streams, or JRTC_ROUTER_DEVICE_ID_ANY for wildcard.
+    /// @param path_pattern The pattern of the stream paths.
+    /// @param name_pattern A glob of the stream names. NULL corresponds to wildcard.
+    /// @return 1 if the request was successful or negative value otherwise.
+    int
+    jrtc_router_channel_register_pattern_req(
+        dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* path_pattern, const char* name_pattern);
+
+    /// @brief Unsubscribes an app from a pattern request made with jrtc_router_channel_register_pattern_req().
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param fwd_dst Destination endpoint(s) for channel data, as in the request.
+    /// @param device_id The device of origin of the streams, as in the request.
+    /// @param path_pattern The pattern of the stream paths, as in the request.
+    /// @param name_pattern The glob of the stream names, as in the request.
+    /// @return 1 if the app was unsubscribed, 0 if it had not made the request, or negative value otherwise.
+    int
+    jrtc_router_channel_deregister_pattern_req(
+        dapp_router_ctx_t app_ctx, int fwd_dst, int device_id, const char* path_pattern, const char* name_pattern);
+
+    /// @brief Adds the path and the name of a stream to the stream catalog of the router, which is used to match
+    /// the pattern requests. Streams requested by name with jrtc_router_channel_register_req() are added
+    /// automatically.
+    /// @ingroup router
+    /// @param stream_path The path of the stream.
+    /// @param stream_name The name of the stream.
+    /// @return 1 if the stream was added, 0 if it was already known, or negative value otherwise.
+    int
+    jrtc_router_stream_catalog_add(const char* stream_path, const char* stream_name);
+
     /// @brief Populates an array of jrtc_router_data_entry_t entries, with data arriving from subscribed channels.
+    /// The input channels of the app are only polled when marked ready by jrtc_router_channel_send_input_msg(),
+    /// in round-robin order and up to JRTC_ROUTER_IN_CHANNEL_BUDGET messages per channel at a time. All of them
+    /// are polled every JRTC_ROUTER_IN_CHANNEL_SWEEP_PERIOD calls, for messages sent by other means.
     /// @ingroup router
     /// @param app_ctx The context of the app.
     /// @param data_entries An array of jrtc_router_data_entry_t entries to be filled by the callee.
@@ -101,6 +440,38 @@ extern "C"
     int
     jrtc_router_receive(dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, size_t num_entries);
 
+    /// @brief Same as jrtc_router_receive(), but waits for up to timeout_ns if there is no data, without spinning.
+    /// The app is woken up by the router as soon as data arrives in its queue or is sent to one of its input channels
+    /// with jrtc_router_channel_send_input_msg().
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @param data_entries An array of jrtc_router_data_entry_t entries to be filled by the callee.
+    /// @param num_entries The size of data_entries.
+    /// @param timeout_ns The max time to wait in nanoseconds. With 0 the call does not wait.
+    /// @return The number of received entries (0 on timeout) if successful, or a negative value in the case of an
+    /// error.
+    int
+    jrtc_router_receive_timeout(
+        dapp_router_ctx_t app_ctx, jrtc_router_data_entry_t* data_entries, size_t num_entries, uint64_t timeout_ns);
+
+    /// @brief Returns a file descriptor that becomes readable when data arrives for the app, so that apps can wait
+    /// with epoll, select or an event loop. It is only signaled after jrtc_router_arm_fd() returned 0, and only once
+    /// until it is armed again.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @return The file descriptor, or a negative value in the case of an error. Must not be closed by the app.
+    int
+    jrtc_router_get_fd(dapp_router_ctx_t app_ctx);
+
+    /// @brief Arms the file descriptor of jrtc_router_get_fd() before waiting on it. The app should call this after
+    /// jrtc_router_receive() has returned 0, then wait for the descriptor and receive again.
+    /// @ingroup router
+    /// @param app_ctx The context of the app.
+    /// @return 0 if armed, 1 if data is already pending and the app should receive instead of waiting, or a negative
+    /// value in the case of an error.
+    int
+    jrtc_router_arm_fd(dapp_router_ctx_t app_ctx);
+
     /// @brief Reserves a buffer from a channel allocated by the caller app.
     /// Is used in conjunction with jrtc_router_channel_send_output().
     /// @ingroup router
@@ -125,7 +496,7 @@ extern "C"
     /// @param chan_ctx The context of the channel that will transport the data.
     /// @param data A pointer to some data to be sent over the channel. It is expected that the consumer knows how to
     /// parse the received data.
-    /// @param data_len The size of the data buffer.
+    /// @param data_len The size of the data buffer, at most the element size of the channel.
     /// @return 0 if the send was successful or a negative number otherwise.
     int
     jrtc_router_channel_send_output_msg(dapp_channel_ctx_t chan_ctx, void* data, size_t data_len);
@@ -142,6 +513,21 @@ extern "C"
     int
     jrtc_router_channel_send_input_msg(struct jrtc_router_stream_id stream_id, void* data, size_t data_len);
 
+    /// @brief Sends some data to all the input channels that match a wildcard stream id, e.g. to the same codelet
+    /// on every agent with JRTC_ROUTER_DEVICE_ID_ANY. The channels a stream id resolves to are cached, so repeated
+    /// sends do not search for them again.
+    /// Only fwd_dst and device_id can be wildcards. The router looks up every exact stream id they stand for in
+    /// jbpf, so the channels of all the agents are found, also the ones the router has never seen. The apps of the
+    /// channels that receive the data are woken up.
+    /// @ingroup router
+    /// @param stream_id The stream id of the target channels, with wildcard fields.
+    /// @param data A pointer to the data to be sent, which is copied to every channel.
+    /// @param data_len The size of the data buffer.
+    /// @return The number of channels the data was sent to, JRTC_ROUTER_MULTICAST_UNRESOLVED if the stream path or
+    /// name of the stream id is a wildcard, or -1 in the case of another error.
+    int
+    jrtc_router_channel_multicast_input_msg(struct jrtc_router_stream_id stream_id, void* data, size_t data_len);
+
     /// @brief Releases a buffer allocated with jrtc_router_channel_reserve_buf().
     /// Typically this function is expected to be called by the consumer of the data.
     /// @ingroup router
@@ -0,0 +1,158 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#include <stddef.h>
+#include <string.h>
+
+#include "jrtc_router_int.h"
+
+static size_t
+_jrtc_router_app_set_size(uint32_t max_num_apps, bool is_bitmap)
+{
+    return offsetof(jrtc_router_app_set_t, bitmap) + (is_bitmap ? ck_bitmap_size(max_num_apps) : 0);
+}
+
+jrtc_router_app_set_t*
+_jrtc_router_app_set_create(uint32_t max_num_apps, bool is_bitmap)
+{
+    jrtc_router_app_set_t* set;
+
+    set = jbpf_calloc(1, _jrtc_router_app_set_size(max_num_apps, is_bitmap));
+    if (!set) {
+        return NULL;
+    }
+
+    set->is_bitmap = is_bitmap;
+    if (is_bitmap) {
+        ck_bitmap_init(&set->bitmap, max_num_apps, false);
+    }
+
+    return set;
+}
+
+bool
+_jrtc_router_app_set_test(const jrtc_router_app_set_t* set, unsigned int app_id)
+{
+    if (set->is_bitmap) {
+        return ck_bitmap_test(&set->bitmap, app_id);
+    }
+
+    for (uint32_t i = 0; i < set->num_apps && set->list[i] <= app_id; i++) {
+        if (set->list[i] == app_id) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+jrtc_router_app_set_t*
+_jrtc_router_app_set_update(const jrtc_router_app_set_t* set, uint32_t max_num_apps, unsigned int app_id, bool add)
+{
+    jrtc_router_app_set_t* new_set;
+    jrtc_router_app_set_iterator_t iter;
+    uint32_t num_apps;
+    unsigned int id;
+    bool is_member;
+
+    num_apps = set ? set->num_apps : 0;
+    is_member = set && _jrtc_router_app_set_test(set, app_id);
+    if (add && !is_member) {
+        num_apps++;
+    } else if (!add && is_member) {
+        num_apps--;
+    }
+
+    new_set = _jrtc_router_app_set_create(max_num_apps, num_apps > JRTC_ROUTER_APP_SET_LIST_SIZE);
+    if (!new_set) {
+        return NULL;
+    }
+
+    if (new_set->is_bitmap) {
+        if (set && set->is_bitmap) {
+            memcpy(&new_set->bitmap, &set->bitmap, ck_bitmap_size(max_num_apps));
+        } else if (set) {
+            for (uint32_t i = 0; i < set->num_apps; i++) {
+                ck_bitmap_set(&new_set->bitmap, set->list[i]);
+            }
+        }
+
+        if (add) {
+            ck_bitmap_set(&new_set->bitmap, app_id);
+        } else {
+            ck_bitmap_reset(&new_set->bitmap, app_id);
+        }
+    } else {
+        // Merge app_id into the sorted list
+        if (set) {
+            _jrtc_router_app_set_iterator_init(&iter, set);
+            while (_jrtc_router_app_set_next(&iter, &id)) {
+                if (add && app_id < id && !is_member) {
+                    new_set->list[new_set->num_apps++] = app_id;
+                    is_member = true;
+                }
+                if (id != app_id || add) {
+                    new_set->list[new_set->num_apps++] = id;
+                }
+            }
+        }
+        if (add && !is_member) {
+            new_set->list[new_set->num_apps++] = app_id;
+        }
+    }
+
+    new_set->num_apps = num_apps;
+    return new_set;
+}
+
+void
+_jrtc_router_app_set_union(ck_bitmap_t* bitmap, const jrtc_router_app_set_t* set)
+{
+    if (set->is_bitmap) {
+        ck_bitmap_union(bitmap, &set->bitmap);
+        return;
+    }
+
+    for (uint32_t i = 0; i < set->num_apps; i++) {
+        ck_bitmap_set(bitmap, set->list[i]);
+    }
+}
+
+void
+_jrtc_router_app_set_fill(jrtc_router_app_set_t* set, const ck_bitmap_t* bitmap, uint32_t max_num_apps)
+{
+    ck_bitmap_iterator_t iter;
+    unsigned int app_id;
+    uint32_t num_apps;
+
+    num_apps = ck_bitmap_count(bitmap, max_num_apps);
+
+    set->num_apps = 0;
+    set->is_bitmap = num_apps > JRTC_ROUTER_APP_SET_LIST_SIZE;
+
+    if (set->is_bitmap) {
+        memcpy(&set->bitmap, bitmap, ck_bitmap_size(max_num_apps));
+    } else {
+        ck_bitmap_iterator_init(&iter, bitmap);
+        while (ck_bitmap_next(bitmap, &iter, &app_id)) {
+            set->list[set->num_apps++] = app_id;
+        }
+    }
+
+    set->num_apps = num_apps;
+}
+
+jrtc_router_app_set_t*
+_jrtc_router_app_set_from_bitmap(const ck_bitmap_t* bitmap, uint32_t max_num_apps)
+{
+    jrtc_router_app_set_t* set;
+    bool is_bitmap;
+
+    is_bitmap = ck_bitmap_count(bitmap, max_num_apps) > JRTC_ROUTER_APP_SET_LIST_SIZE;
+    set = _jrtc_router_app_set_create(max_num_apps, is_bitmap);
+    if (!set) {
+        return NULL;
+    }
+
+    _jrtc_router_app_set_fill(set, bitmap, max_num_apps);
+    return set;
+}
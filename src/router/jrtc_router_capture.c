@@ -0,0 +1,269 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "jbpf_io_channel.h"
+
+#include "jrtc_router_int.h"
+#include "jrtc_router_capture.h"
+
+// Capture of the messages received by the router, for replaying production traffic on a bench.
+//
+// The router thread is the only writer, so the capture takes no locks: each message is serialized straight into a
+// shared mapping of the current segment file and the page cache writes it back to the file. When a message does
+// not fit in the segment, the segment is closed and the next one is started. The format of the segments is
+// described in jrtc_router_capture.h.
+
+#define JRTC_ROUTER_CAPTURE_ALIGN (8)
+
+#define _jrtc_router_capture_align(size) \
+    (((size) + JRTC_ROUTER_CAPTURE_ALIGN - 1) & ~(uint64_t)(JRTC_ROUTER_CAPTURE_ALIGN - 1))
+
+static void
+_jrtc_router_capture_segment_name(char* name, size_t len, const char* path, uint32_t segment)
+{
+    snprintf(name, len, "%s.%u", path, segment);
+}
+
+// Maps a new segment file. Returns NULL on failure.
+static struct jrtc_router_capture_header*
+_jrtc_router_capture_segment_create(jrtc_router_capture_t* capture, uint32_t segment)
+{
+    char name[JRTC_ROUTER_CAPTURE_PATH_LEN + 16];
+    struct jrtc_router_capture_header* header;
+    int fd;
+
+    _jrtc_router_capture_segment_name(name, sizeof(name), capture->path, segment);
+
+    fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        jrtc_logger(JRTC_ERROR, "Could not create the capture segment %s\n", name);
+        return NULL;
+    }
+
+    // The file is sparse, only the pages that are written take space
+    if (ftruncate(fd, capture->segment_size) != 0) {
+        jrtc_logger(JRTC_ERROR, "Could not size the capture segment %s\n", name);
+        close(fd);
+        unlink(name);
+        return NULL;
+    }
+
+    header = mmap(NULL, capture->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        jrtc_logger(JRTC_ERROR, "Could not map the capture segment %s\n", name);
+        unlink(name);
+        return NULL;
+    }
+
+    header->version = JRTC_ROUTER_CAPTURE_VERSION;
+    header->header_size = sizeof(struct jrtc_router_capture_header);
+    header->segment = segment;
+    header->segment_size = capture->segment_size;
+    header->used = header->header_size;
+    header->clock_source = capture->clock_source;
+    header->start_ns = capture->start_ns;
+
+    // Readers only look at a segment once its magic is set
+    ck_pr_fence_store();
+    ck_pr_store_32(&header->magic, JRTC_ROUTER_CAPTURE_MAGIC);
+
+    // Keep the last max_segments segments
+    if (capture->max_segments > 0 && segment >= capture->max_segments) {
+        _jrtc_router_capture_segment_name(name, sizeof(name), capture->path, segment - capture->max_segments);
+        unlink(name);
+    }
+
+    return header;
+}
+
+static void
+_jrtc_router_capture_segment_close(struct jrtc_router_capture_header* header)
+{
+    ck_pr_fence_store();
+    ck_pr_store_32(&header->flags, header->flags | JRTC_ROUTER_CAPTURE_FLAG_CLOSED);
+    munmap(header, header->segment_size);
+}
+
+int
+_jrtc_router_capture_init(
+    jrtc_router_capture_t* capture,
+    const struct jrtc_router_capture_config* config,
+    uint32_t clock_source,
+    uint64_t start_ns)
+{
+    memset(capture, 0, sizeof(jrtc_router_capture_t));
+
+    if (config->path[0] == '\0') {
+        return 0;
+    }
+
+    strncpy(capture->path, config->path, sizeof(capture->path) - 1);
+    capture->segment_size = config->segment_size_mb > 0 ? config->segment_size_mb
+                                                        : JRTC_ROUTER_DEFAULT_CAPTURE_SEGMENT_SIZE_MB;
+    capture->segment_size *= 1024 * 1024;
+    capture->max_segments = config->max_segments;
+    capture->clock_source = clock_source == JRTC_ROUTER_TIMESTAMP_NONE ? JRTC_ROUTER_TIMESTAMP_MONOTONIC : clock_source;
+    capture->start_ns = start_ns;
+
+    capture->header = _jrtc_router_capture_segment_create(capture, 0);
+    if (!capture->header) {
+        return -1;
+    }
+
+    jrtc_logger(
+        JRTC_INFO,
+        "Capturing the messages of the router to %s.*, segments of %lu MB\n",
+        capture->path,
+        capture->segment_size / (1024 * 1024));
+    return 0;
+}
+
+// Serializes a message at the end of the current segment. Returns false if it does not fit.
+static inline bool
+_jrtc_router_capture_append(jrtc_router_capture_t* capture, struct jbpf_io_ctx* io_ctx, void* buf, uint64_t ts_ns)
+{
+    struct jrtc_router_capture_header* header = capture->header;
+    struct jrtc_router_capture_record* record;
+    uint64_t space;
+    int len;
+
+    if (header->used + sizeof(struct jrtc_router_capture_record) > header->segment_size) {
+        return false;
+    }
+
+    record = (struct jrtc_router_capture_record*)((uint8_t*)header + header->used);
+    space = header->segment_size - header->used - offsetof(struct jrtc_router_capture_record, stream_id);
+
+    // jbpf serializes a message as its stream id followed by its payload
+    len = jbpf_io_channel_pack_msg(io_ctx, buf, record->stream_id, space);
+    if (len < (int)sizeof(record->stream_id)) {
+        return false;
+    }
+
+    record->data_len = len - sizeof(record->stream_id);
+    record->ingress_ts_ns = ts_ns;
+    // The segment size is a multiple of the alignment, so the padding always fits
+    record->record_size = _jrtc_router_capture_align(sizeof(struct jrtc_router_capture_record) + record->data_len);
+
+    header->num_records++;
+    capture->num_records++;
+    capture->num_bytes += record->data_len;
+
+    // The record must be complete before readers can see it
+    ck_pr_fence_store();
+    ck_pr_store_64(&header->used, header->used + record->record_size);
+    return true;
+}
+
+void
+_jrtc_router_capture_msgs(
+    jrtc_router_capture_t* capture,
+    struct jbpf_io_ctx* io_ctx,
+    void** bufs,
+    int num_bufs,
+    uint64_t ts_ns)
+{
+    struct jrtc_router_capture_header* next;
+
+    for (int i = 0; i < num_bufs; i++) {
+        if (_jrtc_router_capture_append(capture, io_ctx, bufs[i], ts_ns)) {
+            continue;
+        }
+
+        // A message that does not fit in an empty segment never will
+        if (capture->header->used == capture->header->header_size) {
+            capture->num_dropped++;
+            continue;
+        }
+
+        next = _jrtc_router_capture_segment_create(capture, capture->segment + 1);
+        if (!next) {
+            // Keep the full segment, the next messages are dropped until a segment can be created
+            capture->num_dropped++;
+            continue;
+        }
+        _jrtc_router_capture_segment_close(capture->header);
+        capture->header = next;
+        capture->segment++;
+
+        if (!_jrtc_router_capture_append(capture, io_ctx, bufs[i], ts_ns)) {
+            capture->num_dropped++;
+        }
+    }
+}
+
+void
+_jrtc_router_capture_close(jrtc_router_capture_t* capture)
+{
+    if (!capture->header) {
+        return;
+    }
+
+    _jrtc_router_capture_segment_close(capture->header);
+    capture->header = NULL;
+
+    jrtc_logger(
+        JRTC_INFO,
+        "Captured %lu messages (%lu bytes) in %u segments to %s.*, dropped %lu\n",
+        capture->num_records,
+        capture->num_bytes,
+        capture->segment + 1,
+        capture->path,
+        capture->num_dropped);
+}
+
+struct jrtc_router_capture_header*
+jrtc_router_capture_map(const char* path, uint32_t segment)
+{
+    char name[JRTC_ROUTER_CAPTURE_PATH_LEN + 16];
+    struct jrtc_router_capture_header* header;
+    struct stat st;
+    int fd;
+
+    if (!path) {
+        return NULL;
+    }
+
+    _jrtc_router_capture_segment_name(name, sizeof(name), path, segment);
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct jrtc_router_capture_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (header == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (ck_pr_load_32(&header->magic) != JRTC_ROUTER_CAPTURE_MAGIC || header->version != JRTC_ROUTER_CAPTURE_VERSION ||
+        header->segment_size != (uint64_t)st.st_size) {
+        munmap(header, st.st_size);
+        return NULL;
+    }
+
+    return header;
+}
+
+void
+jrtc_router_capture_unmap(struct jrtc_router_capture_header* header)
+{
+    if (header) {
+        munmap(header, header->segment_size);
+    }
+}
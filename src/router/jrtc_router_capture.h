@@ -0,0 +1,135 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef JRTC_ROUTER_CAPTURE_H
+#define JRTC_ROUTER_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * Layout of a router capture, version 1
+     *
+     * When jrtc_router_config.capture.path is set, the router thread appends every buffer it receives from the
+     * IO channels to the capture, before it forwards the buffer. A capture is a sequence of segment files
+     * "<path>.<segment>", with segment counting from 0, each of capture.segment_size_mb MB:
+     *
+     *   offset 0              struct jrtc_router_capture_header
+     *   header.header_size    records, each a struct jrtc_router_capture_record followed by data_len bytes of
+     *                         payload and padded to 8 bytes
+     *
+     * header.used is the end of the last complete record. It is updated with release semantics after every
+     * record, so a segment can be read while the router is still writing to it, and the rest of the file is
+     * sparse. JRTC_ROUTER_CAPTURE_FLAG_CLOSED is set once the router has moved on to the next segment or stopped.
+     *
+     * The stream id and the payload of a record are the message as serialized by jrtc_router_create_serialized_msg(),
+     * so they can also be fed to jrtc_router_deserialize_msg(). The payload is kept as raw bytes: the stream id is
+     * the reference to its descriptor, as registered with the decoder.
+     *
+     * The timestamps are the ingress timestamps of the messages, in nanoseconds, in the clock given by
+     * header.clock_source (a jrtc_router_timestamp_source_e). If the router takes no ingress timestamps, they are
+     * CLOCK_MONOTONIC.
+     */
+
+#define JRTC_ROUTER_CAPTURE_MAGIC (0x4a525443)
+#define JRTC_ROUTER_CAPTURE_VERSION (1)
+
+#define JRTC_ROUTER_CAPTURE_FLAG_CLOSED (1 << 0)
+
+    /**
+     * @brief The jrtc_router_capture_header struct
+     * @ingroup router
+     * magic: JRTC_ROUTER_CAPTURE_MAGIC
+     * version: JRTC_ROUTER_CAPTURE_VERSION
+     * header_size: The size of the header, i.e. the offset of the first record
+     * segment: The number of the segment in the capture
+     * segment_size: The size of the segment file
+     * used: The end of the last complete record
+     * flags: JRTC_ROUTER_CAPTURE_FLAG_*
+     * clock_source: The clock of the timestamps, see jrtc_router_timestamp_source_e
+     * start_ns: The time the capture was started
+     * num_records: The number of complete records in the segment
+     */
+    struct jrtc_router_capture_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t segment;
+        uint64_t segment_size;
+        uint64_t used;
+        uint32_t flags;
+        uint32_t clock_source;
+        uint64_t start_ns;
+        uint64_t num_records;
+        uint64_t reserved[2];
+    };
+
+    /**
+     * @brief The jrtc_router_capture_record struct
+     * @ingroup router
+     * record_size: The size of the record, including the header, the payload and the padding
+     * data_len: The size of the payload, which follows the header
+     * ingress_ts_ns: The time the router received the message
+     * stream_id: The stream id of the message
+     */
+    struct jrtc_router_capture_record
+    {
+        uint32_t record_size;
+        uint32_t data_len;
+        uint64_t ingress_ts_ns;
+        uint8_t stream_id[16];
+        uint8_t data[];
+    };
+
+    /**
+     * @brief Get the record at an offset of a mapped segment and move the offset to the next record
+     * @ingroup router
+     * @param header The mapped segment
+     * @param offset The offset of the record, header->header_size for the first one
+     * @return The record, or NULL if there is no complete record at the offset (yet)
+     */
+    static inline const struct jrtc_router_capture_record*
+    jrtc_router_capture_next(const struct jrtc_router_capture_header* header, uint64_t* offset)
+    {
+        const struct jrtc_router_capture_record* record;
+
+        if (*offset + sizeof(struct jrtc_router_capture_record) > __atomic_load_n(&header->used, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        record = (const struct jrtc_router_capture_record*)((const uint8_t*)header + *offset);
+        if (record->record_size < sizeof(struct jrtc_router_capture_record)) {
+            return NULL;
+        }
+        *offset += record->record_size;
+        return record;
+    }
+
+    /**
+     * @brief Map a segment of a capture read-only
+     * @ingroup router
+     * @param path The path of the capture, as in jrtc_router_config.capture.path
+     * @param segment The number of the segment
+     * @return The mapped segment, or NULL if the segment does not exist or has an unsupported version
+     */
+    struct jrtc_router_capture_header*
+    jrtc_router_capture_map(const char* path, uint32_t segment);
+
+    /**
+     * @brief Unmap a segment mapped with jrtc_router_capture_map()
+     * @ingroup router
+     * @param header The mapped segment
+     */
+    void
+    jrtc_router_capture_unmap(struct jrtc_router_capture_header* header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
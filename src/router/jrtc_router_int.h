@@ -10,15 +10,23 @@
 #include <linux/types.h>
 #include <sys/syscall.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
+#include "ck_pr.h"
 #include "ck_ring.h"
 #include "ck_ht.h"
 #include "ck_bitmap.h"
 #include "ck_spinlock.h"
+#include "ck_rwlock.h"
 #include "ck_epoch.h"
 
 #include "jbpf_mempool.h"
+#include "jrtc_router.h"
 #include "jrtc_router_app_api.h"
+#include "jrtc_router_doorbell.h"
+#include "jrtc_router_stats.h"
+#include "jrtc_router_capture.h"
 #include "jrtc_logging.h"
 
 #define gettid() syscall(__NR_gettid)
@@ -69,59 +77,872 @@ struct sched_attr
 struct jrtc_router_thread_ctx
 {
     pthread_t jrtc_router_thread_id;
-};
+    // Set while the router thread runs, cleared by jrtc_router_stop() to stop it
+    int running;
 
-///// JRTC ROUTER DEFS ////////
+    // Rung by the producers of the IO channels when the router is parked
+    jrtc_router_doorbell_t* doorbell;
+    char ipc_name[32];
 
-#define JRTC_ROUTER_MAX_APP_QUEUE_SIZE (10000)
+    // Number of buffers forwarded so far, used to detect empty polls
+    uint64_t num_forwarded;
+    uint64_t start_ns;
+    struct jrtc_router_idle_stats idle_stats;
+};
 
-#define JRTC_ROUTER_MAX_NUM_APPS (128)
+///// JRTC ROUTER DEFS ////////
 
 #define JRTC_ROUTER_MAX_NUM_DEV_ID (256)
 #define JRTC_ROUTER_MAX_NUM_FWD_DST (256)
-#define JRTC_ROUTER_MAX_REQ_ENTRIES (2048)
 
 #define JRTC_ROUTER_NUM_REQ_LOOKUPS (16)
-#define JRTC_ROUTER_INIT_NUM_REQ_ENTRIES (2048)
 
 #define JRTC_ROUTER_NUM_APP_CHANNELS (16)
 
 #define JRTC_ROUTER_DATA_BATCH_SIZE (16)
 
+// The input channels of an app are only polled when a producer has marked them ready, see jrtc_router_receive()
+#define JRTC_ROUTER_MAX_APP_IN_CHANNELS (256)
+#define JRTC_ROUTER_APP_IN_READY_WORDS (JRTC_ROUTER_MAX_APP_IN_CHANNELS / 64)
+// Max messages received from an input channel before moving on to the next ready one
+#define JRTC_ROUTER_IN_CHANNEL_BUDGET (JRTC_ROUTER_DATA_BATCH_SIZE)
+// Every this many receive calls all the input channels are polled, for producers that do not go through
+// jrtc_router_channel_send_input_msg()
+#define JRTC_ROUTER_IN_CHANNEL_SWEEP_PERIOD (64)
+
+
+#define JRTC_ROUTER_MAX_OVERWRITE_RETRIES (16)
+
+#define JRTC_ROUTER_ROUTE_CACHE_INIT_ENTRIES (1024)
+#define JRTC_ROUTER_ROUTE_CACHE_MAX_ENTRIES (16384)
+
+#define JRTC_ROUTER_SHARD_QUEUE_SIZE (8192)
+#define JRTC_ROUTER_SHARD_BATCH_SIZE (64)
+
+#define JRTC_ROUTER_CACHELINE_SIZE (64)
+
+// NUMA placement of the router state, see jrtc_router_numa.c. Nodes are identified by their number, -1 means that
+// the memory is not placed on a particular node.
+#define JRTC_ROUTER_NUMA_MAX_NODES (64)
+
+// The number of NUMA nodes of the machine, 1 if it is not NUMA
+int
+_jrtc_router_numa_num_nodes(void);
+
+// The node of a CPU, or -1 if unknown
+int
+_jrtc_router_numa_node_of_cpu(int cpu);
+
+// The node that all the CPUs of the set belong to, or -1 if they span several nodes
+int
+_jrtc_router_numa_node_of_cpus(const cpu_set_t* cpus);
+
+// The node of the CPUs a thread may run on, or -1 if they span several nodes
+int
+_jrtc_router_numa_node_of_thread(pthread_t thread_id);
+
+// Fills cpus with the CPUs of a node
+int
+_jrtc_router_numa_node_cpus(int node, cpu_set_t* cpus);
+
+// Sets a preferred policy for the node on a range of memory. With move, pages already on another node are moved.
+int
+_jrtc_router_numa_bind(void* addr, size_t len, int node, bool move);
+
+// Moves already allocated memory to a node, e.g. static data. Also moves the rest of the pages of the range.
+int
+_jrtc_router_numa_move(void* addr, size_t len, int node);
+
+// The node the page of an address currently sits on, or -1 if unknown
+int
+_jrtc_router_numa_node_of_addr(const void* addr);
+
+// Memory of the router state that is touched on every message, see jrtc_router_mem.c
+// Allocations smaller than this are never backed by huge pages
+#define JRTC_ROUTER_HUGEPAGE_MIN_ALLOC_SIZE (256 * 1024)
+
+void
+_jrtc_router_mem_init(jrtc_router_hugepages_e hugepages);
+
+// Zeroed memory aligned to a cache line, placed on the given node and backed by huge pages as configured.
+// Falls back to jbpf_calloc() if node is -1 or the machine is not NUMA, and huge pages are not used.
+// Must be freed with _jrtc_router_mem_free().
+void*
+_jrtc_router_mem_calloc(size_t size, int node);
+
+void
+_jrtc_router_mem_free(void* ptr);
+
+// Reads the page sizes of the mappings of the process from /proc/self/smaps. The mappings with ipc_name in their
+// path are counted as the IPC segment.
+int
+_jrtc_router_mem_read_stats(const char* ipc_name, struct jrtc_router_mem_stats* stats);
+
+void
+_jrtc_router_mem_log_stats(const char* ipc_name);
+
+#define JRTC_ROUTER_STATS_MAX_STREAMS (1024)
+#define JRTC_ROUTER_STATS_NAME_LEN (64)
+
+// The shared memory region with the stats of the router, see jrtc_router_stats.h
+typedef struct jrtc_router_stats_region
+{
+    struct jrtc_router_stats_header* header;
+    size_t size;
+    // Serializes the allocation of stream slots
+    ck_spinlock_t lock;
+    char name[JRTC_ROUTER_STATS_NAME_LEN];
+} jrtc_router_stats_region_t;
+
+int
+_jrtc_router_stats_create(
+    jrtc_router_stats_region_t* region,
+    const char* ipc_name,
+    uint32_t max_streams,
+    uint32_t max_apps,
+    uint64_t start_ns,
+    uint32_t clock_source);
+
+void
+_jrtc_router_stats_destroy(jrtc_router_stats_region_t* region);
+
+// Returns the slot of a stream, taking a new one if the stream has none.
+// Returns NULL if the region does not exist or is full.
+struct jrtc_router_stream_stats*
+_jrtc_router_stats_get_stream(jrtc_router_stats_region_t* region, jrtc_router_stream_id_t* sid);
+
+struct jrtc_router_app_stats_slot*
+_jrtc_router_stats_get_app(jrtc_router_stats_region_t* region, int app_id);
+
+// Sections with a single writer are updated between these two calls
+static inline void
+_jrtc_router_stats_write_begin(uint32_t* seq)
+{
+    ck_pr_store_32(seq, *seq + 1);
+    ck_pr_fence_store();
+}
+
+static inline void
+_jrtc_router_stats_write_end(uint32_t* seq)
+{
+    ck_pr_fence_store();
+    ck_pr_store_32(seq, *seq + 1);
+}
+
+static inline unsigned int
+_jrtc_router_stats_delay_bucket(uint64_t delay_ns)
+{
+    unsigned int bucket;
+
+    if (delay_ns < 2) {
+        return 0;
+    }
+
+    bucket = 63 - __builtin_clzll(delay_ns);
+    return bucket < JRTC_ROUTER_STATS_NUM_DELAY_BUCKETS - 1 ? bucket : JRTC_ROUTER_STATS_NUM_DELAY_BUCKETS - 1;
+}
+
+// The clock of the ingress timestamps. TSC readings are converted to CLOCK_MONOTONIC_RAW nanoseconds
+// as ns_base + (((tsc - tsc_base) * tsc_mult) >> 32), where tsc_mult is calibrated when the router starts.
+typedef struct jrtc_router_timebase
+{
+    jrtc_router_timestamp_source_e source;
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    uint64_t tsc_mult;
+} jrtc_router_timebase_t;
+
+// Sets up the timebase of the given source. TSC falls back to CLOCK_MONOTONIC_RAW if there is no invariant TSC.
+void
+_jrtc_router_timebase_init(jrtc_router_timebase_t* timebase, jrtc_router_timestamp_source_e source);
+
+static inline uint64_t
+_jrtc_router_clock_ns(clockid_t clock_id)
+{
+    struct timespec ts;
+
+    clock_gettime(clock_id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The current time of the timebase. CLOCK_MONOTONIC if the router does not take ingress timestamps.
+static inline uint64_t
+_jrtc_router_timebase_now_ns(const jrtc_router_timebase_t* timebase)
+{
+    switch (timebase->source) {
+#ifdef __x86_64__
+    case JRTC_ROUTER_TIMESTAMP_TSC:
+        // The TSC of another core may be slightly behind the one of the calibration
+        return timebase->ns_base +
+               (int64_t)(((__int128)(int64_t)(__builtin_ia32_rdtsc() - timebase->tsc_base) * timebase->tsc_mult) >> 32);
+#endif
+    case JRTC_ROUTER_TIMESTAMP_MONOTONIC_RAW:
+        return _jrtc_router_clock_ns(CLOCK_MONOTONIC_RAW);
+    default:
+        return _jrtc_router_clock_ns(CLOCK_MONOTONIC);
+    }
+}
+
+// The timestamp of a message arriving at the router, 0 if the router does not take ingress timestamps
+static inline uint64_t
+_jrtc_router_timebase_ingress_ns(const jrtc_router_timebase_t* timebase)
+{
+    return timebase->source == JRTC_ROUTER_TIMESTAMP_NONE ? 0 : _jrtc_router_timebase_now_ns(timebase);
+}
+
+// Log-linear latency histogram, in the style of HdrHistogram. Delays below JRTC_ROUTER_LATENCY_SUB_BUCKETS ns
+// have a bucket each and every power of two above that is split in JRTC_ROUTER_LATENCY_SUB_BUCKETS buckets.
+#define JRTC_ROUTER_LATENCY_SUB_BITS (4)
+#define JRTC_ROUTER_LATENCY_SUB_BUCKETS (1 << JRTC_ROUTER_LATENCY_SUB_BITS)
+#define JRTC_ROUTER_LATENCY_MAX_BITS (36)
+#define JRTC_ROUTER_LATENCY_NUM_BUCKETS \
+    ((JRTC_ROUTER_LATENCY_MAX_BITS - JRTC_ROUTER_LATENCY_SUB_BITS + 1) * JRTC_ROUTER_LATENCY_SUB_BUCKETS)
+
+// Only updated by the app in jrtc_router_receive(), readers may see the counters of a partial update
+typedef struct jrtc_router_latency_hist
+{
+    jrtc_router_stream_id_t stream_id;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t sum_ns;
+    uint64_t buckets[JRTC_ROUTER_LATENCY_NUM_BUCKETS];
+} jrtc_router_latency_hist_t;
+
+static inline unsigned int
+_jrtc_router_latency_bucket(uint64_t delay_ns)
+{
+    unsigned int shift;
+
+    if (delay_ns < JRTC_ROUTER_LATENCY_SUB_BUCKETS) {
+        return delay_ns;
+    }
+    if (delay_ns >> JRTC_ROUTER_LATENCY_MAX_BITS) {
+        return JRTC_ROUTER_LATENCY_NUM_BUCKETS - 1;
+    }
+
+    shift = 63 - __builtin_clzll(delay_ns) - JRTC_ROUTER_LATENCY_SUB_BITS;
+    return ((shift + 1) << JRTC_ROUTER_LATENCY_SUB_BITS) + (delay_ns >> shift) - JRTC_ROUTER_LATENCY_SUB_BUCKETS;
+}
+
+// The highest delay counted by a bucket
+static inline uint64_t
+_jrtc_router_latency_bucket_max(unsigned int bucket)
+{
+    unsigned int shift;
+
+    if (bucket < JRTC_ROUTER_LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    shift = (bucket >> JRTC_ROUTER_LATENCY_SUB_BITS) - 1;
+    return (((uint64_t)(bucket & (JRTC_ROUTER_LATENCY_SUB_BUCKETS - 1)) + JRTC_ROUTER_LATENCY_SUB_BUCKETS + 1)
+            << shift) -
+           1;
+}
+
+void
+_jrtc_router_latency_hist_read(jrtc_router_latency_hist_t* hist, struct jrtc_router_latency_stats* stats);
+
 typedef int dapp_id_t;
 
+// The queues of the apps store the delivered data entries by value
+CK_RING_PROTOTYPE(jrtc_router_data_entry, jrtc_router_data_entry)
+
+// Latest-value delivery, see jrtc_router_latest.c
+#define JRTC_ROUTER_MAX_LATEST_REQS (64)
+#define JRTC_ROUTER_MAX_LATEST_STREAMS (1024)
+#define JRTC_ROUTER_LATEST_READY_WORDS (JRTC_ROUTER_MAX_LATEST_STREAMS / 64)
+#define JRTC_ROUTER_LATEST_INDEX_SIZE (2 * JRTC_ROUTER_MAX_LATEST_STREAMS)
+
+// The latest-value requests of an app. Never modified once published, like the app sets.
+typedef struct jrtc_router_latest_reqs
+{
+    ck_epoch_entry_t epoch_entry;
+    uint32_t num_reqs;
+    jrtc_router_stream_id_t reqs[];
+} jrtc_router_latest_reqs_t;
+
+// The last message of a stream that the app has not received yet. entry.data is NULL if there is none.
+typedef struct jrtc_router_latest_slot
+{
+    ck_spinlock_t lock;
+    jrtc_router_data_entry_t entry;
+} CK_CC_CACHELINE jrtc_router_latest_slot_t;
+
+// The slots of the streams an app receives with latest-value. A slot is taken by the shard of the stream on
+// its first message and is kept until the app deregisters.
+typedef struct jrtc_router_latest_table
+{
+    // Serializes the shards that take slots
+    ck_spinlock_t lock;
+    uint32_t num_slots;
+    // Slot where the next pass of the app starts
+    uint32_t next_slot;
+    // Open addressing index of the slots by stream id. 0 is an empty entry and i + 1 is slot i.
+    uint16_t index[JRTC_ROUTER_LATEST_INDEX_SIZE];
+    // Slots with a new message, set by the shards and cleared by the app
+    uint64_t ready[JRTC_ROUTER_LATEST_READY_WORDS] CK_CC_CACHELINE;
+    jrtc_router_latest_slot_t slots[JRTC_ROUTER_MAX_LATEST_STREAMS];
+} jrtc_router_latest_table_t;
+
 struct dapp_router_ctx
 {
-    ck_ring_t ring;
-    ck_ring_buffer_t* ringbuffer;
-    jbpf_mempool_t* data_entry_pool;
+    ck_ring_t ring CK_CC_CACHELINE;
+    // Aligned to a cache line and placed on numa_node, see _jrtc_router_mem_calloc()
+    jrtc_router_data_entry_t* ringbuffer;
 
     ck_ht_t app_out_channel_list;
     ck_ht_t app_in_channel_list;
 
+    // Signaled when new data arrives while the app waits, see jrtc_router_arm_fd(). The producers only
+    // write to the eventfd while wait_armed is set, and the first one clears it, so a burst costs a single write.
+    int event_fd;
+    uint32_t wait_armed CK_CC_CACHELINE;
+
+    // The input channels by slot. The ready bits are set by the producers and cleared by the app,
+    // in_slots has the bits of the slots in use.
+    uint64_t in_ready[JRTC_ROUTER_APP_IN_READY_WORDS] CK_CC_CACHELINE;
+    struct dapp_channel_ctx* in_channels[JRTC_ROUTER_MAX_APP_IN_CHANNELS] CK_CC_CACHELINE;
+    uint64_t in_slots[JRTC_ROUTER_APP_IN_READY_WORDS];
+    // Slot where the next round-robin pass over the ready input channels starts
+    uint32_t in_next_slot;
+    uint32_t num_receive_calls;
+
     dapp_id_t app_id;
+
+    // The node the context and the queue of the app are placed on, -1 if none
+    int numa_node;
+
+    jrtc_router_overflow_policy_e overflow_policy;
+    uint32_t block_timeout_us;
+
+    // The queue counters are updated by all the forwarding shards and the rx counters by the app.
+    // Points to the slot of the app in the stats region, or to local_stats_slot if there is none.
+    struct jrtc_router_app_stats_slot* stats_slot;
+    struct jrtc_router_app_stats_slot local_stats_slot;
+
+    // The latest-value requests of the app, NULL if none, and the slots of the streams they matched
+    jrtc_router_latest_reqs_t* latest_reqs;
+    jrtc_router_latest_table_t* latest_table;
+
+    // The limits of the requests of the app, NULL if none
+    struct jrtc_router_req_limits* req_limits;
+
+    // Latency histograms of the streams received by the app, allocated by the app on the first message of a
+    // stream. last_latency_hist caches the histogram of the last stream, since messages mostly come in runs.
+    jrtc_router_latency_hist_t* latency_hists[JRTC_ROUTER_MAX_LATENCY_STREAMS];
+    uint32_t num_latency_hists;
+    jrtc_router_latency_hist_t* last_latency_hist;
 };
 
+// Sets with up to this many apps are stored as a sorted list of app ids
+#define JRTC_ROUTER_APP_SET_LIST_SIZE (16)
+
+// A set of apps, e.g. the apps that made a request. Most streams have a few subscribers, so small sets
+// are kept as a sorted list of app ids and only large ones take a bitmap of max_num_apps bits.
+// Never modified once published, see jrtc_router_req_table.c.
+typedef struct jrtc_router_app_set
+{
+    ck_epoch_entry_t epoch_entry;
+    uint32_t num_apps;
+    uint32_t is_bitmap;
+    uint16_t list[JRTC_ROUTER_APP_SET_LIST_SIZE];
+    // Must be last, since it is followed by the bits. Only allocated for bitmap sets.
+    ck_bitmap_t bitmap;
+} jrtc_router_app_set_t;
+
+typedef struct jrtc_router_app_set_iterator
+{
+    const jrtc_router_app_set_t* set;
+    ck_bitmap_iterator_t bitmap_iter;
+    uint32_t pos;
+} jrtc_router_app_set_iterator_t;
+
+static inline void
+_jrtc_router_app_set_iterator_init(jrtc_router_app_set_iterator_t* iter, const jrtc_router_app_set_t* set)
+{
+    iter->set = set;
+    iter->pos = 0;
+    if (set->is_bitmap) {
+        ck_bitmap_iterator_init(&iter->bitmap_iter, &set->bitmap);
+    }
+}
+
+static inline bool
+_jrtc_router_app_set_next(jrtc_router_app_set_iterator_t* iter, unsigned int* app_id)
+{
+    if (iter->set->is_bitmap) {
+        return ck_bitmap_next(&iter->set->bitmap, &iter->bitmap_iter, app_id);
+    }
+    if (iter->pos == iter->set->num_apps) {
+        return false;
+    }
+    *app_id = iter->set->list[iter->pos++];
+    return true;
+}
+
+// Allocates an empty set. Bitmap sets can hold up to max_num_apps apps.
+jrtc_router_app_set_t*
+_jrtc_router_app_set_create(uint32_t max_num_apps, bool is_bitmap);
+
+bool
+_jrtc_router_app_set_test(const jrtc_router_app_set_t* set, unsigned int app_id);
+
+// Returns a new set with app_id added or removed. set may be NULL for an empty set.
+jrtc_router_app_set_t*
+_jrtc_router_app_set_update(const jrtc_router_app_set_t* set, uint32_t max_num_apps, unsigned int app_id, bool add);
+
+// Sets the bits of the apps of the set in bitmap
+void
+_jrtc_router_app_set_union(ck_bitmap_t* bitmap, const jrtc_router_app_set_t* set);
+
+// Replaces the apps of set with the ones of bitmap. set must be a bitmap set if bitmap has more than
+// JRTC_ROUTER_APP_SET_LIST_SIZE apps.
+void
+_jrtc_router_app_set_fill(jrtc_router_app_set_t* set, const ck_bitmap_t* bitmap, uint32_t max_num_apps);
+
+jrtc_router_app_set_t*
+_jrtc_router_app_set_from_bitmap(const ck_bitmap_t* bitmap, uint32_t max_num_apps);
+
 typedef struct jrtc_router_req_entry
 {
     jrtc_router_stream_id_t stream_id;
-    ck_bitmap_t* bitmap;
+    jrtc_router_app_set_t* apps;
     ck_epoch_entry_t epoch_entry;
 } jrtc_router_req_entry_t;
 
+#define JRTC_ROUTER_PATH_MAX_LEN (256)
+#define JRTC_ROUTER_PATH_MAX_SEGMENTS (32)
+#define JRTC_ROUTER_STREAM_CATALOG_INIT_ENTRIES (256)
+#define JRTC_ROUTER_STREAM_CATALOG_MAX_ENTRIES (65536)
+
+// A stream of the stream catalog. The key is the stream id of the stream with the
+// fwd_dst and the device_id cleared, so it only holds the hashes of the path and the name.
+typedef struct jrtc_router_catalog_entry
+{
+    jrtc_router_stream_id_t key;
+    char* name;
+    uint32_t num_segments;
+    // Point into path, where the '/' are replaced by '\0'
+    char* segments[JRTC_ROUTER_PATH_MAX_SEGMENTS];
+    char path[];
+} jrtc_router_catalog_entry_t;
+
+// A pattern request, kept at the trie node of the last segment of its pattern
+typedef struct jrtc_router_pattern_req
+{
+    struct jrtc_router_pattern_req* next;
+    uint16_t fwd_dst;
+    uint16_t device_id;
+    // NULL matches any name
+    char* name_pattern;
+    jrtc_router_app_set_t* apps;
+} jrtc_router_pattern_req_t;
+
+// A node of the trie of path segments
+typedef struct jrtc_router_path_node
+{
+    struct jrtc_router_path_node* next;
+    struct jrtc_router_path_node* children;
+    char* segment;
+    bool is_glob;
+    // The requests for the paths that end at this node
+    jrtc_router_pattern_req_t* reqs;
+    // The requests for the paths with more segments below this node
+    jrtc_router_pattern_req_t* prefix_reqs;
+} jrtc_router_path_node_t;
+
+// The pattern requests and the stream catalog they are matched against, see jrtc_router_path_index.c
+typedef struct jrtc_router_path_index
+{
+    ck_spinlock_t lock;
+    jrtc_router_path_node_t root;
+    // Read without the lock, to skip the matching when there are no pattern requests
+    uint32_t num_patterns;
+    ck_ht_t catalog;
+    uint32_t num_streams;
+} jrtc_router_path_index_t;
+
 typedef struct jrtc_router_req_table
 {
     ck_ht_t reqs;
-    ck_bitmap_t* lookup_result;
+    // Serializes the writers. Readers only need an epoch section of router_epoch.
     ck_spinlock_t lock;
+    // Bumped on every change of the request table, used to invalidate resolved routes
+    uint64_t generation;
     ck_epoch_t router_epoch;
-    ck_epoch_record_t router_epoch_record;
-    ck_epoch_record_t app_epoch_record[JRTC_ROUTER_MAX_NUM_APPS];
+    // Deferred frees of the writers, dispatched by the housekeeping thread. Only used under the lock.
+    ck_epoch_record_t gc_record;
+    uint64_t num_deferred;
+    uint32_t max_num_apps;
+    // Used by the apps to wait for the forwarding shards when they deregister, one per app
+    ck_epoch_record_t* app_epoch_record;
+    pthread_t gc_thread_id;
+    int gc_running;
+    // The requests with path patterns
+    jrtc_router_path_index_t path_index;
 } jrtc_router_req_table_t;
 
+#define JRTC_ROUTER_REQ_GC_INTERVAL_US (1000)
+
+// Initializes the request table and starts its housekeeping thread
+int
+_jrtc_router_req_table_init(jrtc_router_req_table_t* req_table, uint32_t max_num_apps, uint32_t init_num_entries);
+
+// Stops the housekeeping thread
+void
+_jrtc_router_req_table_stop(jrtc_router_req_table_t* req_table);
+
+void
+_jrtc_router_req_table_destroy(jrtc_router_req_table_t* req_table);
+
+// Adds an app to a request. Returns 1 on success, -1 on failure.
+int
+_jrtc_router_req_table_add(jrtc_router_req_table_t* req_table, int app_id, jrtc_router_stream_id_t* stream_id);
+
+// Removes an app from a request. Returns 1 if the app had made the request, 0 if not, -1 on failure.
+int
+_jrtc_router_req_table_remove(jrtc_router_req_table_t* req_table, int app_id, jrtc_router_stream_id_t* stream_id);
+
+// Removes an app from all the requests, including the pattern requests.
+// Returns the number of requests the app was removed from.
+int
+_jrtc_router_req_table_remove_app(jrtc_router_req_table_t* req_table, int app_id);
+
+// Adds or removes a latest-value request of an app. Returns 1 if the requests changed, 0 if not, -1 on failure.
+int
+_jrtc_router_latest_req_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    bool add);
+
+// Removes all the latest-value requests of an app
+void
+_jrtc_router_latest_req_clear(jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp);
+
+// Whether a stream matches a latest-value request of an app. Called by the shards, in their epoch section.
+bool
+_jrtc_router_latest_matches(struct dapp_router_ctx* dapp, const jrtc_router_stream_id_t* sid);
+
+// Stores the last buffer of a batch in the slot of the stream and releases the rest, along with the buffer it
+// replaces. Returns the number of buffers that were replaced, or -1 if there is no slot left for the stream.
+int
+_jrtc_router_latest_store(
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* sid,
+    void** bufs,
+    int num_bufs,
+    uint64_t ingress_ts_ns);
+
+// Receives the slots with a new message, in round-robin order. Only called by the app.
+int
+_jrtc_router_latest_receive(
+    struct dapp_router_ctx* dapp, jrtc_router_data_entry_t* data_entries, int entries_added, size_t num_entries);
+
+bool
+_jrtc_router_latest_pending(struct dapp_router_ctx* dapp);
+
+// Releases the buffers left in the slots and frees the requests and the slots of an app. The shards must no
+// longer see the app.
+void
+_jrtc_router_latest_destroy(struct dapp_router_ctx* dapp);
+
+int
+_jrtc_router_path_index_init(jrtc_router_path_index_t* path_index);
+
+void
+_jrtc_router_path_index_destroy(jrtc_router_path_index_t* path_index);
+
+// Adds an app to a pattern request. Returns 1 on success, -1 on failure.
+int
+_jrtc_router_path_index_add(
+    jrtc_router_req_table_t* req_table,
+    int app_id,
+    int fwd_dst,
+    int device_id,
+    const char* path_pattern,
+    const char* name_pattern);
+
+// Removes an app from a pattern request. Returns 1 if the app had made the request, 0 if not, -1 on failure.
+int
+_jrtc_router_path_index_remove(
+    jrtc_router_req_table_t* req_table,
+    int app_id,
+    int fwd_dst,
+    int device_id,
+    const char* path_pattern,
+    const char* name_pattern);
+
+// Removes an app from all the pattern requests. Returns the number of requests the app was removed from.
+int
+_jrtc_router_path_index_remove_app(jrtc_router_req_table_t* req_table, int app_id);
+
+// Returns 1 if the stream was added to the catalog, 0 if it was already there, -1 on failure
+int
+_jrtc_router_path_index_catalog_add(
+    jrtc_router_req_table_t* req_table, const char* stream_path, const char* stream_name);
+
+// Sets in lookup_res the apps of the pattern requests that match the stream id
+void
+_jrtc_router_path_index_match(
+    jrtc_router_req_table_t* req_table, const jrtc_router_stream_id_t* sid, ck_bitmap_t* lookup_res);
+
+#define JRTC_ROUTER_MULTICAST_MAX_GROUPS (256)
+#define JRTC_ROUTER_MULTICAST_MAX_INPUTS (16384)
+// A stream id with wildcards in fwd_dst and device_id stands for at most 6 fwd_dst values times 127 device ids
+#define JRTC_ROUTER_MULTICAST_MAX_TARGETS (6 * JRTC_ROUTER_DEVICE_ID_ANY)
+// The targets of a group are resolved again after this time, to reach the input channels created since
+#define JRTC_ROUTER_MULTICAST_TTL_NS (1000 * 1000 * 1000ULL)
+
+// The input channels that a wildcard stream id resolved to, see jrtc_router_multicast.c
+typedef struct jrtc_router_multicast_group
+{
+    jrtc_router_stream_id_t stream_id;
+    uint64_t generation;
+    uint64_t resolved_ns;
+    uint32_t num_targets;
+    jrtc_router_stream_id_t targets[];
+} jrtc_router_multicast_group_t;
+
+typedef struct jrtc_router_multicast
+{
+    ck_rwlock_t lock;
+    // The resolved groups by wildcard stream id
+    ck_ht_t groups;
+    // The exact stream ids of the input channels seen so far, only kept to resolve the groups again when one is new
+    ck_ht_t inputs;
+    // Bumped when a new input channel is seen, to resolve the groups again
+    uint64_t generation;
+} jrtc_router_multicast_t;
+
+int
+_jrtc_router_multicast_init(jrtc_router_multicast_t* multicast);
+
+void
+_jrtc_router_multicast_destroy(jrtc_router_multicast_t* multicast);
+
+// Records the stream id of an existing input channel
+void
+_jrtc_router_multicast_learn(jrtc_router_multicast_t* multicast, const jrtc_router_stream_id_t* stream_id);
+
+// Sends a message to all the input channels that match a stream id. Returns the number of channels reached, or
+// JRTC_ROUTER_MULTICAST_UNRESOLVED if the stream id cannot be resolved.
+int
+_jrtc_router_multicast_send(
+    jrtc_router_ctx_t router_ctx, const jrtc_router_stream_id_t* stream_id, void* data, size_t data_len);
+
+// Marks the input channel of an app with the given stream id as ready and wakes up the app, if there is one
+void
+_jrtc_router_in_channel_set_ready(jrtc_router_ctx_t router_ctx, jrtc_router_stream_id_t* stream_id);
+
+// A resolved route. Maps a concrete stream id to the union of the app sets of all
+// the requests that match it. Only the shard of the stream creates and updates its route.
+typedef struct jrtc_router_route_entry
+{
+    jrtc_router_stream_id_t stream_id;
+    uint64_t generation;
+    jrtc_router_app_set_t* apps;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t num_enqueued;
+    uint64_t num_dropped;
+    uint64_t queue_high_watermark;
+    // The slot of the stream in the stats region, if any
+    struct jrtc_router_stream_stats* stats;
+    // The limits and filters of the subscribed apps that have one on the stream
+    struct jrtc_router_route_limit* limits;
+    uint32_t num_limits;
+    uint64_t num_suppressed;
+    // The size of the messages of the stream, learned from jbpf with the first batch.
+    // 0 until then, JRTC_ROUTER_ELEM_SIZE_UNKNOWN if jbpf could not report it.
+    uint32_t elem_size;
+} jrtc_router_route_entry_t;
+
+#define JRTC_ROUTER_ELEM_SIZE_UNKNOWN (UINT32_MAX)
+// Messages of up to this size can be sized by the router, which covers every field a filter can read
+#define JRTC_ROUTER_MAX_LEARNED_ELEM_SIZE (JRTC_ROUTER_FILTER_MAX_OFFSET + sizeof(uint64_t))
+
+typedef struct jrtc_router_route_cache
+{
+    ck_ht_t routes;
+    uint32_t num_routes;
+} jrtc_router_route_cache_t;
+
+// Sampling and rate limits and content filters of requests, see jrtc_router_limit.c
+#define JRTC_ROUTER_MAX_REQ_LIMITS (64)
+
+typedef struct jrtc_router_req_limit_entry
+{
+    jrtc_router_stream_id_t stream_id;
+    struct jrtc_router_req_limit limit;
+    struct jrtc_router_req_filter filter;
+} jrtc_router_req_limit_entry_t;
+
+// The limits of an app. Never modified once published, like the app sets.
+typedef struct jrtc_router_req_limits
+{
+    ck_epoch_entry_t epoch_entry;
+    uint32_t num_limits;
+    jrtc_router_req_limit_entry_t limits[];
+} jrtc_router_req_limits_t;
+
+// The state of the limit of an app on a stream. Lives in the route of the stream, so only its shard uses it.
+typedef struct jrtc_router_route_limit
+{
+    int app_id;
+    struct jrtc_router_req_limit limit;
+    struct jrtc_router_req_filter filter;
+    uint32_t sample_count;
+    // Token bucket, in 1/JRTC_ROUTER_LIMIT_TOKEN messages
+    uint64_t tokens;
+    uint64_t max_tokens;
+    uint64_t last_ns;
+} jrtc_router_route_limit_t;
+
+// Sets or, with a NULL limit, removes the limit of an app for a stream id. Returns 1 if the limits changed,
+// 0 if not, -1 on failure.
+int
+_jrtc_router_limit_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    const struct jrtc_router_req_limit* limit);
+
+// Sets or, with a NULL filter, removes the filter of an app for a stream id. Returns 1 if the limits changed,
+// 0 if not, -1 if the filter is invalid or on failure.
+int
+_jrtc_router_filter_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    const struct jrtc_router_req_filter* filter);
+
+// Removes both the limit and the filter of an app for a stream id
+void
+_jrtc_router_limit_remove(
+    jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp, const jrtc_router_stream_id_t* stream_id);
+
+// Removes all the limits of an app
+void
+_jrtc_router_limit_clear(jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp);
+
+// Recomputes the limits of the apps of a route, keeping the state of the limits that did not change.
+// Called by the shard of the route, in its epoch section. Returns 0 on success, -1 on failure.
+int
+_jrtc_router_limit_resolve(jrtc_router_ctx_t router_ctx, jrtc_router_route_entry_t* route);
+
+// Returns the limit of an app on a route, or NULL if the app has none
+static inline jrtc_router_route_limit_t*
+_jrtc_router_limit_of(jrtc_router_route_entry_t* route, int app_id)
+{
+    for (uint32_t i = 0; i < route->num_limits; i++) {
+        if (route->limits[i].app_id == app_id) {
+            return &route->limits[i];
+        }
+    }
+    return NULL;
+}
+
+// Copies the buffers of a batch that pass the filter and then the limit to passed and returns their number.
+// elem_size is the size of the messages of the stream, 0 if unknown, in which case no filter matches. The buffers
+// that do not pass are counted in num_filtered_out, num_sampled_out and num_rate_limited and are left to the caller.
+int
+_jrtc_router_limit_apply(
+    jrtc_router_route_limit_t* limit,
+    void** bufs,
+    int num_bufs,
+    uint32_t elem_size,
+    uint64_t now_ns,
+    void** passed,
+    uint32_t* num_filtered_out,
+    uint32_t* num_sampled_out,
+    uint32_t* num_rate_limited);
+
+// Frees the limits of an app. The shards must no longer see the app.
+void
+_jrtc_router_limit_destroy(struct dapp_router_ctx* dapp);
+
+// The capture of the messages received by the router, see jrtc_router_capture.c
+
+typedef struct jrtc_router_capture
+{
+    char path[JRTC_ROUTER_CAPTURE_PATH_LEN];
+    uint64_t segment_size;
+    uint32_t max_segments;
+    uint32_t clock_source;
+    uint64_t start_ns;
+    // The segment being written, NULL if the router does not capture
+    struct jrtc_router_capture_header* header;
+    uint32_t segment;
+    uint64_t num_records;
+    uint64_t num_bytes;
+    uint64_t num_dropped;
+} jrtc_router_capture_t;
+
+// Creates the first segment of a capture, if the config has a path. Returns 0 on success, -1 on failure.
+int
+_jrtc_router_capture_init(
+    jrtc_router_capture_t* capture,
+    const struct jrtc_router_capture_config* config,
+    uint32_t clock_source,
+    uint64_t start_ns);
+
+// Appends a batch of messages to the capture. Called by the router thread before it forwards them.
+void
+_jrtc_router_capture_msgs(
+    jrtc_router_capture_t* capture,
+    struct jbpf_io_ctx* io_ctx,
+    void** bufs,
+    int num_bufs,
+    uint64_t ts_ns);
+
+// Closes the capture. Called by the router thread when it stops.
+void
+_jrtc_router_capture_close(jrtc_router_capture_t* capture);
+
+// A message dispatched by the router thread to a forwarding shard
+struct jrtc_router_shard_msg
+{
+    jrtc_router_stream_id_t stream_id;
+    void* buf;
+    uint64_t ingress_ts_ns;
+};
+
+CK_RING_PROTOTYPE(jrtc_router_shard_msg, jrtc_router_shard_msg)
+
+// A forwarding shard. Owns all the state needed to forward the messages of its streams.
+// With a single shard, the router thread forwards the messages itself using shard 0.
+typedef struct jrtc_router_shard
+{
+    uint32_t shard_id;
+    pthread_t thread_id;
+    // Set while the shard thread runs, which drains the queue of the shard once it is cleared
+    int running;
+    // The node the scratch state and the queue of the shard are placed on, -1 if none
+    int numa_node;
+
+    // Scratch space for the lookups that cannot be cached and for the fan out
+    ck_bitmap_t* lookup_result;
+    jrtc_router_app_set_t* lookup_set;
+    struct dapp_router_ctx** dapps;
+    // A message is serialized here to learn its size, once per route
+    uint8_t* msg_scratch;
+    ck_epoch_record_t epoch_record;
+    jrtc_router_route_cache_t route_cache;
+
+    // Messages dispatched by the router thread. Only used with more than one shard.
+    ck_ring_t ring CK_CC_CACHELINE;
+    struct jrtc_router_shard_msg* ring_buffer;
+    jrtc_router_doorbell_t doorbell;
+
+    struct jrtc_router_shard_stats stats;
+} jrtc_router_shard_t;
+
 typedef struct jrtc_router_app_data
 {
-    struct dapp_router_ctx* ctx[JRTC_ROUTER_MAX_NUM_APPS];
+    // Indexed by app id, max_num_apps entries
+    struct dapp_router_ctx** ctx;
     ck_bitmap_t* app_bitmap;
 } jrtc_router_app_data_t;
 
@@ -133,8 +954,29 @@ struct jrtc_router_ctx
     // Used for storing all the requests made by the apps
     jrtc_router_req_table_t req_table;
 
+    // The forwarding shards of the router
+    jrtc_router_shard_t shards[JRTC_ROUTER_MAX_NUM_SHARDS];
+    uint32_t num_shards;
+    jrtc_router_shard_partition_e shard_partition;
+    bool numa_shards;
+
     // Holds all the app metadata
     jrtc_router_app_data_t app_metadata;
+    uint32_t max_num_apps;
+    uint32_t max_app_queue_size;
+
+    // The input channels of all the apps by stream id, used by the producers to mark them ready
+    ck_ht_t in_channel_registry;
+    ck_rwlock_t in_channel_lock;
+
+    // Wildcard stream ids resolved to the input channels they reach
+    jrtc_router_multicast_t multicast;
+
+    jrtc_router_stats_region_t stats;
+    jrtc_router_timebase_t timebase;
+
+    // Only written by the router thread
+    jrtc_router_capture_t capture;
 };
 
 #endif
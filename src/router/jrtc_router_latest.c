@@ -0,0 +1,363 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "jbpf_io_channel.h"
+#include "jbpf_io_hash.h"
+
+#include "jrtc_router_int.h"
+
+// Latest-value (conflated) delivery.
+//
+// An app that only needs the current value of a stream, e.g. a dashboard or a slow controller, can make its
+// request with JRTC_ROUTER_REQ_MODE_LATEST. The messages of the matched streams are then not queued: the shard
+// keeps the last one in a slot per stream and releases the one it replaces, so an app that falls behind gets
+// fresh values instead of a full queue of stale ones, and never makes the router drop messages of other streams.
+//
+// The requests are kept in the request table as usual, so the shards find the app as for any other request, and
+// in a small copy-on-write list of the app, published and freed like the app sets of the request table. The slots
+// are taken by the shards on the first message of a stream and found through a lock-free index. A shard swaps the
+// buffer of a slot under the spinlock of the slot and sets its bit in the ready bitmap, and the app only visits
+// the slots whose bit is set.
+
+CK_EPOCH_CONTAINER(jrtc_router_latest_reqs_t, epoch_entry, latest_reqs_container)
+
+static void
+_jrtc_router_latest_reqs_destructor(ck_epoch_entry_t* p)
+{
+    jbpf_free(latest_reqs_container(p));
+    ck_pr_dec_64(&jrtc_router_get_ctx()->req_table.num_deferred);
+}
+
+// Publishes a new list of requests and defers the free of the old one. Called under the lock of the table.
+static void
+_jrtc_router_latest_reqs_publish(
+    jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp, jrtc_router_latest_reqs_t* reqs)
+{
+    jrtc_router_latest_reqs_t* old_reqs = dapp->latest_reqs;
+
+    ck_pr_fence_store();
+    ck_pr_store_ptr(&dapp->latest_reqs, reqs);
+
+    if (old_reqs) {
+        ck_pr_inc_64(&req_table->num_deferred);
+        ck_epoch_call(&req_table->gc_record, &old_reqs->epoch_entry, _jrtc_router_latest_reqs_destructor);
+    }
+}
+
+static jrtc_router_latest_table_t*
+_jrtc_router_latest_table_create(struct dapp_router_ctx* dapp)
+{
+    jrtc_router_latest_table_t* table;
+
+    table = _jrtc_router_mem_calloc(sizeof(jrtc_router_latest_table_t), dapp->numa_node);
+    if (!table) {
+        return NULL;
+    }
+
+    ck_spinlock_init(&table->lock);
+    for (int i = 0; i < JRTC_ROUTER_MAX_LATEST_STREAMS; i++) {
+        ck_spinlock_init(&table->slots[i].lock);
+    }
+    return table;
+}
+
+int
+_jrtc_router_latest_req_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    bool add)
+{
+    jrtc_router_latest_reqs_t* old_reqs;
+    jrtc_router_latest_reqs_t* reqs = NULL;
+    jrtc_router_latest_table_t* table;
+    uint32_t num_reqs = 0;
+    int found = -1;
+    int res = 1;
+
+    ck_spinlock_lock(&req_table->lock);
+
+    old_reqs = dapp->latest_reqs;
+    if (old_reqs) {
+        num_reqs = old_reqs->num_reqs;
+        for (uint32_t i = 0; i < num_reqs; i++) {
+            if (memcmp(&old_reqs->reqs[i], stream_id, sizeof(jrtc_router_stream_id_t)) == 0) {
+                found = i;
+                break;
+            }
+        }
+    }
+
+    if ((add && found >= 0) || (!add && found < 0)) {
+        res = 0;
+        goto out;
+    }
+
+    if (add && num_reqs >= JRTC_ROUTER_MAX_LATEST_REQS) {
+        jrtc_logger(JRTC_ERROR, "App %d has too many latest-value requests\n", dapp->app_id);
+        res = -1;
+        goto out;
+    }
+
+    if (add && !dapp->latest_table) {
+        table = _jrtc_router_latest_table_create(dapp);
+        if (!table) {
+            res = -1;
+            goto out;
+        }
+        // The table must be visible before the requests that lead the shards to it
+        ck_pr_fence_store();
+        ck_pr_store_ptr(&dapp->latest_table, table);
+    }
+
+    num_reqs = add ? num_reqs + 1 : num_reqs - 1;
+    if (num_reqs > 0) {
+        reqs = jbpf_calloc(1, sizeof(jrtc_router_latest_reqs_t) + num_reqs * sizeof(jrtc_router_stream_id_t));
+        if (!reqs) {
+            res = -1;
+            goto out;
+        }
+        for (uint32_t i = 0; old_reqs && i < old_reqs->num_reqs; i++) {
+            if (i != found) {
+                reqs->reqs[reqs->num_reqs++] = old_reqs->reqs[i];
+            }
+        }
+        if (add) {
+            reqs->reqs[reqs->num_reqs++] = *stream_id;
+        }
+    }
+
+    _jrtc_router_latest_reqs_publish(req_table, dapp, reqs);
+
+out:
+    ck_spinlock_unlock(&req_table->lock);
+    return res;
+}
+
+void
+_jrtc_router_latest_req_clear(jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp)
+{
+    ck_spinlock_lock(&req_table->lock);
+    if (dapp->latest_reqs) {
+        _jrtc_router_latest_reqs_publish(req_table, dapp, NULL);
+    }
+    ck_spinlock_unlock(&req_table->lock);
+}
+
+bool
+_jrtc_router_latest_matches(struct dapp_router_ctx* dapp, const jrtc_router_stream_id_t* sid)
+{
+    jrtc_router_latest_reqs_t* reqs;
+
+    reqs = ck_pr_load_ptr(&dapp->latest_reqs);
+    if (!reqs) {
+        return false;
+    }
+    ck_pr_fence_load();
+
+    for (uint32_t i = 0; i < reqs->num_reqs; i++) {
+        if (jrtc_router_stream_id_matches_req(sid, &reqs->reqs[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns the slot of a stream, taking a new one if needed, or -1 if there are no slots left
+static int
+_jrtc_router_latest_slot_get(jrtc_router_latest_table_t* table, const jrtc_router_stream_id_t* sid)
+{
+    uint32_t h, pos;
+    uint16_t v;
+    int slot = -1;
+    bool locked = false;
+
+    h = (uint32_t)(MurmurHash64A(sid, JRTC_ROUTER_STREAM_ID_BYTE_LEN, 6602834) % JRTC_ROUTER_LATEST_INDEX_SIZE);
+
+    // The index is only ever added to, so a lookup that reaches an empty entry without the stream can take the
+    // lock and retry to add it
+retry:
+    for (uint32_t i = 0; i < JRTC_ROUTER_LATEST_INDEX_SIZE; i++) {
+        pos = (h + i) % JRTC_ROUTER_LATEST_INDEX_SIZE;
+        v = ck_pr_load_16(&table->index[pos]);
+        if (v == 0) {
+            if (!locked) {
+                ck_spinlock_lock(&table->lock);
+                locked = true;
+                goto retry;
+            }
+            if (table->num_slots >= JRTC_ROUTER_MAX_LATEST_STREAMS) {
+                break;
+            }
+            slot = table->num_slots;
+            table->slots[slot].entry.stream_id = *sid;
+            // The slot must be set before it can be found
+            ck_pr_fence_store();
+            ck_pr_store_16(&table->index[pos], (uint16_t)(slot + 1));
+            ck_pr_store_32(&table->num_slots, slot + 1);
+            break;
+        }
+        ck_pr_fence_load();
+        if (memcmp(&table->slots[v - 1].entry.stream_id, sid, sizeof(jrtc_router_stream_id_t)) == 0) {
+            slot = v - 1;
+            break;
+        }
+    }
+
+    if (locked) {
+        ck_spinlock_unlock(&table->lock);
+    }
+    return slot;
+}
+
+int
+_jrtc_router_latest_store(
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* sid,
+    void** bufs,
+    int num_bufs,
+    uint64_t ingress_ts_ns)
+{
+    jrtc_router_latest_table_t* table;
+    jrtc_router_latest_slot_t* slot;
+    void* old_data;
+    int slot_id;
+    int num_replaced;
+
+    table = ck_pr_load_ptr(&dapp->latest_table);
+    if (!table || num_bufs <= 0) {
+        return -1;
+    }
+
+    slot_id = _jrtc_router_latest_slot_get(table, sid);
+    if (slot_id < 0) {
+        return -1;
+    }
+    slot = &table->slots[slot_id];
+
+    ck_spinlock_lock(&slot->lock);
+    old_data = slot->entry.data;
+    slot->entry.data = bufs[num_bufs - 1];
+    slot->entry.ingress_ts_ns = ingress_ts_ns;
+    ck_spinlock_unlock(&slot->lock);
+
+    ck_pr_or_64(&table->ready[slot_id / 64], 1ULL << (slot_id % 64));
+
+    // Only the last buffer of the batch is kept
+    for (int i = 0; i < num_bufs - 1; i++) {
+        jbpf_io_channel_release_buf(bufs[i]);
+    }
+    num_replaced = num_bufs - 1;
+    if (old_data) {
+        jbpf_io_channel_release_buf(old_data);
+        num_replaced++;
+    }
+
+    return num_replaced;
+}
+
+int
+_jrtc_router_latest_receive(
+    struct dapp_router_ctx* dapp, jrtc_router_data_entry_t* data_entries, int entries_added, size_t num_entries)
+{
+    jrtc_router_latest_table_t* table;
+    jrtc_router_latest_slot_t* slot;
+    uint32_t num_words, start, word, slot_id;
+    uint64_t bits, bit;
+
+    table = ck_pr_load_ptr(&dapp->latest_table);
+    if (!table) {
+        return entries_added;
+    }
+
+    num_words = (ck_pr_load_32(&table->num_slots) + 63) / 64;
+    if (num_words == 0) {
+        return entries_added;
+    }
+
+    // Starts from the slot after the last one received, so that all the streams get their turn when the app
+    // asks for fewer entries than there are ready slots. The first word is visited again at the end for the
+    // slots before the start.
+    start = table->next_slot % (num_words * 64);
+    for (uint32_t n = 0; n <= num_words && entries_added < num_entries; n++) {
+        word = (start / 64 + n) % num_words;
+        bits = ck_pr_load_64(&table->ready[word]);
+        if (n == 0) {
+            bits &= ~0ULL << (start % 64);
+        }
+        if (bits == 0) {
+            continue;
+        }
+        ck_pr_and_64(&table->ready[word], ~bits);
+
+        while (bits) {
+            if (entries_added >= num_entries) {
+                // Leave the rest for the next call
+                ck_pr_or_64(&table->ready[word], bits);
+                break;
+            }
+            bit = bits & -bits;
+            bits &= ~bit;
+            slot_id = word * 64 + __builtin_ctzll(bit);
+            slot = &table->slots[slot_id];
+
+            ck_spinlock_lock(&slot->lock);
+            data_entries[entries_added] = slot->entry;
+            slot->entry.data = NULL;
+            ck_spinlock_unlock(&slot->lock);
+
+            // The slot may have been taken by an earlier pass after its bit was set again
+            if (data_entries[entries_added].data) {
+                entries_added++;
+                table->next_slot = slot_id + 1;
+            }
+        }
+    }
+
+    return entries_added;
+}
+
+bool
+_jrtc_router_latest_pending(struct dapp_router_ctx* dapp)
+{
+    jrtc_router_latest_table_t* table;
+    uint32_t num_words;
+
+    table = ck_pr_load_ptr(&dapp->latest_table);
+    if (!table) {
+        return false;
+    }
+
+    num_words = (ck_pr_load_32(&table->num_slots) + 63) / 64;
+    for (uint32_t i = 0; i < num_words; i++) {
+        if (ck_pr_load_64(&table->ready[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+_jrtc_router_latest_destroy(struct dapp_router_ctx* dapp)
+{
+    jrtc_router_latest_table_t* table = dapp->latest_table;
+
+    if (dapp->latest_reqs) {
+        jbpf_free(dapp->latest_reqs);
+        dapp->latest_reqs = NULL;
+    }
+
+    if (!table) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < table->num_slots; i++) {
+        if (table->slots[i].entry.data) {
+            jbpf_io_channel_release_buf(table->slots[i].entry.data);
+        }
+    }
+    _jrtc_router_mem_free(table);
+    dapp->latest_table = NULL;
+}
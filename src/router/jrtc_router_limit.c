@@ -0,0 +1,484 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "jrtc_router_int.h"
+
+// Sampling and rate limits and content filters of requests.
+//
+// Monitoring apps often only want one in N messages of a stream, a few messages per second, or the messages of a
+// given cell or UE. The router applies these limits in the fan-out, before it takes a reference to a message for
+// the app or queues it, so the app does not pay for the messages it would throw away.
+//
+// The filters are declarative predicates on integer fields of the payload rather than programs: they are checked
+// once when they are set and cost a few loads and compares per message, with nothing to verify or run in a VM.
+//
+// The limits and filters of an app are a small copy-on-write list, published and freed like the app sets of the
+// request table, and setting one bumps the generation of the table, so that the routes resolve them again. The
+// state of a limit (sample counter and token bucket) is per stream and lives in the route of the stream, which is
+// only used by the shard that owns the stream, so it is updated without any atomic operation.
+
+// One message in the token bucket. Tokens are added at max_rate per second, i.e. max_rate per ns in these units.
+#define JRTC_ROUTER_LIMIT_TOKEN (1000UL * 1000 * 1000)
+
+CK_EPOCH_CONTAINER(jrtc_router_req_limits_t, epoch_entry, req_limits_container)
+
+static void
+_jrtc_router_req_limits_destructor(ck_epoch_entry_t* p)
+{
+    jbpf_free(req_limits_container(p));
+    ck_pr_dec_64(&jrtc_router_get_ctx()->req_table.num_deferred);
+}
+
+// Publishes a new list of limits and defers the free of the old one. Called under the lock of the table.
+static void
+_jrtc_router_req_limits_publish(
+    jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp, jrtc_router_req_limits_t* limits)
+{
+    jrtc_router_req_limits_t* old_limits = dapp->req_limits;
+
+    ck_pr_fence_store();
+    ck_pr_store_ptr(&dapp->req_limits, limits);
+
+    // The routes must resolve the limits again
+    ck_pr_fence_store();
+    ck_pr_inc_64(&req_table->generation);
+
+    if (old_limits) {
+        ck_pr_inc_64(&req_table->num_deferred);
+        ck_epoch_call(&req_table->gc_record, &old_limits->epoch_entry, _jrtc_router_req_limits_destructor);
+    }
+}
+
+static bool
+_jrtc_router_limit_is_none(const struct jrtc_router_req_limit* limit)
+{
+    return !limit || (limit->sample_every <= 1 && limit->max_rate == 0);
+}
+
+static bool
+_jrtc_router_filter_is_valid(const struct jrtc_router_req_filter* filter)
+{
+    const struct jrtc_router_filter_cond* cond;
+
+    if (filter->num_conds > JRTC_ROUTER_FILTER_MAX_CONDS) {
+        return false;
+    }
+    for (uint32_t i = 0; i < filter->num_conds; i++) {
+        cond = &filter->conds[i];
+        if ((cond->size != 1 && cond->size != 2 && cond->size != 4 && cond->size != 8) ||
+            cond->op >= JRTC_ROUTER_FILTER_NUM_OPS ||
+            (uint64_t)cond->offset + cond->size > JRTC_ROUTER_FILTER_MAX_OFFSET) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sets or removes the limit and the filter of an app for a stream id. An entry without a limit or a filter is
+// removed. Both are stored without their unused fields, so that entries can be compared with memcmp.
+static int
+_jrtc_router_limit_entry_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    const struct jrtc_router_req_limit* limit,
+    const struct jrtc_router_req_filter* filter,
+    bool set_limit,
+    bool set_filter)
+{
+    jrtc_router_req_limits_t* old_limits;
+    jrtc_router_req_limits_t* limits = NULL;
+    jrtc_router_req_limit_entry_t entry;
+    uint32_t num_limits = 0;
+    bool remove;
+    int found = -1;
+    int res = 1;
+
+    ck_spinlock_lock(&req_table->lock);
+
+    old_limits = dapp->req_limits;
+    if (old_limits) {
+        num_limits = old_limits->num_limits;
+        for (uint32_t i = 0; i < num_limits; i++) {
+            if (memcmp(&old_limits->limits[i].stream_id, stream_id, sizeof(jrtc_router_stream_id_t)) == 0) {
+                found = i;
+                break;
+            }
+        }
+    }
+
+    if (found >= 0) {
+        entry = old_limits->limits[found];
+    } else {
+        memset(&entry, 0, sizeof(jrtc_router_req_limit_entry_t));
+        entry.stream_id = *stream_id;
+    }
+    if (set_limit) {
+        memset(&entry.limit, 0, sizeof(struct jrtc_router_req_limit));
+        if (!_jrtc_router_limit_is_none(limit)) {
+            entry.limit = *limit;
+        }
+    }
+    if (set_filter) {
+        memset(&entry.filter, 0, sizeof(struct jrtc_router_req_filter));
+        for (uint32_t i = 0; filter && i < filter->num_conds; i++) {
+            entry.filter.conds[i].offset = filter->conds[i].offset;
+            entry.filter.conds[i].size = filter->conds[i].size;
+            entry.filter.conds[i].is_signed = filter->conds[i].is_signed ? 1 : 0;
+            entry.filter.conds[i].op = filter->conds[i].op;
+            entry.filter.conds[i].value = filter->conds[i].value;
+        }
+        entry.filter.num_conds = filter ? filter->num_conds : 0;
+    }
+    remove = _jrtc_router_limit_is_none(&entry.limit) && entry.filter.num_conds == 0;
+
+    if (remove && found < 0) {
+        res = 0;
+        goto out;
+    }
+    if (!remove && found >= 0 &&
+        memcmp(&old_limits->limits[found], &entry, sizeof(jrtc_router_req_limit_entry_t)) == 0) {
+        res = 0;
+        goto out;
+    }
+
+    if (!remove && found < 0) {
+        if (num_limits >= JRTC_ROUTER_MAX_REQ_LIMITS) {
+            jrtc_logger(JRTC_ERROR, "App %d has too many request limits\n", dapp->app_id);
+            res = -1;
+            goto out;
+        }
+        num_limits++;
+    } else if (remove) {
+        num_limits--;
+    }
+
+    if (num_limits > 0) {
+        limits = jbpf_calloc(1, sizeof(jrtc_router_req_limits_t) + num_limits * sizeof(jrtc_router_req_limit_entry_t));
+        if (!limits) {
+            res = -1;
+            goto out;
+        }
+        // The limits keep the order in which they were first set
+        for (uint32_t i = 0; old_limits && i < old_limits->num_limits; i++) {
+            if (i != found) {
+                limits->limits[limits->num_limits++] = old_limits->limits[i];
+            } else if (!remove) {
+                limits->limits[limits->num_limits++] = entry;
+            }
+        }
+        if (!remove && found < 0) {
+            limits->limits[limits->num_limits++] = entry;
+        }
+    }
+
+    _jrtc_router_req_limits_publish(req_table, dapp, limits);
+
+out:
+    ck_spinlock_unlock(&req_table->lock);
+    return res;
+}
+
+int
+_jrtc_router_limit_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    const struct jrtc_router_req_limit* limit)
+{
+    return _jrtc_router_limit_entry_update(req_table, dapp, stream_id, limit, NULL, true, false);
+}
+
+int
+_jrtc_router_filter_update(
+    jrtc_router_req_table_t* req_table,
+    struct dapp_router_ctx* dapp,
+    const jrtc_router_stream_id_t* stream_id,
+    const struct jrtc_router_req_filter* filter)
+{
+    if (filter && !_jrtc_router_filter_is_valid(filter)) {
+        jrtc_logger(JRTC_ERROR, "Invalid request filter for app %d\n", dapp->app_id);
+        return -1;
+    }
+    return _jrtc_router_limit_entry_update(req_table, dapp, stream_id, NULL, filter, false, true);
+}
+
+void
+_jrtc_router_limit_remove(
+    jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp, const jrtc_router_stream_id_t* stream_id)
+{
+    _jrtc_router_limit_entry_update(req_table, dapp, stream_id, NULL, NULL, true, true);
+}
+
+void
+_jrtc_router_limit_clear(jrtc_router_req_table_t* req_table, struct dapp_router_ctx* dapp)
+{
+    ck_spinlock_lock(&req_table->lock);
+    if (dapp->req_limits) {
+        _jrtc_router_req_limits_publish(req_table, dapp, NULL);
+    }
+    ck_spinlock_unlock(&req_table->lock);
+}
+
+// Returns the first limit of an app that matches a stream, or NULL
+static const jrtc_router_req_limit_entry_t*
+_jrtc_router_limit_find(jrtc_router_ctx_t router_ctx, int app_id, const jrtc_router_stream_id_t* sid)
+{
+    struct dapp_router_ctx* dapp;
+    jrtc_router_req_limits_t* limits;
+
+    dapp = ck_pr_load_ptr(&router_ctx->app_metadata.ctx[app_id]);
+    if (!dapp) {
+        return NULL;
+    }
+    limits = ck_pr_load_ptr(&dapp->req_limits);
+    if (!limits) {
+        return NULL;
+    }
+    ck_pr_fence_load();
+
+    for (uint32_t i = 0; i < limits->num_limits; i++) {
+        if (jrtc_router_stream_id_matches_req(sid, &limits->limits[i].stream_id)) {
+            return &limits->limits[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+_jrtc_router_route_limit_init(
+    jrtc_router_route_limit_t* route_limit, int app_id, const jrtc_router_req_limit_entry_t* entry)
+{
+    const struct jrtc_router_req_limit* limit = &entry->limit;
+    uint64_t burst;
+
+    memset(route_limit, 0, sizeof(jrtc_router_route_limit_t));
+    route_limit->app_id = app_id;
+    route_limit->limit = *limit;
+    route_limit->filter = entry->filter;
+
+    // The bucket starts full
+    burst = limit->burst > 0 ? limit->burst : limit->max_rate;
+    route_limit->max_tokens = (burst > 0 ? burst : 1) * JRTC_ROUTER_LIMIT_TOKEN;
+    route_limit->tokens = route_limit->max_tokens;
+}
+
+int
+_jrtc_router_limit_resolve(jrtc_router_ctx_t router_ctx, jrtc_router_route_entry_t* route)
+{
+    const jrtc_router_req_limit_entry_t* entry;
+    jrtc_router_route_limit_t* limits = NULL;
+    jrtc_router_route_limit_t* old_limit;
+    jrtc_router_app_set_iterator_t iter;
+    unsigned int app_id;
+    uint32_t num_limits = 0, max_limits;
+
+    _jrtc_router_app_set_iterator_init(&iter, route->apps);
+    while (_jrtc_router_app_set_next(&iter, &app_id)) {
+        if (_jrtc_router_limit_find(router_ctx, app_id, &route->stream_id)) {
+            num_limits++;
+        }
+    }
+
+    if (num_limits > 0) {
+        limits = jbpf_calloc(num_limits, sizeof(jrtc_router_route_limit_t));
+        if (!limits) {
+            return -1;
+        }
+
+        // The limits may change in the meantime, then the generation has changed too and the route is resolved
+        // again on the next batch
+        max_limits = num_limits;
+        num_limits = 0;
+        _jrtc_router_app_set_iterator_init(&iter, route->apps);
+        while (num_limits < max_limits && _jrtc_router_app_set_next(&iter, &app_id)) {
+            entry = _jrtc_router_limit_find(router_ctx, app_id, &route->stream_id);
+            if (!entry) {
+                continue;
+            }
+            // Keep the counters of the limits that did not change
+            old_limit = _jrtc_router_limit_of(route, app_id);
+            if (old_limit && memcmp(&old_limit->limit, &entry->limit, sizeof(struct jrtc_router_req_limit)) == 0) {
+                limits[num_limits] = *old_limit;
+                limits[num_limits].filter = entry->filter;
+            } else {
+                _jrtc_router_route_limit_init(&limits[num_limits], app_id, entry);
+            }
+            num_limits++;
+        }
+    }
+
+    // Only this shard reads the limits of the route, so the old ones can be freed right away
+    jbpf_free(route->limits);
+    route->limits = limits;
+    route->num_limits = num_limits;
+
+    return 0;
+}
+
+// Reads the field of a condition, sign-extended if it is signed
+static inline uint64_t
+_jrtc_router_filter_field(const struct jrtc_router_filter_cond* cond, const uint8_t* data)
+{
+    uint8_t v8;
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    switch (cond->size) {
+    case 1:
+        memcpy(&v8, data + cond->offset, sizeof(v8));
+        return cond->is_signed ? (uint64_t)(int64_t)(int8_t)v8 : v8;
+    case 2:
+        memcpy(&v16, data + cond->offset, sizeof(v16));
+        return cond->is_signed ? (uint64_t)(int64_t)(int16_t)v16 : v16;
+    case 4:
+        memcpy(&v32, data + cond->offset, sizeof(v32));
+        return cond->is_signed ? (uint64_t)(int64_t)(int32_t)v32 : v32;
+    default:
+        memcpy(&v64, data + cond->offset, sizeof(v64));
+        return v64;
+    }
+}
+
+static inline bool
+_jrtc_router_filter_matches(const struct jrtc_router_req_filter* filter, const void* data, uint32_t elem_size)
+{
+    const struct jrtc_router_filter_cond* cond;
+    uint64_t field;
+    int cmp;
+
+    for (uint32_t i = 0; i < filter->num_conds; i++) {
+        cond = &filter->conds[i];
+        // The field must be in the message. Without the size of the message, nothing can be read safely.
+        if (elem_size == 0 || cond->offset + cond->size > elem_size) {
+            return false;
+        }
+
+        field = _jrtc_router_filter_field(cond, data);
+        if (cond->is_signed) {
+            cmp = (int64_t)field < (int64_t)cond->value ? -1 : (int64_t)field > (int64_t)cond->value;
+        } else {
+            cmp = field < cond->value ? -1 : field > cond->value;
+        }
+
+        switch (cond->op) {
+        case JRTC_ROUTER_FILTER_EQ:
+            if (cmp != 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_NE:
+            if (cmp == 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_LT:
+            if (cmp >= 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_LE:
+            if (cmp > 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_GT:
+            if (cmp <= 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_GE:
+            if (cmp < 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_MASK_ANY:
+            if ((field & cond->value) == 0) {
+                return false;
+            }
+            break;
+        case JRTC_ROUTER_FILTER_MASK_ALL:
+            if ((field & cond->value) != cond->value) {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+_jrtc_router_limit_apply(
+    jrtc_router_route_limit_t* limit,
+    void** bufs,
+    int num_bufs,
+    uint32_t elem_size,
+    uint64_t now_ns,
+    void** passed,
+    uint32_t* num_filtered_out,
+    uint32_t* num_sampled_out,
+    uint32_t* num_rate_limited)
+{
+    uint64_t elapsed_ns;
+    int num_passed = 0;
+    bool skip;
+
+    // Refill the bucket once for the whole batch
+    if (limit->limit.max_rate > 0 && now_ns > limit->last_ns) {
+        elapsed_ns = now_ns - limit->last_ns;
+        if (limit->last_ns == 0 || elapsed_ns >= limit->max_tokens / limit->limit.max_rate) {
+            limit->tokens = limit->max_tokens;
+        } else {
+            limit->tokens += elapsed_ns * limit->limit.max_rate;
+            if (limit->tokens > limit->max_tokens) {
+                limit->tokens = limit->max_tokens;
+            }
+        }
+        limit->last_ns = now_ns;
+    }
+
+    for (int i = 0; i < num_bufs; i++) {
+        // The messages that do not match the filter do not count for the sampling and the rate
+        if (limit->filter.num_conds > 0 && !_jrtc_router_filter_matches(&limit->filter, bufs[i], elem_size)) {
+            (*num_filtered_out)++;
+            continue;
+        }
+
+        if (limit->limit.sample_every > 1) {
+            skip = limit->sample_count != 0;
+            if (++limit->sample_count >= limit->limit.sample_every) {
+                limit->sample_count = 0;
+            }
+            if (skip) {
+                (*num_sampled_out)++;
+                continue;
+            }
+        }
+
+        if (limit->limit.max_rate > 0) {
+            if (limit->tokens < JRTC_ROUTER_LIMIT_TOKEN) {
+                (*num_rate_limited)++;
+                continue;
+            }
+            limit->tokens -= JRTC_ROUTER_LIMIT_TOKEN;
+        }
+
+        passed[num_passed++] = bufs[i];
+    }
+
+    return num_passed;
+}
+
+void
+_jrtc_router_limit_destroy(struct dapp_router_ctx* dapp)
+{
+    if (dapp->req_limits) {
+        jbpf_free(dapp->req_limits);
+        dapp->req_limits = NULL;
+    }
+}
@@ -0,0 +1,272 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "jrtc_router_int.h"
+
+// Memory of the router state that is touched on every message, i.e. the queues of the apps and of the shards,
+// the scratch state of the shards and the hash tables of the router.
+//
+// It is placed on a NUMA node, see jrtc_router_numa.c, and backed by huge pages as configured with
+// jrtc_router_config.hugepages, so that the router thread does not spend its time on TLB misses. Explicit huge
+// pages are taken from the hugetlb pool and fall back to transparent huge pages when the pool has none left.
+// Huge pages are only used for allocations of at least JRTC_ROUTER_HUGEPAGE_MIN_ALLOC_SIZE, and each of them
+// takes at least one huge page. Other allocations come from jbpf_calloc().
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT (26)
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+#define JRTC_ROUTER_HUGEPAGE_SIZE_2MB (2UL * 1024 * 1024)
+#define JRTC_ROUTER_HUGEPAGE_SIZE_1GB (1024UL * 1024 * 1024)
+
+// Stored right before the memory returned by _jrtc_router_mem_calloc()
+typedef struct jrtc_router_mem_hdr
+{
+    void* base;
+    size_t len;
+    bool is_mapped;
+} jrtc_router_mem_hdr_t;
+
+#define JRTC_ROUTER_MEM_HDR_SIZE                                                                               \
+    ((sizeof(jrtc_router_mem_hdr_t) + JRTC_ROUTER_CACHELINE_SIZE - 1) & ~(size_t)(JRTC_ROUTER_CACHELINE_SIZE - 1))
+
+static jrtc_router_hugepages_e g_hugepages = JRTC_ROUTER_HUGEPAGES_NONE;
+static uint32_t g_hugetlb_warned = 0;
+
+void
+_jrtc_router_mem_init(jrtc_router_hugepages_e hugepages)
+{
+    if (hugepages > JRTC_ROUTER_HUGEPAGES_1GB) {
+        jrtc_logger(JRTC_WARN, "Invalid huge page setting %d, using none\n", hugepages);
+        hugepages = JRTC_ROUTER_HUGEPAGES_NONE;
+    }
+    g_hugepages = hugepages;
+}
+
+// Maps len bytes from the hugetlb pool, rounded up to the huge page size. Returns MAP_FAILED if the pool is empty.
+static void*
+_jrtc_router_mem_map_hugetlb(size_t* len)
+{
+    size_t page_size;
+    int flags;
+    void* base;
+
+    // 1 GB pages would waste most of the page for the usual queue sizes
+    if (g_hugepages == JRTC_ROUTER_HUGEPAGES_1GB && *len > JRTC_ROUTER_HUGEPAGE_SIZE_1GB / 2) {
+        page_size = JRTC_ROUTER_HUGEPAGE_SIZE_1GB;
+        flags = MAP_HUGE_1GB;
+    } else {
+        page_size = JRTC_ROUTER_HUGEPAGE_SIZE_2MB;
+        flags = MAP_HUGE_2MB;
+    }
+
+    base = mmap(
+        NULL,
+        (*len + page_size - 1) & ~(page_size - 1),
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | flags,
+        -1,
+        0);
+    if (base == MAP_FAILED) {
+        if (ck_pr_fas_32(&g_hugetlb_warned, 1) == 0) {
+            jrtc_logger(
+                JRTC_WARN,
+                "No %lu kB huge pages left, falling back to transparent huge pages\n",
+                page_size / 1024);
+        }
+        return MAP_FAILED;
+    }
+
+    *len = (*len + page_size - 1) & ~(page_size - 1);
+    return base;
+}
+
+void*
+_jrtc_router_mem_calloc(size_t size, int node)
+{
+    jrtc_router_mem_hdr_t* hdr;
+    void* base = MAP_FAILED;
+    size_t len;
+    uintptr_t ptr;
+    bool huge;
+
+    if (node >= JRTC_ROUTER_NUMA_MAX_NODES || _jrtc_router_numa_num_nodes() <= 1) {
+        node = -1;
+    }
+    huge = g_hugepages != JRTC_ROUTER_HUGEPAGES_NONE && size >= JRTC_ROUTER_HUGEPAGE_MIN_ALLOC_SIZE;
+
+    if (node < 0 && !huge) {
+        len = JRTC_ROUTER_MEM_HDR_SIZE + size + JRTC_ROUTER_CACHELINE_SIZE;
+        base = jbpf_calloc(1, len);
+        if (!base) {
+            return NULL;
+        }
+        ptr = ((uintptr_t)base + JRTC_ROUTER_MEM_HDR_SIZE + JRTC_ROUTER_CACHELINE_SIZE - 1) &
+              ~(uintptr_t)(JRTC_ROUTER_CACHELINE_SIZE - 1);
+    } else {
+        len = JRTC_ROUTER_MEM_HDR_SIZE + size;
+        if (huge && g_hugepages != JRTC_ROUTER_HUGEPAGES_THP) {
+            base = _jrtc_router_mem_map_hugetlb(&len);
+        }
+        if (base == MAP_FAILED) {
+            base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                return NULL;
+            }
+            if (huge) {
+                madvise(base, len, MADV_HUGEPAGE);
+            }
+        }
+        if (node >= 0 && _jrtc_router_numa_bind(base, len, node, false) < 0) {
+            jrtc_logger(JRTC_WARN, "Could not bind %zu bytes to NUMA node %d\n", size, node);
+        }
+        // Fault the pages in now, so that they are placed by the policy and not by the first user
+        memset(base, 0, len);
+        ptr = (uintptr_t)base + JRTC_ROUTER_MEM_HDR_SIZE;
+    }
+
+    hdr = (jrtc_router_mem_hdr_t*)(ptr - sizeof(jrtc_router_mem_hdr_t));
+    hdr->base = base;
+    hdr->len = len;
+    hdr->is_mapped = node >= 0 || huge;
+
+    return (void*)ptr;
+}
+
+void
+_jrtc_router_mem_free(void* ptr)
+{
+    jrtc_router_mem_hdr_t* hdr;
+
+    if (!ptr) {
+        return;
+    }
+
+    hdr = (jrtc_router_mem_hdr_t*)((uintptr_t)ptr - sizeof(jrtc_router_mem_hdr_t));
+    if (hdr->is_mapped) {
+        munmap(hdr->base, hdr->len);
+    } else {
+        jbpf_free(hdr->base);
+    }
+}
+
+static void
+_jrtc_router_mem_add_mapping(
+    struct jrtc_router_mem_stats* stats, uint64_t size_kb, uint64_t page_size_kb, bool is_ipc)
+{
+    if (page_size_kb >= JRTC_ROUTER_HUGEPAGE_SIZE_1GB / 1024) {
+        stats->mapped_1gb_kb += size_kb;
+    } else if (page_size_kb >= JRTC_ROUTER_HUGEPAGE_SIZE_2MB / 1024) {
+        stats->mapped_2mb_kb += size_kb;
+    } else {
+        stats->mapped_4kb_kb += size_kb;
+    }
+
+    if (is_ipc) {
+        stats->ipc_kb += size_kb;
+        stats->ipc_page_size_kb = page_size_kb;
+    }
+}
+
+int
+_jrtc_router_mem_read_stats(const char* ipc_name, struct jrtc_router_mem_stats* stats)
+{
+    char line[512];
+    char path[256];
+    uint64_t value, size_kb = 0, page_size_kb = 0;
+    unsigned long start, end;
+    bool in_mapping = false, is_ipc = false;
+    FILE* f;
+
+    memset(stats, 0, sizeof(struct jrtc_router_mem_stats));
+    stats->hugepages = g_hugepages;
+
+    f = fopen("/proc/self/smaps", "r");
+    if (!f) {
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        // The first line of a mapping is "start-end perms offset dev inode [path]"
+        if (sscanf(line, "%lx-%lx", &start, &end) == 2) {
+            if (in_mapping) {
+                _jrtc_router_mem_add_mapping(stats, size_kb, page_size_kb, is_ipc);
+            }
+            path[0] = '\0';
+            sscanf(line, "%*x-%*x %*s %*x %*x:%*x %*u %255s", path);
+            is_ipc = ipc_name && ipc_name[0] && strstr(path, ipc_name);
+            in_mapping = true;
+            size_kb = 0;
+            page_size_kb = 0;
+        } else if (sscanf(line, "Size: %lu kB", &value) == 1) {
+            size_kb = value;
+        } else if (sscanf(line, "KernelPageSize: %lu kB", &value) == 1) {
+            page_size_kb = value;
+        } else if (sscanf(line, "AnonHugePages: %lu kB", &value) == 1) {
+            stats->thp_kb += value;
+        }
+    }
+    if (in_mapping) {
+        _jrtc_router_mem_add_mapping(stats, size_kb, page_size_kb, is_ipc);
+    }
+    fclose(f);
+
+    f = fopen("/proc/meminfo", "r");
+    if (f) {
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "HugePages_Total: %lu", &value) == 1) {
+                stats->hugetlb_pages_total = value;
+            } else if (sscanf(line, "HugePages_Free: %lu", &value) == 1) {
+                stats->hugetlb_pages_free = value;
+            } else if (sscanf(line, "Hugepagesize: %lu kB", &value) == 1) {
+                stats->hugetlb_page_size_kb = value;
+            }
+        }
+        fclose(f);
+    }
+
+    return 0;
+}
+
+void
+_jrtc_router_mem_log_stats(const char* ipc_name)
+{
+    struct jrtc_router_mem_stats stats;
+
+    if (_jrtc_router_mem_read_stats(ipc_name, &stats) < 0) {
+        jrtc_logger(JRTC_WARN, "Could not read the memory mappings of the process\n");
+        return;
+    }
+
+    jrtc_logger(
+        JRTC_INFO,
+        "Memory mappings: %lu kB on 4 kB pages, %lu kB on 2 MB pages, %lu kB on 1 GB pages, %lu kB of transparent "
+        "huge pages\n",
+        stats.mapped_4kb_kb,
+        stats.mapped_2mb_kb,
+        stats.mapped_1gb_kb,
+        stats.thp_kb);
+    jrtc_logger(
+        JRTC_INFO,
+        "IPC segment %s: %lu kB on %lu kB pages. Huge page pool: %lu of %lu pages of %lu kB free\n",
+        ipc_name,
+        stats.ipc_kb,
+        stats.ipc_page_size_kb,
+        stats.hugetlb_pages_free,
+        stats.hugetlb_pages_total,
+        stats.hugetlb_page_size_kb);
+    if (stats.ipc_kb > 0 && stats.ipc_page_size_kb < JRTC_ROUTER_HUGEPAGE_SIZE_2MB / 1024) {
+        jrtc_logger(JRTC_WARN, "The IPC segment is not backed by huge pages, is hugetlbfs mounted?\n");
+    }
+}
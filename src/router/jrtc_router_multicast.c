@@ -0,0 +1,336 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#include <string.h>
+#include <time.h>
+
+#include "jbpf_io.h"
+#include "jbpf_io_channel.h"
+#include "jbpf_io_hash.h"
+
+#include "jrtc_router_int.h"
+
+// Multicast of control messages to input channels.
+//
+// jbpf_io_channel_send_msg() only delivers to the input channel with the exact stream id, so sending a command to
+// a codelet on every agent takes one send per device id. The router resolves a wildcard stream id to the input
+// channels it matches once, caches the result as a group, and sends to all the members in a single call.
+//
+// jbpf cannot list its channels, but the fwd_dst and device_id fields only take a few values, so a stream id with
+// wildcards in them is resolved by looking up every exact stream id it stands for in jbpf, at most
+// JRTC_ROUTER_MULTICAST_MAX_TARGETS of them. That finds the input channels of agents the router has never seen.
+// The stream path and name are hashes that cannot be enumerated, so wildcards in them are reported as unresolved.
+// Groups are resolved again after JRTC_ROUTER_MULTICAST_TTL_NS, when the router sees a new input channel, or when
+// a send fails. Resolving takes no lock, so it does not hold back the other senders. Every input channel has its
+// own memory pool, so the message is copied to each member.
+
+// The values of fwd_dst that a wildcard fwd_dst stands for
+static const uint16_t multicast_fwd_dsts[] = {
+    JRTC_ROUTER_DEST_NONE,
+    JRTC_ROUTER_DEST_UDP,
+    JRTC_ROUTER_DEST_RESERVED,
+    JRTC_ROUTER_DEST_RESERVED2,
+    JRTC_ROUTER_DEST_RESERVED3,
+    JRTC_ROUTER_DEST_RESERVED4};
+
+static void
+_jrtc_router_multicast_hash(struct ck_ht_hash* h, const void* key, size_t length, uint64_t seed)
+{
+    h->value = (unsigned long)MurmurHash64A(key, length, seed);
+}
+
+static void*
+_jrtc_router_multicast_malloc(size_t r)
+{
+    return jbpf_malloc(r);
+}
+
+static void
+_jrtc_router_multicast_free(void* p, size_t b, bool r)
+{
+    (void)b;
+    (void)r;
+    jbpf_free(p);
+}
+
+static struct ck_malloc multicast_allocator = {
+    .malloc = _jrtc_router_multicast_malloc, .free = _jrtc_router_multicast_free};
+
+static inline uint64_t
+_jrtc_router_multicast_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline bool
+_jrtc_router_multicast_channel_exists(struct jbpf_io_ctx* io_ctx, const jrtc_router_stream_id_t* stream_id)
+{
+    return jbpf_io_find_channel(io_ctx, *(struct jbpf_io_stream_id*)stream_id, false) != NULL;
+}
+
+int
+_jrtc_router_multicast_init(jrtc_router_multicast_t* multicast)
+{
+    memset(multicast, 0, sizeof(*multicast));
+    ck_rwlock_init(&multicast->lock);
+
+    if (!ck_ht_init(
+            &multicast->groups,
+            CK_HT_MODE_BYTESTRING,
+            _jrtc_router_multicast_hash,
+            &multicast_allocator,
+            JRTC_ROUTER_MULTICAST_MAX_GROUPS,
+            6602834)) {
+        return -1;
+    }
+
+    if (!ck_ht_init(
+            &multicast->inputs,
+            CK_HT_MODE_BYTESTRING,
+            _jrtc_router_multicast_hash,
+            &multicast_allocator,
+            JRTC_ROUTER_MULTICAST_MAX_GROUPS,
+            6602834)) {
+        ck_ht_destroy(&multicast->groups);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+_jrtc_router_multicast_destroy(jrtc_router_multicast_t* multicast)
+{
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+
+    while (ck_ht_next(&multicast->groups, &iterator, &cursor)) {
+        jbpf_free(ck_ht_entry_value(cursor));
+    }
+    ck_ht_destroy(&multicast->groups);
+
+    ck_ht_iterator_init(&iterator);
+    while (ck_ht_next(&multicast->inputs, &iterator, &cursor)) {
+        jbpf_free(ck_ht_entry_value(cursor));
+    }
+    ck_ht_destroy(&multicast->inputs);
+}
+
+static bool
+_jrtc_router_multicast_is_known(jrtc_router_multicast_t* multicast, const jrtc_router_stream_id_t* stream_id)
+{
+    ck_ht_hash_t h;
+    ck_ht_entry_t entry;
+
+    ck_ht_hash(&h, &multicast->inputs, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    return ck_ht_get_spmc(&multicast->inputs, h, &entry);
+}
+
+// Must hold the write lock
+static void
+_jrtc_router_multicast_learn_locked(jrtc_router_multicast_t* multicast, const jrtc_router_stream_id_t* stream_id)
+{
+    jrtc_router_stream_id_t* input;
+    ck_ht_hash_t h;
+    ck_ht_entry_t entry;
+
+    if (_jrtc_router_multicast_is_known(multicast, stream_id) ||
+        ck_ht_count(&multicast->inputs) >= JRTC_ROUTER_MULTICAST_MAX_INPUTS) {
+        return;
+    }
+
+    // The key is stored by reference
+    input = jbpf_malloc(sizeof(jrtc_router_stream_id_t));
+    if (!input) {
+        return;
+    }
+    *input = *stream_id;
+
+    ck_ht_hash(&h, &multicast->inputs, input, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_set(&entry, h, input, JRTC_ROUTER_STREAM_ID_BYTE_LEN, input);
+    if (!ck_ht_put_spmc(&multicast->inputs, h, &entry)) {
+        jbpf_free(input);
+        return;
+    }
+
+    multicast->generation++;
+}
+
+void
+_jrtc_router_multicast_learn(jrtc_router_multicast_t* multicast, const jrtc_router_stream_id_t* stream_id)
+{
+    bool known;
+
+    ck_rwlock_read_lock(&multicast->lock);
+    known = _jrtc_router_multicast_is_known(multicast, stream_id);
+    ck_rwlock_read_unlock(&multicast->lock);
+
+    if (!known) {
+        ck_rwlock_write_lock(&multicast->lock);
+        _jrtc_router_multicast_learn_locked(multicast, stream_id);
+        ck_rwlock_write_unlock(&multicast->lock);
+    }
+}
+
+// Resolves the members of the group of stream_id, the exact stream ids it stands for that have a channel in jbpf
+static jrtc_router_multicast_group_t*
+_jrtc_router_multicast_resolve(
+    struct jbpf_io_ctx* io_ctx, const jrtc_router_stream_id_t* stream_id, uint64_t generation)
+{
+    jrtc_router_multicast_group_t* group;
+    jrtc_router_stream_id_t target;
+    const uint16_t* fwd_dsts;
+    uint16_t fwd_dst, device_id, first_device_id, last_device_id;
+    int num_fwd_dsts;
+    uint32_t num_targets;
+
+    group = jbpf_calloc(
+        1, sizeof(jrtc_router_multicast_group_t) + JRTC_ROUTER_MULTICAST_MAX_TARGETS * sizeof(jrtc_router_stream_id_t));
+    if (!group) {
+        return NULL;
+    }
+
+    fwd_dst = jrtc_router_stream_id_get_fwd_dst(stream_id);
+    if (fwd_dst == JRTC_ROUTER_DEST_ANY) {
+        fwd_dsts = multicast_fwd_dsts;
+        num_fwd_dsts = sizeof(multicast_fwd_dsts) / sizeof(multicast_fwd_dsts[0]);
+    } else {
+        fwd_dsts = &fwd_dst;
+        num_fwd_dsts = 1;
+    }
+
+    device_id = jrtc_router_stream_id_get_device_id(stream_id);
+    first_device_id = device_id == JRTC_ROUTER_DEVICE_ID_ANY ? 0 : device_id;
+    last_device_id = device_id == JRTC_ROUTER_DEVICE_ID_ANY ? JRTC_ROUTER_DEVICE_ID_ANY - 1 : device_id;
+
+    num_targets = 0;
+    target = *stream_id;
+    for (int i = 0; i < num_fwd_dsts; i++) {
+        jrtc_router_stream_id_set_fwd_dst(&target, fwd_dsts[i]);
+        for (uint16_t d = first_device_id; d <= last_device_id; d++) {
+            jrtc_router_stream_id_set_device_id(&target, d);
+            if (_jrtc_router_multicast_channel_exists(io_ctx, &target)) {
+                group->targets[num_targets++] = target;
+            }
+        }
+    }
+
+    group->stream_id = *stream_id;
+    group->num_targets = num_targets;
+    group->generation = generation;
+    group->resolved_ns = _jrtc_router_multicast_now_ns();
+
+    return group;
+}
+
+// Replaces the group of stream_id. Must hold the write lock. Returns false if the group could not be cached, or if
+// a new input channel was seen since it was resolved.
+static bool
+_jrtc_router_multicast_store(jrtc_router_multicast_t* multicast, jrtc_router_multicast_group_t* group)
+{
+    jrtc_router_multicast_group_t* old_group;
+    ck_ht_hash_t h;
+    ck_ht_entry_t entry;
+
+    if (group->generation != multicast->generation) {
+        return false;
+    }
+
+    ck_ht_hash(&h, &multicast->groups, &group->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&entry, &group->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    if (ck_ht_remove_spmc(&multicast->groups, h, &entry)) {
+        old_group = ck_ht_entry_value(&entry);
+        jbpf_free(old_group);
+    }
+
+    if (ck_ht_count(&multicast->groups) >= JRTC_ROUTER_MULTICAST_MAX_GROUPS) {
+        return false;
+    }
+
+    ck_ht_entry_set(&entry, h, &group->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, group);
+    return ck_ht_put_spmc(&multicast->groups, h, &entry);
+}
+
+// Sends to the members of a group and marks their input channels ready, so that their apps are woken up
+static int
+_jrtc_router_multicast_send_group(
+    jrtc_router_ctx_t router_ctx, jrtc_router_multicast_group_t* group, void* data, size_t data_len, bool* failed)
+{
+    int num_reached = 0;
+
+    for (uint32_t i = 0; i < group->num_targets; i++) {
+        if (jbpf_io_channel_send_msg(
+                router_ctx->io_ctx, (struct jbpf_io_stream_id*)&group->targets[i], data, data_len) == 0) {
+            _jrtc_router_in_channel_set_ready(router_ctx, &group->targets[i]);
+            num_reached++;
+        } else {
+            *failed = true;
+        }
+    }
+
+    return num_reached;
+}
+
+int
+_jrtc_router_multicast_send(
+    jrtc_router_ctx_t router_ctx, const jrtc_router_stream_id_t* stream_id, void* data, size_t data_len)
+{
+    jrtc_router_multicast_t* multicast = &router_ctx->multicast;
+    jrtc_router_multicast_group_t* group;
+    ck_ht_hash_t h;
+    ck_ht_entry_t entry;
+    uint64_t generation;
+    bool failed = false;
+    int num_reached = -1;
+
+    if (jrtc_router_stream_id_get_stream_path(stream_id) == JRTC_ROUTER_STREAM_PATH_ANY ||
+        jrtc_router_stream_id_get_stream_name(stream_id) == JRTC_ROUTER_STREAM_NAME_ANY) {
+        return JRTC_ROUTER_MULTICAST_UNRESOLVED;
+    }
+
+    ck_ht_hash(&h, &multicast->groups, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    // The groups are only replaced under the write lock, so the group stays valid while it is used
+    group = NULL;
+    ck_rwlock_read_lock(&multicast->lock);
+    if (ck_ht_get_spmc(&multicast->groups, h, &entry)) {
+        group = ck_ht_entry_value(&entry);
+        if (group->generation == multicast->generation &&
+            _jrtc_router_multicast_now_ns() - ck_pr_load_64(&group->resolved_ns) < JRTC_ROUTER_MULTICAST_TTL_NS) {
+            num_reached = _jrtc_router_multicast_send_group(router_ctx, group, data, data_len, &failed);
+            // A member is gone, so resolve the group again on the next send
+            if (failed) {
+                ck_pr_store_64(&group->resolved_ns, 0);
+            }
+        }
+    }
+    generation = multicast->generation;
+    ck_rwlock_read_unlock(&multicast->lock);
+
+    if (num_reached >= 0) {
+        return num_reached;
+    }
+
+    group = _jrtc_router_multicast_resolve(router_ctx->io_ctx, stream_id, generation);
+    if (!group) {
+        return -1;
+    }
+
+    // The new group is not shared yet, so it is sent to without any lock
+    num_reached = _jrtc_router_multicast_send_group(router_ctx, group, data, data_len, &failed);
+    if (failed) {
+        group->resolved_ns = 0;
+    }
+
+    ck_rwlock_write_lock(&multicast->lock);
+    if (!_jrtc_router_multicast_store(multicast, group)) {
+        jbpf_free(group);
+    }
+    ck_rwlock_write_unlock(&multicast->lock);
+
+    return num_reached;
+}
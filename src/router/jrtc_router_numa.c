@@ -0,0 +1,206 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jrtc_router_int.h"
+
+// NUMA placement of the router state.
+//
+// The rings and the scratch state of the router are read and written on every message, so they should sit on the
+// node of the threads that use them. The node of a thread is the node of all the CPUs in its affinity mask, and
+// memory for a node is mapped with a preferred policy for that node and faulted in right away, so that it does not
+// depend on which thread touches it first, see _jrtc_router_mem_calloc(). The topology is read from sysfs and the
+// policies are set with raw syscalls, so there is no dependency on libnuma.
+
+#define JRTC_ROUTER_NUMA_SYSFS_NODE "/sys/devices/system/node"
+#define JRTC_ROUTER_NUMA_SYSFS_CPU "/sys/devices/system/cpu"
+
+// From linux/mempolicy.h
+#define JRTC_ROUTER_MPOL_PREFERRED (1)
+#define JRTC_ROUTER_MPOL_F_NODE (1 << 0)
+#define JRTC_ROUTER_MPOL_F_ADDR (1 << 1)
+#define JRTC_ROUTER_MPOL_MF_MOVE (1 << 1)
+
+static int g_num_nodes = -1;
+
+int
+_jrtc_router_numa_num_nodes(void)
+{
+    DIR* dir;
+    struct dirent* entry;
+    int num_nodes = 0;
+    int node;
+
+    if (ck_pr_load_int(&g_num_nodes) >= 0) {
+        return ck_pr_load_int(&g_num_nodes);
+    }
+
+    dir = opendir(JRTC_ROUTER_NUMA_SYSFS_NODE);
+    if (dir) {
+        while ((entry = readdir(dir)) != NULL) {
+            if (sscanf(entry->d_name, "node%d", &node) == 1 && node >= 0 && node < JRTC_ROUTER_NUMA_MAX_NODES) {
+                num_nodes++;
+            }
+        }
+        closedir(dir);
+    }
+
+    // Without sysfs, the machine is treated as a single node
+    if (num_nodes == 0) {
+        num_nodes = 1;
+    }
+
+    ck_pr_store_int(&g_num_nodes, num_nodes);
+    return num_nodes;
+}
+
+int
+_jrtc_router_numa_node_of_cpu(int cpu)
+{
+    char path[64];
+    DIR* dir;
+    struct dirent* entry;
+    int node = -1;
+
+    snprintf(path, sizeof(path), JRTC_ROUTER_NUMA_SYSFS_CPU "/cpu%d", cpu);
+    dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+        node = -1;
+    }
+    closedir(dir);
+
+    return node;
+}
+
+int
+_jrtc_router_numa_node_of_cpus(const cpu_set_t* cpus)
+{
+    int node = -1;
+    int cpu_node;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, cpus)) {
+            continue;
+        }
+        cpu_node = _jrtc_router_numa_node_of_cpu(cpu);
+        if (cpu_node < 0 || (node >= 0 && cpu_node != node)) {
+            return -1;
+        }
+        node = cpu_node;
+    }
+
+    return node;
+}
+
+int
+_jrtc_router_numa_node_of_thread(pthread_t thread_id)
+{
+    cpu_set_t cpus;
+
+    if (pthread_getaffinity_np(thread_id, sizeof(cpu_set_t), &cpus) != 0) {
+        return -1;
+    }
+
+    return _jrtc_router_numa_node_of_cpus(&cpus);
+}
+
+int
+_jrtc_router_numa_node_cpus(int node, cpu_set_t* cpus)
+{
+    char path[64];
+    FILE* f;
+    int first, last;
+    char sep;
+
+    CPU_ZERO(cpus);
+
+    snprintf(path, sizeof(path), JRTC_ROUTER_NUMA_SYSFS_NODE "/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    // The list has the form "0-3,8-11"
+    while (fscanf(f, "%d", &first) == 1) {
+        last = first;
+        sep = (char)fgetc(f);
+        if (sep == '-') {
+            if (fscanf(f, "%d", &last) != 1) {
+                break;
+            }
+            sep = (char)fgetc(f);
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        if (sep != ',') {
+            break;
+        }
+    }
+    fclose(f);
+
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+int
+_jrtc_router_numa_bind(void* addr, size_t len, int node, bool move)
+{
+    unsigned long nodemask;
+
+    nodemask = 1UL << node;
+    return syscall(
+        __NR_mbind,
+        addr,
+        len,
+        JRTC_ROUTER_MPOL_PREFERRED,
+        &nodemask,
+        sizeof(nodemask) * 8 + 1,
+        move ? JRTC_ROUTER_MPOL_MF_MOVE : 0) < 0
+               ? -1
+               : 0;
+}
+
+int
+_jrtc_router_numa_move(void* addr, size_t len, int node)
+{
+    uintptr_t page_size, start, end;
+
+    if (node < 0 || node >= JRTC_ROUTER_NUMA_MAX_NODES || _jrtc_router_numa_num_nodes() <= 1) {
+        return -1;
+    }
+
+    page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    start = (uintptr_t)addr & ~(page_size - 1);
+    end = ((uintptr_t)addr + len + page_size - 1) & ~(page_size - 1);
+
+    return _jrtc_router_numa_bind((void*)start, end - start, node, true);
+}
+
+int
+_jrtc_router_numa_node_of_addr(const void* addr)
+{
+    int node = -1;
+
+    if (!addr) {
+        return -1;
+    }
+
+    if (syscall(
+            __NR_get_mempolicy, &node, NULL, 0, addr, JRTC_ROUTER_MPOL_F_NODE | JRTC_ROUTER_MPOL_F_ADDR) < 0) {
+        return -1;
+    }
+
+    return node;
+}
@@ -0,0 +1,618 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <fnmatch.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "jbpf_io.h"
+#include "jbpf_io_hash.h"
+
+#include "jrtc_router_int.h"
+
+// Pattern requests on stream paths.
+//
+// Stream ids only carry hashes of the path and the name of a stream, so the exact and wildcard requests of the
+// request table cannot express "every stream under codeletset_x/". The path index keeps the pattern requests in a
+// trie of path segments, and a catalog that maps the path and name hashes of the known streams back to their
+// strings. When a shard resolves the route of a new stream id, the stream is looked up in the catalog and its path
+// is walked down the trie. The result is cached in the route like the one of the request table, so the patterns
+// are only matched again when the requests change.
+//
+// The index is only used when routes are resolved, so readers and writers simply share the lock. Changes bump the
+// generation of the request table, which invalidates the resolved routes.
+
+static void
+_jrtc_router_catalog_hash(struct ck_ht_hash* h, const void* key, size_t length, uint64_t seed)
+{
+    h->value = (unsigned long)MurmurHash64A(key, length, seed);
+}
+
+static void*
+_jrtc_router_catalog_malloc(size_t r)
+{
+    return jbpf_malloc(r);
+}
+
+static void
+_jrtc_router_catalog_free(void* p, size_t b, bool r)
+{
+    (void)b;
+    (void)r;
+    jbpf_free(p);
+}
+
+static struct ck_malloc catalog_allocator = {.malloc = _jrtc_router_catalog_malloc, .free = _jrtc_router_catalog_free};
+
+static char*
+_jrtc_router_strdup(const char* str)
+{
+    size_t len;
+    char* copy;
+
+    len = strlen(str) + 1;
+    copy = jbpf_malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+// Splits path in place at '/'. Returns the number of segments, or -1 if there are too many.
+static int
+_jrtc_router_path_split(char* path, char** segments)
+{
+    int num_segments = 0;
+    char* pos = path;
+
+    while (true) {
+        if (num_segments == JRTC_ROUTER_PATH_MAX_SEGMENTS) {
+            return -1;
+        }
+        segments[num_segments++] = pos;
+        pos = strchr(pos, '/');
+        if (!pos) {
+            return num_segments;
+        }
+        *pos++ = '\0';
+    }
+}
+
+static inline void
+_jrtc_router_path_index_changed(jrtc_router_req_table_t* req_table)
+{
+    ck_pr_fence_store();
+    ck_pr_inc_64(&req_table->generation);
+}
+
+static void
+_jrtc_router_pattern_req_free(jrtc_router_pattern_req_t* req)
+{
+    jbpf_free(req->name_pattern);
+    jbpf_free(req->apps);
+    jbpf_free(req);
+}
+
+static void
+_jrtc_router_path_node_free(jrtc_router_path_node_t* node)
+{
+    jrtc_router_path_node_t* child;
+    jrtc_router_pattern_req_t* req;
+
+    while ((child = node->children)) {
+        node->children = child->next;
+        _jrtc_router_path_node_free(child);
+        jbpf_free(child->segment);
+        jbpf_free(child);
+    }
+    while ((req = node->reqs)) {
+        node->reqs = req->next;
+        _jrtc_router_pattern_req_free(req);
+    }
+    while ((req = node->prefix_reqs)) {
+        node->prefix_reqs = req->next;
+        _jrtc_router_pattern_req_free(req);
+    }
+}
+
+// Frees the children of node without any requests below them
+static void
+_jrtc_router_path_node_prune(jrtc_router_path_node_t* node)
+{
+    jrtc_router_path_node_t** pos = &node->children;
+    jrtc_router_path_node_t* child;
+
+    while ((child = *pos)) {
+        _jrtc_router_path_node_prune(child);
+        if (!child->children && !child->reqs && !child->prefix_reqs) {
+            *pos = child->next;
+            jbpf_free(child->segment);
+            jbpf_free(child);
+        } else {
+            pos = &child->next;
+        }
+    }
+}
+
+static jrtc_router_path_node_t*
+_jrtc_router_path_node_child(jrtc_router_path_node_t* node, const char* segment, bool create)
+{
+    jrtc_router_path_node_t* child;
+
+    for (child = node->children; child; child = child->next) {
+        if (strcmp(child->segment, segment) == 0) {
+            return child;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    child = jbpf_calloc(1, sizeof(jrtc_router_path_node_t));
+    if (!child) {
+        return NULL;
+    }
+    child->segment = _jrtc_router_strdup(segment);
+    if (!child->segment) {
+        jbpf_free(child);
+        return NULL;
+    }
+    child->is_glob = strpbrk(segment, "*?[") != NULL;
+    child->next = node->children;
+    node->children = child;
+
+    return child;
+}
+
+// Returns the list of requests of a pattern, creating the trie nodes if needed. Called under the lock.
+static jrtc_router_pattern_req_t**
+_jrtc_router_path_index_reqs(jrtc_router_path_index_t* path_index, const char* path_pattern, bool create)
+{
+    char path[JRTC_ROUTER_PATH_MAX_LEN];
+    char* segments[JRTC_ROUTER_PATH_MAX_SEGMENTS];
+    jrtc_router_path_node_t* node;
+    int num_segments;
+    bool is_prefix;
+
+    if (strlen(path_pattern) >= sizeof(path)) {
+        return NULL;
+    }
+    strcpy(path, path_pattern);
+
+    num_segments = _jrtc_router_path_split(path, segments);
+    if (num_segments < 0) {
+        return NULL;
+    }
+
+    // A last segment of "*" matches everything under the preceding segments
+    is_prefix = strcmp(segments[num_segments - 1], "*") == 0;
+    if (is_prefix) {
+        num_segments--;
+    }
+
+    node = &path_index->root;
+    for (int i = 0; i < num_segments && node; i++) {
+        node = _jrtc_router_path_node_child(node, segments[i], create);
+    }
+    if (!node) {
+        return NULL;
+    }
+
+    return is_prefix ? &node->prefix_reqs : &node->reqs;
+}
+
+static inline bool
+_jrtc_router_name_pattern_equal(const char* a, const char* b)
+{
+    return (!a && !b) || (a && b && strcmp(a, b) == 0);
+}
+
+static jrtc_router_pattern_req_t**
+_jrtc_router_pattern_req_find(jrtc_router_pattern_req_t** reqs, int fwd_dst, int device_id, const char* name_pattern)
+{
+    jrtc_router_pattern_req_t** pos;
+
+    for (pos = reqs; *pos; pos = &(*pos)->next) {
+        if ((*pos)->fwd_dst == fwd_dst && (*pos)->device_id == device_id &&
+            _jrtc_router_name_pattern_equal((*pos)->name_pattern, name_pattern)) {
+            return pos;
+        }
+    }
+
+    return NULL;
+}
+
+// Removes an app from a request and frees the request if no apps are left. Returns 1 if the app had made
+// the request, 0 if not and -1 on failure. Called under the lock.
+static int
+_jrtc_router_pattern_req_remove_app(jrtc_router_req_table_t* req_table, jrtc_router_pattern_req_t** pos, int app_id)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    jrtc_router_pattern_req_t* req = *pos;
+    jrtc_router_app_set_t* apps;
+
+    if (!_jrtc_router_app_set_test(req->apps, app_id)) {
+        return 0;
+    }
+
+    if (req->apps->num_apps == 1) {
+        *pos = req->next;
+        _jrtc_router_pattern_req_free(req);
+        ck_pr_dec_32(&path_index->num_patterns);
+        return 1;
+    }
+
+    apps = _jrtc_router_app_set_update(req->apps, req_table->max_num_apps, app_id, false);
+    if (!apps) {
+        return -1;
+    }
+    jbpf_free(req->apps);
+    req->apps = apps;
+
+    return 1;
+}
+
+int
+_jrtc_router_path_index_init(jrtc_router_path_index_t* path_index)
+{
+    memset(path_index, 0, sizeof(jrtc_router_path_index_t));
+    ck_spinlock_init(&path_index->lock);
+
+    if (!ck_ht_init(
+            &path_index->catalog,
+            CK_HT_MODE_BYTESTRING,
+            _jrtc_router_catalog_hash,
+            &catalog_allocator,
+            JRTC_ROUTER_STREAM_CATALOG_INIT_ENTRIES,
+            6602834)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+_jrtc_router_path_index_destroy(jrtc_router_path_index_t* path_index)
+{
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+
+    while (ck_ht_next(&path_index->catalog, &iterator, &cursor)) {
+        jbpf_free(ck_ht_entry_value(cursor));
+    }
+    ck_ht_destroy(&path_index->catalog);
+
+    _jrtc_router_path_node_free(&path_index->root);
+    path_index->num_patterns = 0;
+}
+
+int
+_jrtc_router_path_index_add(
+    jrtc_router_req_table_t* req_table,
+    int app_id,
+    int fwd_dst,
+    int device_id,
+    const char* path_pattern,
+    const char* name_pattern)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    jrtc_router_pattern_req_t **reqs, **pos;
+    jrtc_router_pattern_req_t* req;
+    jrtc_router_app_set_t* apps;
+    int res = 1;
+
+    if (name_pattern && strcmp(name_pattern, "*") == 0) {
+        name_pattern = NULL;
+    }
+
+    ck_spinlock_lock(&path_index->lock);
+
+    reqs = _jrtc_router_path_index_reqs(path_index, path_pattern, true);
+    if (!reqs) {
+        jrtc_logger(JRTC_ERROR, "Invalid path pattern %s\n", path_pattern);
+        res = -1;
+        goto out;
+    }
+
+    pos = _jrtc_router_pattern_req_find(reqs, fwd_dst, device_id, name_pattern);
+    if (pos) {
+        req = *pos;
+        if (_jrtc_router_app_set_test(req->apps, app_id)) {
+            goto out;
+        }
+
+        apps = _jrtc_router_app_set_update(req->apps, req_table->max_num_apps, app_id, true);
+        if (!apps) {
+            res = -1;
+            goto out;
+        }
+        jbpf_free(req->apps);
+        req->apps = apps;
+    } else {
+        req = jbpf_calloc(1, sizeof(jrtc_router_pattern_req_t));
+        if (!req) {
+            res = -1;
+            goto out;
+        }
+
+        req->fwd_dst = fwd_dst;
+        req->device_id = device_id;
+        req->name_pattern = name_pattern ? _jrtc_router_strdup(name_pattern) : NULL;
+        req->apps = _jrtc_router_app_set_update(NULL, req_table->max_num_apps, app_id, true);
+        if ((name_pattern && !req->name_pattern) || !req->apps) {
+            _jrtc_router_pattern_req_free(req);
+            res = -1;
+            goto out;
+        }
+
+        req->next = *reqs;
+        *reqs = req;
+        ck_pr_inc_32(&path_index->num_patterns);
+        jrtc_logger(JRTC_INFO, "Added pattern request %s, name %s\n", path_pattern, name_pattern ? name_pattern : "*");
+    }
+
+    _jrtc_router_path_index_changed(req_table);
+
+out:
+    if (res < 0) {
+        _jrtc_router_path_node_prune(&path_index->root);
+    }
+    ck_spinlock_unlock(&path_index->lock);
+    return res;
+}
+
+int
+_jrtc_router_path_index_remove(
+    jrtc_router_req_table_t* req_table,
+    int app_id,
+    int fwd_dst,
+    int device_id,
+    const char* path_pattern,
+    const char* name_pattern)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    jrtc_router_pattern_req_t **reqs, **pos;
+    int res = 0;
+
+    if (name_pattern && strcmp(name_pattern, "*") == 0) {
+        name_pattern = NULL;
+    }
+
+    ck_spinlock_lock(&path_index->lock);
+
+    reqs = _jrtc_router_path_index_reqs(path_index, path_pattern, false);
+    if (!reqs) {
+        goto out;
+    }
+
+    pos = _jrtc_router_pattern_req_find(reqs, fwd_dst, device_id, name_pattern);
+    if (!pos) {
+        goto out;
+    }
+
+    res = _jrtc_router_pattern_req_remove_app(req_table, pos, app_id);
+    if (res == 1) {
+        _jrtc_router_path_node_prune(&path_index->root);
+        _jrtc_router_path_index_changed(req_table);
+    }
+
+out:
+    ck_spinlock_unlock(&path_index->lock);
+    return res;
+}
+
+static int
+_jrtc_router_path_node_remove_app(jrtc_router_req_table_t* req_table, jrtc_router_path_node_t* node, int app_id)
+{
+    jrtc_router_pattern_req_t** lists[] = {&node->reqs, &node->prefix_reqs};
+    jrtc_router_pattern_req_t** pos;
+    jrtc_router_path_node_t* child;
+    int num_removed = 0;
+
+    for (int i = 0; i < 2; i++) {
+        pos = lists[i];
+        while (*pos) {
+            jrtc_router_pattern_req_t* req = *pos;
+            if (_jrtc_router_pattern_req_remove_app(req_table, pos, app_id) == 1) {
+                num_removed++;
+            } else if (_jrtc_router_app_set_test(req->apps, app_id)) {
+                // Leave the app in the set, the forwarding skips apps that are not registered
+                jrtc_logger(JRTC_ERROR, "Could not allocate an app set to remove the requests of app %d\n", app_id);
+            }
+            // The request was unlinked if it has no apps left
+            if (*pos == req) {
+                pos = &req->next;
+            }
+        }
+    }
+
+    for (child = node->children; child; child = child->next) {
+        num_removed += _jrtc_router_path_node_remove_app(req_table, child, app_id);
+    }
+
+    return num_removed;
+}
+
+int
+_jrtc_router_path_index_remove_app(jrtc_router_req_table_t* req_table, int app_id)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    int num_removed;
+
+    if (ck_pr_load_32(&path_index->num_patterns) == 0) {
+        return 0;
+    }
+
+    ck_spinlock_lock(&path_index->lock);
+
+    num_removed = _jrtc_router_path_node_remove_app(req_table, &path_index->root, app_id);
+    if (num_removed > 0) {
+        _jrtc_router_path_node_prune(&path_index->root);
+        _jrtc_router_path_index_changed(req_table);
+    }
+
+    ck_spinlock_unlock(&path_index->lock);
+    return num_removed;
+}
+
+int
+_jrtc_router_path_index_catalog_add(
+    jrtc_router_req_table_t* req_table, const char* stream_path, const char* stream_name)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    jrtc_router_catalog_entry_t* entry;
+    jrtc_router_stream_id_t key;
+    ck_ht_entry_t catalog_entry;
+    ck_ht_hash_t h;
+    size_t path_len, name_len;
+    int num_segments;
+    int res = 1;
+
+    if (!stream_path || !stream_name) {
+        return -1;
+    }
+
+    path_len = strlen(stream_path) + 1;
+    name_len = strlen(stream_name) + 1;
+    if (path_len > JRTC_ROUTER_PATH_MAX_LEN) {
+        return -1;
+    }
+
+    if (jrtc_router_generate_stream_id(&key, 0, 0, stream_path, stream_name) != 1) {
+        return -1;
+    }
+
+    ck_spinlock_lock(&path_index->lock);
+
+    ck_ht_hash(&h, &path_index->catalog, &key, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&catalog_entry, &key, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    if (ck_ht_get_spmc(&path_index->catalog, h, &catalog_entry)) {
+        res = 0;
+        goto out;
+    }
+
+    if (path_index->num_streams >= JRTC_ROUTER_STREAM_CATALOG_MAX_ENTRIES) {
+        jrtc_logger(JRTC_WARN, "The stream catalog is full, %s is not added\n", stream_path);
+        res = -1;
+        goto out;
+    }
+
+    entry = jbpf_calloc(1, sizeof(jrtc_router_catalog_entry_t) + path_len + name_len);
+    if (!entry) {
+        res = -1;
+        goto out;
+    }
+
+    entry->key = key;
+    memcpy(entry->path, stream_path, path_len);
+    entry->name = entry->path + path_len;
+    memcpy(entry->name, stream_name, name_len);
+
+    num_segments = _jrtc_router_path_split(entry->path, entry->segments);
+    if (num_segments < 0) {
+        jrtc_logger(JRTC_WARN, "Too many segments in stream path %s\n", stream_path);
+        jbpf_free(entry);
+        res = -1;
+        goto out;
+    }
+    entry->num_segments = num_segments;
+
+    ck_ht_entry_set(&catalog_entry, h, &entry->key, JRTC_ROUTER_STREAM_ID_BYTE_LEN, entry);
+    if (!ck_ht_set_spmc(&path_index->catalog, h, &catalog_entry)) {
+        jbpf_free(entry);
+        res = -1;
+        goto out;
+    }
+    path_index->num_streams++;
+
+    // Routes resolved before the stream was known may now match a pattern
+    if (path_index->num_patterns > 0) {
+        _jrtc_router_path_index_changed(req_table);
+    }
+
+out:
+    ck_spinlock_unlock(&path_index->lock);
+    return res;
+}
+
+static void
+_jrtc_router_pattern_reqs_match(
+    jrtc_router_pattern_req_t* req,
+    const jrtc_router_catalog_entry_t* entry,
+    uint16_t fwd_dst,
+    uint16_t device_id,
+    ck_bitmap_t* lookup_res)
+{
+    for (; req; req = req->next) {
+        if ((fwd_dst & req->fwd_dst) != fwd_dst || (device_id & req->device_id) != device_id) {
+            continue;
+        }
+        if (req->name_pattern && fnmatch(req->name_pattern, entry->name, 0) != 0) {
+            continue;
+        }
+        _jrtc_router_app_set_union(lookup_res, req->apps);
+    }
+}
+
+// Walks the segments of the path of entry down from node, which matched the first depth segments
+static void
+_jrtc_router_path_node_match(
+    const jrtc_router_path_node_t* node,
+    const jrtc_router_catalog_entry_t* entry,
+    uint32_t depth,
+    uint16_t fwd_dst,
+    uint16_t device_id,
+    ck_bitmap_t* lookup_res)
+{
+    const jrtc_router_path_node_t* child;
+    const char* segment;
+
+    if (depth == entry->num_segments) {
+        _jrtc_router_pattern_reqs_match(node->reqs, entry, fwd_dst, device_id, lookup_res);
+        return;
+    }
+
+    _jrtc_router_pattern_reqs_match(node->prefix_reqs, entry, fwd_dst, device_id, lookup_res);
+
+    segment = entry->segments[depth];
+    for (child = node->children; child; child = child->next) {
+        if (child->is_glob ? fnmatch(child->segment, segment, 0) == 0 : strcmp(child->segment, segment) == 0) {
+            _jrtc_router_path_node_match(child, entry, depth + 1, fwd_dst, device_id, lookup_res);
+        }
+    }
+}
+
+void
+_jrtc_router_path_index_match(
+    jrtc_router_req_table_t* req_table, const jrtc_router_stream_id_t* sid, ck_bitmap_t* lookup_res)
+{
+    jrtc_router_path_index_t* path_index = &req_table->path_index;
+    jrtc_router_catalog_entry_t* entry;
+    jrtc_router_stream_id_t key;
+    ck_ht_entry_t catalog_entry;
+    ck_ht_hash_t h;
+    uint16_t fwd_dst, device_id;
+
+    if (ck_pr_load_32(&path_index->num_patterns) == 0) {
+        return;
+    }
+
+    fwd_dst = _jrtc_router_stream_id_get_fwd_dst(sid->id);
+    device_id = _jrtc_router_stream_id_get_device_id(sid->id);
+
+    key = *sid;
+    _jrtc_router_stream_id_set_fwd_dst(key.id, 0);
+    _jrtc_router_stream_id_set_device_id(key.id, 0);
+
+    ck_spinlock_lock(&path_index->lock);
+
+    ck_ht_hash(&h, &path_index->catalog, &key, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&catalog_entry, &key, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    if (ck_ht_get_spmc(&path_index->catalog, h, &catalog_entry)) {
+        entry = ck_ht_entry_value(&catalog_entry);
+        _jrtc_router_path_node_match(&path_index->root, entry, 0, fwd_dst, device_id, lookup_res);
+    }
+
+    ck_spinlock_unlock(&path_index->lock);
+}
@@ -0,0 +1,390 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <string.h>
+
+#include "jbpf_io.h"
+#include "jbpf_io_hash.h"
+#include "jbpf_io_utils.h"
+
+#include "jrtc_router_int.h"
+
+// The subscription manager of the router.
+//
+// The request table maps every requested stream id (possibly with wildcards) to the set of the apps that
+// made the request. The forwarding shards read the table without any lock, from an epoch section of
+// router_epoch. Writers are serialized by the lock and never modify anything a reader can see: the app sets
+// are copied on write and swapped in, and the replaced sets, removed entries and old maps of the hash table
+// are handed to ck_epoch_call(). The housekeeping thread frees them once all the readers have moved on, so
+// the writers never wait for a grace period.
+
+CK_EPOCH_CONTAINER(jrtc_router_req_entry_t, epoch_entry, req_entry_container)
+CK_EPOCH_CONTAINER(jrtc_router_app_set_t, epoch_entry, app_set_container)
+
+// Blocks of the hash table are prefixed with an epoch entry, so that the table can be grown with readers
+typedef union jrtc_router_req_ht_block
+{
+    ck_epoch_entry_t epoch_entry;
+    uint8_t pad[2 * sizeof(void*)];
+} jrtc_router_req_ht_block_t;
+
+CK_EPOCH_CONTAINER(jrtc_router_req_ht_block_t, epoch_entry, req_ht_block_container)
+
+static void
+_jrtc_router_req_ht_hash(struct ck_ht_hash* h, const void* key, size_t length, uint64_t seed)
+{
+    h->value = (unsigned long)MurmurHash64A(key, length, seed);
+}
+
+static void*
+_jrtc_router_req_ht_malloc(size_t r)
+{
+    jrtc_router_req_ht_block_t* block;
+
+    // The maps are probed for every message that misses the route cache, so large ones are backed by huge pages
+    block = _jrtc_router_mem_calloc(sizeof(jrtc_router_req_ht_block_t) + r, -1);
+    return block ? block + 1 : NULL;
+}
+
+static void
+_jrtc_router_req_ht_block_destructor(ck_epoch_entry_t* p)
+{
+    _jrtc_router_mem_free(req_ht_block_container(p));
+    ck_pr_dec_64(&jrtc_router_get_ctx()->req_table.num_deferred);
+}
+
+static void
+_jrtc_router_req_ht_free(void* p, size_t b, bool defer)
+{
+    jrtc_router_req_table_t* req_table;
+    jrtc_router_req_ht_block_t* block;
+
+    (void)b;
+
+    block = (jrtc_router_req_ht_block_t*)p - 1;
+    if (!defer) {
+        _jrtc_router_mem_free(block);
+        return;
+    }
+
+    // Only called by writers, under the lock
+    req_table = &jrtc_router_get_ctx()->req_table;
+    ck_pr_inc_64(&req_table->num_deferred);
+    ck_epoch_call(&req_table->gc_record, &block->epoch_entry, _jrtc_router_req_ht_block_destructor);
+}
+
+static struct ck_malloc req_ht_allocator = {.malloc = _jrtc_router_req_ht_malloc, .free = _jrtc_router_req_ht_free};
+
+static void
+_jrtc_router_app_set_destructor(ck_epoch_entry_t* p)
+{
+    jbpf_free(app_set_container(p));
+    ck_pr_dec_64(&jrtc_router_get_ctx()->req_table.num_deferred);
+}
+
+static void
+_jrtc_router_req_entry_destructor(ck_epoch_entry_t* p)
+{
+    jrtc_router_req_entry_t* req_entry = req_entry_container(p);
+
+    jbpf_free(req_entry->apps);
+    jbpf_free(req_entry);
+    ck_pr_dec_64(&jrtc_router_get_ctx()->req_table.num_deferred);
+}
+
+// Adds or removes an app from a request, publishing a new set and deferring the free of the old one.
+// Called under the lock. Returns 0 on success, -1 on failure.
+static int
+_jrtc_router_req_apps_update(
+    jrtc_router_req_table_t* req_table, jrtc_router_req_entry_t* req_entry, int app_id, bool add)
+{
+    jrtc_router_app_set_t* old_apps;
+    jrtc_router_app_set_t* apps;
+
+    old_apps = req_entry->apps;
+    apps = _jrtc_router_app_set_update(old_apps, req_table->max_num_apps, app_id, add);
+    if (!apps) {
+        return -1;
+    }
+
+    // The set must be visible before the pointer
+    ck_pr_fence_store();
+    ck_pr_store_ptr(&req_entry->apps, apps);
+
+    ck_pr_inc_64(&req_table->num_deferred);
+    ck_epoch_call(&req_table->gc_record, &old_apps->epoch_entry, _jrtc_router_app_set_destructor);
+    return 0;
+}
+
+// Removes a request with no apps from the table and defers its free. Called under the lock.
+static void
+_jrtc_router_req_entry_remove(
+    jrtc_router_req_table_t* req_table, jrtc_router_req_entry_t* req_entry, ck_ht_hash_t h_req)
+{
+    ck_ht_entry_t req_table_entry;
+
+    ck_ht_entry_key_set(&req_table_entry, &req_entry->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_remove_spmc(&req_table->reqs, h_req, &req_table_entry);
+
+    ck_pr_inc_64(&req_table->num_deferred);
+    ck_epoch_call(&req_table->gc_record, &req_entry->epoch_entry, _jrtc_router_req_entry_destructor);
+}
+
+// Invalidates all the resolved routes. Called under the lock, after the table has been updated.
+static inline void
+_jrtc_router_req_table_changed(jrtc_router_req_table_t* req_table)
+{
+    ck_pr_fence_store();
+    ck_pr_inc_64(&req_table->generation);
+}
+
+static void*
+_jrtc_router_req_table_gc_thread(void* args)
+{
+    jrtc_router_req_table_t* req_table = args;
+
+    if (pthread_setname_np(pthread_self(), "jrtc_router_gc")) {
+        jrtc_logger(JRTC_ERROR, "Error in setting app name to %s\n", "jrtc_router_gc");
+    }
+
+    jbpf_io_register_thread();
+
+    while (ck_pr_load_int(&req_table->gc_running)) {
+        usleep(JRTC_ROUTER_REQ_GC_INTERVAL_US);
+
+        if (ck_pr_load_64(&req_table->num_deferred) == 0) {
+            continue;
+        }
+
+        // ck_epoch_poll() does not wait for the readers, so the writers are only held back briefly
+        ck_spinlock_lock(&req_table->lock);
+        ck_epoch_poll(&req_table->gc_record);
+        ck_spinlock_unlock(&req_table->lock);
+    }
+
+    return NULL;
+}
+
+int
+_jrtc_router_req_table_init(jrtc_router_req_table_t* req_table, uint32_t max_num_apps, uint32_t init_num_entries)
+{
+    ck_spinlock_init(&req_table->lock);
+
+    req_table->max_num_apps = max_num_apps;
+    req_table->app_epoch_record = jbpf_calloc(max_num_apps, sizeof(ck_epoch_record_t));
+    if (!req_table->app_epoch_record) {
+        return -1;
+    }
+
+    ck_epoch_init(&req_table->router_epoch);
+    ck_epoch_register(&req_table->router_epoch, &req_table->gc_record, NULL);
+    for (uint32_t i = 0; i < max_num_apps; i++) {
+        ck_epoch_register(&req_table->router_epoch, &req_table->app_epoch_record[i], NULL);
+    }
+
+    if (!ck_ht_init(
+            &req_table->reqs,
+            CK_HT_MODE_BYTESTRING,
+            _jrtc_router_req_ht_hash,
+            &req_ht_allocator,
+            init_num_entries,
+            6602834)) {
+        jbpf_free(req_table->app_epoch_record);
+        req_table->app_epoch_record = NULL;
+        return -1;
+    }
+
+    if (_jrtc_router_path_index_init(&req_table->path_index) < 0) {
+        ck_ht_destroy(&req_table->reqs);
+        jbpf_free(req_table->app_epoch_record);
+        req_table->app_epoch_record = NULL;
+        return -1;
+    }
+
+    req_table->generation = 0;
+    req_table->num_deferred = 0;
+
+    ck_pr_store_int(&req_table->gc_running, 1);
+    if (pthread_create(&req_table->gc_thread_id, NULL, _jrtc_router_req_table_gc_thread, req_table) != 0) {
+        jrtc_logger(JRTC_ERROR, "Error creating the housekeeping thread of the router\n");
+        _jrtc_router_path_index_destroy(&req_table->path_index);
+        ck_ht_destroy(&req_table->reqs);
+        jbpf_free(req_table->app_epoch_record);
+        req_table->app_epoch_record = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+_jrtc_router_req_table_stop(jrtc_router_req_table_t* req_table)
+{
+    if (!ck_pr_load_int(&req_table->gc_running)) {
+        return;
+    }
+
+    ck_pr_store_int(&req_table->gc_running, 0);
+    pthread_join(req_table->gc_thread_id, NULL);
+}
+
+void
+_jrtc_router_req_table_destroy(jrtc_router_req_table_t* req_table)
+{
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+    jrtc_router_req_entry_t* req_entry;
+
+    _jrtc_router_req_table_stop(req_table);
+
+    // Called once nothing reads the table anymore, so the deferred frees do not wait for a grace period
+    ck_epoch_reclaim(&req_table->gc_record);
+    req_table->num_deferred = 0;
+
+    while (ck_ht_next(&req_table->reqs, &iterator, &cursor)) {
+        req_entry = ck_ht_entry_value(cursor);
+        jbpf_free(req_entry->apps);
+        jbpf_free(req_entry);
+    }
+
+    _jrtc_router_path_index_destroy(&req_table->path_index);
+    ck_ht_destroy(&req_table->reqs);
+    jbpf_free(req_table->app_epoch_record);
+    req_table->app_epoch_record = NULL;
+}
+
+int
+_jrtc_router_req_table_add(jrtc_router_req_table_t* req_table, int app_id, jrtc_router_stream_id_t* stream_id)
+{
+    ck_ht_hash_t h_req;
+    ck_ht_entry_t req_table_entry;
+    jrtc_router_req_entry_t* req_entry;
+    int res = 1;
+
+    ck_spinlock_lock(&req_table->lock);
+
+    ck_ht_hash(&h_req, &req_table->reqs, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&req_table_entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    if (ck_ht_get_spmc(&req_table->reqs, h_req, &req_table_entry)) {
+        req_entry = ck_ht_entry_value(&req_table_entry);
+        if (_jrtc_router_app_set_test(req_entry->apps, app_id)) {
+            goto out;
+        }
+
+        jrtc_logger(JRTC_INFO, "Request already existed. Updating registered apps\n");
+        if (_jrtc_router_req_apps_update(req_table, req_entry, app_id, true) < 0) {
+            res = -1;
+            goto out;
+        }
+    } else {
+        req_entry = jbpf_malloc(sizeof(jrtc_router_req_entry_t));
+        if (!req_entry) {
+            res = -1;
+            goto out;
+        }
+
+        req_entry->stream_id = *stream_id;
+        req_entry->apps = _jrtc_router_app_set_update(NULL, req_table->max_num_apps, app_id, true);
+        if (!req_entry->apps) {
+            jbpf_free(req_entry);
+            res = -1;
+            goto out;
+        }
+
+        ck_ht_entry_set(&req_table_entry, h_req, &req_entry->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN, req_entry);
+        if (!ck_ht_set_spmc(&req_table->reqs, h_req, &req_table_entry)) {
+            jbpf_free(req_entry->apps);
+            jbpf_free(req_entry);
+            res = -1;
+            goto out;
+        }
+
+        jrtc_print_stream_id("Added stream id %s\n", &req_entry->stream_id);
+    }
+
+    _jrtc_router_req_table_changed(req_table);
+
+out:
+    ck_spinlock_unlock(&req_table->lock);
+    return res;
+}
+
+int
+_jrtc_router_req_table_remove(jrtc_router_req_table_t* req_table, int app_id, jrtc_router_stream_id_t* stream_id)
+{
+    ck_ht_hash_t h_req;
+    ck_ht_entry_t req_table_entry;
+    jrtc_router_req_entry_t* req_entry;
+    int res = 0;
+
+    ck_spinlock_lock(&req_table->lock);
+
+    ck_ht_hash(&h_req, &req_table->reqs, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+    ck_ht_entry_key_set(&req_table_entry, stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+
+    if (!ck_ht_get_spmc(&req_table->reqs, h_req, &req_table_entry)) {
+        goto out;
+    }
+
+    req_entry = ck_ht_entry_value(&req_table_entry);
+    if (!_jrtc_router_app_set_test(req_entry->apps, app_id)) {
+        goto out;
+    }
+
+    if (req_entry->apps->num_apps == 1) {
+        // The app was the last one with this request
+        _jrtc_router_req_entry_remove(req_table, req_entry, h_req);
+    } else if (_jrtc_router_req_apps_update(req_table, req_entry, app_id, false) < 0) {
+        res = -1;
+        goto out;
+    }
+
+    _jrtc_router_req_table_changed(req_table);
+    res = 1;
+
+out:
+    ck_spinlock_unlock(&req_table->lock);
+    return res;
+}
+
+int
+_jrtc_router_req_table_remove_app(jrtc_router_req_table_t* req_table, int app_id)
+{
+    ck_ht_iterator_t iterator = CK_HT_ITERATOR_INITIALIZER;
+    ck_ht_entry_t* cursor;
+    ck_ht_hash_t h_req;
+    jrtc_router_req_entry_t* req_entry;
+    int num_removed = 0;
+
+    ck_spinlock_lock(&req_table->lock);
+
+    // Removals only leave tombstones behind, so the table can be changed while it is iterated
+    while (ck_ht_next(&req_table->reqs, &iterator, &cursor)) {
+        req_entry = ck_ht_entry_value(cursor);
+        if (!_jrtc_router_app_set_test(req_entry->apps, app_id)) {
+            continue;
+        }
+
+        if (req_entry->apps->num_apps == 1) {
+            ck_ht_hash(&h_req, &req_table->reqs, &req_entry->stream_id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+            _jrtc_router_req_entry_remove(req_table, req_entry, h_req);
+        } else if (_jrtc_router_req_apps_update(req_table, req_entry, app_id, false) < 0) {
+            // Leave the app in the set, the forwarding skips apps that are not registered
+            jrtc_logger(JRTC_ERROR, "Could not allocate an app set to remove the requests of app %d\n", app_id);
+            continue;
+        }
+
+        num_removed++;
+    }
+
+    if (num_removed > 0) {
+        _jrtc_router_req_table_changed(req_table);
+    }
+
+    ck_spinlock_unlock(&req_table->lock);
+
+    num_removed += _jrtc_router_path_index_remove_app(req_table, app_id);
+    return num_removed;
+}
@@ -0,0 +1,317 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __x86_64__
+#include <cpuid.h>
+#endif
+
+#include "jrtc_router_int.h"
+#include "jrtc_router_stats.h"
+
+static size_t
+_jrtc_router_stats_size(uint32_t max_streams, uint32_t max_apps)
+{
+    return sizeof(struct jrtc_router_stats_header) + (size_t)max_streams * sizeof(struct jrtc_router_stream_stats) +
+           (size_t)max_apps * sizeof(struct jrtc_router_app_stats_slot);
+}
+
+int
+_jrtc_router_stats_create(
+    jrtc_router_stats_region_t* region,
+    const char* ipc_name,
+    uint32_t max_streams,
+    uint32_t max_apps,
+    uint64_t start_ns,
+    uint32_t clock_source)
+{
+    struct jrtc_router_stats_header* header;
+    size_t size;
+    int fd;
+
+    memset(region, 0, sizeof(jrtc_router_stats_region_t));
+    ck_spinlock_init(&region->lock);
+
+    snprintf(region->name, sizeof(region->name), JRTC_ROUTER_STATS_NAME_PREFIX "%s", ipc_name);
+    size = _jrtc_router_stats_size(max_streams, max_apps);
+
+    // Readers map the region read-only, so it can be readable by everyone
+    fd = shm_open(region->name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(region->name);
+        return -1;
+    }
+
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (header == MAP_FAILED) {
+        shm_unlink(region->name);
+        return -1;
+    }
+
+    memset(header, 0, size);
+    header->version = JRTC_ROUTER_STATS_VERSION;
+    header->header_size = sizeof(struct jrtc_router_stats_header);
+    header->stream_slot_size = sizeof(struct jrtc_router_stream_stats);
+    header->app_slot_size = sizeof(struct jrtc_router_app_stats_slot);
+    header->max_streams = max_streams;
+    header->max_apps = max_apps;
+    header->stream_slots_offset = sizeof(struct jrtc_router_stats_header);
+    header->app_slots_offset =
+        header->stream_slots_offset + (uint64_t)max_streams * sizeof(struct jrtc_router_stream_stats);
+    header->start_ns = start_ns;
+    header->clock_source = clock_source;
+
+    // Readers check the magic last, so it must be set after the rest of the header
+    ck_pr_fence_store();
+    ck_pr_store_32(&header->magic, JRTC_ROUTER_STATS_MAGIC);
+
+    region->header = header;
+    region->size = size;
+
+    return 0;
+}
+
+void
+_jrtc_router_stats_destroy(jrtc_router_stats_region_t* region)
+{
+    if (!region->header) {
+        return;
+    }
+
+    munmap(region->header, region->size);
+    shm_unlink(region->name);
+    region->header = NULL;
+}
+
+struct jrtc_router_stream_stats*
+_jrtc_router_stats_get_stream(jrtc_router_stats_region_t* region, jrtc_router_stream_id_t* sid)
+{
+    struct jrtc_router_stats_header* header;
+    struct jrtc_router_stream_stats* slots;
+    struct jrtc_router_stream_stats* slot = NULL;
+    uint32_t i;
+
+    header = region->header;
+    if (!header) {
+        return NULL;
+    }
+
+    slots = (struct jrtc_router_stream_stats*)((uint8_t*)header + header->stream_slots_offset);
+
+    // Slots are only taken when a stream is first seen, so a linear search is good enough
+    ck_spinlock_lock(&region->lock);
+
+    for (i = 0; i < header->num_streams; i++) {
+        if (memcmp(slots[i].stream_id, sid->id, JRTC_ROUTER_STREAM_ID_BYTE_LEN) == 0) {
+            slot = &slots[i];
+            goto out;
+        }
+    }
+
+    if (header->num_streams < header->max_streams) {
+        slot = &slots[header->num_streams];
+        memcpy(slot->stream_id, sid->id, JRTC_ROUTER_STREAM_ID_BYTE_LEN);
+        ck_pr_fence_store();
+        ck_pr_store_32(&header->num_streams, header->num_streams + 1);
+    }
+
+out:
+    ck_spinlock_unlock(&region->lock);
+    return slot;
+}
+
+struct jrtc_router_app_stats_slot*
+_jrtc_router_stats_get_app(jrtc_router_stats_region_t* region, int app_id)
+{
+    struct jrtc_router_stats_header* header;
+
+    header = region->header;
+    if (!header || app_id < 0 || (uint32_t)app_id >= header->max_apps) {
+        return NULL;
+    }
+
+    return (struct jrtc_router_app_stats_slot*)((uint8_t*)header + header->app_slots_offset) + app_id;
+}
+
+struct jrtc_router_stats_header*
+jrtc_router_stats_map(const char* ipc_name)
+{
+    char name[JRTC_ROUTER_STATS_NAME_LEN];
+    struct jrtc_router_stats_header* header;
+    struct stat st;
+    int fd;
+
+    if (!ipc_name) {
+        return NULL;
+    }
+
+    snprintf(name, sizeof(name), JRTC_ROUTER_STATS_NAME_PREFIX "%s", ipc_name);
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct jrtc_router_stats_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (header == MAP_FAILED) {
+        return NULL;
+    }
+
+    if (ck_pr_load_32(&header->magic) != JRTC_ROUTER_STATS_MAGIC || header->version != JRTC_ROUTER_STATS_VERSION) {
+        munmap(header, st.st_size);
+        return NULL;
+    }
+
+    return header;
+}
+
+void
+jrtc_router_stats_unmap(struct jrtc_router_stats_header* header)
+{
+    if (header) {
+        munmap(header, _jrtc_router_stats_size(header->max_streams, header->max_apps));
+    }
+}
+
+#ifdef __x86_64__
+#define JRTC_ROUTER_TSC_CALIBRATION_US (10000)
+#define JRTC_ROUTER_TSC_SAMPLE_TRIES (16)
+
+static bool
+_jrtc_router_tsc_is_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007) {
+        return false;
+    }
+
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    return (edx & (1 << 8)) != 0;
+}
+
+// Reads the TSC and CLOCK_MONOTONIC_RAW as close together as possible
+static void
+_jrtc_router_tsc_sample(uint64_t* tsc, uint64_t* ns)
+{
+    uint64_t before, after, best = UINT64_MAX;
+    uint64_t now;
+
+    for (int i = 0; i < JRTC_ROUTER_TSC_SAMPLE_TRIES; i++) {
+        before = __builtin_ia32_rdtsc();
+        now = _jrtc_router_clock_ns(CLOCK_MONOTONIC_RAW);
+        after = __builtin_ia32_rdtsc();
+
+        if (after - before < best) {
+            best = after - before;
+            *tsc = before + (after - before) / 2;
+            *ns = now;
+        }
+    }
+}
+#endif
+
+void
+_jrtc_router_timebase_init(jrtc_router_timebase_t* timebase, jrtc_router_timestamp_source_e source)
+{
+    memset(timebase, 0, sizeof(jrtc_router_timebase_t));
+    timebase->source = source;
+
+    if (source != JRTC_ROUTER_TIMESTAMP_TSC) {
+        return;
+    }
+
+#ifdef __x86_64__
+    if (_jrtc_router_tsc_is_invariant()) {
+        uint64_t tsc_start, ns_start, tsc_end, ns_end;
+
+        _jrtc_router_tsc_sample(&tsc_start, &ns_start);
+        usleep(JRTC_ROUTER_TSC_CALIBRATION_US);
+        _jrtc_router_tsc_sample(&tsc_end, &ns_end);
+
+        if (tsc_end > tsc_start) {
+            timebase->tsc_mult = ((ns_end - ns_start) << 32) / (tsc_end - tsc_start);
+            timebase->tsc_base = tsc_end;
+            timebase->ns_base = ns_end;
+            jrtc_logger(
+                JRTC_INFO,
+                "Using the TSC for the ingress timestamps, %lu kHz\n",
+                (tsc_end - tsc_start) * 1000000 / (ns_end - ns_start));
+            return;
+        }
+    }
+#endif
+
+    jrtc_logger(JRTC_WARN, "No invariant TSC, using CLOCK_MONOTONIC_RAW for the ingress timestamps\n");
+    timebase->source = JRTC_ROUTER_TIMESTAMP_MONOTONIC_RAW;
+}
+
+void
+_jrtc_router_latency_hist_read(jrtc_router_latency_hist_t* hist, struct jrtc_router_latency_stats* stats)
+{
+    uint64_t* buckets;
+    uint64_t count = 0;
+    uint64_t seen = 0;
+    uint64_t ranks[4];
+    uint64_t* values[4] = {&stats->p50_ns, &stats->p90_ns, &stats->p99_ns, &stats->p999_ns};
+    int next = 0;
+
+    memset(stats, 0, sizeof(struct jrtc_router_latency_stats));
+
+    // Work on a copy, so that the percentiles are consistent with the count
+    buckets = malloc(sizeof(hist->buckets));
+    if (!buckets) {
+        return;
+    }
+
+    for (int i = 0; i < JRTC_ROUTER_LATENCY_NUM_BUCKETS; i++) {
+        buckets[i] = ck_pr_load_64(&hist->buckets[i]);
+        count += buckets[i];
+    }
+
+    if (count == 0) {
+        goto out;
+    }
+
+    stats->count = count;
+    stats->min_ns = ck_pr_load_64(&hist->min_ns);
+    stats->max_ns = ck_pr_load_64(&hist->max_ns);
+    stats->mean_ns = ck_pr_load_64(&hist->sum_ns) / count;
+
+    // The smallest delay such that at least the given fraction of the messages were not slower
+    ranks[0] = (count * 500 + 999) / 1000;
+    ranks[1] = (count * 900 + 999) / 1000;
+    ranks[2] = (count * 990 + 999) / 1000;
+    ranks[3] = (count * 999 + 999) / 1000;
+
+    for (int i = 0; i < JRTC_ROUTER_LATENCY_NUM_BUCKETS && next < 4; i++) {
+        seen += buckets[i];
+        while (next < 4 && seen >= ranks[next]) {
+            uint64_t value = _jrtc_router_latency_bucket_max(i);
+            *values[next++] = value < stats->max_ns ? value : stats->max_ns;
+        }
+    }
+
+out:
+    free(buckets);
+}
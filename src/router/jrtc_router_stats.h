@@ -0,0 +1,221 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef JRTC_ROUTER_STATS_H
+#define JRTC_ROUTER_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /*
+     * Layout of the router stats region, version 1
+     *
+     * The router exports its counters in the POSIX shared memory object "/jrtc_router_stats_<ipc_name>",
+     * which can be mapped read-only by any process (e.g. with jrtc_router_stats_map()):
+     *
+     *   offset 0                      struct jrtc_router_stats_header
+     *   header.stream_slots_offset    struct jrtc_router_stream_stats[header.max_streams]
+     *   header.app_slots_offset       struct jrtc_router_app_stats_slot[header.max_apps]
+     *
+     * Readers must take all the offsets and slot sizes from the header, since new fields may be appended
+     * to the end of the header and of the slots. Existing fields are never moved within a version and any
+     * incompatible change bumps the version.
+     *
+     * A stream slot is taken the first time the router sees a stream and is never released.
+     * Only slots below header.num_streams are in use. App slots are indexed by the app id and are
+     * reset when an app registers.
+     *
+     * Sections that have a single writer start with a sequence counter, which is odd while the
+     * section is updated. Use jrtc_router_stats_read() to get a consistent copy of such a section.
+     * The queue counters of the apps are updated by all the router threads with atomic operations,
+     * so each of them can be read on its own, but not as a consistent set.
+     *
+     * All the timestamps are in nanoseconds, in the clock given by header.clock_source (a
+     * jrtc_router_timestamp_source_e). If the router takes no ingress timestamps, last_seen_ns is 0
+     * and the delay histograms are empty, and the other timestamps are CLOCK_MONOTONIC.
+     */
+
+#define JRTC_ROUTER_STATS_MAGIC (0x4a525453)
+#define JRTC_ROUTER_STATS_VERSION (1)
+
+#define JRTC_ROUTER_STATS_NAME_PREFIX "/jrtc_router_stats_"
+
+    /**
+     * @brief Number of buckets of the queueing delay histograms. Bucket 0 counts delays below 2ns,
+     * bucket i > 0 counts delays in [2^i, 2^(i+1)) ns and the last bucket also counts all the longer delays.
+     * @ingroup router
+     */
+#define JRTC_ROUTER_STATS_NUM_DELAY_BUCKETS (32)
+
+    /**
+     * @brief The jrtc_router_stats_header struct
+     * @ingroup router
+     * magic: JRTC_ROUTER_STATS_MAGIC, set last, once the region is initialized
+     * version: JRTC_ROUTER_STATS_VERSION
+     * header_size: The size of the header
+     * stream_slot_size: The size of a stream slot
+     * app_slot_size: The size of an app slot
+     * max_streams: The number of stream slots
+     * max_apps: The number of app slots
+     * num_streams: The number of stream slots in use
+     * stream_slots_offset: The offset of the first stream slot
+     * app_slots_offset: The offset of the first app slot
+     * start_ns: The time the router was started
+     * clock_source: The clock of the timestamps, see jrtc_router_timestamp_source_e
+     */
+    struct jrtc_router_stats_header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t header_size;
+        uint32_t stream_slot_size;
+        uint32_t app_slot_size;
+        uint32_t max_streams;
+        uint32_t max_apps;
+        uint32_t num_streams;
+        uint64_t stream_slots_offset;
+        uint64_t app_slots_offset;
+        uint64_t start_ns;
+        uint32_t clock_source;
+        uint32_t reserved;
+    };
+
+    /**
+     * @brief The jrtc_router_stream_stats struct. Updated once per batch by the router thread that owns the stream.
+     * @ingroup router
+     * seq: The sequence counter of the slot
+     * elem_size: The size of the messages of the stream, learned from jbpf with its first batch, or 0 if jbpf
+     * could not report it
+     * stream_id: The stream id
+     * num_msgs: Messages received by the router
+     * num_bytes: num_msgs * elem_size, not counted while elem_size is 0
+     * num_delivered: Messages placed in the queues of the subscribed apps, once per app
+     * num_dropped: Messages that could not be placed in the queues of the subscribed apps, once per app
+     * last_seen_ns: The time the last message was received
+     */
+    struct jrtc_router_stream_stats
+    {
+        uint32_t seq;
+        uint32_t elem_size;
+        uint8_t stream_id[16];
+        uint64_t num_msgs;
+        uint64_t num_bytes;
+        uint64_t num_delivered;
+        uint64_t num_dropped;
+        uint64_t last_seen_ns;
+    };
+
+    /**
+     * @brief The jrtc_router_app_stats_slot struct
+     * @ingroup router
+     * in_use: 1 while the app is registered
+     * app_id: The id of the app
+     * num_filtered_out, num_enqueued, num_dropped, num_overwritten, high_watermark, num_sampled_out,
+     * num_rate_limited: The queue counters of the app, as returned by jrtc_router_get_app_stats()
+     * rx_seq: The sequence counter of the rx section, which is updated by the app in jrtc_router_receive()
+     * num_received: Messages received by the app from its queue
+     * last_receive_ns: The time of the last jrtc_router_receive() call that returned messages
+     * delay_hist: The time from the arrival of the messages at the router until they were received by the app
+     */
+    struct jrtc_router_app_stats_slot
+    {
+        uint32_t in_use;
+        int32_t app_id;
+        uint64_t num_filtered_out;
+        uint64_t num_enqueued;
+        uint64_t num_dropped;
+        uint64_t num_overwritten;
+        uint64_t high_watermark;
+        uint64_t num_sampled_out;
+        uint64_t num_rate_limited;
+
+        // Starts on its own cache line, since it is written by the app
+        uint32_t rx_seq;
+        uint32_t reserved2;
+        uint64_t num_received;
+        uint64_t last_receive_ns;
+        uint64_t delay_hist[JRTC_ROUTER_STATS_NUM_DELAY_BUCKETS];
+        uint64_t reserved3[5];
+    };
+
+    /**
+     * @brief Get a stream slot of a mapped stats region
+     * @ingroup router
+     * @param header The mapped region
+     * @param idx The index of the slot, lower than header->num_streams
+     */
+    static inline const struct jrtc_router_stream_stats*
+    jrtc_router_stats_stream_slot(const struct jrtc_router_stats_header* header, uint32_t idx)
+    {
+        return (const struct jrtc_router_stream_stats*)((const uint8_t*)header + header->stream_slots_offset +
+                                                        (size_t)idx * header->stream_slot_size);
+    }
+
+    /**
+     * @brief Get an app slot of a mapped stats region
+     * @ingroup router
+     * @param header The mapped region
+     * @param app_id The id of the app, lower than header->max_apps
+     */
+    static inline const struct jrtc_router_app_stats_slot*
+    jrtc_router_stats_app_slot(const struct jrtc_router_stats_header* header, uint32_t app_id)
+    {
+        return (const struct jrtc_router_app_stats_slot*)((const uint8_t*)header + header->app_slots_offset +
+                                                          (size_t)app_id * header->app_slot_size);
+    }
+
+    /**
+     * @brief Get a consistent copy of a section that is protected by a sequence counter
+     * @ingroup router
+     * @param seq The sequence counter of the section
+     * @param src The start of the section
+     * @param dst Stores the copy
+     * @param len The size of the section
+     */
+    static inline void
+    jrtc_router_stats_read(const uint32_t* seq, const void* src, void* dst, size_t len)
+    {
+        uint32_t start;
+
+        while (1) {
+            start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+            if (start & 1) {
+                continue;
+            }
+
+            memcpy(dst, src, len);
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(seq, __ATOMIC_RELAXED) == start) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Map the stats region of a router read-only
+     * @ingroup router
+     * @param ipc_name The ipc name of the router
+     * @return The mapped region, or NULL if the region does not exist or has an unsupported version
+     */
+    struct jrtc_router_stats_header*
+    jrtc_router_stats_map(const char* ipc_name);
+
+    /**
+     * @brief Unmap a region mapped with jrtc_router_stats_map()
+     * @ingroup router
+     * @param header The mapped region
+     */
+    void
+    jrtc_router_stats_unmap(struct jrtc_router_stats_header* header);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "jrtc_router_doorbell.h"
+
+#define JRTC_ROUTER_DOORBELL_NAME_LEN (64)
+
+static void
+_jrtc_router_doorbell_name(const char* ipc_name, char* name, size_t len)
+{
+    snprintf(name, len, "/jrtc_router_doorbell_%s", ipc_name);
+}
+
+static jrtc_router_doorbell_t*
+_jrtc_router_doorbell_map(const char* ipc_name, int flags)
+{
+    char name[JRTC_ROUTER_DOORBELL_NAME_LEN];
+    jrtc_router_doorbell_t* doorbell;
+    int fd;
+
+    if (!ipc_name) {
+        return NULL;
+    }
+
+    _jrtc_router_doorbell_name(ipc_name, name, sizeof(name));
+
+    fd = shm_open(name, flags, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    if ((flags & O_CREAT) && ftruncate(fd, sizeof(jrtc_router_doorbell_t)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    doorbell = mmap(NULL, sizeof(jrtc_router_doorbell_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (doorbell == MAP_FAILED) {
+        return NULL;
+    }
+
+    return doorbell;
+}
+
+jrtc_router_doorbell_t*
+jrtc_router_doorbell_create(const char* ipc_name)
+{
+    jrtc_router_doorbell_t* doorbell;
+
+    doorbell = _jrtc_router_doorbell_map(ipc_name, O_CREAT | O_RDWR);
+    if (doorbell) {
+        memset(doorbell, 0, sizeof(jrtc_router_doorbell_t));
+    }
+    return doorbell;
+}
+
+jrtc_router_doorbell_t*
+jrtc_router_doorbell_open(const char* ipc_name)
+{
+    return _jrtc_router_doorbell_map(ipc_name, O_RDWR);
+}
+
+void
+jrtc_router_doorbell_close(jrtc_router_doorbell_t* doorbell, const char* ipc_name)
+{
+    char name[JRTC_ROUTER_DOORBELL_NAME_LEN];
+
+    if (doorbell) {
+        munmap(doorbell, sizeof(jrtc_router_doorbell_t));
+    }
+
+    if (ipc_name) {
+        _jrtc_router_doorbell_name(ipc_name, name, sizeof(name));
+        shm_unlink(name);
+    }
+}
+
+void
+_jrtc_router_doorbell_wake(jrtc_router_doorbell_t* doorbell)
+{
+    struct timespec ts;
+    uint32_t parked = 1;
+
+    // Only the first producer that sees the router parked issues the wake up
+    if (!__atomic_compare_exchange_n(&doorbell->parked, &parked, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    __atomic_store_n(&doorbell->ring_ts_ns, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&doorbell->seq, 1, __ATOMIC_SEQ_CST);
+
+    syscall(SYS_futex, &doorbell->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+uint32_t
+jrtc_router_doorbell_prepare_park(jrtc_router_doorbell_t* doorbell)
+{
+    uint32_t seq;
+
+    seq = __atomic_load_n(&doorbell->seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&doorbell->parked, 1, __ATOMIC_RELAXED);
+
+    // Pairs with the fence in jrtc_router_doorbell_ring()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return seq;
+}
+
+void
+jrtc_router_doorbell_cancel_park(jrtc_router_doorbell_t* doorbell)
+{
+    __atomic_store_n(&doorbell->parked, 0, __ATOMIC_RELEASE);
+}
+
+int
+jrtc_router_doorbell_park(jrtc_router_doorbell_t* doorbell, uint32_t seq, uint32_t timeout_us, uint64_t* ring_ts_ns)
+{
+    struct timespec timeout;
+    long res;
+
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    // Returns immediately if a producer has rung since jrtc_router_doorbell_prepare_park()
+    do {
+        res = syscall(SYS_futex, &doorbell->seq, FUTEX_WAIT, seq, &timeout, NULL, 0);
+    } while (res != 0 && errno == EINTR && __atomic_load_n(&doorbell->seq, __ATOMIC_ACQUIRE) == seq);
+
+    jrtc_router_doorbell_cancel_park(doorbell);
+
+    if (__atomic_load_n(&doorbell->seq, __ATOMIC_ACQUIRE) != seq) {
+        if (ring_ts_ns) {
+            *ring_ts_ns = __atomic_load_n(&doorbell->ring_ts_ns, __ATOMIC_RELAXED);
+        }
+        return 1;
+    }
+
+    return 0;
+}
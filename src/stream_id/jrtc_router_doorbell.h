@@ -0,0 +1,112 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#ifndef JRTC_ROUTER_DOORBELL_H
+#define JRTC_ROUTER_DOORBELL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * @brief The jrtc_router_doorbell struct
+ * @ingroup stream_id
+ * A futex based doorbell in shared memory, used by producers to wake up a parked router thread
+ * seq: The futex word, incremented on every wake up
+ * parked: Set while the router is parked or about to park
+ * ring_ts_ns: CLOCK_MONOTONIC time of the ring that woke up the router
+ */
+typedef struct jrtc_router_doorbell
+{
+    uint32_t seq;
+    uint32_t parked;
+    uint64_t ring_ts_ns;
+} jrtc_router_doorbell_t;
+
+/**
+ * @brief Create the doorbell of a router
+ * @ingroup stream_id
+ * @param ipc_name The ipc name of the router
+ * @return The doorbell, or NULL on failure
+ */
+jrtc_router_doorbell_t*
+jrtc_router_doorbell_create(const char* ipc_name);
+
+/**
+ * @brief Open the doorbell of a router that was created by another process
+ * @ingroup stream_id
+ * @param ipc_name The ipc name of the router
+ * @return The doorbell, or NULL on failure
+ */
+jrtc_router_doorbell_t*
+jrtc_router_doorbell_open(const char* ipc_name);
+
+/**
+ * @brief Close a doorbell
+ * @ingroup stream_id
+ * @param doorbell The doorbell
+ * @param ipc_name If not NULL, the doorbell is also removed from the system
+ */
+void
+jrtc_router_doorbell_close(jrtc_router_doorbell_t* doorbell, const char* ipc_name);
+
+void
+_jrtc_router_doorbell_wake(jrtc_router_doorbell_t* doorbell);
+
+/**
+ * @brief Wake up the router, if it is parked. Must be called after the data has been submitted.
+ * @ingroup stream_id
+ * @param doorbell The doorbell
+ */
+static inline void
+jrtc_router_doorbell_ring(jrtc_router_doorbell_t* doorbell)
+{
+    if (!doorbell) {
+        return;
+    }
+
+    // Pairs with the fence in jrtc_router_doorbell_prepare_park()
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&doorbell->parked, __ATOMIC_RELAXED)) {
+        _jrtc_router_doorbell_wake(doorbell);
+    }
+}
+
+/**
+ * @brief Announce that the router is about to park. The router must poll once more after this call
+ * and then either park or cancel.
+ * @ingroup stream_id
+ * @param doorbell The doorbell
+ * @return The value to pass to jrtc_router_doorbell_park()
+ */
+uint32_t
+jrtc_router_doorbell_prepare_park(jrtc_router_doorbell_t* doorbell);
+
+/**
+ * @brief Cancel a park announced with jrtc_router_doorbell_prepare_park()
+ * @ingroup stream_id
+ * @param doorbell The doorbell
+ */
+void
+jrtc_router_doorbell_cancel_park(jrtc_router_doorbell_t* doorbell);
+
+/**
+ * @brief Park until the doorbell is rung or the timeout expires
+ * @ingroup stream_id
+ * @param doorbell The doorbell
+ * @param seq The value returned by jrtc_router_doorbell_prepare_park()
+ * @param timeout_us The max time to park in microseconds
+ * @param ring_ts_ns Set to the time of the ring, if woken up by a ring
+ * @return 1 if woken up by a ring, 0 on timeout
+ */
+int
+jrtc_router_doorbell_park(jrtc_router_doorbell_t* doorbell, uint32_t seq, uint32_t timeout_us, uint64_t* ring_ts_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -89,6 +89,11 @@ JrtcApp::Init()
         }
         si.sid = sid;
 
+        // Announce named streams so that pattern subscriptions can match them
+        if (s.sid.stream_source && s.sid.io_map) {
+            jrtc_router_stream_catalog_add(s.sid.stream_source, s.sid.io_map);
+        }
+
         // Create channel if needed
         if (s.appChannel) {
             si.chan_ctx = jrtc_router_channel_create(
@@ -107,7 +112,8 @@ JrtcApp::Init()
 
         // Register stream if it is for reception
         if (s.is_rx && (!si.registered)) {
-            res = jrtc_router_channel_register_stream_id_req(env_ctx->dapp_ctx, si.sid);
+            res = jrtc_router_channel_register_stream_id_req_ex(
+                env_ctx->dapp_ctx, si.sid, s.latest ? JRTC_ROUTER_REQ_MODE_LATEST : JRTC_ROUTER_REQ_MODE_QUEUE);
             if (res != 1) {
                 std::cout << app_cfg->context << "::  Failure registering stream id for " << s.sid << std::endl;
                 return -1;
@@ -191,7 +197,20 @@ JrtcApp::run()
                 last_received_time = now;
             }
 
-            auto num_rcv = jrtc_router_receive(env_ctx->dapp_ctx, data_entries.data(), app_cfg->q_size);
+            // Wait for data instead of sleeping. The wait is bounded, so that app_exit and the inactivity timeout
+            // are still checked.
+            int num_rcv;
+            if (app_cfg->sleep_timeout_secs > 0) {
+                // Ensure the timeout is at least 1 nanosecond (1e-9 seconds)
+                float dur = std::max(app_cfg->sleep_timeout_secs, 1e-9f);
+                num_rcv = jrtc_router_receive_timeout(
+                    env_ctx->dapp_ctx,
+                    data_entries.data(),
+                    app_cfg->q_size,
+                    static_cast<uint64_t>(static_cast<double>(dur) * 1'000'000'000));
+            } else {
+                num_rcv = jrtc_router_receive(env_ctx->dapp_ctx, data_entries.data(), app_cfg->q_size);
+            }
             for (int i = 0; i < num_rcv; ++i) {
 
                 // find index which matches stream, if any
@@ -212,12 +231,6 @@ JrtcApp::run()
                 jrtc_router_channel_release_buf(data_entries[i].data);
                 last_received_time = std::chrono::steady_clock::now();
             }
-
-            if (app_cfg->sleep_timeout_secs > 0) {
-                // Ensure the timeout is at least 1 nanosecond (1e-9 seconds)
-                float dur = std::max(app_cfg->sleep_timeout_secs, 1e-9f);
-                std::this_thread::sleep_for(std::chrono::nanoseconds(static_cast<long long>(dur * 1'000'000'000)));
-            }
         }
     }
     CleanUp();
@@ -240,6 +253,17 @@ JrtcApp::get_chan_ctx(int stream_idx)
     return (static_cast<size_t>(stream_idx) < stream_items.size()) ? stream_items[stream_idx].chan_ctx : nullptr;
 }
 
+// ###########################################################
+// Retrieves the router-to-app latency of a stream received by the app
+int
+JrtcApp::get_latency_stats(const jrtc_router_stream_id_t* stream_id, struct jrtc_router_latency_stats* stats)
+{
+    if (!stream_id) {
+        return -1;
+    }
+    return jrtc_router_get_latency_stats(env_ctx->dapp_ctx, *stream_id, stats);
+}
+
 // ###########################################################
 // C API wrapper functions
 extern "C"
@@ -309,4 +333,26 @@ extern "C"
         }
         return jrtc_router_channel_send_input_msg(*sid, data, data_len);
     }
+
+    // abstraction wrapper for jrtc_router_channel_multicast_input_msg, using stream_index
+    int
+    jrtc_app_router_channel_multicast_input_msg(JrtcApp* app, uint stream_idx, void* data, size_t data_len)
+    {
+        jrtc_router_stream_id_t* sid = app->get_stream(stream_idx);
+        if (!sid) {
+            return -1;
+        }
+        return jrtc_router_channel_multicast_input_msg(*sid, data, data_len);
+    }
+
+    // abstraction wrapper for jrtc_router_get_latency_stats
+    int
+    jrtc_app_get_latency_stats(
+        JrtcApp* app, const jrtc_router_stream_id_t* stream_id, struct jrtc_router_latency_stats* stats)
+    {
+        if (!app) {
+            return -1;
+        }
+        return app->get_latency_stats(stream_id, stats);
+    }
 }
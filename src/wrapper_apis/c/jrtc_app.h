@@ -38,6 +38,7 @@ extern "C"
         JrtcStreamIdCfg_t sid;           // Stream ID configuration
         bool is_rx;                      // Indicates if the stream is for receiving
         JrtcAppChannelCfg_t* appChannel; // Pointer to application channel configuration
+        bool latest;                     // Only receive the latest message of the stream, for rx streams
     } JrtcStreamCfg_t;
 
     // Structure representing the overall application configuration
@@ -48,7 +49,7 @@ extern "C"
         int num_streams;                   // Number of streams
         JrtcStreamCfg_t* streams;          // Pointer to an array of stream configurations
         float initialization_timeout_secs; // Maximum time to wait for initialisation to complete.
-        float sleep_timeout_secs;          // Sleep timeout in seconds
+        float sleep_timeout_secs;          // Max time to wait for data in seconds, 0 to busy poll
         float inactivity_timeout_secs;     // Inactivity timeout in seconds
     } JrtcAppCfg_t;
 
@@ -98,6 +99,22 @@ extern "C"
     int
     jrtc_app_router_channel_send_input_msg(JrtcApp* app, uint stream_idx, void* data, size_t data_len);
 
+    // abstraction wrapper for jrtc_router_channel_multicast_input_msg, using stream_index
+    // @param app - Pointer to the JrtcApp instance
+    // @param stream_idx - Index of the stream, whose id may use JRTC_ROUTER_REQ_DEST_ANY/JRTC_ROUTER_REQ_DEVICE_ID_ANY
+    // @return the number of input channels the message was sent to, JRTC_ROUTER_MULTICAST_UNRESOLVED if the stream
+    // path or name is a wildcard, or -1 on error
+    int
+    jrtc_app_router_channel_multicast_input_msg(JrtcApp* app, uint stream_idx, void* data, size_t data_len);
+
+    // abstraction wrapper for jrtc_router_get_latency_stats
+    // @param app - Pointer to the JrtcApp instance
+    // @param stream_id - The exact stream ID, e.g. the one of a received data entry
+    // @param stats - Stores the router-to-app latency of the stream
+    int
+    jrtc_app_get_latency_stats(
+        JrtcApp* app, const jrtc_router_stream_id_t* stream_id, struct jrtc_router_latency_stats* stats);
+
 #ifdef __cplusplus
 }
 #endif
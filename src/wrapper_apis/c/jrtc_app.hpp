@@ -56,6 +56,13 @@ class JrtcApp
     dapp_channel_ctx_t
     get_chan_ctx(int stream_idx);
 
+    // Retrieves the router-to-app latency of a stream received by the app
+    // @param stream_id - The exact stream ID, e.g. the one of a received data entry
+    // @param stats - Stores the latency stats
+    // @return 0 on success, -1 if no timestamped messages of the stream were received
+    int
+    get_latency_stats(const jrtc_router_stream_id_t* stream_id, struct jrtc_router_latency_stats* stats);
+
   private:
     struct jrtc_app_env* env_ctx;                             // Environment context
     JrtcAppCfg_t* app_cfg;                                    // Pointer to application configuration
@@ -35,19 +35,42 @@ from jrtc_wrapper_utils import (
 )
 from jrtc_router_lib import (
     jrtc_router_channel_register_stream_id_req,
+    jrtc_router_channel_register_stream_id_req_ex,
+    jrtc_router_channel_set_req_limit,
+    jrtc_router_channel_set_req_filter,
     jrtc_router_channel_create,
     jrtc_router_input_channel_exists,
     jrtc_router_receive,
+    jrtc_router_receive_timeout,
+    jrtc_router_get_fd,
+    jrtc_router_arm_fd,
     jrtc_router_channel_deregister_stream_id_req,
     jrtc_router_channel_destroy,
     jrtc_router_channel_send_input_msg,
+    jrtc_router_channel_multicast_input_msg,
     jrtc_router_channel_send_output_msg,
     jrtc_router_channel_release_buf,
+    jrtc_router_get_latency_stats,
+    jrtc_router_timestamp_now_ns,
+    jrtc_router_channel_register_pattern_req,
+    jrtc_router_channel_deregister_pattern_req,
+    jrtc_router_stream_catalog_add,
     JRTC_ROUTER_REQ_DEST_ANY,
     JRTC_ROUTER_REQ_DEVICE_ID_ANY,
     JRTC_ROUTER_REQ_DEST_NONE,
     JRTC_ROUTER_REQ_STREAM_PATH_ANY,
     JRTC_ROUTER_REQ_STREAM_NAME_ANY,
+    JRTC_ROUTER_REQ_MODE_QUEUE,
+    JRTC_ROUTER_REQ_MODE_LATEST,
+    JRTC_ROUTER_FILTER_EQ,
+    JRTC_ROUTER_FILTER_NE,
+    JRTC_ROUTER_FILTER_LT,
+    JRTC_ROUTER_FILTER_LE,
+    JRTC_ROUTER_FILTER_GT,
+    JRTC_ROUTER_FILTER_GE,
+    JRTC_ROUTER_FILTER_MASK_ANY,
+    JRTC_ROUTER_FILTER_MASK_ALL,
+    JRTC_ROUTER_MULTICAST_UNRESOLVED,
 )
 
 
@@ -70,6 +93,7 @@ class JrtcStreamCfg_t(Structure):
         ("sid", JrtcStreamIdCfg_t),
         ("is_rx", c_bool),
         ("appChannel", POINTER(JrtcAppChannelCfg_t)),
+        ("latest", c_bool),
     ]
 
 
@@ -161,6 +185,10 @@ class JrtcApp:
             _sid = si.sid
             si.sid = si.sid.convert_to_struct_jrtc_router_stream_id()
 
+            # Announce named streams so that pattern subscriptions can match them
+            if stream.sid.stream_source and stream.sid.io_map:
+                jrtc_router_stream_catalog_add(stream.sid.stream_source, stream.sid.io_map)
+
             if not any(bytes(si.sid)) or not any(bytes(_sid)):
                 self.logger.error(f"Stream {i} ID is all zeros after generation!")
 
@@ -188,8 +216,13 @@ class JrtcApp:
                     return -1
 
             if stream.is_rx and not si.registered:
-                if not jrtc_router_channel_register_stream_id_req(
-                    self.data.env_ctx.dapp_ctx, si.sid
+                mode = (
+                    JRTC_ROUTER_REQ_MODE_LATEST
+                    if stream.latest
+                    else JRTC_ROUTER_REQ_MODE_QUEUE
+                )
+                if not jrtc_router_channel_register_stream_id_req_ex(
+                    self.data.env_ctx.dapp_ctx, si.sid, mode
                 ):
                     self.logger.error(
                         f"{self.data.app_cfg.context}:: Failed to register stream {i}"
@@ -273,9 +306,18 @@ class JrtcApp:
                 self.data.app_handler(True, -1, None, self.data.app_state)
                 self.last_received_time = now
 
-            num_rcv = jrtc_router_receive(
-                self.data.env_ctx.dapp_ctx, data_entries, self.data.app_cfg.q_size
-            )
+            # Wait for data instead of sleeping, the GIL is released during the wait
+            if self.data.app_cfg.sleep_timeout_secs > 0:
+                num_rcv = jrtc_router_receive_timeout(
+                    self.data.env_ctx.dapp_ctx,
+                    data_entries,
+                    self.data.app_cfg.q_size,
+                    int(max(self.data.app_cfg.sleep_timeout_secs, 1e-9) * 1e9),
+                )
+            else:
+                num_rcv = jrtc_router_receive(
+                    self.data.env_ctx.dapp_ctx, data_entries, self.data.app_cfg.q_size
+                )
             for i in range(num_rcv):
                 data_entry = data_entries[i]
                 if not data_entry:
@@ -293,9 +335,6 @@ class JrtcApp:
                 jrtc_router_channel_release_buf(data_entry.data)
                 self.data.last_received_time = time.monotonic()
 
-            if self.data.app_cfg.sleep_timeout_secs > 0:
-                time.sleep(max(self.data.app_cfg.sleep_timeout_secs, 1e-9))
-
 
     def get_stream(self, stream_idx: int) -> Optional[JrtcRouterStreamId]:
         if stream_idx < 0 or stream_idx >= len(self.stream_items):
@@ -338,6 +377,18 @@ def jrtc_app_router_channel_send_input_msg(
     return jrtc_router_channel_send_input_msg(stream, data, data_len)
 
 
+def jrtc_app_router_channel_multicast_input_msg(
+    app: JrtcApp, stream_idx: int, data: bytes, data_len: int
+) -> int:
+    """Sends the message to every input channel matching the stream id, which may use
+    JRTC_ROUTER_REQ_DEST_ANY/JRTC_ROUTER_REQ_DEVICE_ID_ANY. Returns the number of channels reached,
+    or JRTC_ROUTER_MULTICAST_UNRESOLVED if the stream path or name is a wildcard."""
+    stream = app.get_stream(stream_idx)
+    if not stream:
+        return -1
+    return jrtc_router_channel_multicast_input_msg(stream, data, data_len)
+
+
 def jrtc_app_router_channel_send_output_msg(
     app: JrtcApp, stream_idx: int, data: bytes, data_len: int
 ) -> int:
@@ -346,12 +397,89 @@ def jrtc_app_router_channel_send_output_msg(
         return -1
     return jrtc_router_channel_send_output_msg(chan_ctx, data, data_len)
 
+
+def jrtc_app_get_latency_stats(app: JrtcApp, stream_id):
+    """Returns the router-to-app latency of a received stream, e.g. of data_entry.stream_id, or None."""
+    return jrtc_router_get_latency_stats(app.data.env_ctx.dapp_ctx, stream_id)
+
+def jrtc_app_register_pattern_req(app: JrtcApp, fwd_dst, device_id, path_pattern: str, name_pattern: str = None):
+    """Subscribes the app to all the streams whose path matches path_pattern, e.g. "MyDeployment://jbpf_agent/*"."""
+    return jrtc_router_channel_register_pattern_req(
+        app.data.env_ctx.dapp_ctx,
+        fwd_dst,
+        device_id,
+        path_pattern.encode(),
+        name_pattern.encode() if name_pattern else None,
+    )
+
+def jrtc_app_set_req_limit(app: JrtcApp, stream_idx: int, sample_every: int = 0, max_rate: int = 0, burst: int = 0):
+    """Delivers only one in sample_every messages and/or at most max_rate messages per second of each stream
+    matched by an rx stream of the app, see jrtc_router_req_limit. With the default values, the limit is removed."""
+    stream = app.get_stream(stream_idx)
+    if not stream:
+        return -1
+    limit = struct_jrtc_router_req_limit(sample_every, max_rate, burst)
+    return jrtc_router_channel_set_req_limit(app.data.env_ctx.dapp_ctx, stream, limit)
+
+def jrtc_app_set_req_filter(app: JrtcApp, stream_idx: int, conds: Optional[list] = None):
+    """Delivers only the messages of each stream matched by an rx stream of the app whose payload meets all the
+    conditions, see jrtc_router_req_filter. Each condition is a tuple (offset, size, op, value) or
+    (offset, size, op, value, is_signed), with op one of JRTC_ROUTER_FILTER_*. Without conditions, the filter is
+    removed."""
+    stream = app.get_stream(stream_idx)
+    if not stream:
+        return -1
+    if not conds:
+        return jrtc_router_channel_set_req_filter(app.data.env_ctx.dapp_ctx, stream, None)
+    if len(conds) > len(struct_jrtc_router_req_filter().conds):
+        return -1
+    filter = struct_jrtc_router_req_filter()
+    filter.num_conds = len(conds)
+    for i, cond in enumerate(conds):
+        offset, size, op, value = cond[:4]
+        filter.conds[i].offset = offset
+        filter.conds[i].size = size
+        filter.conds[i].op = op
+        filter.conds[i].is_signed = 1 if len(cond) > 4 and cond[4] else 0
+        # The value is compared as a 64-bit pattern, negative values are sign-extended
+        filter.conds[i].value = value & 0xFFFFFFFFFFFFFFFF
+    return jrtc_router_channel_set_req_filter(app.data.env_ctx.dapp_ctx, stream, filter)
+
+def jrtc_app_deregister_pattern_req(app: JrtcApp, fwd_dst, device_id, path_pattern: str, name_pattern: str = None):
+    return jrtc_router_channel_deregister_pattern_req(
+        app.data.env_ctx.dapp_ctx,
+        fwd_dst,
+        device_id,
+        path_pattern.encode(),
+        name_pattern.encode() if name_pattern else None,
+    )
+
+def jrtc_app_get_fd(app: JrtcApp):
+    """Returns a file descriptor that becomes readable when data arrives for the app, e.g. for asyncio's add_reader().
+    It must be armed with jrtc_app_arm_fd() before each wait."""
+    return jrtc_router_get_fd(app.data.env_ctx.dapp_ctx)
+
+def jrtc_app_arm_fd(app: JrtcApp):
+    """Arms the file descriptor of the app. Returns 1 if data is already pending, so there is no need to wait."""
+    return jrtc_router_arm_fd(app.data.env_ctx.dapp_ctx)
+
 __all__ = [
     "JRTC_ROUTER_REQ_DEST_ANY",
     "JRTC_ROUTER_REQ_DEVICE_ID_ANY",
     "JRTC_ROUTER_REQ_DEST_NONE",
     "JRTC_ROUTER_REQ_STREAM_PATH_ANY",
     "JRTC_ROUTER_REQ_STREAM_NAME_ANY",
+    "JRTC_ROUTER_REQ_MODE_QUEUE",
+    "JRTC_ROUTER_REQ_MODE_LATEST",
+    "JRTC_ROUTER_FILTER_EQ",
+    "JRTC_ROUTER_FILTER_NE",
+    "JRTC_ROUTER_FILTER_LT",
+    "JRTC_ROUTER_FILTER_LE",
+    "JRTC_ROUTER_FILTER_GT",
+    "JRTC_ROUTER_FILTER_GE",
+    "JRTC_ROUTER_FILTER_MASK_ANY",
+    "JRTC_ROUTER_FILTER_MASK_ALL",
+    "JRTC_ROUTER_MULTICAST_UNRESOLVED",
     "struct_jrtc_router_data_entry",
     "JrtcStreamIdCfg_t",
     "JrtcAppChannelCfg_t",
@@ -362,5 +490,14 @@ __all__ = [
     "jrtc_app_run",
     "jrtc_app_destroy",
     "jrtc_app_router_channel_send_input_msg",
+    "jrtc_app_router_channel_multicast_input_msg",
     "jrtc_app_router_channel_send_output_msg",
+    "jrtc_app_get_latency_stats",
+    "jrtc_router_timestamp_now_ns",
+    "jrtc_app_register_pattern_req",
+    "jrtc_app_get_fd",
+    "jrtc_app_arm_fd",
+    "jrtc_app_deregister_pattern_req",
+    "jrtc_app_set_req_limit",
+    "jrtc_app_set_req_filter",
 ]
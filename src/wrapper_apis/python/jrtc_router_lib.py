@@ -25,6 +25,22 @@ JRTC_ROUTER_REQ_STREAM_PATH_ANY = None
 JRTC_ROUTER_REQ_STREAM_NAME_ANY = None
 JRTC_ROUTER_CONTROLLER_DEVICE_ID = 0x0
 
+JRTC_ROUTER_REQ_MODE_QUEUE = 0
+JRTC_ROUTER_REQ_MODE_LATEST = 1
+
+# Comparisons of the conditions of request filters, see jrtc_router_filter_op_e
+JRTC_ROUTER_FILTER_EQ = 0
+JRTC_ROUTER_FILTER_NE = 1
+JRTC_ROUTER_FILTER_LT = 2
+JRTC_ROUTER_FILTER_LE = 3
+JRTC_ROUTER_FILTER_GT = 4
+JRTC_ROUTER_FILTER_GE = 5
+JRTC_ROUTER_FILTER_MASK_ANY = 6
+JRTC_ROUTER_FILTER_MASK_ALL = 7
+
+# Returned by jrtc_router_channel_multicast_input_msg for a wildcard stream path or name
+JRTC_ROUTER_MULTICAST_UNRESOLVED = -2
+
 def jrtc_router_receive(app_ctx, data_entries_array_ptr, num_entries):
     jrtc_router_lib.jrtc_router_receive.argtypes = [
         ctypes.POINTER(jrtc_bindings.struct_dapp_router_ctx),  # app_ctx
@@ -38,6 +54,51 @@ def jrtc_router_receive(app_ctx, data_entries_array_ptr, num_entries):
     )
     return res
 
+def jrtc_router_receive_timeout(app_ctx, data_entries_array_ptr, num_entries, timeout_ns):
+    jrtc_router_lib.jrtc_router_receive_timeout.argtypes = [
+        ctypes.POINTER(jrtc_bindings.struct_dapp_router_ctx),  # app_ctx
+        ctypes.POINTER(jrtc_bindings.struct_jrtc_router_data_entry),  # data_entries
+        ctypes.c_size_t,  # num_entries
+        ctypes.c_uint64,  # timeout_ns
+    ]
+    jrtc_router_lib.jrtc_router_receive_timeout.restype = ctypes.c_int
+
+    return jrtc_router_lib.jrtc_router_receive_timeout(
+        app_ctx, data_entries_array_ptr, num_entries, timeout_ns
+    )
+
+def jrtc_router_get_fd(app_ctx):
+    jrtc_router_lib.jrtc_router_get_fd.argtypes = [
+        ctypes.POINTER(jrtc_bindings.struct_dapp_router_ctx),  # app_ctx
+    ]
+    jrtc_router_lib.jrtc_router_get_fd.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_get_fd(app_ctx)
+
+def jrtc_router_arm_fd(app_ctx):
+    jrtc_router_lib.jrtc_router_arm_fd.argtypes = [
+        ctypes.POINTER(jrtc_bindings.struct_dapp_router_ctx),  # app_ctx
+    ]
+    jrtc_router_lib.jrtc_router_arm_fd.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_arm_fd(app_ctx)
+
+def jrtc_router_get_latency_stats(dapp_ctx, stream_id):
+    jrtc_router_lib.jrtc_router_get_latency_stats.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,  # dapp_ctx
+        jrtc_bindings.struct_jrtc_router_stream_id,  # stream_id
+        ctypes.POINTER(jrtc_bindings.struct_jrtc_router_latency_stats),  # stats
+    ]
+    jrtc_router_lib.jrtc_router_get_latency_stats.restype = ctypes.c_int
+    stats = jrtc_bindings.struct_jrtc_router_latency_stats()
+    res = jrtc_router_lib.jrtc_router_get_latency_stats(
+        dapp_ctx, stream_id, ctypes.byref(stats)
+    )
+    return stats if res == 0 else None
+
+def jrtc_router_timestamp_now_ns():
+    jrtc_router_lib.jrtc_router_timestamp_now_ns.argtypes = []
+    jrtc_router_lib.jrtc_router_timestamp_now_ns.restype = ctypes.c_uint64
+    return jrtc_router_lib.jrtc_router_timestamp_now_ns()
+
 def jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id):
     jrtc_router_lib.jrtc_router_channel_register_stream_id_req.argtypes = [
         jrtc_bindings.dapp_router_ctx_t,
@@ -50,6 +111,41 @@ def jrtc_router_channel_register_stream_id_req(dapp_ctx, stream_id):
         dapp_ctx, stream_id
     )
 
+def jrtc_router_channel_register_stream_id_req_ex(dapp_ctx, stream_id, mode):
+    jrtc_router_lib.jrtc_router_channel_register_stream_id_req_ex.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,
+        jrtc_bindings.struct_jrtc_router_stream_id,
+        ctypes.c_int,
+    ]
+    jrtc_router_lib.jrtc_router_channel_register_stream_id_req_ex.restype = (
+        ctypes.c_int
+    )
+    return jrtc_router_lib.jrtc_router_channel_register_stream_id_req_ex(
+        dapp_ctx, stream_id, mode
+    )
+
+def jrtc_router_channel_set_req_limit(dapp_ctx, stream_id, limit):
+    jrtc_router_lib.jrtc_router_channel_set_req_limit.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,
+        jrtc_bindings.struct_jrtc_router_stream_id,
+        ctypes.POINTER(jrtc_bindings.struct_jrtc_router_req_limit),  # limit, None to remove it
+    ]
+    jrtc_router_lib.jrtc_router_channel_set_req_limit.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_channel_set_req_limit(
+        dapp_ctx, stream_id, ctypes.byref(limit) if limit is not None else None
+    )
+
+def jrtc_router_channel_set_req_filter(dapp_ctx, stream_id, filter):
+    jrtc_router_lib.jrtc_router_channel_set_req_filter.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,
+        jrtc_bindings.struct_jrtc_router_stream_id,
+        ctypes.POINTER(jrtc_bindings.struct_jrtc_router_req_filter),  # filter, None to remove it
+    ]
+    jrtc_router_lib.jrtc_router_channel_set_req_filter.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_channel_set_req_filter(
+        dapp_ctx, stream_id, ctypes.byref(filter) if filter is not None else None
+    )
+
 def jrtc_router_channel_deregister_stream_id_req(dapp_ctx, stream_id):
     jrtc_router_lib.jrtc_router_channel_deregister_stream_id_req.argtypes = [
         jrtc_bindings.dapp_router_ctx_t,
@@ -60,6 +156,40 @@ def jrtc_router_channel_deregister_stream_id_req(dapp_ctx, stream_id):
         dapp_ctx, stream_id
     )
 
+def jrtc_router_channel_register_pattern_req(dapp_ctx, fwd_dst, device_id, path_pattern, name_pattern=None):
+    jrtc_router_lib.jrtc_router_channel_register_pattern_req.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,
+        ctypes.c_int,  # fwd_dst
+        ctypes.c_int,  # device_id
+        ctypes.c_char_p,  # path_pattern
+        ctypes.c_char_p,  # name_pattern
+    ]
+    jrtc_router_lib.jrtc_router_channel_register_pattern_req.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_channel_register_pattern_req(
+        dapp_ctx, fwd_dst, device_id, path_pattern, name_pattern
+    )
+
+def jrtc_router_channel_deregister_pattern_req(dapp_ctx, fwd_dst, device_id, path_pattern, name_pattern=None):
+    jrtc_router_lib.jrtc_router_channel_deregister_pattern_req.argtypes = [
+        jrtc_bindings.dapp_router_ctx_t,
+        ctypes.c_int,  # fwd_dst
+        ctypes.c_int,  # device_id
+        ctypes.c_char_p,  # path_pattern
+        ctypes.c_char_p,  # name_pattern
+    ]
+    jrtc_router_lib.jrtc_router_channel_deregister_pattern_req.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_channel_deregister_pattern_req(
+        dapp_ctx, fwd_dst, device_id, path_pattern, name_pattern
+    )
+
+def jrtc_router_stream_catalog_add(stream_path, stream_name):
+    jrtc_router_lib.jrtc_router_stream_catalog_add.argtypes = [
+        ctypes.c_char_p,  # stream_path
+        ctypes.c_char_p,  # stream_name
+    ]
+    jrtc_router_lib.jrtc_router_stream_catalog_add.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_stream_catalog_add(stream_path, stream_name)
+
 def jrtc_router_channel_send_input_msg(stream_id, data, data_len):
     jrtc_router_lib.jrtc_router_channel_send_input_msg.argtypes = [
         jrtc_bindings.struct_jrtc_router_stream_id,  # stream_id
@@ -69,6 +199,15 @@ def jrtc_router_channel_send_input_msg(stream_id, data, data_len):
     jrtc_router_lib.jrtc_router_channel_send_input_msg.restype = ctypes.c_int
     return jrtc_router_lib.jrtc_router_channel_send_input_msg(stream_id, data, data_len)
 
+def jrtc_router_channel_multicast_input_msg(stream_id, data, data_len):
+    jrtc_router_lib.jrtc_router_channel_multicast_input_msg.argtypes = [
+        jrtc_bindings.struct_jrtc_router_stream_id,  # stream_id
+        ctypes.c_void_p,  # data
+        ctypes.c_size_t,  # data_len
+    ]
+    jrtc_router_lib.jrtc_router_channel_multicast_input_msg.restype = ctypes.c_int
+    return jrtc_router_lib.jrtc_router_channel_multicast_input_msg(stream_id, data, data_len)
+
 def jrtc_router_channel_send_output_msg(chan_ctx, data, data_len):
     jrtc_router_lib.jrtc_router_channel_send_output_msg.argtypes = [
         jrtc_bindings.dapp_channel_ctx_t,  # chan_ctx
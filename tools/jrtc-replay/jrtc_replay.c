@@ -0,0 +1,561 @@
+// Copyright (c) Microsoft Corporation.
+// Licensed under the MIT license.
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jrtc_logging.h"
+#include "jrtc_router.h"
+#include "jrtc_router_app_api.h"
+#include "jrtc_router_capture.h"
+#include "jrtc_router_stream_id.h"
+#include "jrtc_config.h"
+#include "jrtc_config_int.h"
+
+// Replays a router capture (see jrtc_router_capture.h) through a router started in this process.
+//
+// Every stream of the capture gets an output channel of a source app, and the records are sent to it in order,
+// at their original pace scaled by a speed factor, or as fast as possible. The router thread forwards them as it
+// would forward the messages of agents, so the replay goes through _jrtc_router_forward_msgs(), the request
+// table and the shards. A number of sink apps subscribe to all the streams and release what they receive, and
+// the router and app stats are printed at the end.
+
+#define JRTC_REPLAY_DEFAULT_IPC_NAME "jrtc_replay"
+#define JRTC_REPLAY_DEFAULT_NUM_SINKS (1)
+#define JRTC_REPLAY_DEFAULT_APP_QUEUE_SIZE (4096)
+#define JRTC_REPLAY_DEFAULT_NUM_ELEMS (1024)
+
+#define JRTC_REPLAY_MAX_STREAMS (1024)
+#define JRTC_REPLAY_MAX_SEGMENTS (65536)
+#define JRTC_REPLAY_MAX_SINKS (64)
+#define JRTC_REPLAY_BATCH (32)
+#define JRTC_REPLAY_MAX_RETRIES (1000000)
+
+#define JRTC_REPLAY_NS_PER_SEC (1000 * 1000 * 1000ULL)
+#define JRTC_REPLAY_SPIN_NS (50 * 1000)
+#define JRTC_REPLAY_RECEIVE_TIMEOUT_NS (10 * 1000 * 1000)
+#define JRTC_REPLAY_DRAIN_NS (200 * 1000 * 1000)
+
+struct replay_opts
+{
+    const char* capture_path;
+    const char* config_file;
+    const char* ipc_name;
+    double speed;
+    int num_sinks;
+    int app_queue_size;
+    int num_elems;
+    int num_loops;
+};
+
+struct replay_stream
+{
+    jrtc_router_stream_id_t stream_id;
+    uint32_t elem_size;
+    dapp_channel_ctx_t chan;
+    uint64_t num_records;
+    uint64_t num_sent;
+};
+
+struct replay_sink
+{
+    pthread_t tid;
+    dapp_router_ctx_t app;
+    uint64_t num_received;
+};
+
+struct replay_batch
+{
+    struct replay_stream* stream;
+    const struct jrtc_router_capture_record* records[JRTC_REPLAY_BATCH];
+    int num_records;
+};
+
+struct replay_totals
+{
+    uint64_t num_records;
+    uint64_t num_bytes;
+    uint64_t num_sent;
+    uint64_t num_dropped;
+    uint64_t num_retries;
+};
+
+static struct replay_stream streams[JRTC_REPLAY_MAX_STREAMS];
+static int num_streams;
+
+static uint32_t segments[JRTC_REPLAY_MAX_SEGMENTS];
+static int num_segments;
+
+static struct replay_sink sinks[JRTC_REPLAY_MAX_SINKS];
+
+static int replay_done;
+
+static uint64_t
+_replay_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * JRTC_REPLAY_NS_PER_SEC + ts.tv_nsec;
+}
+
+// Sleeps until shortly before the deadline and spins for the rest, for sub-microsecond pacing
+static void
+_replay_wait_until(uint64_t deadline_ns)
+{
+    struct timespec ts;
+    uint64_t now = _replay_now_ns();
+
+    if (deadline_ns > now + JRTC_REPLAY_SPIN_NS) {
+        ts.tv_sec = (deadline_ns - JRTC_REPLAY_SPIN_NS) / JRTC_REPLAY_NS_PER_SEC;
+        ts.tv_nsec = (deadline_ns - JRTC_REPLAY_SPIN_NS) % JRTC_REPLAY_NS_PER_SEC;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    while (_replay_now_ns() < deadline_ns) {
+    }
+}
+
+static int
+_replay_segment_cmp(const void* a, const void* b)
+{
+    uint32_t sa = *(const uint32_t*)a;
+    uint32_t sb = *(const uint32_t*)b;
+
+    return sa < sb ? -1 : sa > sb;
+}
+
+// Finds the segments of the capture, which may not start at 0 if the router only kept the last ones
+static int
+_replay_find_segments(const char* path)
+{
+    char pattern[JRTC_ROUTER_CAPTURE_PATH_LEN + 8];
+    const char* suffix;
+    char* end;
+    unsigned long segment;
+    glob_t g;
+
+    snprintf(pattern, sizeof(pattern), "%s.*", path);
+    if (glob(pattern, 0, NULL, &g) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < g.gl_pathc && num_segments < JRTC_REPLAY_MAX_SEGMENTS; i++) {
+        suffix = g.gl_pathv[i] + strlen(path) + 1;
+        segment = strtoul(suffix, &end, 10);
+        if (*suffix == '\0' || *end != '\0' || segment > UINT32_MAX) {
+            continue;
+        }
+        segments[num_segments++] = segment;
+    }
+    globfree(&g);
+
+    qsort(segments, num_segments, sizeof(uint32_t), _replay_segment_cmp);
+    return num_segments > 0 ? 0 : -1;
+}
+
+static struct replay_stream*
+_replay_stream_find(const uint8_t* stream_id)
+{
+    for (int i = 0; i < num_streams; i++) {
+        if (memcmp(&streams[i].stream_id, stream_id, sizeof(jrtc_router_stream_id_t)) == 0) {
+            return &streams[i];
+        }
+    }
+    return NULL;
+}
+
+// Collects the streams of the capture and the largest message of each, which sizes its channel
+static int
+_replay_scan(const char* path)
+{
+    struct jrtc_router_capture_header* header;
+    const struct jrtc_router_capture_record* record;
+    struct replay_stream* stream;
+    uint64_t offset;
+
+    for (int i = 0; i < num_segments; i++) {
+        header = jrtc_router_capture_map(path, segments[i]);
+        if (!header) {
+            jrtc_logger(JRTC_WARN, "Skipping the invalid capture segment %s.%u\n", path, segments[i]);
+            continue;
+        }
+
+        offset = header->header_size;
+        while ((record = jrtc_router_capture_next(header, &offset))) {
+            stream = _replay_stream_find(record->stream_id);
+            if (!stream) {
+                if (num_streams >= JRTC_REPLAY_MAX_STREAMS) {
+                    jrtc_logger(JRTC_ERROR, "The capture has more than %d streams\n", JRTC_REPLAY_MAX_STREAMS);
+                    jrtc_router_capture_unmap(header);
+                    return -1;
+                }
+                stream = &streams[num_streams++];
+                memcpy(&stream->stream_id, record->stream_id, sizeof(jrtc_router_stream_id_t));
+            }
+            if (record->data_len > stream->elem_size) {
+                stream->elem_size = record->data_len;
+            }
+            stream->num_records++;
+        }
+
+        jrtc_router_capture_unmap(header);
+    }
+
+    return 0;
+}
+
+static void
+_replay_flush(struct replay_batch* batch, struct replay_totals* totals)
+{
+    struct replay_stream* stream = batch->stream;
+    const struct jrtc_router_capture_record* record;
+    int num_sent = 0;
+    int num_retries = 0;
+
+    while (num_sent < batch->num_records) {
+        record = batch->records[num_sent];
+        if (jrtc_router_channel_send_output_msg(stream->chan, (void*)record->data, record->data_len) == 0) {
+            num_sent++;
+            continue;
+        }
+
+        // The channel is full, wait for the router to catch up
+        if (++num_retries > JRTC_REPLAY_MAX_RETRIES) {
+            break;
+        }
+        totals->num_retries++;
+        sched_yield();
+    }
+
+    stream->num_sent += num_sent;
+    totals->num_sent += num_sent;
+    totals->num_dropped += batch->num_records - num_sent;
+    batch->stream = NULL;
+    batch->num_records = 0;
+}
+
+static void
+_replay_segment(
+    const struct replay_opts* opts,
+    struct jrtc_router_capture_header* header,
+    bool* first,
+    uint64_t* first_ts_ns,
+    uint64_t start_ns,
+    struct replay_totals* totals)
+{
+    const struct jrtc_router_capture_record* record;
+    struct replay_batch batch = {0};
+    struct replay_stream* stream;
+    uint64_t offset = header->header_size;
+
+    while ((record = jrtc_router_capture_next(header, &offset))) {
+        stream = _replay_stream_find(record->stream_id);
+        if (!stream || !stream->chan) {
+            // A stream written after the scan
+            totals->num_dropped++;
+            continue;
+        }
+
+        if (*first) {
+            *first_ts_ns = record->ingress_ts_ns;
+            *first = false;
+        }
+
+        // Records are sent one at a time when paced, and in batches per stream otherwise
+        if (opts->speed > 0) {
+            if (batch.num_records > 0) {
+                _replay_flush(&batch, totals);
+            }
+            if (record->ingress_ts_ns > *first_ts_ns) {
+                _replay_wait_until(start_ns + (uint64_t)((record->ingress_ts_ns - *first_ts_ns) / opts->speed));
+            }
+        } else if (batch.num_records > 0 && (batch.stream != stream || batch.num_records == JRTC_REPLAY_BATCH)) {
+            _replay_flush(&batch, totals);
+        }
+
+        batch.stream = stream;
+        batch.records[batch.num_records++] = record;
+        totals->num_records++;
+        totals->num_bytes += record->data_len;
+    }
+
+    // The records are in the mapping of the segment
+    if (batch.num_records > 0) {
+        _replay_flush(&batch, totals);
+    }
+}
+
+static void*
+_replay_sink_run(void* arg)
+{
+    struct replay_sink* sink = arg;
+    jrtc_router_data_entry_t entries[JRTC_REPLAY_BATCH];
+    int n;
+
+    for (;;) {
+        n = jrtc_router_receive_timeout(sink->app, entries, JRTC_REPLAY_BATCH, JRTC_REPLAY_RECEIVE_TIMEOUT_NS);
+        if (n < 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            jrtc_router_channel_release_buf(entries[i].data);
+        }
+        sink->num_received += n;
+
+        if (n == 0 && __atomic_load_n(&replay_done, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+_replay_print_stats(const struct replay_opts* opts, const struct replay_totals* totals, uint64_t elapsed_ns)
+{
+    struct jrtc_router_app_stats app_stats;
+    struct jrtc_router_latency_stats latency;
+    double secs = (double)elapsed_ns / JRTC_REPLAY_NS_PER_SEC;
+
+    printf(
+        "Replayed %lu records (%lu bytes) of %d streams in %.3f s: %.0f msgs/s, sent %lu, dropped %lu, retries %lu\n",
+        totals->num_records,
+        totals->num_bytes,
+        num_streams,
+        secs,
+        secs > 0 ? totals->num_sent / secs : 0,
+        totals->num_sent,
+        totals->num_dropped,
+        totals->num_retries);
+
+    for (int i = 0; i < opts->num_sinks; i++) {
+        memset(&app_stats, 0, sizeof(app_stats));
+        jrtc_router_get_app_stats(sinks[i].app, &app_stats);
+        printf(
+            "Sink %d: received %lu, enqueued %lu, dropped %lu, high watermark %lu\n",
+            i,
+            sinks[i].num_received,
+            app_stats.num_enqueued,
+            app_stats.num_dropped,
+            app_stats.high_watermark);
+    }
+
+    // The latency of the first sink, per stream
+    for (int i = 0; i < num_streams; i++) {
+        if (jrtc_router_get_latency_stats(sinks[0].app, streams[i].stream_id, &latency) < 0) {
+            continue;
+        }
+        printf(
+            "Stream %d: sent %lu, latency p50 %lu ns, p99 %lu ns, p999 %lu ns, max %lu ns\n",
+            i,
+            streams[i].num_sent,
+            latency.p50_ns,
+            latency.p99_ns,
+            latency.p999_ns,
+            latency.max_ns);
+    }
+}
+
+static void
+_replay_usage(const char* prog)
+{
+    fprintf(
+        stderr,
+        "Usage: %s -p <capture path> [-c <config yaml>] [-n <ipc name>] [-s <speed>] [-a <num sinks>]\n"
+        "          [-q <app queue size>] [-e <channel elems>] [-l <loops>]\n"
+        "  -p  The path of the capture, as in capture_path of the config of the router\n"
+        "  -c  The config of the router to replay against (default: the default config)\n"
+        "  -n  The IPC name of the router (default: %s)\n"
+        "  -s  The speed relative to the capture, 0 for as fast as possible (default: 1)\n"
+        "  -a  The number of sink apps subscribed to all the streams (default: %d, max %d)\n"
+        "  -q  The queue size of the sink apps (default: %d)\n"
+        "  -e  The number of elements of the channel of each stream (default: %d)\n"
+        "  -l  The number of times the capture is replayed (default: 1)\n",
+        prog,
+        JRTC_REPLAY_DEFAULT_IPC_NAME,
+        JRTC_REPLAY_DEFAULT_NUM_SINKS,
+        JRTC_REPLAY_MAX_SINKS,
+        JRTC_REPLAY_DEFAULT_APP_QUEUE_SIZE,
+        JRTC_REPLAY_DEFAULT_NUM_ELEMS);
+}
+
+int
+main(int argc, char** argv)
+{
+    struct replay_opts opts = {
+        .ipc_name = JRTC_REPLAY_DEFAULT_IPC_NAME,
+        .speed = 1,
+        .num_sinks = JRTC_REPLAY_DEFAULT_NUM_SINKS,
+        .app_queue_size = JRTC_REPLAY_DEFAULT_APP_QUEUE_SIZE,
+        .num_elems = JRTC_REPLAY_DEFAULT_NUM_ELEMS,
+        .num_loops = 1,
+    };
+    struct jrtc_config config = {0};
+    struct replay_totals totals = {0};
+    struct jrtc_router_capture_header* header;
+    jrtc_router_stream_id_t any_stream_id;
+    dapp_router_ctx_t source = NULL;
+    uint64_t first_ts_ns = 0;
+    uint64_t start_ns, loop_start_ns, end_ns;
+    bool first;
+    int num_started = 0;
+    int res = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:c:n:s:a:q:e:l:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            opts.capture_path = optarg;
+            break;
+        case 'c':
+            opts.config_file = optarg;
+            break;
+        case 'n':
+            opts.ipc_name = optarg;
+            break;
+        case 's':
+            opts.speed = atof(optarg);
+            break;
+        case 'a':
+            opts.num_sinks = atoi(optarg);
+            break;
+        case 'q':
+            opts.app_queue_size = atoi(optarg);
+            break;
+        case 'e':
+            opts.num_elems = atoi(optarg);
+            break;
+        case 'l':
+            opts.num_loops = atoi(optarg);
+            break;
+        default:
+            _replay_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (!opts.capture_path || strlen(opts.capture_path) >= JRTC_ROUTER_CAPTURE_PATH_LEN || opts.speed < 0 ||
+        opts.num_sinks < 1 || opts.num_sinks > JRTC_REPLAY_MAX_SINKS || opts.app_queue_size <= 0 ||
+        opts.num_elems <= 0 || opts.num_loops < 1) {
+        _replay_usage(argv[0]);
+        return 1;
+    }
+
+    if (_replay_find_segments(opts.capture_path) < 0) {
+        jrtc_logger(JRTC_ERROR, "No capture segments found at %s.*\n", opts.capture_path);
+        return 1;
+    }
+    if (_replay_scan(opts.capture_path) < 0) {
+        return 1;
+    }
+    jrtc_logger(
+        JRTC_INFO,
+        "Found %d streams in %d segments of %s, from segment %u\n",
+        num_streams,
+        num_segments,
+        opts.capture_path,
+        segments[0]);
+
+    if (set_config_values(opts.config_file, &config) != 0) {
+        jrtc_logger(JRTC_ERROR, "Failed to read the config %s\n", opts.config_file);
+        return 1;
+    }
+    // The replay must not be captured again
+    config.jrtc_router_config.capture.path[0] = '\0';
+    strncpy(config.jrtc_router_config.io_config.ipc_name, opts.ipc_name, JBPF_IO_IPC_MAX_NAMELEN - 1);
+    config.jrtc_router_config.io_config.ipc_name[JBPF_IO_IPC_MAX_NAMELEN - 1] = '\0';
+    strncpy(config.jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name, opts.ipc_name, JBPF_IO_IPC_MAX_NAMELEN - 1);
+    config.jbpf_io_config.ipc_config.addr.jbpf_io_ipc_name[JBPF_IO_IPC_MAX_NAMELEN - 1] = '\0';
+
+    if (jrtc_router_init(&config) < 0) {
+        jrtc_logger(JRTC_ERROR, "Failed to initialize the router\n");
+        return 1;
+    }
+
+    // The sinks subscribe before the first record is sent
+    jrtc_router_generate_stream_id(&any_stream_id, JRTC_ROUTER_REQ_DEST_ANY, JRTC_ROUTER_REQ_DEVICE_ID_ANY, NULL, NULL);
+    for (int i = 0; i < opts.num_sinks; i++) {
+        sinks[i].app = jrtc_router_register_app(opts.app_queue_size);
+        if (!sinks[i].app || jrtc_router_channel_register_stream_id_req(sinks[i].app, any_stream_id) < 0) {
+            jrtc_logger(JRTC_ERROR, "Failed to register the sink app %d\n", i);
+            goto cleanup;
+        }
+    }
+
+    source = jrtc_router_register_app(opts.app_queue_size);
+    if (!source) {
+        jrtc_logger(JRTC_ERROR, "Failed to register the source app\n");
+        goto cleanup;
+    }
+    for (int i = 0; i < num_streams; i++) {
+        streams[i].chan = jrtc_router_channel_create(
+            source, true, opts.num_elems, streams[i].elem_size, streams[i].stream_id, NULL, 0);
+        if (!streams[i].chan) {
+            jrtc_logger(JRTC_ERROR, "Failed to create the channel of stream %d\n", i);
+            goto cleanup;
+        }
+    }
+
+    for (; num_started < opts.num_sinks; num_started++) {
+        if (pthread_create(&sinks[num_started].tid, NULL, _replay_sink_run, &sinks[num_started]) != 0) {
+            jrtc_logger(JRTC_ERROR, "Failed to start the sink thread %d\n", num_started);
+            goto cleanup;
+        }
+    }
+
+    start_ns = _replay_now_ns();
+    for (int loop = 0; loop < opts.num_loops; loop++) {
+        // Each loop is paced from its own start
+        first = true;
+        loop_start_ns = _replay_now_ns();
+        for (int i = 0; i < num_segments; i++) {
+            header = jrtc_router_capture_map(opts.capture_path, segments[i]);
+            if (!header) {
+                continue;
+            }
+            _replay_segment(&opts, header, &first, &first_ts_ns, loop_start_ns, &totals);
+            jrtc_router_capture_unmap(header);
+        }
+    }
+    end_ns = _replay_now_ns();
+
+    // Give the router and the sinks time to drain the channels and the queues
+    _replay_wait_until(end_ns + JRTC_REPLAY_DRAIN_NS);
+    res = 0;
+
+cleanup:
+    __atomic_store_n(&replay_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < num_started; i++) {
+        pthread_join(sinks[i].tid, NULL);
+    }
+
+    if (res == 0) {
+        _replay_print_stats(&opts, &totals, end_ns - start_ns);
+    }
+
+    for (int i = 0; i < num_streams; i++) {
+        if (streams[i].chan) {
+            jrtc_router_channel_destroy(streams[i].chan);
+        }
+    }
+    if (source) {
+        jrtc_router_deregister_app(source);
+    }
+    for (int i = 0; i < opts.num_sinks; i++) {
+        if (sinks[i].app) {
+            jrtc_router_deregister_app(sinks[i].app);
+        }
+    }
+    jrtc_router_stop();
+
+    return res == 0 ? 0 : 1;
+}